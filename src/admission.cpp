@@ -0,0 +1,64 @@
+#include "admission.hpp"
+
+#include <algorithm>
+
+#include "parallel.hpp"
+
+namespace names {
+    AdmissionController::AdmissionController(const AdmissionOptions &options)
+        : options_(options),
+          inFlight_(0),
+          queued_(0),
+          expensive_(0),
+          admitted_(0),
+          overloaded_(0),
+          expired_(0),
+          deferred_(0) {
+        if (!options_.maxExpensive)
+            options_.maxExpensive = std::max<size_t>(1, workerCount() / 2);
+    }
+
+    bool AdmissionController::expire(const std::chrono::steady_clock::time_point arrived,
+                                     const std::chrono::steady_clock::time_point now, const size_t count) {
+        if (options_.deadline.count() <= 0 || now - arrived <= options_.deadline)
+            return false;
+        expired_.fetch_add(count, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t AdmissionController::acquire(const size_t count, const size_t reserved) {
+        // read once, outside the exchange: requests queued meanwhile may overshoot the budget by as many
+        const size_t waiting = queued_.load(std::memory_order_relaxed);
+        const size_t guaranteed = std::min(count, reserved);
+        size_t current = inFlight_.load(std::memory_order_relaxed);
+        size_t granted;
+        do {
+            const size_t used = std::min(current + waiting, options_.maxInFlight);
+            granted = std::max(guaranteed, std::min(count, options_.maxInFlight - used));
+        } while (granted && !inFlight_.compare_exchange_weak(current, current + granted, std::memory_order_acquire,
+                                                             std::memory_order_relaxed));
+        admitted_.fetch_add(granted, std::memory_order_relaxed);
+        if (granted < count)
+            overloaded_.fetch_add(count - granted, std::memory_order_relaxed);
+        return granted;
+    }
+
+    bool AdmissionController::tryAcquireExpensive() {
+        size_t current = expensive_.load(std::memory_order_relaxed);
+        while (current < options_.maxExpensive) {
+            if (expensive_.compare_exchange_weak(current, current + 1, std::memory_order_acquire,
+                                                 std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    AdmissionStats AdmissionController::stats() const {
+        AdmissionStats stats;
+        stats.admitted = admitted_.load();
+        stats.overloaded = overloaded_.load();
+        stats.expired = expired_.load();
+        stats.deferred = deferred_.load();
+        return stats;
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * admission.hpp
+ *
+ * Admission control for the query protocols. The event loops answer requests as they are read, so under a burst the
+ * queue is the requests sitting unread in receive buffers, and without limits every one of them is answered however
+ * long it has waited. An AdmissionController shared by every handler of a server bounds that work:
+ *
+ * - A connection gets at most maxConnectionInFlight requests answered per turn. The rest wait in its buffer while the
+ *   loop serves other connections, and nothing more is read from it meanwhile, so a deep pipeline backs up into the
+ *   client's socket rather than delaying everyone else.
+ * - At most maxInFlight requests are answered or left waiting at once across every loop. The loops answer requests
+ *   synchronously, so it is the requests a connection had to leave in its buffer (see queue()) that fill this budget
+ *   under a burst; requests beyond it are refused at once with an overloaded status rather than queued as well.
+ * - The first connectionQuota requests of each turn are let in whatever the budget, and still count against it. A
+ *   backlog is mostly frames that deep pipelines left for their next turn, so without the quota a few such clients
+ *   would refuse each other's every request while the loops sat idle; with it each still makes progress.
+ * - Requests that have waited longer than the deadline since they arrived are refused without being answered, since
+ *   their client has likely given up on them.
+ * - Expensive queries (prefix scans) run under their own, smaller concurrency budget, so a flood of them leaves loops
+ *   free for point lookups. A request that cannot get a slot waits for its connection's next turn.
+ */
+
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "query.hpp"
+
+namespace names {
+    struct AdmissionOptions {
+        /// Requests answered or waiting in a connection's buffer at once, across every connection.
+        size_t maxInFlight;
+        /// Requests of one connection answered per turn.
+        size_t maxConnectionInFlight;
+        /// Requests of one connection let in per turn even when maxInFlight is used up.
+        size_t connectionQuota;
+        /// Expensive requests answered at once. 0 means half the cores, at least one.
+        size_t maxExpensive;
+        /// How long a request may wait between arriving and being answered. 0 means forever.
+        std::chrono::microseconds deadline;
+
+        AdmissionOptions()
+            : maxInFlight(1 << 13),
+              maxConnectionInFlight(1024),
+              connectionQuota(4),
+              maxExpensive(0),
+              deadline(std::chrono::milliseconds(100)) {
+        }
+    };
+
+    struct AdmissionStats {
+        uint64_t admitted;
+        /// Refused because maxInFlight requests were already being answered or waiting.
+        uint64_t overloaded;
+        /// Refused because they had waited past the deadline.
+        uint64_t expired;
+        /// Turns that ended with requests left waiting, for the per-connection limit or an expensive query.
+        uint64_t deferred;
+    };
+
+    /// Whether query gets the expensive budget: prefix queries, which may scan and sort much of the dictionary.
+    inline bool isExpensive(const Query &query) {
+        return query.type == QueryType::Prefix;
+    }
+
+    class AdmissionController {
+        AdmissionOptions options_;
+        std::atomic<size_t> inFlight_;
+        std::atomic<size_t> queued_;
+        std::atomic<size_t> expensive_;
+        std::atomic<uint64_t> admitted_;
+        std::atomic<uint64_t> overloaded_;
+        std::atomic<uint64_t> expired_;
+        std::atomic<uint64_t> deferred_;
+
+    public:
+        explicit AdmissionController(const AdmissionOptions &options = AdmissionOptions());
+
+        const AdmissionOptions &options() const {
+            return options_;
+        }
+
+        /// Whether requests that arrived at arrived are past the deadline at now. Counts them as expired if so.
+        bool expire(std::chrono::steady_clock::time_point arrived, std::chrono::steady_clock::time_point now,
+                    size_t count);
+
+        /// Lets in up to count requests and returns how many were let in; the rest count as overloaded. The first
+        /// reserved of them are let in even past maxInFlight. release() them once they have been answered.
+        size_t acquire(size_t count, size_t reserved = 0);
+
+        void release(size_t count) {
+            inFlight_.fetch_sub(count, std::memory_order_release);
+        }
+
+        /// Counts complete requests a handler left waiting for its connection's next turn against maxInFlight, so a
+        /// backlog across many connections refuses new work instead of growing. A handler unqueue()s them before
+        /// its next turn, and when its connection goes.
+        void queue(size_t count) {
+            queued_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        void unqueue(size_t count) {
+            queued_.fetch_sub(count, std::memory_order_relaxed);
+        }
+
+        /// Requests currently left waiting.
+        size_t queued() const {
+            return queued_.load(std::memory_order_relaxed);
+        }
+
+        /// Takes one of the expensive slots if one is free. A handler takes a single slot for all the expensive
+        /// requests it answers in one turn, since they run one after another on its thread.
+        bool tryAcquireExpensive();
+
+        void releaseExpensive() {
+            expensive_.fetch_sub(1, std::memory_order_release);
+        }
+
+        /// Counts a turn that left requests waiting.
+        void noteDeferred() {
+            deferred_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        AdmissionStats stats() const;
+    };
+}
+
+#endif //ADMISSION_HPP
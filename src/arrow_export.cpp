@@ -0,0 +1,430 @@
+#include "arrow_export.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "file_io.hpp"
+
+namespace names {
+    namespace {
+        /// Builds a flatbuffer back to front, as the flatbuffers library does: children are written before the tables
+        /// that point at them, so every offset points forward. Objects are referred to by their distance from the end
+        /// of the buffer until it is finished. Only what the Arrow metadata needs is here; integers are written in
+        /// host order, which is little-endian on every platform we build for.
+        class FlatBuilder {
+            /// The buffer so far, reversed: bytes_[0] is the last byte of the finished buffer.
+            std::vector<uint8_t> bytes_;
+            size_t minAlign_;
+            /// (field ID, distance from the end) of each field of the table being built.
+            std::vector<std::pair<uint16_t, uint32_t> > fields_;
+            uint32_t tableStart_;
+
+            void prependBytes(const void *data, const size_t len) {
+                const uint8_t *p = static_cast<const uint8_t *>(data);
+                for (size_t i = len; i-- > 0;)
+                    bytes_.push_back(p[i]);
+            }
+
+            /// Pads so that the next len bytes prepended end up aligned.
+            void align(const size_t len, const size_t alignment) {
+                minAlign_ = std::max(minAlign_, alignment);
+                while ((bytes_.size() + len) % alignment)
+                    bytes_.push_back(0);
+            }
+
+            template<typename T>
+            void prepend(const T value) {
+                align(sizeof(T), sizeof(T));
+                prependBytes(&value, sizeof(T));
+            }
+
+            void prependOffset(const uint32_t target) {
+                align(4, 4);
+                prepend<uint32_t>(size() + 4 - target);
+            }
+
+        public:
+            FlatBuilder()
+                : minAlign_(1),
+                  tableStart_(0) {
+            }
+
+            uint32_t size() const {
+                return static_cast<uint32_t>(bytes_.size());
+            }
+
+            uint32_t createString(const char *text) {
+                const size_t len = std::strlen(text);
+                align(len + 1, 4);
+                bytes_.push_back(0);
+                prependBytes(text, len);
+                prepend<uint32_t>(static_cast<uint32_t>(len));
+                return size();
+            }
+
+            /// A vector of count structs of elementSize bytes each, laid out as in memory.
+            uint32_t createStructVector(const void *data, const size_t count, const size_t elementSize,
+                                        const size_t alignment) {
+                align(count * elementSize, std::max<size_t>(alignment, 4));
+                prependBytes(data, count * elementSize);
+                prepend<uint32_t>(static_cast<uint32_t>(count));
+                return size();
+            }
+
+            uint32_t createOffsetVector(const std::vector<uint32_t> &targets) {
+                align(targets.size() * 4, 4);
+                for (size_t i = targets.size(); i-- > 0;)
+                    prependOffset(targets[i]);
+                prepend<uint32_t>(static_cast<uint32_t>(targets.size()));
+                return size();
+            }
+
+            /// Begins a table. Everything it points at must already be built.
+            void startTable() {
+                fields_.clear();
+                tableStart_ = size();
+            }
+
+            template<typename T>
+            void addField(const uint16_t id, const T value) {
+                prepend(value);
+                fields_.push_back(std::make_pair(id, size()));
+            }
+
+            void addOffset(const uint16_t id, const uint32_t target) {
+                prependOffset(target);
+                fields_.push_back(std::make_pair(id, size()));
+            }
+
+            /// Finishes the table with its vtable placed right before it.
+            uint32_t endTable() {
+                prepend<int32_t>(0);
+                const uint32_t table = size();
+                std::vector<uint16_t> slots;
+                for (const std::pair<uint16_t, uint32_t> &field: fields_) {
+                    if (slots.size() <= field.first)
+                        slots.resize(field.first + 1, 0);
+                    slots[field.first] = static_cast<uint16_t>(table - field.second);
+                }
+                for (size_t i = slots.size(); i-- > 0;)
+                    prepend<uint16_t>(slots[i]);
+                prepend<uint16_t>(static_cast<uint16_t>(table - tableStart_));
+                prepend<uint16_t>(static_cast<uint16_t>(4 + 2 * slots.size()));
+
+                // the table starts with the signed distance back to its vtable
+                const int32_t vtable = static_cast<int32_t>(size() - table);
+                uint8_t encoded[4];
+                std::memcpy(encoded, &vtable, 4);
+                for (size_t k = 0; k < 4; ++k)
+                    bytes_[table - 1 - k] = encoded[k];
+                return table;
+            }
+
+            std::vector<uint8_t> finish(const uint32_t root) {
+                align(4, minAlign_);
+                prependOffset(root);
+                return std::vector<uint8_t>(bytes_.rbegin(), bytes_.rend());
+            }
+        };
+
+        // Identifiers from the Arrow format's Schema.fbs and Message.fbs.
+        const int16_t METADATA_V5 = 4;
+        const uint8_t HEADER_SCHEMA = 1;
+        const uint8_t HEADER_DICTIONARY_BATCH = 2;
+        const uint8_t HEADER_RECORD_BATCH = 3;
+        const uint8_t TYPE_INT = 2;
+        const uint8_t TYPE_UTF8 = 5;
+        const int64_t NAME_DICTIONARY = 0;
+        const int64_t SEX_DICTIONARY = 1;
+
+        const char MAGIC[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+        const uint32_t CONTINUATION = 0xffffffff;
+        const char ZEROS[ARROW_ALIGNMENT] = {};
+
+        struct FieldNode {
+            int64_t length;
+            int64_t nullCount;
+        };
+
+        struct BufferRef {
+            int64_t offset;
+            int64_t length;
+        };
+
+        struct Block {
+            int64_t offset;
+            int32_t metaDataLength;
+            int32_t padding;
+            int64_t bodyLength;
+        };
+
+        static_assert(sizeof(FieldNode) == 16 && sizeof(BufferRef) == 16 && sizeof(Block) == 24,
+                      "Arrow metadata structs must match the flatbuffer layout");
+
+        /// A message body: chunks of existing memory, each buffer padded out to ARROW_ALIGNMENT.
+        struct Body {
+            std::vector<FieldNode> nodes;
+            std::vector<BufferRef> buffers;
+            std::vector<WriteChunk> chunks;
+            int64_t length;
+
+            Body()
+                : length(0) {
+            }
+
+            void buffer(const void *data, const size_t len) {
+                const BufferRef ref = {length, static_cast<int64_t>(len)};
+                buffers.push_back(ref);
+                if (len)
+                    chunks.push_back(WriteChunk(data, len));
+                const size_t padding = (ARROW_ALIGNMENT - len % ARROW_ALIGNMENT) % ARROW_ALIGNMENT;
+                if (padding)
+                    chunks.push_back(WriteChunk(ZEROS, padding));
+                length += static_cast<int64_t>(len + padding);
+            }
+
+            /// A column of fixed-width values with no nulls, and so an empty validity bitmap.
+            void column(const size_t rows, const void *data, const size_t len) {
+                const FieldNode node = {static_cast<int64_t>(rows), 0};
+                nodes.push_back(node);
+                buffer(nullptr, 0);
+                buffer(data, len);
+            }
+
+            /// A utf8 column with no nulls.
+            void strings(const size_t rows, const void *offsets, const void *bytes, const size_t len) {
+                const FieldNode node = {static_cast<int64_t>(rows), 0};
+                nodes.push_back(node);
+                buffer(nullptr, 0);
+                buffer(offsets, (rows + 1) * sizeof(int32_t));
+                buffer(bytes, len);
+            }
+        };
+
+        uint32_t intType(FlatBuilder &builder, const int32_t bitWidth, const bool isSigned) {
+            builder.startTable();
+            builder.addField<int32_t>(0, bitWidth);
+            builder.addField<uint8_t>(1, isSigned);
+            return builder.endTable();
+        }
+
+        uint32_t field(FlatBuilder &builder, const char *name, const uint8_t typeType, const uint32_t type,
+                       const uint32_t dictionary) {
+            const uint32_t nameOffset = builder.createString(name);
+            const uint32_t children = builder.createOffsetVector(std::vector<uint32_t>());
+            builder.startTable();
+            builder.addOffset(0, nameOffset);
+            builder.addField<uint8_t>(1, false);
+            builder.addField<uint8_t>(2, typeType);
+            builder.addOffset(3, type);
+            if (dictionary)
+                builder.addOffset(4, dictionary);
+            builder.addOffset(5, children);
+            return builder.endTable();
+        }
+
+        /// A utf8 field whose values are dictionary indices of the given width.
+        uint32_t dictionaryField(FlatBuilder &builder, const char *name, const int64_t id, const int32_t indexWidth) {
+            builder.startTable();
+            const uint32_t utf8 = builder.endTable();
+            const uint32_t indexType = intType(builder, indexWidth, true);
+            builder.startTable();
+            builder.addField<int64_t>(0, id);
+            builder.addOffset(1, indexType);
+            builder.addField<uint8_t>(2, false);
+            const uint32_t encoding = builder.endTable();
+            return field(builder, name, TYPE_UTF8, utf8, encoding);
+        }
+
+        uint32_t schema(FlatBuilder &builder) {
+            std::vector<uint32_t> fields;
+            fields.push_back(dictionaryField(builder, "name", NAME_DICTIONARY, 32));
+            fields.push_back(dictionaryField(builder, "sex", SEX_DICTIONARY, 8));
+            fields.push_back(field(builder, "count", TYPE_INT, intType(builder, 32, false), 0));
+            fields.push_back(field(builder, "year", TYPE_INT, intType(builder, 16, true), 0));
+            const uint32_t vector = builder.createOffsetVector(fields);
+            builder.startTable();
+            builder.addField<int16_t>(0, 0);
+            builder.addOffset(1, vector);
+            return builder.endTable();
+        }
+
+        uint32_t recordBatch(FlatBuilder &builder, const int64_t rows, const Body &body) {
+            const uint32_t nodes = builder.createStructVector(body.nodes.data(), body.nodes.size(), sizeof(FieldNode),
+                                                              8);
+            const uint32_t buffers = builder.createStructVector(body.buffers.data(), body.buffers.size(),
+                                                                sizeof(BufferRef), 8);
+            builder.startTable();
+            builder.addField<int64_t>(0, rows);
+            builder.addOffset(1, nodes);
+            builder.addOffset(2, buffers);
+            return builder.endTable();
+        }
+
+        std::vector<uint8_t> message(FlatBuilder &builder, const uint8_t headerType, const uint32_t header,
+                                     const int64_t bodyLength) {
+            builder.startTable();
+            builder.addField<int16_t>(0, METADATA_V5);
+            builder.addField<uint8_t>(1, headerType);
+            builder.addOffset(2, header);
+            builder.addField<int64_t>(3, bodyLength);
+            return builder.finish(builder.endTable());
+        }
+
+        /// Lays out the file as a list of chunks, most of which point into the corpus.
+        class ArrowFileLayout {
+            std::vector<WriteChunk> chunks_;
+            /// Metadata and the generated year columns. A deque, so earlier entries stay put as more are added.
+            std::deque<std::vector<uint8_t> > owned_;
+            uint64_t size_;
+            std::vector<Block> dictionaries_;
+            std::vector<Block> recordBatches_;
+
+            void append(const void *data, const size_t len) {
+                if (len)
+                    chunks_.push_back(WriteChunk(data, len));
+                size_ += len;
+            }
+
+            /// Appends an encapsulated message: the continuation marker, the metadata length, the metadata padded so
+            /// the body starts ARROW_ALIGNMENT-aligned in the file, then the body.
+            Block encapsulate(const std::vector<uint8_t> &metadata, const Body &body) {
+                Block block = {static_cast<int64_t>(size_), 0, 0, body.length};
+                const size_t unpadded = size_ + 8 + metadata.size();
+                const size_t padded = (unpadded + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+                const int32_t length = static_cast<int32_t>(metadata.size() + padded - unpadded);
+                block.metaDataLength = length + 8;
+
+                owned_.push_back(std::vector<uint8_t>(8));
+                std::vector<uint8_t> &prefix = owned_.back();
+                std::memcpy(prefix.data(), &CONTINUATION, 4);
+                std::memcpy(prefix.data() + 4, &length, 4);
+                owned_.push_back(metadata);
+                owned_.back().resize(static_cast<size_t>(length), 0);
+                append(prefix.data(), prefix.size());
+                append(owned_.back().data(), owned_.back().size());
+                for (const WriteChunk &chunk: body.chunks)
+                    append(chunk.first, chunk.second);
+                return block;
+            }
+
+        public:
+            ArrowFileLayout()
+                : size_(0) {
+                append(MAGIC, sizeof(MAGIC));
+                FlatBuilder builder;
+                encapsulate(message(builder, HEADER_SCHEMA, schema(builder), 0), Body());
+            }
+
+            void dictionary(const int64_t id, const Body &body, const size_t values) {
+                FlatBuilder builder;
+                const uint32_t data = recordBatch(builder, static_cast<int64_t>(values), body);
+                builder.startTable();
+                builder.addField<int64_t>(0, id);
+                builder.addOffset(1, data);
+                builder.addField<uint8_t>(2, false);
+                const uint32_t batch = builder.endTable();
+                dictionaries_.push_back(encapsulate(message(builder, HEADER_DICTIONARY_BATCH, batch, body.length),
+                                                    body));
+            }
+
+            void records(const size_t rows, const Body &body) {
+                FlatBuilder builder;
+                const uint32_t batch = recordBatch(builder, static_cast<int64_t>(rows), body);
+                recordBatches_.push_back(encapsulate(message(builder, HEADER_RECORD_BATCH, batch, body.length), body));
+            }
+
+            /// Storage for generated data that must live until the file is written.
+            std::vector<uint8_t> &own(const size_t len) {
+                owned_.push_back(std::vector<uint8_t>(len));
+                return owned_.back();
+            }
+
+            /// Appends the end-of-stream marker, the footer and the trailing magic, and returns the finished layout.
+            const std::vector<WriteChunk> &finish() {
+                static const uint32_t END_OF_STREAM[2] = {CONTINUATION, 0};
+                append(END_OF_STREAM, sizeof(END_OF_STREAM));
+
+                FlatBuilder builder;
+                const uint32_t schemaOffset = schema(builder);
+                const uint32_t dictionaries = builder.createStructVector(dictionaries_.data(), dictionaries_.size(),
+                                                                         sizeof(Block), 8);
+                const uint32_t batches = builder.createStructVector(recordBatches_.data(), recordBatches_.size(),
+                                                                    sizeof(Block), 8);
+                builder.startTable();
+                builder.addField<int16_t>(0, METADATA_V5);
+                builder.addOffset(1, schemaOffset);
+                builder.addOffset(2, dictionaries);
+                builder.addOffset(3, batches);
+                owned_.push_back(builder.finish(builder.endTable()));
+                const int32_t footerLength = static_cast<int32_t>(owned_.back().size());
+                append(owned_.back().data(), owned_.back().size());
+                std::vector<uint8_t> &trailer = own(4 + 6);
+                std::memcpy(trailer.data(), &footerLength, 4);
+                std::memcpy(trailer.data() + 4, MAGIC, 6);
+                append(trailer.data(), trailer.size());
+                return chunks_;
+            }
+        };
+    }
+
+    void writeArrowFile(const Corpus &corpus, const std::string &path) {
+        const NameDictionary &dictionary = corpus.dictionary();
+        if (dictionary.bytes().size() > INT32_MAX)
+            throw std::runtime_error("name dictionary is too large for an Arrow file: " + path);
+
+        ArrowFileLayout layout;
+
+        // the dictionary's arena and offsets are already Arrow's utf8 layout
+        Body names;
+        names.strings(dictionary.size(), dictionary.offsets().data(), dictionary.bytes().data(),
+                      dictionary.bytes().size());
+        layout.dictionary(NAME_DICTIONARY, names, dictionary.size());
+
+        static const int32_t SEX_OFFSETS[SEX_COUNT + 1] = {0, 1, 2};
+        static const char SEX_VALUES[SEX_COUNT] = {sexChar(Sex::Female), sexChar(Sex::Male)};
+        Body sexes;
+        sexes.strings(SEX_COUNT, SEX_OFFSETS, SEX_VALUES, sizeof(SEX_VALUES));
+        layout.dictionary(SEX_DICTIONARY, sexes, SEX_COUNT);
+
+        // sex and year are the only columns not stored per row; one buffer of each value covers every batch
+        size_t longest = 0;
+        for (const YearTable &table: corpus.years()) {
+            for (size_t s = 0; s < SEX_COUNT; ++s)
+                longest = std::max(longest, table.columns[s].size());
+        }
+        const uint8_t *sexIndices[SEX_COUNT];
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            std::vector<uint8_t> &indices = layout.own(longest);
+            std::fill(indices.begin(), indices.end(), static_cast<uint8_t>(s));
+            sexIndices[s] = indices.data();
+        }
+
+        for (const YearTable &table: corpus.years()) {
+            const size_t rows = std::max(table.columns[0].size(), table.columns[1].size());
+            std::vector<uint8_t> &years = layout.own(rows * sizeof(int16_t));
+            const int16_t year = static_cast<int16_t>(table.year);
+            for (size_t row = 0; row < rows; ++row)
+                std::memcpy(years.data() + row * sizeof(int16_t), &year, sizeof(int16_t));
+
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                const SexColumn &column = table.columns[s];
+                if (!column.size())
+                    continue;
+                Body body;
+                body.column(column.size(), column.nameIds.data(), column.size() * sizeof(uint32_t));
+                body.column(column.size(), sexIndices[s], column.size());
+                body.column(column.size(), column.counts.data(), column.size() * sizeof(uint32_t));
+                body.column(column.size(), years.data(), column.size() * sizeof(int16_t));
+                layout.records(column.size(), body);
+            }
+        }
+
+        writeFileAtomically(path, layout.finish());
+    }
+}
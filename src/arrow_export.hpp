@@ -0,0 +1,33 @@
+/*
+ * arrow_export.hpp
+ *
+ * Export of a corpus in the Arrow IPC file format (Feather v2), so columnar tools can memory-map and query it
+ * directly. The flatbuffer metadata is written by hand and the column data goes to disk straight from the corpus's
+ * own arrays: the name dictionary's arena and offsets are the Arrow string dictionary, and each sex column's name IDs
+ * and counts are its record batch's index and count buffers.
+ */
+
+#ifndef ARROW_EXPORT_HPP
+#define ARROW_EXPORT_HPP
+
+#include <string>
+
+#include "corpus.hpp"
+
+namespace names {
+    /// Alignment of every buffer in an exported file, as the Arrow format recommends for SIMD access when mapped.
+    const size_t ARROW_ALIGNMENT = 64;
+
+    /// Writes every row of the corpus to path as an Arrow IPC file with the columns
+    ///
+    ///     name   dictionary<values=utf8, indices=int32>
+    ///     sex    dictionary<values=utf8, indices=int8>
+    ///     count  uint32
+    ///     year   int16
+    ///
+    /// and one record batch per non-empty year and sex column, in corpus order. Written under a temporary name and
+    /// renamed into place. Throws std::runtime_error on I/O failure or if the corpus is too large for 32-bit offsets.
+    void writeArrowFile(const Corpus &corpus, const std::string &path);
+}
+
+#endif //ARROW_EXPORT_HPP
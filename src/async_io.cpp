@@ -0,0 +1,239 @@
+#include "async_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "corpus.hpp"
+#include "io_ring.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+#ifndef NAMES_HAVE_IO_URING
+    class IoRing {
+    };
+#endif
+
+    namespace {
+#ifdef __unix__
+        std::runtime_error ioError(const std::string &what, const std::string &path, const int err) {
+            return std::runtime_error(what + " " + path + ": " + std::strerror(err));
+        }
+
+        /// Opens the request's file and sizes its buffer. Returns false, with the error set, if that fails.
+        bool openRequest(AsyncFileReader::Request &request) {
+            request.fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (request.fd < 0) {
+                request.error = std::make_exception_ptr(ioError("unable to open", request.path, errno));
+                return false;
+            }
+            struct stat st;
+            if (fstat(request.fd, &st) != 0) {
+                request.error = std::make_exception_ptr(ioError("unable to stat", request.path, errno));
+                close(request.fd);
+                request.fd = -1;
+                return false;
+            }
+            request.data.resize(static_cast<size_t>(st.st_size));
+            return true;
+        }
+#endif
+    }
+
+    AsyncFileReader::ReadAwaiter::ReadAwaiter(AsyncFileReader &reader, std::string path)
+        : reader_(reader) {
+        request_.path = std::move(path);
+        request_.fd = -1;
+        request_.done = 0;
+    }
+
+    void AsyncFileReader::ReadAwaiter::await_suspend(const std::coroutine_handle<> awaiting) {
+        request_.awaiting = awaiting;
+        reader_.start(&request_);
+    }
+
+    std::string AsyncFileReader::ReadAwaiter::await_resume() {
+        if (request_.error)
+            std::rethrow_exception(request_.error);
+        return std::move(request_.data);
+    }
+
+    AsyncFileReader::AsyncFileReader(TaskPool &pool, const AsyncReaderOptions &options)
+        : pool_(pool),
+          backend_(IoBackend::ThreadPool),
+          stopping_(false),
+          queueDepth_(std::max<size_t>(1, options.queueDepth)),
+          wakeQueued_(false),
+          reads_(0) {
+#ifdef NAMES_HAVE_IO_URING
+        if (options.backend != IoBackend::ThreadPool) {
+            // room for a wake-up beside a full set of reads
+            ring_ = openIoRing(queueDepth_ + 1);
+            if (ring_)
+                backend_ = IoBackend::IoUring;
+        }
+#endif
+        if (options.backend == IoBackend::IoUring && backend_ != IoBackend::IoUring)
+            throw std::runtime_error("io_uring is not available");
+
+        if (ring_) {
+            threads_.push_back(std::thread([this]() { ringLoop(); }));
+        } else {
+            for (size_t i = 0; i < std::max<size_t>(1, options.ioThreads); ++i)
+                threads_.push_back(std::thread([this]() { readLoop(); }));
+        }
+    }
+
+    AsyncFileReader::~AsyncFileReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        queued_.notify_all();
+#ifdef NAMES_HAVE_IO_URING
+        if (ring_) {
+            std::lock_guard<std::mutex> lock(ringMutex_);
+            ring_->queueNop(0);
+            ring_->submit(false);
+        }
+#endif
+        for (std::thread &thread: threads_)
+            thread.join();
+    }
+
+    void AsyncFileReader::start(Request *request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(request);
+        }
+        queued_.notify_one();
+#ifdef NAMES_HAVE_IO_URING
+        // the ring thread clears the flag before it next looks at the queue, so a set flag means it will see this one
+        if (ring_ && !wakeQueued_.exchange(true)) {
+            std::lock_guard<std::mutex> lock(ringMutex_);
+            ring_->queueNop(0);
+            ring_->submit(false);
+        }
+#endif
+    }
+
+    void AsyncFileReader::finish(Request *request) {
+        reads_.fetch_add(1, std::memory_order_relaxed);
+        // the request lives in the coroutine's frame, which may be gone as soon as it is resumed
+        const std::coroutine_handle<> awaiting = request->awaiting;
+        pool_.post([awaiting]() { awaiting.resume(); });
+    }
+
+    void AsyncFileReader::readLoop() {
+        for (;;) {
+            Request *request;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queued_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+                if (queue_.empty())
+                    return;
+                request = queue_.front();
+                queue_.pop_front();
+            }
+#ifdef __unix__
+            if (openRequest(*request)) {
+                while (request->done < request->data.size()) {
+                    const ssize_t n = pread(request->fd, &request->data[request->done],
+                                            request->data.size() - request->done, static_cast<off_t>(request->done));
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n <= 0) {
+                        request->error = std::make_exception_ptr(ioError("unable to read", request->path,
+                                                                         n < 0 ? errno : EIO));
+                        break;
+                    }
+                    request->done += static_cast<size_t>(n);
+                }
+                close(request->fd);
+                request->fd = -1;
+            }
+#else
+            try {
+                request->data = readFile(request->path);
+            } catch (...) {
+                request->error = std::current_exception();
+            }
+#endif
+            finish(request);
+        }
+    }
+
+    void AsyncFileReader::ringLoop() {
+#ifdef NAMES_HAVE_IO_URING
+        IoRing &ring = *ring_;
+        size_t inFlight = 0;
+
+        const auto issue = [&](Request &request) {
+            const size_t chunk = std::min<size_t>(request.data.size() - request.done, 1u << 30);
+            std::lock_guard<std::mutex> lock(ringMutex_);
+            ring.queueRead(request.fd, &request.data[request.done], static_cast<unsigned>(chunk), request.done, -1,
+                           reinterpret_cast<uint64_t>(&request));
+            ring.submit(false);
+        };
+
+        const auto complete = [&](Request &request) {
+            close(request.fd);
+            request.fd = -1;
+            finish(&request);
+        };
+
+        for (;;) {
+            std::vector<Request *> fresh;
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                while (!queue_.empty() && inFlight + fresh.size() < queueDepth_) {
+                    fresh.push_back(queue_.front());
+                    queue_.pop_front();
+                }
+                stopping = stopping_ && queue_.empty();
+            }
+            for (Request *request: fresh) {
+                if (!openRequest(*request)) {
+                    finish(request);
+                } else if (request->data.empty()) {
+                    complete(*request);
+                } else {
+                    issue(*request);
+                    ++inFlight;
+                }
+            }
+            if (stopping && !inFlight)
+                return;
+
+            ring.wait();
+            ring.reap([&](const uint64_t userData, const int result) {
+                if (!userData) {
+                    wakeQueued_.store(false);
+                    return;
+                }
+                Request &request = *reinterpret_cast<Request *>(userData);
+                if (result <= 0) {
+                    // a read of zero before the end means the file shrank under us
+                    request.error = std::make_exception_ptr(
+                        ioError("unable to read", request.path, result < 0 ? -result : EIO));
+                } else {
+                    request.done += static_cast<size_t>(result);
+                    if (request.done < request.data.size()) {
+                        issue(request);
+                        return;
+                    }
+                }
+                --inFlight;
+                complete(request);
+            });
+        }
+#endif
+    }
+}
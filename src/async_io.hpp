@@ -0,0 +1,128 @@
+/*
+ * async_io.hpp
+ *
+ * Whole-file reads that a coroutine can wait for without holding a thread. A reader owns one thread that drives an
+ * io_uring, or, where that is unavailable, a few threads issuing blocking reads. Either way the awaiting coroutine is
+ * suspended while the read is in flight and resumed as a task on the task pool once the file is in memory, so any
+ * number of reads can be outstanding while the pool's threads go on with other work.
+ */
+
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_loader.hpp"
+#include "task_pool.hpp"
+
+namespace names {
+    class IoRing;
+
+    struct AsyncReaderOptions {
+        IoBackend backend;
+        /// Reads in flight at once on the io_uring; more wait their turn.
+        size_t queueDepth;
+        /// Reader threads for the ThreadPool backend.
+        size_t ioThreads;
+
+        AsyncReaderOptions()
+            : backend(IoBackend::Auto),
+              queueDepth(64),
+              ioThreads(2) {
+        }
+    };
+
+    class AsyncFileReader {
+    public:
+        /// One read, living in the awaiting coroutine's frame until it is resumed.
+        struct Request {
+            std::string path;
+            std::string data;
+            std::exception_ptr error;
+            std::coroutine_handle<> awaiting;
+            int fd;
+            size_t done;
+        };
+
+        /// What co_await reader.read(path) suspends on. Gives the file's contents, or throws std::runtime_error if it
+        /// cannot be read.
+        class ReadAwaiter {
+            AsyncFileReader &reader_;
+            Request request_;
+
+        public:
+            ReadAwaiter(AsyncFileReader &reader, std::string path);
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> awaiting);
+
+            std::string await_resume();
+        };
+
+    private:
+        TaskPool &pool_;
+        IoBackend backend_;
+        std::unique_ptr<IoRing> ring_;
+        /// Requests not yet picked up by a reader thread.
+        std::mutex mutex_;
+        std::condition_variable queued_;
+        std::deque<Request *> queue_;
+        bool stopping_;
+        size_t queueDepth_;
+        /// Serialises queueing on the ring between the ring thread and the threads waking it.
+        std::mutex ringMutex_;
+        /// Whether a wake-up is already queued on the ring, so a burst of reads queues only one.
+        std::atomic<bool> wakeQueued_;
+        std::vector<std::thread> threads_;
+        std::atomic<uint64_t> reads_;
+
+        void start(Request *request);
+        /// Hands a finished request back to its coroutine on the pool.
+        void finish(Request *request);
+        void readLoop();
+        void ringLoop();
+
+    public:
+        /// Starts the reader threads. Asking for IoUring explicitly throws std::runtime_error if it is not available.
+        explicit AsyncFileReader(TaskPool &pool = TaskPool::shared(),
+                                 const AsyncReaderOptions &options = AsyncReaderOptions());
+
+        /// Stops the reader threads. Every read must have completed.
+        ~AsyncFileReader();
+
+        AsyncFileReader(const AsyncFileReader &) = delete;
+
+        AsyncFileReader &operator=(const AsyncFileReader &) = delete;
+
+        /// The backend in use: IoUring or ThreadPool.
+        IoBackend backend() const {
+            return backend_;
+        }
+
+        /// Reads the whole file at path: co_await reader.read(path).
+        ReadAwaiter read(std::string path) {
+            return ReadAwaiter(*this, std::move(path));
+        }
+
+        /// Files read so far, successfully or not.
+        uint64_t reads() const {
+            return reads_.load(std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif //ASYNC_IO_HPP
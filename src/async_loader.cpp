@@ -0,0 +1,389 @@
+#include "async_loader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "corpus.hpp"
+#include "file_io.hpp"
+#include "io_ring.hpp"
+#include "parallel.hpp"
+#include "state.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    namespace {
+        /// queueDepth buffers of bufferSize bytes. A slot is held from the moment a read is issued until its file has
+        /// been parsed, which is what bounds the number of files in flight.
+        class BufferPool {
+            std::vector<std::unique_ptr<char[]> > buffers_;
+            std::vector<size_t> free_;
+            std::mutex mutex_;
+            std::condition_variable released_;
+            size_t bufferSize_;
+
+        public:
+            BufferPool(const size_t count, const size_t bufferSize)
+                : bufferSize_(bufferSize) {
+                for (size_t i = 0; i < count; ++i) {
+                    buffers_.push_back(std::unique_ptr<char[]>(new char[bufferSize]));
+                    free_.push_back(count - 1 - i);
+                }
+            }
+
+            size_t count() const {
+                return buffers_.size();
+            }
+
+            size_t bufferSize() const {
+                return bufferSize_;
+            }
+
+            char *buffer(const size_t slot) {
+                return buffers_[slot].get();
+            }
+
+            /// Blocks until a slot is free.
+            size_t acquire() {
+                std::unique_lock<std::mutex> lock(mutex_);
+                released_.wait(lock, [this]() { return !free_.empty(); });
+                const size_t slot = free_.back();
+                free_.pop_back();
+                return slot;
+            }
+
+            /// Takes a free slot if there is one.
+            bool tryAcquire(size_t &slot) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (free_.empty())
+                    return false;
+                slot = free_.back();
+                free_.pop_back();
+                return true;
+            }
+
+            void release(const size_t slot) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    free_.push_back(slot);
+                }
+                released_.notify_one();
+            }
+        };
+
+        /// A file whose contents are being read or are waiting to be parsed.
+        struct PendingFile {
+            size_t index;
+            size_t slot;
+            size_t size;
+            size_t done;
+            int fd;
+            /// Set when the file is larger than a pooled buffer.
+            std::unique_ptr<char[]> own;
+
+            PendingFile()
+                : index(0),
+                  slot(0),
+                  size(0),
+                  done(0),
+                  fd(-1) {
+            }
+
+            char *data(BufferPool &pool) {
+                return own ? own.get() : pool.buffer(slot);
+            }
+        };
+
+        /// State shared between the reading side and the parse tasks.
+        struct LoadContext {
+            const std::vector<std::string> &paths;
+            const FileConsumer &consume;
+            BufferPool pool;
+            TaskGroup parses;
+            std::atomic<bool> failed;
+            std::mutex errorMutex;
+            std::exception_ptr error;
+
+            LoadContext(const std::vector<std::string> &paths, const FileConsumer &consume,
+                        const AsyncLoadOptions &options)
+                : paths(paths),
+                  consume(consume),
+                  pool(std::max<size_t>(1, options.queueDepth), options.bufferSize),
+                  failed(false) {
+            }
+
+            void fail(const std::exception_ptr &e) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = e;
+                failed = true;
+            }
+
+            /// Hands a file that has been read in full to the task pool to parse.
+            void parse(std::unique_ptr<PendingFile> file) {
+                // tasks must be copyable, so the file travels as a raw pointer
+                PendingFile *read = file.release();
+                parses.run([this, read]() {
+                    const std::unique_ptr<PendingFile> owned(read);
+                    if (!failed) {
+                        try {
+                            consume(owned->index, owned->data(pool), owned->size);
+                        } catch (...) {
+                            fail(std::current_exception());
+                        }
+                    }
+                    pool.release(owned->slot);
+                });
+            }
+        };
+
+#ifdef __unix__
+        std::runtime_error ioError(const std::string &what, const std::string &path, const int err) {
+            return std::runtime_error(what + " " + path + ": " + std::strerror(err));
+        }
+
+        /// Opens the file and sizes it, allocating a private buffer if it does not fit a pooled one.
+        std::unique_ptr<PendingFile> openPending(LoadContext &context, const size_t index, const size_t slot) {
+            const std::string &path = context.paths[index];
+            std::unique_ptr<PendingFile> file(new PendingFile());
+            file->index = index;
+            file->slot = slot;
+            file->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file->fd < 0)
+                throw ioError("unable to open", path, errno);
+            struct stat st;
+            if (fstat(file->fd, &st) != 0) {
+                const int err = errno;
+                close(file->fd);
+                throw ioError("unable to stat", path, err);
+            }
+            file->size = static_cast<size_t>(st.st_size);
+            if (file->size > context.pool.bufferSize())
+                file->own.reset(new char[file->size]);
+            return file;
+        }
+#endif
+
+        // ---- Thread-pool backend ---- //
+
+        void readWithThreads(LoadContext &context, const AsyncLoadOptions &options) {
+            std::atomic<size_t> next(0);
+            const auto reader = [&]() {
+                for (size_t index = next++; index < context.paths.size() && !context.failed; index = next++) {
+                    const size_t slot = context.pool.acquire();
+                    try {
+#ifdef __unix__
+                        std::unique_ptr<PendingFile> file = openPending(context, index, slot);
+                        char *data = file->data(context.pool);
+                        while (file->done < file->size) {
+                            const ssize_t n = pread(file->fd, data + file->done, file->size - file->done,
+                                                    static_cast<off_t>(file->done));
+                            if (n < 0 && errno == EINTR)
+                                continue;
+                            if (n <= 0) {
+                                const int err = n < 0 ? errno : EIO;
+                                close(file->fd);
+                                throw ioError("unable to read", context.paths[index], err);
+                            }
+                            file->done += static_cast<size_t>(n);
+                        }
+                        close(file->fd);
+                        file->fd = -1;
+#else
+                        const std::string contents = readFile(context.paths[index]);
+                        std::unique_ptr<PendingFile> file(new PendingFile());
+                        file->index = index;
+                        file->slot = slot;
+                        file->size = contents.size();
+                        if (file->size > context.pool.bufferSize())
+                            file->own.reset(new char[file->size]);
+                        std::memcpy(file->data(context.pool), contents.data(), file->size);
+#endif
+                        context.parse(std::move(file));
+                    } catch (...) {
+                        context.pool.release(slot);
+                        context.fail(std::current_exception());
+                    }
+                }
+            };
+            const size_t threads = std::max<size_t>(1, std::min(options.ioThreads, context.paths.size()));
+            std::vector<std::thread> readers;
+            for (size_t t = 0; t < threads; ++t)
+                readers.push_back(std::thread(reader));
+            for (std::thread &thread: readers)
+                thread.join();
+        }
+
+        // ---- io_uring backend ---- //
+
+#ifdef NAMES_HAVE_IO_URING
+        void readWithRing(LoadContext &context, IoRing &ring) {
+            std::vector<iovec> buffers(context.pool.count());
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                buffers[i].iov_base = context.pool.buffer(i);
+                buffers[i].iov_len = context.pool.bufferSize();
+            }
+            const bool fixed = ring.registerBuffers(buffers);
+            // entries are indexed by the user_data of their reads
+            std::vector<std::unique_ptr<PendingFile> > reading(context.paths.size());
+            size_t next = 0;
+            size_t inFlight = 0;
+
+            const auto issue = [&](PendingFile &file) {
+                const size_t chunk = std::min<size_t>(file.size - file.done, 1u << 30);
+                ring.queueRead(file.fd, file.data(context.pool) + file.done, static_cast<unsigned>(chunk), file.done,
+                               fixed && !file.own ? static_cast<int>(file.slot) : -1, file.index);
+            };
+
+            const auto finish = [&](const size_t index) {
+                std::unique_ptr<PendingFile> file = std::move(reading[index]);
+                close(file->fd);
+                file->fd = -1;
+                context.parse(std::move(file));
+            };
+
+            while ((next < context.paths.size() && !context.failed) || inFlight) {
+                // keep the ring full while there are files and buffers to read them into
+                while (next < context.paths.size() && !context.failed && inFlight < ring.entries()) {
+                    size_t slot;
+                    if (inFlight) {
+                        if (!context.pool.tryAcquire(slot))
+                            break;
+                    } else {
+                        // nothing to reap, so waiting on the parsers is all that can be done
+                        slot = context.pool.acquire();
+                    }
+                    const size_t index = next++;
+                    try {
+                        reading[index] = openPending(context, index, slot);
+                    } catch (...) {
+                        context.pool.release(slot);
+                        context.fail(std::current_exception());
+                        break;
+                    }
+                    if (reading[index]->size == 0) {
+                        finish(index);
+                        continue;
+                    }
+                    issue(*reading[index]);
+                    ++inFlight;
+                }
+                if (!inFlight)
+                    continue;
+
+                ring.submit(true);
+                ring.reap([&](const uint64_t userData, const int result) {
+                    PendingFile &file = *reading[userData];
+                    if (result <= 0) {
+                        // a read of zero before the end means the file shrank under us
+                        context.fail(std::make_exception_ptr(
+                            ioError("unable to read", context.paths[file.index], result < 0 ? -result : EIO)));
+                        close(file.fd);
+                        context.pool.release(file.slot);
+                        reading[userData].reset();
+                        --inFlight;
+                        return;
+                    }
+                    file.done += static_cast<size_t>(result);
+                    if (file.done < file.size) {
+                        // short read: ask for the remainder in the same ring slot
+                        issue(file);
+                        return;
+                    }
+                    --inFlight;
+                    finish(userData);
+                });
+            }
+        }
+#endif
+    }
+
+    IoBackend readFilesAsync(const std::vector<std::string> &paths, const FileConsumer &consume,
+                             const AsyncLoadOptions &options) {
+        LoadContext context(paths, consume, options);
+        IoBackend used = IoBackend::ThreadPool;
+#ifdef NAMES_HAVE_IO_URING
+        std::unique_ptr<IoRing> ring;
+        if (options.backend != IoBackend::ThreadPool) {
+            ring = openIoRing(context.pool.count());
+            if (ring)
+                used = IoBackend::IoUring;
+        }
+#endif
+        if (options.backend == IoBackend::IoUring && used != IoBackend::IoUring)
+            throw std::runtime_error("io_uring is not available");
+
+        try {
+#ifdef NAMES_HAVE_IO_URING
+            if (ring)
+                readWithRing(context, *ring);
+            else
+#endif
+                readWithThreads(context, options);
+        } catch (...) {
+            context.fail(std::current_exception());
+        }
+        context.parses.wait();
+        if (context.error)
+            std::rethrow_exception(context.error);
+        return used;
+    }
+
+    size_t loadYearRangeAsync(Corpus &corpus, const std::string &dir, const int firstYear, const int lastYear,
+                              const AsyncLoadOptions &options) {
+        std::vector<std::string> paths;
+        std::vector<int> years;
+        for (int year = firstYear; year <= lastYear; ++year) {
+            std::stringstream path;
+            path << dir << "/yob" << year << ".txt";
+            if (!fileExists(path.str()))
+                continue;
+            paths.push_back(path.str());
+            years.push_back(year);
+        }
+
+        std::vector<Corpus> parsed(paths.size());
+        readFilesAsync(paths, [&](const size_t index, const char *data, const size_t len) {
+            loadYearData(parsed[index], years[index], data, len);
+        }, options);
+        for (const Corpus &part: parsed)
+            mergeInto(corpus, part);
+        return paths.size();
+    }
+
+    size_t loadStateDirectoryAsync(StateCorpus &corpus, const std::string &dir, const AsyncLoadOptions &options) {
+        std::vector<std::string> paths;
+        for (const std::string &code: allStateCodes()) {
+            const std::string path = dir + "/" + code + ".TXT";
+            if (fileExists(path))
+                paths.push_back(path);
+        }
+
+        // every file gets a private dictionary so parsers never share one
+        std::vector<std::unique_ptr<NameDictionary> > dictionaries(paths.size());
+        std::vector<std::unique_ptr<StateCorpus> > parsed(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            dictionaries[i].reset(new NameDictionary());
+            parsed[i].reset(new StateCorpus(*dictionaries[i]));
+        }
+        readFilesAsync(paths, [&](const size_t index, const char *data, const size_t len) {
+            loadStateData(*parsed[index], data, len);
+        }, options);
+        for (const std::unique_ptr<StateCorpus> &part: parsed)
+            mergeInto(corpus, *part);
+        return paths.size();
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * async_loader.hpp
+ *
+ * Bulk loading that overlaps file reads with parsing. On Linux the reads go through io_uring into a pool of registered
+ * buffers; elsewhere, or when io_uring is unavailable, a small pool of threads issues blocking reads instead. Either
+ * way a bounded number of files are in flight and each is parsed on the shared task pool as soon as its read completes.
+ */
+
+#ifndef ASYNC_LOADER_HPP
+#define ASYNC_LOADER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace names {
+    class Corpus;
+    class StateCorpus;
+
+    enum class IoBackend {
+        /// io_uring if the kernel allows it, otherwise ThreadPool.
+        Auto,
+        IoUring,
+        ThreadPool,
+    };
+
+    struct AsyncLoadOptions {
+        IoBackend backend;
+        /// Maximum number of files read or waiting to be parsed at once. Also the number of pooled buffers.
+        size_t queueDepth;
+        /// Size of each pooled buffer. Larger files get a buffer of their own, but still count against queueDepth.
+        size_t bufferSize;
+        /// Reader threads for the ThreadPool backend.
+        size_t ioThreads;
+
+        AsyncLoadOptions()
+            : backend(IoBackend::Auto),
+              queueDepth(16),
+              bufferSize(1 << 20),
+              ioThreads(4) {
+        }
+    };
+
+    /// Called from task pool threads, possibly concurrently, with the index into paths and the file's contents. The data
+    /// is only valid for the duration of the call.
+    typedef std::function<void(size_t index, const char *data, size_t len)> FileConsumer;
+
+    /// Reads every file and hands it to consume. Rethrows the first exception thrown by a read or by consume once all
+    /// reads and parses have stopped. Returns the backend that was used; asking for IoUring explicitly throws
+    /// std::runtime_error if it is not available.
+    IoBackend readFilesAsync(const std::vector<std::string> &paths, const FileConsumer &consume,
+                             const AsyncLoadOptions &options = AsyncLoadOptions());
+
+    /// Like loadYearRange(), but with reads and parsing overlapped. Each file is parsed into its own corpus and the
+    /// results are merged in year order, so name IDs come out the same as with the sequential loader.
+    size_t loadYearRangeAsync(Corpus &corpus, const std::string &dir, int firstYear, int lastYear,
+                              const AsyncLoadOptions &options = AsyncLoadOptions());
+
+    /// Like loadStateDirectory(), but with reads and parsing overlapped. Merged in state order.
+    size_t loadStateDirectoryAsync(StateCorpus &corpus, const std::string &dir,
+                                   const AsyncLoadOptions &options = AsyncLoadOptions());
+}
+
+#endif //ASYNC_LOADER_HPP
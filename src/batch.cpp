@@ -0,0 +1,343 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "async_loader.hpp"
+#include "parallel.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    namespace {
+        /// Whole lines read in one go, with the queries parsed from them. Queries point into text.
+        struct InputBatch {
+            std::vector<char> text;
+            std::vector<Query> queries;
+            /// Position of the first query in the whole input.
+            uint64_t firstQuery;
+        };
+
+        struct AnsweredBatch {
+            InputBatch input;
+            std::vector<QueryRow> rows;
+            /// End of each query's rows.
+            std::vector<size_t> rowEnds;
+        };
+
+        /// Tells the reader to stop, even while it waits for input that may never come. Without a pipe to poll, it
+        /// only notices between reads.
+        class ReadCancel {
+            std::atomic<bool> stopping_;
+            int fds_[2];
+
+        public:
+            ReadCancel()
+                : stopping_(false),
+                  fds_{-1, -1} {
+#ifdef __unix__
+                if (pipe(fds_) != 0)
+                    throw std::runtime_error(std::string("unable to create a pipe: ") + std::strerror(errno));
+                fcntl(fds_[0], F_SETFD, FD_CLOEXEC);
+                fcntl(fds_[1], F_SETFD, FD_CLOEXEC);
+#endif
+            }
+
+            ~ReadCancel() {
+#ifdef __unix__
+                close(fds_[0]);
+                close(fds_[1]);
+#endif
+            }
+
+            ReadCancel(const ReadCancel &) = delete;
+
+            ReadCancel &operator=(const ReadCancel &) = delete;
+
+            void cancel() {
+                if (stopping_.exchange(true))
+                    return;
+#ifdef __unix__
+                const char byte = 0;
+                while (write(fds_[1], &byte, 1) < 0 && errno == EINTR) {
+                }
+#endif
+            }
+
+            bool cancelled() const {
+                return stopping_.load(std::memory_order_relaxed);
+            }
+
+            /// Reads what has arrived of in, up to size bytes, waiting for at least one unless cancelled. Returns the
+            /// bytes read, setting ended at the end of the input, or 0 once cancelled.
+            size_t read(std::FILE *in, char *data, const size_t size, bool &ended) const {
+#ifdef __unix__
+                // a descriptor is read directly, so a pipe hands over what it has instead of blocking for a full read
+                const int fd = fileno(in);
+                while (fd >= 0) {
+                    pollfd fds[2] = {{fd, POLLIN, 0}, {fds_[0], POLLIN, 0}};
+                    if (poll(fds, 2, -1) < 0) {
+                        if (errno == EINTR)
+                            continue;
+                        throw std::runtime_error(std::string("unable to read queries: ") + std::strerror(errno));
+                    }
+                    if (fds[1].revents)
+                        return 0;
+                    const ssize_t n = ::read(fd, data, size);
+                    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                        continue;
+                    if (n < 0)
+                        throw std::runtime_error(std::string("unable to read queries: ") + std::strerror(errno));
+                    ended = n == 0;
+                    return static_cast<size_t>(n);
+                }
+#endif
+                const size_t n = std::fread(data, 1, size, in);
+                if (n < size && std::ferror(in))
+                    throw std::runtime_error(std::string("unable to read queries: ") + std::strerror(errno));
+                ended = n < size;
+                return n;
+            }
+        };
+
+        /// Reads in, splits whole lines into batches and parses them. Whatever follows the last line break of a read
+        /// is carried over to the next one. Stops early once cancelled.
+        void readQueries(std::FILE *in, const size_t readSize, BlockingQueue<InputBatch> &batches,
+                         const ReadCancel &cancel) {
+            std::vector<char> carry;
+            uint64_t queries = 0;
+            bool done = false;
+            while (!done && !cancel.cancelled()) {
+                InputBatch batch;
+                batch.firstQuery = queries;
+                batch.text.swap(carry);
+                const size_t start = batch.text.size();
+                batch.text.resize(start + readSize);
+                const size_t n = cancel.read(in, batch.text.data() + start, readSize, done);
+                if (cancel.cancelled())
+                    break;
+
+                size_t end = start + n;
+                if (!done) {
+                    // a line longer than a whole read simply keeps growing the carry
+                    while (end > 0 && batch.text[end - 1] != '\n')
+                        --end;
+                }
+                carry.assign(batch.text.begin() + end, batch.text.begin() + start + n);
+                batch.text.resize(end);
+
+                const char *p = batch.text.data();
+                const char *const last = p + end;
+                while (p < last) {
+                    const char *eol = static_cast<const char *>(std::memchr(p, '\n', last - p));
+                    if (!eol)
+                        eol = last;
+                    Query query;
+                    parseQuery(p, eol - p, query);
+                    if (query.type != QueryType::Invalid || query.textSize)
+                        batch.queries.push_back(query);
+                    p = eol + 1;
+                }
+                queries += batch.queries.size();
+                if (!batch.queries.empty())
+                    batches.push(std::move(batch));
+            }
+        }
+
+        void writeAnswers(ResultWriter &writer, const NameDictionary &dictionary, const AnsweredBatch &batch,
+                          BatchStats &stats) {
+            size_t begin = 0;
+            for (size_t i = 0; i < batch.input.queries.size(); ++i) {
+                const Query &query = batch.input.queries[i];
+                const size_t end = batch.rowEnds[i];
+                stats.invalid += query.type == QueryType::Invalid;
+                for (size_t r = begin; r < end; ++r) {
+                    const QueryRow &row = batch.rows[r];
+                    writer.number(static_cast<uint64_t>(batch.input.firstQuery + i + 1)).text(
+                        queryTypeName(query.type), std::strlen(queryTypeName(query.type)));
+                    if (row.nameId != NameDictionary::npos)
+                        writer.text(dictionary.name(row.nameId));
+                    else
+                        writer.text(query.text, query.textSize);
+                    if (row.hasSex) {
+                        const char sex = sexChar(row.sex);
+                        writer.text(&sex, 1);
+                    } else {
+                        writer.null();
+                    }
+                    if (row.year)
+                        writer.number(static_cast<int64_t>(row.year));
+                    else
+                        writer.null();
+                    if (query.type != QueryType::Invalid)
+                        writer.number(row.count);
+                    else
+                        writer.null();
+                    if (row.rank)
+                        writer.number(static_cast<uint64_t>(row.rank));
+                    else
+                        writer.null();
+                    writer.endRow();
+                }
+                stats.rows += end - begin;
+                begin = end;
+            }
+            stats.queries += batch.input.queries.size();
+        }
+
+        double millisecondsSince(const std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    bool parseYearRange(const char *text, int &first, int &last) {
+        char *end;
+        const long from = std::strtol(text, &end, 10);
+        if (*end != '-')
+            return false;
+        const long to = std::strtol(end + 1, &end, 10);
+        if (*end || from > to || from < 0 || to > 9999)
+            return false;
+        first = static_cast<int>(from);
+        last = static_cast<int>(to);
+        return true;
+    }
+
+    std::vector<std::string> batchColumns() {
+        std::vector<std::string> columns;
+        columns.push_back("id");
+        columns.push_back("query");
+        columns.push_back("name");
+        columns.push_back("sex");
+        columns.push_back("year");
+        columns.push_back("count");
+        columns.push_back("rank");
+        return columns;
+    }
+
+    BatchStats runBatch(const QueryEngine &engine, std::FILE *in, std::FILE *out, const BatchOptions &options) {
+        BlockingQueue<InputBatch> parsed(options.queueDepth);
+        BlockingQueue<AnsweredBatch> answered(options.queueDepth);
+        std::exception_ptr readError;
+        std::exception_ptr writeError;
+        BatchStats stats = {0, 0, 0};
+        ReadCancel cancel;
+
+        // a failed stage stops the reader and keeps draining its input, so the stages before it never block on a full
+        // queue and the input is not read to its end first
+        std::thread reader([&]() {
+            try {
+                readQueries(in, std::max<size_t>(options.readSize, 1), parsed, cancel);
+            } catch (...) {
+                readError = std::current_exception();
+            }
+            parsed.close();
+        });
+        std::thread writer([&]() {
+            AnsweredBatch batch;
+            try {
+                ResultWriter output(out, options.format, batchColumns());
+                output.header();
+                while (answered.pop(batch))
+                    writeAnswers(output, engine.corpus().dictionary(), batch, stats);
+                output.flush();
+            } catch (...) {
+                writeError = std::current_exception();
+                cancel.cancel();
+                while (answered.pop(batch)) {
+                }
+            }
+        });
+
+        try {
+            InputBatch input;
+            while (parsed.pop(input)) {
+                AnsweredBatch batch;
+                batch.rowEnds.reserve(input.queries.size());
+                engine.runBatch(input.queries.data(), input.queries.size(), batch.rows, batch.rowEnds);
+                batch.input = std::move(input);
+                answered.push(std::move(batch));
+            }
+        } catch (...) {
+            // the other stages must be stopped and joined before their threads go out of scope; a closed queue no
+            // longer blocks the reader, nor does a read waiting for input once cancelled, and the writer finishes what
+            // it has
+            cancel.cancel();
+            parsed.close();
+            answered.close();
+            reader.join();
+            writer.join();
+            throw;
+        }
+        answered.close();
+        reader.join();
+        writer.join();
+        if (readError)
+            std::rethrow_exception(readError);
+        if (writeError)
+            std::rethrow_exception(writeError);
+        return stats;
+    }
+
+    int batchMain(const int argc, char **argv) {
+        std::string dir = NAMES_DATA_DIR;
+        int firstYear = 1880;
+        int lastYear = 9999;
+        BatchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 == argc || (arg != "--data" && arg != "--years" && arg != "--format")) {
+                std::fprintf(stderr, "usage: %s [--data DIR] [--years FIRST-LAST] [--format csv|tsv|jsonl]\n",
+                             argv[0]);
+                return 2;
+            }
+            const char *value = argv[++i];
+            try {
+                if (arg == "--data")
+                    dir = value;
+                else if (arg == "--format")
+                    options.format = outputFormat(value);
+                else if (!parseYearRange(value, firstYear, lastYear))
+                    throw std::invalid_argument(std::string("bad year range: ") + value);
+            } catch (const std::invalid_argument &e) {
+                std::fprintf(stderr, "%s\n", e.what());
+                return 2;
+            }
+        }
+
+        try {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            Corpus corpus;
+            const size_t files = loadYearRangeAsync(corpus, dir, firstYear, lastYear);
+            if (!files) {
+                std::fprintf(stderr, "no yob files for %d-%d in %s\n", firstYear, lastYear, dir.c_str());
+                return 1;
+            }
+            const QueryEngine engine(corpus);
+            std::fprintf(stderr, "loaded %zu yob files (%zu rows) in %.1f ms\n", files, corpus.rows(),
+                         millisecondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            const BatchStats stats = runBatch(engine, stdin, stdout, options);
+            std::fprintf(stderr, "answered %llu queries (%llu invalid) with %llu rows in %.1f ms\n",
+                         static_cast<unsigned long long>(stats.queries), static_cast<unsigned long long>(stats.invalid),
+                         static_cast<unsigned long long>(stats.rows), millisecondsSince(start));
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * batch.hpp
+ *
+ * The command-line batch mode: query lines stream in on stdin and their answers stream out on stdout. Reading and
+ * parsing, answering, and formatting each run on their own thread, joined by bounded queues, so a long pipe keeps all
+ * three busy at once while memory stays at a few batches.
+ */
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "query.hpp"
+#include "result_writer.hpp"
+
+namespace names {
+    struct BatchOptions {
+        OutputFormat format;
+        /// Bytes read from the input at a time. Each read becomes one batch of whole lines.
+        size_t readSize;
+        /// Batches that may wait between two stages before the earlier stage blocks.
+        size_t queueDepth;
+
+        BatchOptions()
+            : format(OutputFormat::Csv),
+              readSize(1 << 18),
+              queueDepth(4) {
+        }
+    };
+
+    struct BatchStats {
+        uint64_t queries;
+        uint64_t invalid;
+        uint64_t rows;
+    };
+
+    /// The output columns: the query's 1-based position in the input, its type, then the answer's name, sex, year,
+    /// count and rank. Queries can answer with any number of rows, so the position is what ties rows to queries.
+    std::vector<std::string> batchColumns();
+
+    /// Answers every query line read from in (see parseQuery()), writing a header and then the answer rows to out in
+    /// input order. Blank lines are skipped; lines that do not parse answer with one "invalid" row holding the line.
+    /// Throws std::runtime_error if reading or writing fails, without waiting for the rest of the input. Where in has a
+    /// file descriptor it is read through that, so it must not hold input already buffered by stdio.
+    BatchStats runBatch(const QueryEngine &engine, std::FILE *in, std::FILE *out,
+                        const BatchOptions &options = BatchOptions());
+
+    /// Parses "FIRST-LAST" into an inclusive year range. Returns false if text is not one.
+    bool parseYearRange(const char *text, int &first, int &last);
+
+    /// Entry point for `batch [--data DIR] [--years FIRST-LAST] [--format csv|tsv|jsonl]`, with argv[0] being
+    /// "batch". Loads the corpus, answers stdin on stdout and reports timings on stderr. Returns the exit code.
+    int batchMain(int argc, char **argv);
+}
+
+#endif //BATCH_HPP
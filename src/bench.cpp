@@ -0,0 +1,531 @@
+/*
+ * bench.cpp
+ *
+ * Micro-benchmarks for the hot paths. Run with no arguments to run every benchmark, or name the ones to run.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "binary_protocol.hpp"
+#include "corpus.hpp"
+#include "cpu_features.hpp"
+#include "csv_scan.hpp"
+#include "digits.hpp"
+#include "external_sort.hpp"
+#include "http_protocol.hpp"
+#include "page_memory.hpp"
+#include "parallel.hpp"
+#include "query.hpp"
+#include "radix_sort.hpp"
+#include "result_writer.hpp"
+#include "server.hpp"
+#include "simd_kernels.hpp"
+
+#ifdef __unix__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    double secondsSince(const Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /// Distinct name-like keys, e.g. "Nb3kq".
+    std::vector<std::string> syntheticNames(const size_t count) {
+        std::vector<std::string> keys;
+        keys.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key(1, 'A' + static_cast<char>(i % 26));
+            for (size_t n = i / 26 + 1; n; n /= 26)
+                key += static_cast<char>('a' + n % 26);
+            keys.push_back(key);
+        }
+        return keys;
+    }
+
+    /// Random find() latency over a dictionary large enough that its hash table and arena span far more memory than
+    /// the TLB covers with 4 KiB pages.
+    void benchLookup() {
+        const size_t count = size_t(4) << 20;
+        const size_t lookups = size_t(8) << 20;
+        const std::vector<std::string> keys = syntheticNames(count);
+        std::mt19937_64 rng(42);
+        std::vector<uint32_t> order(lookups);
+        for (uint32_t &index: order)
+            index = static_cast<uint32_t>(rng() % count);
+
+        struct Mode {
+            const char *name;
+            names::HugePages pages;
+            bool populate;
+        };
+        const Mode modes[] = {
+            {"4k pages", names::HugePages::Disabled, false},
+            {"4k pages, populated", names::HugePages::Disabled, true},
+            {"system default", names::HugePages::Default, false},
+            {"transparent huge", names::HugePages::Transparent, false},
+            {"transparent huge, populated", names::HugePages::Transparent, true},
+            {"hugetlb", names::HugePages::Explicit, true},
+        };
+
+        std::printf("lookup: %zu names, %zu random finds\n", count, lookups);
+        std::printf("  %-30s %12s %12s\n", "mode", "build ms", "ns/find");
+        for (const Mode &mode: modes) {
+            names::MappingHints hints;
+            hints.hugePages = mode.pages;
+            hints.populate = mode.populate;
+            names::setArenaHints(hints);
+
+            const Clock::time_point buildStart = Clock::now();
+            names::NameDictionary dictionary;
+            for (const std::string &key: keys)
+                dictionary.intern(key);
+            const double build = secondsSince(buildStart);
+
+            uint64_t checksum = 0;
+            const Clock::time_point findStart = Clock::now();
+            for (const uint32_t index: order) {
+                const std::string &key = keys[index];
+                checksum += dictionary.find(key.data(), key.size());
+            }
+            const double find = secondsSince(findStart);
+            std::printf("  %-30s %12.1f %12.1f%s\n", mode.name, build * 1e3, find * 1e9 / lookups,
+                        checksum ? "" : " (checksum 0)");
+        }
+        names::setArenaHints(names::MappingHints());
+    }
+
+    /// Throughput of each ISA variant of the CSV classifier and the popcount kernel.
+    void benchKernels() {
+        std::string csv;
+        while (csv.size() < (size_t(64) << 20))
+            csv += "Olivia,F,14718\r\nLiam,M,22164\r\nZo\xc3\xab,F,3015\r\n";
+        const std::vector<uint64_t> words(csv.size() / 8, 0x5555aaaa3333ccccULL);
+
+        std::printf("kernels: %zu MiB\n", csv.size() >> 20);
+        std::printf("  %-10s %12s %12s\n", "isa", "scan GB/s", "popcnt GB/s");
+        for (int level = 0; level <= static_cast<int>(names::detectedIsaLevel()); ++level) {
+            const names::IsaLevel isa = static_cast<names::IsaLevel>(level);
+            const names::ScanBlockFn scan = names::scanBlockKernel(isa);
+            uint64_t checksum = 0;
+            Clock::time_point start = Clock::now();
+            for (size_t block = 0; block + 64 <= csv.size(); block += 64) {
+                names::ScanMasks masks;
+                scan(csv.data() + block, masks);
+                checksum += masks.commas ^ masks.newlines ^ masks.nonAscii;
+            }
+            const double scanSeconds = secondsSince(start);
+
+            start = Clock::now();
+            for (int round = 0; round < 8; ++round)
+                checksum += names::simdKernels(isa).popcount(words.data(), words.size());
+            const double popcountSeconds = secondsSince(start) / 8;
+            std::printf("  %-10s %12.2f %12.2f%s\n", names::isaName(isa), csv.size() / scanSeconds / 1e9,
+                        csv.size() / popcountSeconds / 1e9, checksum ? "" : " (checksum 0)");
+        }
+    }
+
+    /// SWAR count parsing against std::stoi, and digit-pair formatting against operator<<, on the yob count column.
+    void benchDigits() {
+        const std::string data = names::readFile(std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        std::vector<std::string> fields;
+        // (offset, length) of each field in data, which is how the loader sees them
+        std::vector<std::pair<size_t, size_t> > spans;
+        std::vector<uint32_t> counts;
+        for (size_t pos = 0; pos < data.size();) {
+            const size_t comma = data.find(',', data.find(',', pos) + 1);
+            const size_t eol = data.find('\r', comma);
+            fields.push_back(data.substr(comma + 1, eol - comma - 1));
+            spans.push_back(std::make_pair(comma + 1, eol - comma - 1));
+            counts.push_back(static_cast<uint32_t>(std::stoul(fields.back())));
+            pos = data.find('\n', eol) + 1;
+        }
+        const char *const end = data.data() + data.size();
+        const int rounds = 100;
+        const size_t total = fields.size() * rounds;
+
+        uint64_t checksum = 0;
+        Clock::time_point start = Clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (const std::string &field: fields)
+                checksum += static_cast<uint32_t>(std::stoi(field));
+        }
+        const double stoi = secondsSince(start);
+        start = Clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (const std::pair<size_t, size_t> &span: spans) {
+                uint32_t value = 0;
+                names::parseUint32(data.data() + span.first, span.second, value, end);
+                checksum -= value;
+            }
+        }
+        const double swar = secondsSince(start);
+
+        start = Clock::now();
+        for (int round = 0; round < rounds / 10; ++round) {
+            std::ostringstream out;
+            for (const uint32_t count: counts)
+                out << count << '\n';
+            checksum += out.str().size();
+        }
+        const double stream = secondsSince(start) * 10;
+        start = Clock::now();
+        std::vector<char> buffer(counts.size() * (names::MAX_DIGITS + 1));
+        for (int round = 0; round < rounds; ++round) {
+            char *p = buffer.data();
+            for (const uint32_t count: counts) {
+                p += names::formatUint64(count, p);
+                *p++ = '\n';
+            }
+            checksum += p - buffer.data();
+        }
+        const double pairs = secondsSince(start);
+
+        std::printf("digits: %zu count fields x %d\n", fields.size(), rounds);
+        std::printf("  %-30s %12.2f ns/field\n", "std::stoi", stoi * 1e9 / total);
+        std::printf("  %-30s %12.2f ns/field\n", "parseUint32 (SWAR)", swar * 1e9 / total);
+        std::printf("  %-30s %12.2f ns/field\n", "ostringstream <<", stream * 1e9 / total);
+        std::printf("  %-30s %12.2f ns/field%s\n", "formatUint64 (digit pairs)", pairs * 1e9 / total,
+                    checksum ? "" : " (checksum 0)");
+    }
+
+    /// Dumping a year as CSV to /dev/null: a stream flushed per line against the buffered writev writer.
+    void benchWriter() {
+        names::Corpus corpus;
+        names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        const names::YearTable &table = corpus.years()[0];
+        const int rounds = 20;
+        const size_t rows = table.rows() * rounds;
+
+        Clock::time_point start = Clock::now();
+        {
+            std::ofstream out("/dev/null");
+            for (int round = 0; round < rounds; ++round) {
+                for (size_t s = 0; s < names::SEX_COUNT; ++s) {
+                    const names::SexColumn &column = table.columns[s];
+                    for (size_t row = 0; row < column.size(); ++row) {
+                        out << table.year << ',' << names::sexChar(static_cast<names::Sex>(s)) << ','
+                                << corpus.dictionary().name(column.nameIds[row]).str() << ',' << column.counts[row]
+                                << std::endl;
+                    }
+                }
+            }
+        }
+        const double stream = secondsSince(start);
+
+        start = Clock::now();
+        std::FILE *null = std::fopen("/dev/null", "wb");
+        uint64_t bytes = 0;
+        {
+            names::ResultWriter writer(null, names::OutputFormat::Csv, names::yearRowColumns());
+            for (int round = 0; round < rounds; ++round)
+                names::writeYearTable(writer, corpus.dictionary(), table);
+            writer.flush();
+            bytes = writer.bytesWritten();
+        }
+        std::fclose(null);
+        const double buffered = secondsSince(start);
+
+        std::printf("writer: %zu CSV rows, %.1f MB\n", rows, bytes / 1e6);
+        std::printf("  %-30s %12.1f ns/row %8.0f MB/s\n", "ostream << std::endl", stream * 1e9 / rows,
+                    bytes / stream / 1e6);
+        std::printf("  %-30s %12.1f ns/row %8.0f MB/s\n", "ResultWriter (writev)", buffered * 1e9 / rows,
+                    bytes / buffered / 1e6);
+    }
+
+    /// Re-sorting a multi-year corpus's rows: alphabetically, by name length and by count, radix sorts against
+    /// std::sort with the equivalent comparators. The years are copies of yob2024, which is all the repo ships.
+    void benchSort() {
+        names::Corpus corpus;
+        names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        const names::NameDictionary &dictionary = corpus.dictionary();
+        const int years = 140;
+        std::vector<uint32_t> rowNames;
+        std::vector<names::KeyedId> byCount;
+        std::vector<names::KeyedId> byLength;
+        for (int year = 0; year < years; ++year) {
+            for (const names::SexColumn &column: corpus.years()[0].columns) {
+                for (size_t row = 0; row < column.size(); ++row) {
+                    const uint32_t id = static_cast<uint32_t>(rowNames.size());
+                    // vary counts by year so the copies do not just repeat one another
+                    const names::KeyedId count = {column.counts[row] * static_cast<uint64_t>(year + 1), id};
+                    const names::KeyedId length = {dictionary.name(column.nameIds[row]).size, id};
+                    rowNames.push_back(column.nameIds[row]);
+                    byCount.push_back(count);
+                    byLength.push_back(length);
+                }
+            }
+        }
+        std::mt19937_64 rng(42);
+        std::shuffle(rowNames.begin(), rowNames.end(), rng);
+        std::shuffle(byCount.begin(), byCount.end(), rng);
+        std::shuffle(byLength.begin(), byLength.end(), rng);
+
+        const auto time = [](const std::function<void()> &fn) {
+            const Clock::time_point start = Clock::now();
+            fn();
+            return secondsSince(start) * 1e3;
+        };
+        const auto byKey = [](const names::KeyedId &a, const names::KeyedId &b) { return a.key < b.key; };
+
+        std::printf("sort: %zu rows (%d years), %zu threads\n", rowNames.size(), years, names::workerCount());
+        std::printf("  %-12s %14s %14s\n", "order", "std::sort ms", "radix ms");
+        std::vector<uint32_t> sorted = rowNames;
+        const double nameSort = time([&]() {
+            std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+                const names::NameRef left = dictionary.name(a);
+                const names::NameRef right = dictionary.name(b);
+                const int order = std::memcmp(left.data, right.data, std::min(left.size, right.size));
+                return order < 0 || (order == 0 && left.size < right.size);
+            });
+        });
+        std::vector<uint32_t> radixNames = rowNames;
+        const double nameRadix = time([&]() { names::sortByName(dictionary, radixNames); });
+        std::printf("  %-12s %14.1f %14.1f%s\n", "name", nameSort, nameRadix, sorted == radixNames ? "" : " (differ)");
+
+        const std::pair<const char *, const std::vector<names::KeyedId> *> keyed[] = {
+            std::make_pair("length", &byLength),
+            std::make_pair("count", &byCount),
+        };
+        for (const auto &order: keyed) {
+            std::vector<names::KeyedId> sorted = *order.second;
+            const double comparison = time([&]() { std::sort(sorted.begin(), sorted.end(), byKey); });
+            std::vector<names::KeyedId> radix = *order.second;
+            const double lsd = time([&]() { names::radixSort(radix); });
+            std::printf("  %-12s %14.1f %14.1f\n", order.first, comparison, lsd);
+        }
+    }
+
+    /// Aggregates synthetic records several times larger than the memory budget, to show the cost of spilling.
+    void benchExternal() {
+        const size_t records = 50000000;
+        const uint64_t distinct = 5000000;
+        names::ExternalSortOptions options;
+        options.memoryBudget = 64 << 20;
+        std::mt19937_64 rng(5);
+        const Clock::time_point start = Clock::now();
+        names::ExternalAggregator aggregator(options);
+        for (size_t i = 0; i < records; ++i)
+            aggregator.add(rng() % distinct * 0x9e3779b97f4a7c15ull, 1);
+        int64_t total = 0;
+        size_t keys = 0;
+        aggregator.finish([&](uint64_t, const int64_t count) {
+            total += count;
+            ++keys;
+        });
+        const double seconds = secondsSince(start);
+        const names::ExternalSortStats &stats = aggregator.stats();
+        std::printf("external: %zu records -> %zu keys (sum %lld) in %.2f s, %.1f M records/s\n", records, keys,
+                    static_cast<long long>(total), seconds, records / seconds / 1e6);
+        std::printf("  %zu runs, %zu merge passes, %.1f MiB spilled, peak %.1f MiB of %.1f MiB\n", stats.runs,
+                    stats.mergePasses, stats.spilledBytes / 1048576.0, stats.peakMemory / 1048576.0,
+                    options.memoryBudget / 1048576.0);
+    }
+
+    /// Binary protocol throughput over loopback with 1, 2, 4, ... event loops and as many client connections, up to
+    /// one per core, to show that the SO_REUSEPORT loops scale.
+    void benchServer() {
+        names::Corpus corpus;
+        names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        const names::QueryEngine engine(corpus);
+        std::vector<names::Query> queries;
+        for (uint32_t id = 0; id < corpus.dictionary().size(); ++id) {
+            const names::NameRef name = corpus.dictionary().name(id);
+            const names::Query query = {names::QueryType::Lookup, name.data, name.size, true,
+                                        static_cast<names::Sex>(id % 2), 0, names::DEFAULT_QUERY_LIMIT};
+            queries.push_back(query);
+        }
+
+        std::printf("server: binary lookups over loopback, %zu cores\n", names::workerCount());
+        std::printf("  %-6s %14s %14s\n", "loops", "queries/s", "per write");
+        for (size_t loops = 1; loops <= names::workerCount(); loops *= 2) {
+            names::ServerOptions options;
+            options.loops = loops;
+            names::QueryServer server(options, [&engine]() {
+                return std::unique_ptr<names::ProtocolHandler>(new names::BinaryHandler(engine));
+            });
+            server.start();
+            names::LoadOptions load;
+            load.port = server.port();
+            load.threads = loops;
+            load.seconds = 1.0;
+            const names::LoadStats stats = names::runLoad(load, queries);
+            server.stop();
+            std::printf("  %-6zu %14.0f %14.1f\n", loops, stats.responses / stats.seconds,
+                        static_cast<double>(stats.responses) / std::max<uint64_t>(1, server.stats().writes));
+        }
+    }
+
+    void benchHttp() {
+#ifdef __unix__
+        names::Corpus corpus;
+        names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        const names::QueryEngine engine(corpus);
+        std::vector<std::string> requests;
+        for (uint32_t id = 0; id < corpus.dictionary().size(); ++id)
+            requests.push_back("GET /lookup?name=" + corpus.dictionary().name(id).str() +
+                               " HTTP/1.1\r\nHost: bench\r\n\r\n");
+
+        sockaddr_in address = sockaddr_in();
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        const auto connectToServer = [&address]() {
+            const int fd = socket(AF_INET, SOCK_STREAM, 0);
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        };
+        // reads until count responses have arrived; every response ends its body with "]}"
+        const auto awaitResponses = [](const int fd, std::vector<char> &buffer, const size_t count) {
+            size_t answered = 0;
+            char last = 0;
+            while (answered < count) {
+                const ssize_t n = read(fd, buffer.data(), buffer.size());
+                if (n <= 0)
+                    return false;
+                for (ssize_t i = 0; i < n; ++i) {
+                    answered += last == ']' && buffer[i] == '}';
+                    last = buffer[i];
+                }
+            }
+            return true;
+        };
+
+        // one request at a time on a kept-alive connection, so each sample is a full round trip
+        const auto probe = [&](std::vector<double> &micros) {
+            const int fd = connectToServer();
+            if (fd < 0)
+                return 0.0;
+            std::vector<char> response(64 << 10);
+            const Clock::time_point start = Clock::now();
+            for (size_t i = 0; secondsSince(start) < 1.0; ++i) {
+                const std::string &request = requests[i % requests.size()];
+                const Clock::time_point sent = Clock::now();
+                if (write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size()) ||
+                    !awaitResponses(fd, response, 1))
+                    break;
+                micros.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+            }
+            close(fd);
+            std::sort(micros.begin(), micros.end());
+            return secondsSince(start);
+        };
+
+        std::printf("http: keep-alive lookups over loopback, one at a time, alone and beside pipelined load\n");
+        std::printf("  %-24s %10s %10s %10s %10s %12s %12s\n", "load", "p50 us", "p99 us", "p99.9 us", "max us",
+                    "probe req/s", "load req/s");
+        const size_t depth = 32;
+        // the load once with its batches answered whole and once split into turns, to show what the split buys
+        const std::pair<size_t, size_t> runs[] = {
+            {0, names::HTTP_TURN_ANSWERS}, {4, SIZE_MAX}, {4, names::HTTP_TURN_ANSWERS}};
+        for (const std::pair<size_t, size_t> &run: runs) {
+            const size_t connections = run.first;
+            // one loop, so the probe's requests queue behind the load's on it
+            names::ServerOptions options;
+            options.loops = 1;
+            options.maxTurnAnswers = run.second;
+            names::QueryServer server(options, [&engine]() {
+                return std::unique_ptr<names::ProtocolHandler>(new names::HttpHandler(engine));
+            });
+            server.start();
+            address.sin_port = htons(server.port());
+            // each load connection sends depth requests in one write, then reads every answer before the next round
+            std::atomic<bool> stopping(false);
+            std::atomic<uint64_t> loaded(0);
+            std::vector<std::thread> loaders;
+            for (size_t c = 0; c < connections; ++c) {
+                loaders.emplace_back([&, c]() {
+                    const int fd = connectToServer();
+                    if (fd < 0)
+                        return;
+                    std::string batch;
+                    for (size_t k = 0; k < depth; ++k)
+                        batch += requests[(c * depth + k) * 7919 % requests.size()];
+                    std::vector<char> buffer(256 << 10);
+                    while (!stopping.load(std::memory_order_relaxed)) {
+                        if (write(fd, batch.data(), batch.size()) != static_cast<ssize_t>(batch.size()) ||
+                            !awaitResponses(fd, buffer, depth))
+                            break;
+                        loaded.fetch_add(depth, std::memory_order_relaxed);
+                    }
+                    close(fd);
+                });
+            }
+            const Clock::time_point loadStart = Clock::now();
+            std::vector<double> micros;
+            const double seconds = probe(micros);
+            stopping = true;
+            for (std::thread &loader: loaders)
+                loader.join();
+            const double loadSeconds = secondsSince(loadStart);
+            server.stop();
+            if (micros.empty()) {
+                std::printf("http: unable to connect\n");
+                break;
+            }
+            const auto percentile = [&micros](const double p) {
+                return micros[std::min(micros.size() - 1, static_cast<size_t>(p * micros.size()))];
+            };
+            char label[64];
+            if (!connections)
+                std::snprintf(label, sizeof(label), "none");
+            else if (run.second == SIZE_MAX)
+                std::snprintf(label, sizeof(label), "%zu conns x %zu deep", connections, depth);
+            else
+                std::snprintf(label, sizeof(label), "%zu x %zu, %zu a turn", connections, depth, run.second);
+            std::printf("  %-24s %10.1f %10.1f %10.1f %10.1f %12.0f %12.0f\n", label, percentile(0.5),
+                        percentile(0.99), percentile(0.999), micros.back(), micros.size() / seconds,
+                        loaded.load() / loadSeconds);
+        }
+#endif
+    }
+
+    struct Benchmark {
+        const char *name;
+        std::function<void()> run;
+    };
+}
+
+int main(const int argc, char **argv) {
+    const Benchmark benchmarks[] = {
+        {"lookup", benchLookup},
+        {"kernels", benchKernels},
+        {"digits", benchDigits},
+        {"writer", benchWriter},
+        {"sort", benchSort},
+        {"external", benchExternal},
+        {"server", benchServer},
+        {"http", benchHttp},
+    };
+    for (const Benchmark &benchmark: benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || !std::strcmp(argv[i], benchmark.name);
+        if (selected)
+            benchmark.run();
+    }
+    return 0;
+}
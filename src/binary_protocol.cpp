@@ -0,0 +1,508 @@
+#include "binary_protocol.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include "parallel.hpp"
+
+#ifdef __unix__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    namespace {
+        template<typename T>
+        char *put(char *p, const T value) {
+            std::memcpy(p, &value, sizeof(T));
+            return p + sizeof(T);
+        }
+
+        template<typename T>
+        T get(const char *p) {
+            T value;
+            std::memcpy(&value, p, sizeof(T));
+            return value;
+        }
+
+        std::runtime_error clientError(const std::string &what) {
+            return std::runtime_error("binary client: " + what + ": " + std::strerror(errno));
+        }
+
+        /// Fills query from a request frame's fields. Returns false if one is out of range.
+        bool decodeRequest(const char *frame, const uint32_t length, Query &query) {
+            const uint8_t type = get<uint8_t>(frame + 8);
+            const uint8_t sex = get<uint8_t>(frame + 9);
+            const uint16_t limit = get<uint16_t>(frame + 10);
+            query.type = QueryType::Invalid;
+            query.text = frame + BINARY_REQUEST_HEADER;
+            query.textSize = length + 4 - static_cast<uint32_t>(BINARY_REQUEST_HEADER);
+            query.hasSex = sex < BINARY_EITHER_SEX;
+            query.sex = sex == 1 ? Sex::Male : Sex::Female;
+            query.year = get<int32_t>(frame + 12);
+            query.limit = limit ? std::min<uint32_t>(limit, MAX_QUERY_LIMIT) : DEFAULT_QUERY_LIMIT;
+            if (type > static_cast<uint8_t>(QueryType::Top) || sex > BINARY_EITHER_SEX)
+                return false;
+            const QueryType queryType = static_cast<QueryType>(type);
+            if ((queryType == QueryType::Rank || queryType == QueryType::Top) && !query.hasSex)
+                return false;
+            if (queryType != QueryType::Top && !query.textSize)
+                return false;
+            query.type = queryType;
+            return true;
+        }
+    }
+
+    void encodeBinaryRequest(const Query &query, const uint32_t id, std::string &out) {
+        char header[BINARY_REQUEST_HEADER];
+        char *p = put(header, static_cast<uint32_t>(BINARY_REQUEST_HEADER - 4 + query.textSize));
+        p = put(p, id);
+        p = put(p, static_cast<uint8_t>(query.type));
+        p = put(p, query.hasSex ? static_cast<uint8_t>(query.sex) : BINARY_EITHER_SEX);
+        p = put(p, static_cast<uint16_t>(std::min<uint32_t>(query.limit, UINT16_MAX)));
+        put(p, static_cast<int32_t>(query.year));
+        out.append(header, sizeof(header));
+        out.append(query.text, query.textSize);
+    }
+
+    size_t decodeBinaryResponse(const char *data, const size_t len, BinaryResponse &response) {
+        if (len < 4)
+            return 0;
+        const uint32_t length = get<uint32_t>(data);
+        if (length < BINARY_RESPONSE_HEADER - 4)
+            throw std::runtime_error("binary response: frame too short");
+        if (len - 4 < length)
+            return 0;
+        const char *end = data + 4 + length;
+        response.id = get<uint32_t>(data + 4);
+        response.status = static_cast<BinaryStatus>(get<uint8_t>(data + 8));
+        const uint16_t rows = get<uint16_t>(data + 10);
+        response.rows.resize(rows);
+        const char *p = data + BINARY_RESPONSE_HEADER;
+        for (BinaryRow &row: response.rows) {
+            if (end - p < static_cast<ptrdiff_t>(BINARY_ROW_HEADER))
+                throw std::runtime_error("binary response: truncated row");
+            row.count = get<uint64_t>(p);
+            row.nameId = get<uint32_t>(p + 8);
+            row.rank = get<uint32_t>(p + 12);
+            row.year = get<int32_t>(p + 16);
+            const uint8_t sex = get<uint8_t>(p + 20);
+            row.hasSex = sex < BINARY_EITHER_SEX;
+            row.sex = sex == 1 ? Sex::Male : Sex::Female;
+            const uint16_t nameLength = get<uint16_t>(p + 22);
+            p += BINARY_ROW_HEADER;
+            if (end - p < nameLength)
+                throw std::runtime_error("binary response: truncated name");
+            row.name.assign(p, nameLength);
+            p += nameLength;
+        }
+        if (p != end)
+            throw std::runtime_error("binary response: trailing bytes");
+        return 4 + length;
+    }
+
+    // ---- BinaryHandler ---- //
+
+    size_t BinaryHandler::consume(const char *data, const size_t len, SendQueue &out, ConsumeContext &context) {
+        // every complete frame becomes one batch, up to the connection's share of a turn; the queries point straight
+        // into the receive buffer
+        queries_.clear();
+        ids_.clear();
+        status_.clear();
+        frameEnds_.clear();
+        if (queued_) {
+            admission_->unqueue(queued_);
+            queued_ = 0;
+        }
+        const size_t limit =
+            std::min(context.maxAnswers, admission_ ? admission_->options().maxConnectionInFlight : SIZE_MAX);
+        size_t used = 0;
+        while (len - used >= 4) {
+            const uint32_t length = get<uint32_t>(data + used);
+            // a frame too short or too long to be a request is not worth waiting for; the stream has lost its framing
+            if (length < BINARY_REQUEST_HEADER - 4 || 4 + static_cast<uint64_t>(length) > context.maxRequest) {
+                context.close = true;
+                break;
+            }
+            if (len - used - 4 < length)
+                break;
+            if (queries_.size() == limit) {
+                context.deferred = true;
+                break;
+            }
+            Query query;
+            status_.push_back(decodeRequest(data + used, length, query) ? BinaryStatus::Ok : BinaryStatus::Invalid);
+            queries_.push_back(query);
+            ids_.push_back(get<uint32_t>(data + used + 4));
+            used += 4 + length;
+            frameEnds_.push_back(used);
+        }
+
+        const bool waited = waiting_;
+        waiting_ = false;
+        size_t loadingAt = SIZE_MAX;
+        if (lazy_) {
+            // a year still loading holds back its request and, to keep the answers in order, the rest
+            for (size_t i = 0; i < queries_.size(); ++i) {
+                if (status_[i] != BinaryStatus::Ok)
+                    continue;
+                if (queries_[i].type != QueryType::Rank && queries_[i].type != QueryType::Top) {
+                    status_[i] = BinaryStatus::Invalid;
+                } else if (lazy_->request(queries_[i].year) == YearState::Loading) {
+                    queries_.resize(i);
+                    used = i ? frameEnds_[i - 1] : 0;
+                    context.deferred = true;
+                    waiting_ = true;
+                    loadingAt = i;
+                    break;
+                }
+            }
+        }
+
+        size_t admitted = queries_.size();
+        bool expensive = false;
+        if (admission_ && !queries_.empty()) {
+            if (admission_->expire(context.arrived, std::chrono::steady_clock::now(), queries_.size())) {
+                std::fill(status_.begin(), status_.end(), BinaryStatus::Expired);
+                admitted = 0;
+            } else {
+                // an expensive query without a slot waits, and so, to keep the answers in order, does the rest
+                for (size_t i = 0; i < queries_.size(); ++i) {
+                    if (status_[i] != BinaryStatus::Ok || !isExpensive(queries_[i]))
+                        continue;
+                    expensive = admission_->tryAcquireExpensive();
+                    if (!expensive) {
+                        queries_.resize(i);
+                        used = i ? frameEnds_[i - 1] : 0;
+                        context.deferred = true;
+                    }
+                    break;
+                }
+                admitted = admission_->acquire(queries_.size(), admission_->options().connectionQuota);
+                std::fill(status_.begin() + admitted, status_.end(), BinaryStatus::Overloaded);
+            }
+        }
+        // waiting for a load needs no turns, unless admission held back an earlier request too
+        context.parked = queries_.size() == loadingAt;
+        if (admission_ && context.deferred) {
+            admission_->noteDeferred();
+            // the frames left for the next turn only need their lengths walked to be counted
+            for (size_t at = used; len - at >= 4;) {
+                const uint32_t length = get<uint32_t>(data + at);
+                if (length < BINARY_REQUEST_HEADER - 4 || len - at - 4 < length)
+                    break;
+                ++queued_;
+                at += 4 + length;
+            }
+            admission_->queue(queued_);
+        }
+        if (queries_.empty())
+            return used;
+        // refused requests are not worth looking up
+        for (size_t i = 0; i < queries_.size(); ++i) {
+            if (status_[i] != BinaryStatus::Ok)
+                queries_[i].type = QueryType::Invalid;
+        }
+
+        rows_.clear();
+        rowEnds_.clear();
+        if (lazy_) {
+            dictionaries_.clear();
+            for (size_t i = 0; i < queries_.size(); ++i) {
+                const LoadedYear *year = lazy_->tryAnswer(queries_[i], rows_);
+                if (!year)
+                    engine_.run(queries_[i], rows_);
+                else if (metrics_ && i == 0 && waited)
+                    metrics_->noteCacheMiss();
+                else if (metrics_)
+                    metrics_->noteCacheHit();
+                rowEnds_.push_back(rows_.size());
+                dictionaries_.push_back(year ? &year->corpus.dictionary() : &engine_.corpus().dictionary());
+            }
+        } else {
+            engine_.runBatch(queries_.data(), queries_.size(), rows_, rowEnds_);
+        }
+
+        size_t begin = 0;
+        for (size_t i = 0; i < queries_.size(); ++i) {
+            const NameDictionary &dictionary = lazy_ ? *dictionaries_[i] : engine_.corpus().dictionary();
+            const size_t end = status_[i] == BinaryStatus::Ok ? rowEnds_[i] : begin;
+            size_t size = BINARY_RESPONSE_HEADER;
+            for (size_t r = begin; r < end; ++r) {
+                size += BINARY_ROW_HEADER;
+                if (rows_[r].nameId != NameDictionary::npos)
+                    size += dictionary.name(rows_[r].nameId).size;
+            }
+            char *frame = out.reserve(size);
+            char *p = put(frame, static_cast<uint32_t>(size - 4));
+            p = put(p, ids_[i]);
+            p = put(p, static_cast<uint8_t>(status_[i]));
+            p = put(p, static_cast<uint8_t>(0));
+            p = put(p, static_cast<uint16_t>(end - begin));
+            for (size_t r = begin; r < end; ++r) {
+                const QueryRow &row = rows_[r];
+                NameRef name = {"", 0};
+                if (row.nameId != NameDictionary::npos)
+                    name = dictionary.name(row.nameId);
+                p = put(p, row.count);
+                p = put(p, row.nameId);
+                p = put(p, row.rank);
+                p = put(p, static_cast<int32_t>(row.year));
+                p = put(p, row.hasSex ? static_cast<uint8_t>(row.sex) : BINARY_EITHER_SEX);
+                p = put(p, static_cast<uint8_t>(0));
+                p = put(p, static_cast<uint16_t>(name.size));
+                std::memcpy(p, name.data, name.size);
+                p += name.size;
+            }
+            out.commit(size);
+            begin = rowEnds_[i];
+        }
+        if (metrics_) {
+            // every query in a batch waited for the whole of it, so they share one latency
+            const uint64_t nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - context.arrived).count());
+            uint64_t answered[static_cast<size_t>(QueryType::Invalid) + 1] = {};
+            for (size_t i = 0; i < queries_.size(); ++i) {
+                if (status_[i] == BinaryStatus::Ok)
+                    ++answered[static_cast<size_t>(queries_[i].type)];
+            }
+            for (size_t t = 0; t <= static_cast<size_t>(QueryType::Invalid); ++t) {
+                if (answered[t])
+                    metrics_->record(static_cast<QueryType>(t), nanos, answered[t]);
+            }
+        }
+        if (expensive)
+            admission_->releaseExpensive();
+        if (admission_)
+            admission_->release(admitted);
+        return used;
+    }
+
+    // ---- BinaryClient ---- //
+
+    BinaryClient::BinaryClient(const std::string &host, const uint16_t port)
+        : fd_(-1),
+          input_(64 << 10),
+          inputStart_(0),
+          inputEnd_(0) {
+#ifdef __unix__
+        sockaddr_in address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+            throw std::runtime_error("binary client: not an IPv4 address: " + host);
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0)
+            throw clientError("socket");
+        if (connect(fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+            const std::runtime_error error = clientError("unable to connect to " + host + ":" + std::to_string(port));
+            close(fd_);
+            throw error;
+        }
+        const int on = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#else
+        static_cast<void>(port);
+        throw std::runtime_error("binary client: not supported on this platform: " + host);
+#endif
+    }
+
+    BinaryClient::~BinaryClient() {
+#ifdef __unix__
+        if (fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    void BinaryClient::flush() {
+#ifdef __unix__
+        size_t sent = 0;
+        while (sent < output_.size()) {
+            const ssize_t n = ::send(fd_, output_.data() + sent, output_.size() - sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw clientError("send");
+            }
+            sent += static_cast<size_t>(n);
+        }
+#endif
+        output_.clear();
+    }
+
+    void BinaryClient::finish() {
+        flush();
+#ifdef __unix__
+        if (shutdown(fd_, SHUT_WR) != 0)
+            throw clientError("shutdown");
+#endif
+    }
+
+    void BinaryClient::fill() {
+#ifdef __unix__
+        if (inputStart_) {
+            std::memmove(input_.data(), input_.data() + inputStart_, inputEnd_ - inputStart_);
+            inputEnd_ -= inputStart_;
+            inputStart_ = 0;
+        }
+        if (inputEnd_ == input_.size())
+            input_.resize(input_.size() * 2);
+        while (true) {
+            const ssize_t n = recv(fd_, input_.data() + inputEnd_, input_.size() - inputEnd_, 0);
+            if (n > 0) {
+                inputEnd_ += static_cast<size_t>(n);
+                return;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0)
+                errno = ECONNRESET;
+            throw clientError("recv");
+        }
+#endif
+    }
+
+    size_t BinaryClient::frameSize() const {
+        const size_t available = inputEnd_ - inputStart_;
+        if (available < 4)
+            return 0;
+        const size_t size = 4 + get<uint32_t>(input_.data() + inputStart_);
+        return available >= size ? size : 0;
+    }
+
+    void BinaryClient::receive(BinaryResponse &response) {
+        while (!frameSize())
+            fill();
+        inputStart_ += decodeBinaryResponse(input_.data() + inputStart_, inputEnd_ - inputStart_, response);
+    }
+
+    size_t BinaryClient::skipResponses() {
+        while (!frameSize())
+            fill();
+        size_t count = 0;
+        for (size_t size = frameSize(); size; size = frameSize()) {
+            inputStart_ += size;
+            ++count;
+        }
+        return count;
+    }
+
+    // ---- Load generator ---- //
+
+    LoadStats runLoad(const LoadOptions &options, const std::vector<Query> &queries) {
+        if (queries.empty())
+            throw std::invalid_argument("load: no queries");
+        const size_t threads = options.threads ? options.threads : workerCount();
+        std::vector<std::unique_ptr<BinaryClient> > clients;
+        for (size_t t = 0; t < threads; ++t)
+            clients.push_back(std::unique_ptr<BinaryClient>(new BinaryClient(options.host, options.port)));
+
+        std::atomic<uint64_t> responses(0);
+        std::vector<std::string> errors(threads);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const std::chrono::steady_clock::time_point deadline =
+            start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(options.seconds));
+        const auto drive = [&](const size_t t) {
+            BinaryClient &client = *clients[t];
+            size_t next = t * queries.size() / threads;
+            uint32_t id = 0;
+            uint64_t answered = 0;
+            try {
+                size_t outstanding = 0;
+                for (; outstanding < std::max<size_t>(1, options.depth); ++outstanding)
+                    client.send(queries[next++ % queries.size()], id++);
+                client.flush();
+                // refill the pipeline with as many requests as were just answered, in one write
+                while (outstanding) {
+                    const size_t arrived = client.skipResponses();
+                    outstanding -= arrived;
+                    answered += arrived;
+                    if (std::chrono::steady_clock::now() < deadline) {
+                        for (size_t i = 0; i < arrived; ++i)
+                            client.send(queries[next++ % queries.size()], id++);
+                        outstanding += arrived;
+                        client.flush();
+                    }
+                }
+            } catch (const std::exception &e) {
+                errors[t] = e.what();
+            }
+            responses += answered;
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; ++t)
+            pool.push_back(std::thread(drive, t));
+        drive(0);
+        for (std::thread &thread: pool)
+            thread.join();
+        for (const std::string &error: errors) {
+            if (!error.empty())
+                throw std::runtime_error(error);
+        }
+
+        LoadStats stats;
+        stats.responses = responses.load();
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats.threads = threads;
+        return stats;
+    }
+
+    int loadMain(const int argc, char **argv) {
+        LoadOptions options;
+        options.port = 7343;
+        std::string namesFile = std::string(NAMES_DATA_DIR) + "/yob2024.txt";
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 == argc || (arg != "--port" && arg != "--threads" && arg != "--depth" && arg != "--seconds" &&
+                                  arg != "--names")) {
+                std::fprintf(stderr, "usage: %s [--port PORT] [--threads N] [--depth N] [--seconds S] [--names FILE]\n",
+                             argv[0]);
+                return 2;
+            }
+            const char *value = argv[++i];
+            if (arg == "--port")
+                options.port = static_cast<uint16_t>(std::atoi(value));
+            else if (arg == "--threads")
+                options.threads = static_cast<size_t>(std::atoi(value));
+            else if (arg == "--depth")
+                options.depth = static_cast<size_t>(std::atoi(value));
+            else if (arg == "--seconds")
+                options.seconds = std::atof(value);
+            else
+                namesFile = value;
+        }
+
+        try {
+            // the file's names, looked up one sex at a time, make a realistic mix of hits and misses
+            Corpus corpus;
+            loadYearFile(corpus, 2024, namesFile);
+            const NameDictionary &dictionary = corpus.dictionary();
+            std::vector<Query> queries;
+            for (uint32_t id = 0; id < dictionary.size(); ++id) {
+                const NameRef name = dictionary.name(id);
+                const Query query = {QueryType::Lookup, name.data, name.size, true, static_cast<Sex>(id % 2), 0,
+                                     DEFAULT_QUERY_LIMIT};
+                queries.push_back(query);
+            }
+            const LoadStats stats = runLoad(options, queries);
+            std::fprintf(stderr, "%zu connections, depth %zu: %llu responses in %.2f s, %.0f queries/s\n",
+                         stats.threads, options.depth, static_cast<unsigned long long>(stats.responses),
+                         stats.seconds, stats.responses / stats.seconds);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,192 @@
+/*
+ * binary_protocol.hpp
+ *
+ * A compact binary framing of queries for clients on the same host, served by QueryServer. Every frame starts with
+ * its length, so a client can pipeline any number of requests without waiting, and the server answers all complete
+ * requests of a read as one batch (see QueryEngine::runBatch()) and sends the answers back in one write. Responses
+ * come back in request order and echo the request's ID. All integers are little-endian.
+ *
+ * Request:  u32 length of the rest, u32 id, u8 query type, u8 sex (0 F, 1 M, 2 either), u16 limit (0 for the
+ *           default), i32 year, then the name or prefix bytes.
+ * Response: u32 length of the rest, u32 id, u8 status, u8 0, u16 row count, then per row u64 count, u32 name ID,
+ *           u32 rank, i32 year, u8 sex (2 for none), u8 0, u16 name length and the name bytes.
+ *
+ * This file also has a blocking client and the load generator built on it.
+ */
+
+#ifndef BINARY_PROTOCOL_HPP
+#define BINARY_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "admission.hpp"
+#include "latency.hpp"
+#include "lazy_years.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+namespace names {
+    const size_t BINARY_REQUEST_HEADER = 16;
+    const size_t BINARY_RESPONSE_HEADER = 12;
+    const size_t BINARY_ROW_HEADER = 24;
+    /// The sex byte of a request that asks about both sexes, or of a row whose figures span both.
+    const uint8_t BINARY_EITHER_SEX = 2;
+
+    enum class BinaryStatus : uint8_t {
+        Ok = 0,
+        /// The request had an unknown query type or an out-of-range field, or asked a server loading years lazily for
+        /// a lookup or prefix, which span every year. It has no rows.
+        Invalid = 1,
+        /// The server was answering as many requests as it allows and refused this one. It has no rows.
+        Overloaded = 2,
+        /// The request waited past the server's deadline and was refused. It has no rows.
+        Expired = 3,
+    };
+
+    /// Appends a request frame for query to out.
+    void encodeBinaryRequest(const Query &query, uint32_t id, std::string &out);
+
+    struct BinaryRow {
+        uint32_t nameId;
+        bool hasSex;
+        Sex sex;
+        int year;
+        uint64_t count;
+        uint32_t rank;
+        std::string name;
+    };
+
+    struct BinaryResponse {
+        uint32_t id;
+        BinaryStatus status;
+        std::vector<BinaryRow> rows;
+    };
+
+    /// Decodes the response frame at the start of [data, data + len). Returns the frame's size, or 0 if it has not
+    /// all arrived yet. Throws std::runtime_error if the frame is malformed.
+    size_t decodeBinaryResponse(const char *data, size_t len, BinaryResponse &response);
+
+    /// Answers binary requests from a shared engine. Each connection has its own, so batches need no locking.
+    class BinaryHandler : public ProtocolHandler {
+        const QueryEngine &engine_;
+        AdmissionController *admission_;
+        QueryMetrics *metrics_;
+        LazyYearStore *lazy_;
+        std::vector<Query> queries_;
+        std::vector<uint32_t> ids_;
+        /// Each frame's status; only BinaryStatus::Ok frames are answered with rows.
+        std::vector<BinaryStatus> status_;
+        /// The end of each frame in the data being consumed.
+        std::vector<size_t> frameEnds_;
+        /// Complete frames left for the next turn, as counted with admission.
+        size_t queued_;
+        std::vector<QueryRow> rows_;
+        std::vector<size_t> rowEnds_;
+        /// With lazy years, the dictionary each query's name IDs refer to.
+        std::vector<const NameDictionary *> dictionaries_;
+        /// Whether the first request left for the next turn waits for its year to load, making it a cache miss.
+        bool waiting_;
+
+    public:
+        /// Requests are let in by admission, if given, and answered ones recorded in metrics, if given. With lazy,
+        /// rank and top are answered from its years, and engine only answers for years lazy does not have. A request
+        /// for a year still loading parks the connection, so the server must be resumed from LazyYearStore::onLoaded().
+        /// All must outlive the handler.
+        explicit BinaryHandler(const QueryEngine &engine, AdmissionController *admission = nullptr,
+                               QueryMetrics *metrics = nullptr, LazyYearStore *lazy = nullptr)
+            : engine_(engine),
+              admission_(admission),
+              metrics_(metrics),
+              lazy_(lazy),
+              queued_(0),
+              waiting_(false) {
+        }
+
+        ~BinaryHandler() override {
+            if (queued_)
+                admission_->unqueue(queued_);
+        }
+
+        size_t consume(const char *data, size_t len, SendQueue &out, ConsumeContext &context) override;
+    };
+
+    /// A blocking connection to a binary query server, for tests, tools and the load generator.
+    class BinaryClient {
+        int fd_;
+        std::string output_;
+        std::vector<char> input_;
+        size_t inputStart_;
+        size_t inputEnd_;
+
+        /// Blocks until more has arrived. Throws std::runtime_error if the connection is closed or fails.
+        void fill();
+
+        /// The size of the complete frame at the front of the input, or 0.
+        size_t frameSize() const;
+
+    public:
+        /// Connects to host:port. Throws std::runtime_error on failure.
+        BinaryClient(const std::string &host, uint16_t port);
+
+        ~BinaryClient();
+
+        BinaryClient(const BinaryClient &) = delete;
+
+        BinaryClient &operator=(const BinaryClient &) = delete;
+
+        /// Queues a request; nothing is sent until flush().
+        void send(const Query &query, uint32_t id) {
+            encodeBinaryRequest(query, id, output_);
+        }
+
+        /// Sends every queued request in one write.
+        void flush();
+
+        /// Sends every queued request and then shuts down the sending side. Responses can still be received.
+        void finish();
+
+        /// Blocks for the next response.
+        void receive(BinaryResponse &response);
+
+        /// Blocks until at least one response has arrived, then consumes every complete one without decoding it.
+        /// Returns how many there were.
+        size_t skipResponses();
+    };
+
+    struct LoadOptions {
+        std::string host;
+        uint16_t port;
+        /// Client threads, each with its own connection. 0 means one per core.
+        size_t threads;
+        /// Requests each connection keeps outstanding.
+        size_t depth;
+        double seconds;
+
+        LoadOptions()
+            : host("127.0.0.1"),
+              port(0),
+              threads(0),
+              depth(64),
+              seconds(2.0) {
+        }
+    };
+
+    struct LoadStats {
+        uint64_t responses;
+        double seconds;
+        size_t threads;
+    };
+
+    /// Sends queries round robin over the connections for the given time, keeping each connection's pipeline full,
+    /// and counts the answers. The queries' text must stay alive until it returns.
+    LoadStats runLoad(const LoadOptions &options, const std::vector<Query> &queries);
+
+    /// Entry point for `load [--port PORT] [--threads N] [--depth N] [--seconds S] [--names YOBFILE]`, with argv[0]
+    /// being "load". Looks up the names of the given yob file against a running server. Returns the exit code.
+    int loadMain(int argc, char **argv);
+}
+
+#endif //BINARY_PROTOCOL_HPP
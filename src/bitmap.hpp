@@ -0,0 +1,95 @@
+/*
+ * bitmap.hpp
+ *
+ * A fixed-size set of bits, typically indexed by name ID. Counting and whole-bitmap logic run on the SIMD kernels.
+ */
+
+#ifndef BITMAP_HPP
+#define BITMAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd_kernels.hpp"
+
+namespace names {
+    class Bitmap {
+        std::vector<uint64_t> words_;
+        size_t size_;
+
+        /// Clears the unused bits of the last word.
+        void trim() {
+            if (size_ % 64)
+                words_.back() &= (uint64_t(1) << size_ % 64) - 1;
+        }
+
+    public:
+        explicit Bitmap(const size_t size = 0)
+            : words_((size + 63) / 64, 0),
+              size_(size) {
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        /// Grows or shrinks to size bits. Added bits are clear.
+        void resize(const size_t size) {
+            words_.resize((size + 63) / 64, 0);
+            size_ = size;
+            trim();
+        }
+
+        bool test(const size_t bit) const {
+            return words_[bit / 64] >> bit % 64 & 1;
+        }
+
+        void set(const size_t bit) {
+            words_[bit / 64] |= uint64_t(1) << bit % 64;
+        }
+
+        void reset(const size_t bit) {
+            words_[bit / 64] &= ~(uint64_t(1) << bit % 64);
+        }
+
+        /// Number of set bits.
+        size_t count() const {
+            return popcount(words_.data(), words_.size());
+        }
+
+        /// Number of bits set in both bitmaps; bits past the shorter one count as clear.
+        size_t countAnd(const Bitmap &other) const {
+            return popcountAnd(words_.data(), other.words_.data(), std::min(words_.size(), other.words_.size()));
+        }
+
+        /// Keeps only bits also set in other.
+        Bitmap &operator&=(const Bitmap &other) {
+            const size_t shared = std::min(words_.size(), other.words_.size());
+            andWords(words_.data(), words_.data(), other.words_.data(), shared);
+            std::fill(words_.begin() + shared, words_.end(), 0);
+            return *this;
+        }
+
+        /// Adds other's bits, ignoring any beyond size().
+        Bitmap &operator|=(const Bitmap &other) {
+            orWords(words_.data(), words_.data(), other.words_.data(), std::min(words_.size(), other.words_.size()));
+            trim();
+            return *this;
+        }
+
+        /// Clears every bit set in other.
+        Bitmap &subtract(const Bitmap &other) {
+            andNotWords(words_.data(), words_.data(), other.words_.data(),
+                        std::min(words_.size(), other.words_.size()));
+            return *this;
+        }
+
+        const uint64_t *words() const {
+            return words_.data();
+        }
+    };
+}
+
+#endif //BITMAP_HPP
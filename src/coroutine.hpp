@@ -0,0 +1,403 @@
+/*
+ * coroutine.hpp
+ *
+ * C++20 coroutines for work that waits on I/O, such as a query whose year still has to be read from disk. An
+ * Async<T> is a coroutine producing a T. It does not start until it is awaited, and when it finishes it resumes its
+ * awaiter directly, so a chain of awaits costs no scheduling. A coroutine that has to wait hands its handle to
+ * whatever completes the wait and returns, leaving its thread free; the completion resumes it as a task on the shared
+ * task pool. Coroutines that never wait run start to finish on the caller's thread, like ordinary calls.
+ */
+
+#ifndef COROUTINE_HPP
+#define COROUTINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "task_pool.hpp"
+
+namespace names {
+    template<typename T>
+    class Async;
+
+    namespace detail {
+        /// The part of an Async's promise that does not depend on its result type.
+        struct AsyncPromiseBase {
+            /// The coroutine awaiting this one, resumed when it finishes.
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            struct FinalAwaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(const std::coroutine_handle<Promise> finished) noexcept {
+                    const std::coroutine_handle<> next = finished.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {
+                }
+            };
+
+            std::suspend_always initial_suspend() const noexcept {
+                return std::suspend_always();
+            }
+
+            FinalAwaiter final_suspend() const noexcept {
+                return FinalAwaiter();
+            }
+
+            void unhandled_exception() {
+                error = std::current_exception();
+            }
+        };
+
+        template<typename T>
+        struct AsyncPromise : AsyncPromiseBase {
+            std::optional<T> value;
+
+            Async<T> get_return_object();
+
+            template<typename U>
+            void return_value(U &&result) {
+                value.emplace(std::forward<U>(result));
+            }
+
+            T take() {
+                if (error)
+                    std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct AsyncPromise<void> : AsyncPromiseBase {
+            Async<void> get_return_object();
+
+            void return_void() const {
+            }
+
+            void take() const {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+        };
+
+        /// A coroutine nobody awaits, which destroys itself when it finishes.
+        struct Detached {
+            struct promise_type {
+                Detached get_return_object() const {
+                    return Detached();
+                }
+
+                std::suspend_never initial_suspend() const noexcept {
+                    return std::suspend_never();
+                }
+
+                std::suspend_never final_suspend() const noexcept {
+                    return std::suspend_never();
+                }
+
+                void return_void() const {
+                }
+
+                void unhandled_exception() const {
+                    std::terminate();
+                }
+            };
+        };
+
+        /// Lets one thread block until another says it may go on.
+        class Latch {
+            std::mutex mutex_;
+            std::condition_variable changed_;
+            bool set_;
+
+        public:
+            Latch()
+                : set_(false) {
+            }
+
+            void set() {
+                // notified under the lock, since the waiter destroys the latch as soon as it sees set_
+                std::lock_guard<std::mutex> lock(mutex_);
+                set_ = true;
+                changed_.notify_all();
+            }
+
+            void wait() {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this]() { return set_; });
+            }
+        };
+    }
+
+    /// A lazily started coroutine returning T. Awaiting it runs it and gives its result, or rethrows what it threw. It
+    /// can be awaited once; syncWait() runs one from ordinary code.
+    template<typename T = void>
+    class [[nodiscard]] Async {
+    public:
+        typedef detail::AsyncPromise<T> promise_type;
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+
+        template<typename U>
+        friend U syncWait(Async<U> task);
+
+    public:
+        explicit Async(const std::coroutine_handle<promise_type> handle)
+            : handle_(handle) {
+        }
+
+        Async(Async &&other) noexcept
+            : handle_(std::exchange(other.handle_, nullptr)) {
+        }
+
+        Async &operator=(Async &&other) noexcept {
+            if (this != &other) {
+                if (handle_)
+                    handle_.destroy();
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        Async(const Async &) = delete;
+
+        Async &operator=(const Async &) = delete;
+
+        ~Async() {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        /// Starts the coroutine in place of the awaiter, which it resumes when it finishes.
+        std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiting) noexcept {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        T await_resume() {
+            return handle_.promise().take();
+        }
+    };
+
+    template<typename T>
+    Async<T> detail::AsyncPromise<T>::get_return_object() {
+        return Async<T>(std::coroutine_handle<AsyncPromise<T> >::from_promise(*this));
+    }
+
+    inline Async<void> detail::AsyncPromise<void>::get_return_object() {
+        return Async<void>(std::coroutine_handle<AsyncPromise<void> >::from_promise(*this));
+    }
+
+    namespace detail {
+        template<typename T>
+        Detached finishThenSet(Async<T> &task, Latch &latch) {
+            try {
+                co_await task;
+            } catch (...) {
+                // rethrown by syncWait() from the task's own promise
+            }
+            latch.set();
+        }
+
+        template<typename T>
+        Detached finishThenSet(Async<T> &task, Latch &latch, std::optional<T> &result) {
+            try {
+                result.emplace(co_await task);
+            } catch (...) {
+                // rethrown by syncWait() from the task's own promise
+            }
+            latch.set();
+        }
+    }
+
+    /// Runs task to completion, blocking the calling thread while it waits, and returns its result. Meant for the
+    /// edges of the program: called from a pool task it would hold a worker for the whole wait.
+    template<typename T>
+    T syncWait(Async<T> task) {
+        detail::Latch latch;
+        std::optional<T> result;
+        detail::finishThenSet(task, latch, result);
+        latch.wait();
+        if (task.handle_.promise().error)
+            std::rethrow_exception(task.handle_.promise().error);
+        return std::move(*result);
+    }
+
+    template<>
+    inline void syncWait(Async<void> task) {
+        detail::Latch latch;
+        detail::finishThenSet(task, latch);
+        latch.wait();
+        task.handle_.promise().take();
+    }
+
+    /// Coroutines started now and waited for together, as a TaskGroup is for tasks. Their results are dropped.
+    class AsyncScope {
+        std::mutex mutex_;
+        std::condition_variable done_;
+        size_t pending_;
+        std::exception_ptr error_;
+
+        template<typename T>
+        static detail::Detached run(Async<T> task, AsyncScope &scope) {
+            std::exception_ptr error;
+            try {
+                co_await task;
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(scope.mutex_);
+            if (error && !scope.error_)
+                scope.error_ = error;
+            if (!--scope.pending_)
+                scope.done_.notify_all();
+        }
+
+    public:
+        AsyncScope()
+            : pending_(0) {
+        }
+
+        AsyncScope(const AsyncScope &) = delete;
+
+        AsyncScope &operator=(const AsyncScope &) = delete;
+
+        /// Waits for every coroutine still running, without rethrowing their errors.
+        ~AsyncScope() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return !pending_; });
+        }
+
+        /// Starts task on the calling thread, which it gets back when the task first suspends or finishes.
+        template<typename T>
+        void spawn(Async<T> task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++pending_;
+            }
+            run(std::move(task), *this);
+        }
+
+        /// Blocks until every spawned coroutine has finished, and rethrows the first exception one of them threw.
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return !pending_; });
+            if (error_) {
+                std::exception_ptr error = error_;
+                error_ = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    /// Continues the awaiting coroutine as a task on a pool.
+    class PoolAwaiter {
+        TaskPool &pool_;
+        TaskPriority priority_;
+
+    public:
+        PoolAwaiter(TaskPool &pool, const TaskPriority priority)
+            : pool_(pool),
+              priority_(priority) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(const std::coroutine_handle<> awaiting) const {
+            pool_.post([awaiting]() { awaiting.resume(); }, priority_);
+        }
+
+        void await_resume() const noexcept {
+        }
+    };
+
+    /// co_await resumeOn(pool) moves the rest of the coroutine onto pool, returning the current thread to whoever
+    /// resumed it.
+    inline PoolAwaiter resumeOn(TaskPool &pool, const TaskPriority priority = TaskPriority::Interactive) {
+        return PoolAwaiter(pool, priority);
+    }
+
+    /// A one-shot signal coroutines can wait for. set() resumes every waiter as a task on the pool; waiting once it
+    /// is set does not suspend at all.
+    class AsyncEvent {
+        TaskPool &pool_;
+        std::mutex mutex_;
+        std::atomic<bool> set_;
+        std::vector<std::coroutine_handle<> > waiters_;
+
+    public:
+        explicit AsyncEvent(TaskPool &pool = TaskPool::shared())
+            : pool_(pool),
+              set_(false) {
+        }
+
+        AsyncEvent(const AsyncEvent &) = delete;
+
+        AsyncEvent &operator=(const AsyncEvent &) = delete;
+
+        bool isSet() const {
+            return set_.load(std::memory_order_acquire);
+        }
+
+        void set() {
+            std::vector<std::coroutine_handle<> > waiting;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                set_.store(true, std::memory_order_release);
+                waiting.swap(waiters_);
+            }
+            for (const std::coroutine_handle<> waiter: waiting)
+                pool_.post([waiter]() { waiter.resume(); });
+        }
+
+        class Awaiter {
+            AsyncEvent &event_;
+
+        public:
+            explicit Awaiter(AsyncEvent &event)
+                : event_(event) {
+            }
+
+            bool await_ready() const {
+                return event_.isSet();
+            }
+
+            bool await_suspend(const std::coroutine_handle<> awaiting) const {
+                std::lock_guard<std::mutex> lock(event_.mutex_);
+                if (event_.isSet())
+                    return false;
+                event_.waiters_.push_back(awaiting);
+                return true;
+            }
+
+            void await_resume() const noexcept {
+            }
+        };
+
+        /// co_await event.wait() suspends until set() has been called.
+        Awaiter wait() {
+            return Awaiter(*this);
+        }
+    };
+}
+
+#endif //COROUTINE_HPP
@@ -0,0 +1,378 @@
+#include "corpus.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "bitmap.hpp"
+#include "csv_scan.hpp"
+#include "digits.hpp"
+#include "validator.hpp"
+
+namespace names {
+    const uint32_t NameDictionary::npos;
+
+    // ---- NameDictionary ---- //
+
+    NameDictionary::NameDictionary()
+        : slots_(1024, npos),
+          slotMask_(1023) {
+        offsets_.push_back(0);
+    }
+
+    size_t NameDictionary::findSlot(const char *data, const size_t len, const uint64_t hash) const {
+        size_t slot = hash & slotMask_;
+        while (true) {
+            const uint32_t id = slots_[slot];
+            if (id == npos)
+                return slot;
+            const uint32_t begin = offsets_[id];
+            const uint32_t size = offsets_[id + 1] - begin;
+            if (size == len && !std::memcmp(bytes_.data() + begin, data, len))
+                return slot;
+            slot = (slot + 1) & slotMask_;
+        }
+    }
+
+    void NameDictionary::grow() {
+        ArenaVector<uint32_t> slots(slots_.size() * 2, npos);
+        slots_.swap(slots);
+        slotMask_ = slots_.size() - 1;
+        for (uint32_t id = 0; id < size(); ++id) {
+            const NameRef ref = name(id);
+            slots_[findSlot(ref.data, ref.size, hash(ref.data, ref.size))] = id;
+        }
+    }
+
+    MemoryFootprint NameDictionary::footprint() const {
+        MemoryFootprint dictionary("dictionary");
+        dictionary.add("name arena", bytes_);
+        dictionary.add("offsets", offsets_);
+        dictionary.add("hash index", slots_);
+        return dictionary;
+    }
+
+    uint32_t NameDictionary::intern(const char *data, const size_t len) {
+        size_t slot = findSlot(data, len, hash(data, len));
+        if (slots_[slot] != npos)
+            return slots_[slot];
+
+        const uint32_t id = static_cast<uint32_t>(size());
+        bytes_.insert(bytes_.end(), data, data + len);
+        offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+        slots_[slot] = id;
+
+        // keep the load factor at or below 1/2
+        if (size() * 2 > slots_.size())
+            grow();
+        return id;
+    }
+
+    uint32_t NameDictionary::find(const char *data, const size_t len) const {
+        return find(data, len, hash(data, len));
+    }
+
+    // ---- Tables ---- //
+
+    uint64_t SexColumn::births() const {
+        uint64_t total = 0;
+        for (const uint32_t count: counts)
+            total += count;
+        return total;
+    }
+
+    std::vector<NameCount> SexColumn::top(const size_t k) const {
+        const bool descending = isNonIncreasing(counts.data(), size());
+
+        // Columns loaded from yob files are already in descending order, so only the first k rows are needed.
+        std::vector<NameCount> result(descending ? std::min(k, size()) : size());
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i].nameId = nameIds[i];
+            result[i].count = counts[i];
+        }
+        if (!descending) {
+            const size_t n = std::min(k, result.size());
+            std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                              [](const NameCount &a, const NameCount &b) { return a.count > b.count; });
+            result.resize(n);
+        }
+        return result;
+    }
+
+    YearTable &Corpus::yearTable(const int year) {
+        std::vector<YearTable>::iterator it = std::lower_bound(
+            years_.begin(), years_.end(), year, [](const YearTable &table, const int y) { return table.year < y; });
+        if (it == years_.end() || it->year != year)
+            it = years_.insert(it, YearTable(year));
+        return *it;
+    }
+
+    const YearTable *Corpus::findYear(const int year) const {
+        const std::vector<YearTable>::const_iterator it = std::lower_bound(
+            years_.begin(), years_.end(), year, [](const YearTable &table, const int y) { return table.year < y; });
+        if (it == years_.end() || it->year != year)
+            return nullptr;
+        return &*it;
+    }
+
+    size_t Corpus::rows() const {
+        size_t total = 0;
+        for (const YearTable &table: years_)
+            total += table.rows();
+        return total;
+    }
+
+    MemoryFootprint Corpus::footprint() const {
+        MemoryFootprint corpus("corpus");
+        corpus.add(dictionary_.footprint());
+        MemoryFootprint years("years");
+        years.add("year tables", years_);
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            MemoryFootprint columns(s == static_cast<size_t>(Sex::Female) ? "female columns" : "male columns");
+            for (const YearTable &table: years_) {
+                const SexColumn &column = table.columns[s];
+                columns.used += (column.nameIds.size() + column.counts.size()) * sizeof(uint32_t);
+                columns.reserved += (column.nameIds.capacity() + column.counts.capacity()) * sizeof(uint32_t);
+            }
+            years.add(columns);
+        }
+        corpus.add(years);
+        return corpus;
+    }
+
+    // ---- Updates ---- //
+
+    namespace {
+        uint64_t rowKey(const int year, const Sex sex, const uint32_t nameId) {
+            return static_cast<uint64_t>(static_cast<uint32_t>(year)) << 33 | static_cast<uint64_t>(sex) << 32 | nameId;
+        }
+    }
+
+    void CorpusUpdater::indexYear(const YearTable &table) {
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            const SexColumn &column = table.columns[s];
+            for (uint32_t row = 0; row < column.size(); ++row)
+                rows_[rowKey(table.year, static_cast<Sex>(s), column.nameIds[row])] = row;
+        }
+        indexedYears_.insert(std::lower_bound(indexedYears_.begin(), indexedYears_.end(), table.year), table.year);
+    }
+
+    void CorpusUpdater::apply(const int year, const Sex sex, const char *name, const size_t len, const int64_t delta) {
+        YearTable &table = corpus_.yearTable(year);
+        if (!std::binary_search(indexedYears_.begin(), indexedYears_.end(), year))
+            indexYear(table);
+
+        const uint32_t nameId = corpus_.dictionary().intern(name, len);
+        SexColumn &column = table.column(sex);
+        const std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> slot = rows_.insert(
+            std::make_pair(rowKey(year, sex, nameId), static_cast<uint32_t>(column.size())));
+        if (slot.second) {
+            column.nameIds.push_back(nameId);
+            column.counts.push_back(0);
+        }
+
+        uint32_t &count = column.counts[slot.first->second];
+        const int64_t updated = static_cast<int64_t>(count) + delta;
+        count = updated < 0 ? 0 : updated > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(updated);
+    }
+
+    MemoryFootprint CorpusUpdater::footprint() const {
+        MemoryFootprint updater("updater");
+        updater.add(mapFootprint("row index", rows_));
+        updater.add("indexed years", indexedYears_);
+        return updater;
+    }
+
+    // ---- Loading ---- //
+
+    namespace {
+        std::runtime_error parseError(const int year, const size_t line, const size_t column, const std::string &what) {
+            std::stringstream ss;
+            ss << "yob" << year << ".txt:" << line << ":" << column << ": " << what;
+            return std::runtime_error(ss.str());
+        }
+
+        /// Parses and checks one row at a time from the scanner's structural positions. Without a report only problems
+        /// that make a row unloadable are checked, and they throw; with a report every check runs and bad rows are
+        /// recorded and skipped.
+        class YobRowParser {
+            const char *data_;
+            const char *end_;
+            int year_;
+            YearTable &table_;
+            NameDictionary &dictionary_;
+            ValidationReport *report_;
+            Bitmap seen_[SEX_COUNT];
+            uint32_t previous_[SEX_COUNT];
+
+            /// Records an issue. Returns true if the row must be dropped.
+            bool fail(const IssueKind kind, const size_t line, const size_t lineStart, const size_t pos,
+                      const char *message) {
+                if (report_) {
+                    report_->add(kind, line, pos - lineStart + 1, message);
+                    return isStructural(kind) || kind == IssueKind::Duplicate;
+                }
+                throw parseError(year_, line, pos - lineStart + 1, message);
+            }
+
+        public:
+            YobRowParser(const char *data, const size_t len, const int year, YearTable &table,
+                         NameDictionary &dictionary, ValidationReport *report)
+                : data_(data),
+                  end_(data + len),
+                  year_(year),
+                  table_(table),
+                  dictionary_(dictionary),
+                  report_(report) {
+                previous_[0] = previous_[1] = UINT32_MAX;
+            }
+
+            /// Handles the row in [lineStart, end). commas holds the first two comma positions, commaCount all of
+            /// them, and firstNonAscii the first non-ASCII byte of the name (or SIZE_MAX).
+            void row(const size_t line, const size_t lineStart, size_t end, const size_t *commas,
+                     const size_t commaCount, const size_t firstNonAscii) {
+                if (end > lineStart && data_[end - 1] == '\r')
+                    --end;
+                if (end == lineStart)
+                    return; // tolerate blank lines, e.g. a trailing newline
+                if (report_)
+                    ++report_->rows;
+
+                if (commaCount != 2) {
+                    fail(IssueKind::FieldCount, line, lineStart, commaCount < 2 ? end : commas[1],
+                         "expected 3 fields: name, sex, count");
+                    return;
+                }
+                if (commas[0] == lineStart) {
+                    fail(IssueKind::EmptyName, line, lineStart, lineStart, "name must not be empty");
+                    return;
+                }
+
+                const char *sexField = data_ + commas[0] + 1;
+                Sex sex;
+                if (commas[1] - commas[0] != 2 || (*sexField != 'F' && *sexField != 'M')) {
+                    fail(IssueKind::BadSex, line, lineStart, commas[0] + 1, "sex must be 'F' or 'M'");
+                    return;
+                }
+                sex = *sexField == 'F' ? Sex::Female : Sex::Male;
+
+                uint32_t count;
+                if (!parseUint32(data_ + commas[1] + 1, end - commas[1] - 1, count, end_)) {
+                    fail(IssueKind::BadCount, line, lineStart, commas[1] + 1, "count must be a decimal number");
+                    return;
+                }
+
+                const uint32_t nameId = dictionary_.intern(data_ + lineStart, commas[0] - lineStart);
+                const size_t s = static_cast<size_t>(sex);
+                if (report_) {
+                    if (firstNonAscii != SIZE_MAX)
+                        fail(IssueKind::NonAsciiName, line, lineStart, firstNonAscii, "name must be ASCII");
+                    if (count < report_->options.minCount)
+                        fail(IssueKind::LowCount, line, lineStart, commas[1] + 1, "count is below the minimum");
+                    if (count > previous_[s])
+                        fail(IssueKind::OutOfOrder, line, lineStart, commas[1] + 1,
+                             "count is larger than the previous row of the same sex");
+                    previous_[s] = count;
+
+                    if (seen_[s].size() <= nameId)
+                        seen_[s].resize(std::max<size_t>(nameId + 1, seen_[s].size() * 2));
+                    if (seen_[s].test(nameId) &&
+                        fail(IssueKind::Duplicate, line, lineStart, lineStart, "name appears twice for this sex"))
+                        return;
+                    seen_[s].set(nameId);
+                }
+
+                SexColumn &column = table_.columns[s];
+                column.nameIds.push_back(nameId);
+                column.counts.push_back(count);
+            }
+        };
+    }
+
+    void loadYearData(Corpus &corpus, const int year, const char *data, const size_t len, ValidationReport *report) {
+        YobRowParser parser(data, len, year, corpus.yearTable(year), corpus.dictionary(), report);
+        CsvScanner scanner(data, len);
+
+        size_t line = 1;
+        size_t lineStart = 0;
+        size_t commas[2] = {0, 0};
+        size_t commaCount = 0;
+        size_t firstNonAscii = SIZE_MAX;
+        size_t pos;
+        CsvScanner::Kind kind;
+        while (scanner.next(pos, kind)) {
+            if (kind == CsvScanner::Comma) {
+                if (commaCount < 2)
+                    commas[commaCount] = pos;
+                ++commaCount;
+            } else if (kind == CsvScanner::NonAscii) {
+                if (!commaCount && firstNonAscii == SIZE_MAX)
+                    firstNonAscii = pos;
+            } else {
+                parser.row(line, lineStart, pos, commas, commaCount, firstNonAscii);
+                ++line;
+                lineStart = pos + 1;
+                commaCount = 0;
+                firstNonAscii = SIZE_MAX;
+            }
+        }
+        if (lineStart < len)
+            parser.row(line, lineStart, len, commas, commaCount, firstNonAscii);
+    }
+
+    void mergeInto(Corpus &target, const Corpus &source) {
+        const NameDictionary &from = source.dictionary();
+        std::vector<uint32_t> remap(from.size());
+        for (uint32_t id = 0; id < remap.size(); ++id) {
+            const NameRef name = from.name(id);
+            remap[id] = target.dictionary().intern(name.data, name.size);
+        }
+        for (const YearTable &table: source.years()) {
+            YearTable &into = target.yearTable(table.year);
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                const SexColumn &column = table.columns[s];
+                SexColumn &out = into.columns[s];
+                out.nameIds.reserve(out.size() + column.size());
+                for (const uint32_t id: column.nameIds)
+                    out.nameIds.push_back(remap[id]);
+                out.counts.insert(out.counts.end(), column.counts.begin(), column.counts.end());
+            }
+        }
+    }
+
+    std::string readFile(const std::string &path) {
+        std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+        if (!in)
+            throw std::runtime_error("unable to open " + path);
+        std::string contents;
+        in.seekg(0, std::ios::end);
+        contents.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0, std::ios::beg);
+        in.read(&contents[0], static_cast<std::streamsize>(contents.size()));
+        if (!in)
+            throw std::runtime_error("unable to read " + path);
+        return contents;
+    }
+
+    void loadYearFile(Corpus &corpus, const int year, const std::string &path, ValidationReport *report) {
+        const std::string contents = readFile(path);
+        loadYearData(corpus, year, contents.data(), contents.size(), report);
+    }
+
+    size_t loadYearRange(Corpus &corpus, const std::string &dir, const int firstYear, const int lastYear) {
+        size_t loaded = 0;
+        for (int year = firstYear; year <= lastYear; ++year) {
+            std::stringstream path;
+            path << dir << "/yob" << year << ".txt";
+            std::ifstream probe(path.str().c_str());
+            if (!probe)
+                continue;
+            probe.close();
+            loadYearFile(corpus, year, path.str());
+            ++loaded;
+        }
+        return loaded;
+    }
+}
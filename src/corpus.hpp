@@ -0,0 +1,249 @@
+/*
+ * corpus.hpp
+ *
+ * In-memory storage for the SSA baby name data. Names are interned once into a shared dictionary and every year is
+ * stored as a pair of columns (one per sex) of name IDs and counts, in the order they appear in the yob file.
+ */
+
+#ifndef CORPUS_HPP
+#define CORPUS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "footprint.hpp"
+#include "page_memory.hpp"
+
+namespace names {
+    struct ValidationReport;
+
+    enum class Sex : uint8_t {
+        Female = 0,
+        Male = 1,
+    };
+
+    /// Number of distinct Sex values, useful for sizing per-sex arrays.
+    const size_t SEX_COUNT = 2;
+
+    inline char sexChar(const Sex sex) {
+        return sex == Sex::Female ? 'F' : 'M';
+    }
+
+    /// A non-owning reference to a name stored in a NameDictionary.
+    struct NameRef {
+        const char *data;
+        uint32_t size;
+
+        std::string str() const {
+            return std::string(data, size);
+        }
+    };
+
+    /// Interns name strings into dense 32-bit IDs. Name bytes live back-to-back in a single arena and are looked up
+    /// through an open-addressing hash table of IDs, so interning never allocates per name. All three arrays follow the
+    /// arena hints (see setArenaHints()) once they are large.
+    class NameDictionary {
+        ArenaVector<char> bytes_;
+        ArenaVector<uint32_t> offsets_;
+        ArenaVector<uint32_t> slots_;
+        size_t slotMask_;
+
+        size_t findSlot(const char *data, size_t len, uint64_t hash) const;
+        void grow();
+
+    public:
+        static const uint32_t npos = UINT32_MAX;
+
+        NameDictionary();
+
+        /// Returns the ID for the given name, adding it to the dictionary if it is not present yet.
+        uint32_t intern(const char *data, size_t len);
+
+        uint32_t intern(const std::string &name) {
+            return intern(name.data(), name.size());
+        }
+
+        /// Returns the ID for the given name, or npos if it has never been interned.
+        uint32_t find(const char *data, size_t len) const;
+
+        uint32_t find(const std::string &name) const {
+            return find(name.data(), name.size());
+        }
+
+        /// Like find(), with the name's hash() already computed.
+        uint32_t find(const char *data, size_t len, uint64_t hash) const {
+            return slots_[findSlot(data, len, hash)];
+        }
+
+        /// Starts loading the table slot for a hash into cache. Batches of lookups hash every name and prefetch first,
+        /// so the cache misses of the whole batch overlap instead of being paid one after another.
+        void prefetch(const uint64_t hash) const {
+#ifdef __GNUC__
+            __builtin_prefetch(slots_.data() + (hash & slotMask_));
+#else
+            static_cast<void>(hash);
+#endif
+        }
+
+        NameRef name(const uint32_t id) const {
+            NameRef ref;
+            ref.data = bytes_.data() + offsets_[id];
+            ref.size = offsets_[id + 1] - offsets_[id];
+            return ref;
+        }
+
+        size_t size() const {
+            return offsets_.size() - 1;
+        }
+
+        /// The name arena: every name's bytes back to back, in ID order.
+        const ArenaVector<char> &bytes() const {
+            return bytes_;
+        }
+
+        /// size() + 1 offsets into bytes(), starting at 0; name(id) spans [offsets()[id], offsets()[id + 1]).
+        const ArenaVector<uint32_t> &offsets() const {
+            return offsets_;
+        }
+
+        /// The name arena, its offsets and the hash table.
+        MemoryFootprint footprint() const;
+
+        /// FNV-1a followed by a final avalanche so the low bits are usable as a table index. Inline because snapshot
+        /// clients probe the name table a published snapshot carries with the same function.
+        static uint64_t hash(const char *data, const size_t len) {
+            uint64_t h = 1469598103934665603ULL;
+            for (size_t i = 0; i < len; ++i) {
+                h ^= static_cast<unsigned char>(data[i]);
+                h *= 1099511628211ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    /// A name ID paired with a birth count, as returned by top-N style queries.
+    struct NameCount {
+        uint32_t nameId;
+        uint64_t count;
+    };
+
+    /// One sex's half of a yob file. Rows are kept in file order, which is descending by count.
+    struct SexColumn {
+        std::vector<uint32_t> nameIds;
+        std::vector<uint32_t> counts;
+
+        size_t size() const {
+            return nameIds.size();
+        }
+
+        uint64_t births() const;
+
+        /// Returns the k most common names, most common first.
+        std::vector<NameCount> top(size_t k) const;
+    };
+
+    /// All names recorded for a single year.
+    struct YearTable {
+        int year;
+        SexColumn columns[SEX_COUNT];
+
+        explicit YearTable(const int year = 0)
+            : year(year) {
+        }
+
+        SexColumn &column(const Sex sex) {
+            return columns[static_cast<size_t>(sex)];
+        }
+
+        const SexColumn &column(const Sex sex) const {
+            return columns[static_cast<size_t>(sex)];
+        }
+
+        size_t rows() const {
+            return columns[0].size() + columns[1].size();
+        }
+    };
+
+    /// The full multi-year corpus: one shared name dictionary plus a table per year, kept sorted by year.
+    class Corpus {
+        NameDictionary dictionary_;
+        std::vector<YearTable> years_;
+
+    public:
+        NameDictionary &dictionary() {
+            return dictionary_;
+        }
+
+        const NameDictionary &dictionary() const {
+            return dictionary_;
+        }
+
+        const std::vector<YearTable> &years() const {
+            return years_;
+        }
+
+        /// Returns the table for the given year, creating an empty one if needed.
+        YearTable &yearTable(int year);
+
+        /// Returns the table for the given year, or nullptr if the year has not been loaded.
+        const YearTable *findYear(int year) const;
+
+        size_t rows() const;
+
+        /// The dictionary and every year's columns.
+        MemoryFootprint footprint() const;
+
+        /// The bytes footprint() counts as used.
+        size_t memoryUsed() const {
+            return footprint().used;
+        }
+    };
+
+    /// Applies count deltas to a corpus in place. A row index is built lazily per year the first time that year is
+    /// touched, so streams of updates cost a hash lookup each. Counts are clamped at zero; rows are never reordered.
+    class CorpusUpdater {
+        Corpus &corpus_;
+        std::unordered_map<uint64_t, uint32_t> rows_;
+        std::vector<int> indexedYears_;
+
+        void indexYear(const YearTable &table);
+
+    public:
+        explicit CorpusUpdater(Corpus &corpus)
+            : corpus_(corpus) {
+        }
+
+        void apply(int year, Sex sex, const char *name, size_t len, int64_t delta);
+
+        /// The row index built so far.
+        MemoryFootprint footprint() const;
+    };
+
+    /// Parses the contents of a yob file (`Name,Sex,Count` per line) into the given year of the corpus. Without a report,
+    /// malformed rows throw std::runtime_error. With a report, the full set of validation checks runs in the same pass,
+    /// every problem is recorded in the report, and rows that cannot be loaded are skipped instead.
+    void loadYearData(Corpus &corpus, int year, const char *data, size_t len, ValidationReport *report = nullptr);
+
+    /// Reads and parses a single yob file. Throws std::runtime_error if the file cannot be read, or if it is malformed
+    /// and no report is given.
+    void loadYearFile(Corpus &corpus, int year, const std::string &path, ValidationReport *report = nullptr);
+
+    /// Loads every `yobYYYY.txt` in the given directory whose year falls in [firstYear, lastYear]. Missing years are
+    /// skipped. Returns the number of files loaded.
+    size_t loadYearRange(Corpus &corpus, const std::string &dir, int firstYear, int lastYear);
+
+    /// Moves every row of source into target, re-interning source's names into target's dictionary. Rows for a year
+    /// target already has are appended after its existing rows.
+    void mergeInto(Corpus &target, const Corpus &source);
+
+    /// Reads a whole file into memory. Throws std::runtime_error on failure.
+    std::string readFile(const std::string &path);
+}
+
+#endif //CORPUS_HPP
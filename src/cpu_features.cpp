@@ -0,0 +1,112 @@
+#include "cpu_features.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NAMES_CPUID_X86
+#include <cpuid.h>
+#ifndef bit_AVX512VPOPCNTDQ
+#define bit_AVX512VPOPCNTDQ 0x4000
+#endif
+#endif
+
+namespace names {
+    namespace {
+#ifdef NAMES_CPUID_X86
+        /// The register state the OS has enabled for saving across context switches (XCR0).
+        unsigned long long enabledStateMask() {
+            unsigned eax;
+            unsigned edx;
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            return static_cast<unsigned long long>(edx) << 32 | eax;
+        }
+#endif
+
+        CpuFeatures detect() {
+            CpuFeatures features;
+            std::memset(&features, 0, sizeof(features));
+#ifdef NAMES_CPUID_X86
+            unsigned eax;
+            unsigned ebx;
+            unsigned ecx;
+            unsigned edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return features;
+            features.sse2 = (edx & bit_SSE2) != 0;
+            features.sse42 = (ecx & bit_SSE4_2) != 0;
+            features.popcnt = (ecx & bit_POPCNT) != 0;
+            // AVX registers are only usable if the OS saves them (XMM and YMM state, plus opmask and ZMM for AVX-512)
+            const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+            const unsigned long long state = osxsave ? enabledStateMask() : 0;
+            const bool ymm = (state & 0x6) == 0x6;
+            const bool zmm = (state & 0xe6) == 0xe6;
+            if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+                return features;
+            features.avx2 = ymm && (ebx & bit_AVX2) != 0;
+            features.bmi2 = (ebx & bit_BMI2) != 0;
+            features.avx512 = zmm && (ebx & bit_AVX512F) != 0 && (ebx & bit_AVX512BW) != 0;
+            features.avx512Popcnt = features.avx512 && (ecx & bit_AVX512VPOPCNTDQ) != 0;
+#endif
+            return features;
+        }
+
+        IsaLevel parseIsa(const char *name, const IsaLevel fallback) {
+            if (!name)
+                return fallback;
+            for (int level = static_cast<int>(IsaLevel::Scalar); level <= static_cast<int>(IsaLevel::Avx512); ++level) {
+                if (!std::strcmp(name, isaName(static_cast<IsaLevel>(level))))
+                    return static_cast<IsaLevel>(level);
+            }
+            return fallback;
+        }
+
+        std::atomic<int> &activeLevel() {
+            static std::atomic<int> level(static_cast<int>(
+                std::min(detectedIsaLevel(), parseIsa(std::getenv("NAMES_ISA"), IsaLevel::Avx512))));
+            return level;
+        }
+    }
+
+    const CpuFeatures &cpuFeatures() {
+        static const CpuFeatures features = detect();
+        return features;
+    }
+
+    const char *isaName(const IsaLevel level) {
+        switch (level) {
+            case IsaLevel::Scalar:
+                return "scalar";
+            case IsaLevel::Sse2:
+                return "sse2";
+            case IsaLevel::Avx2:
+                return "avx2";
+            case IsaLevel::Avx512:
+                return "avx512";
+        }
+        return "unknown";
+    }
+
+    IsaLevel detectedIsaLevel() {
+        const CpuFeatures &features = cpuFeatures();
+        if (features.avx512)
+            return IsaLevel::Avx512;
+        if (features.avx2)
+            return IsaLevel::Avx2;
+        if (features.sse2)
+            return IsaLevel::Sse2;
+        return IsaLevel::Scalar;
+    }
+
+    IsaLevel isaLevel() {
+        return static_cast<IsaLevel>(activeLevel().load(std::memory_order_relaxed));
+    }
+
+    IsaLevel setIsaLevel(const IsaLevel level) {
+        const IsaLevel effective = std::min(level, detectedIsaLevel());
+        activeLevel().store(static_cast<int>(effective), std::memory_order_relaxed);
+        return effective;
+    }
+}
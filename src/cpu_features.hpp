@@ -0,0 +1,49 @@
+/*
+ * cpu_features.hpp
+ *
+ * Runtime detection of the instruction sets the SIMD kernels can use. The binary is built for the baseline target, and
+ * each kernel is compiled once per ISA level with function-level target attributes; the level chosen here at startup
+ * picks which variant runs, so one build runs at full speed on old and new hosts alike.
+ */
+
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+namespace names {
+    struct CpuFeatures {
+        bool sse2;
+        bool sse42;
+        bool popcnt;
+        bool avx2;
+        bool bmi2;
+        /// AVX-512 F and BW, with the OS saving the full register state.
+        bool avx512;
+        bool avx512Popcnt;
+    };
+
+    /// What cpuid reports, read once. All false on non-x86 hosts.
+    const CpuFeatures &cpuFeatures();
+
+    /// Kernel variants, from most portable to widest.
+    enum class IsaLevel {
+        Scalar,
+        Sse2,
+        Avx2,
+        Avx512,
+    };
+
+    const char *isaName(IsaLevel level);
+
+    /// The widest level this host supports.
+    IsaLevel detectedIsaLevel();
+
+    /// The level kernels dispatch on. Defaults to detectedIsaLevel(), capped by the NAMES_ISA environment variable
+    /// ("scalar", "sse2", "avx2" or "avx512") when it is set.
+    IsaLevel isaLevel();
+
+    /// Caps the active level, e.g. to compare variants; it is clamped to what the host supports. Returns the level
+    /// now in effect. Kernels pick it up on their next call.
+    IsaLevel setIsaLevel(IsaLevel level);
+}
+
+#endif //CPU_FEATURES_HPP
@@ -0,0 +1,214 @@
+#include "crc32c.hpp"
+
+#include <cstring>
+
+#include "cpu_features.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NAMES_CRC32C_X86 1
+#include <nmmintrin.h>
+#endif
+
+namespace names {
+    namespace {
+        /// Reflected Castagnoli polynomial.
+        const uint32_t POLY = 0x82f63b78;
+
+        struct Tables {
+            /// slice[k][b] is the CRC of byte b followed by k zero bytes.
+            uint32_t slice[8][256];
+            /// powers[k] is x^(2^k) mod P, used to shift a CRC past runs of zero bytes.
+            uint32_t powers[32];
+
+            Tables();
+        };
+
+        /// Multiplies two polynomials modulo P, in the reflected bit order CRCs use.
+        uint32_t multModP(uint32_t a, uint32_t b) {
+            uint32_t m = 1u << 31;
+            uint32_t p = 0;
+            while (true) {
+                if (a & m) {
+                    p ^= b;
+                    if (!(a & (m - 1)))
+                        break;
+                }
+                m >>= 1;
+                b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+            }
+            return p;
+        }
+
+        Tables::Tables() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+                slice[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int k = 1; k < 8; ++k)
+                    slice[k][i] = (slice[k - 1][i] >> 8) ^ slice[0][slice[k - 1][i] & 0xff];
+            }
+
+            uint32_t p = 1u << 30; // x^1
+            powers[0] = p;
+            for (int k = 1; k < 32; ++k)
+                powers[k] = p = multModP(p, p);
+        }
+
+        const Tables &tables() {
+            static const Tables instance;
+            return instance;
+        }
+
+        /// x^(8 * len) mod P: multiplying a raw CRC by this appends len zero bytes.
+        uint32_t zeroBytesOperator(size_t len) {
+            const Tables &t = tables();
+            uint32_t p = 1u << 31; // x^0
+            unsigned k = 3;
+            while (len) {
+                if (len & 1)
+                    p = multModP(t.powers[k & 31], p);
+                len >>= 1;
+                ++k;
+            }
+            return p;
+        }
+
+        /// Raw (non-inverted) slice-by-8 update.
+        uint32_t updateSoftware(uint32_t crc, const unsigned char *p, size_t len) {
+            const Tables &t = tables();
+            while (len && reinterpret_cast<uintptr_t>(p) & 7) {
+                crc = t.slice[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+                --len;
+            }
+            while (len >= 8) {
+                uint32_t lo;
+                uint32_t hi;
+                std::memcpy(&lo, p, 4);
+                std::memcpy(&hi, p + 4, 4);
+                lo ^= crc;
+                crc = t.slice[7][lo & 0xff] ^ t.slice[6][lo >> 8 & 0xff] ^ t.slice[5][lo >> 16 & 0xff] ^
+                      t.slice[4][lo >> 24] ^ t.slice[3][hi & 0xff] ^ t.slice[2][hi >> 8 & 0xff] ^
+                      t.slice[1][hi >> 16 & 0xff] ^ t.slice[0][hi >> 24];
+                p += 8;
+                len -= 8;
+            }
+            while (len--)
+                crc = t.slice[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+
+#ifdef NAMES_CRC32C_X86
+        const size_t LONG_BLOCK = 8192;
+        const size_t SHORT_BLOCK = 256;
+
+        struct HardwareShifts {
+            uint32_t longShift;
+            uint32_t shortShift;
+
+            HardwareShifts()
+                : longShift(zeroBytesOperator(LONG_BLOCK)),
+                  shortShift(zeroBytesOperator(SHORT_BLOCK)) {
+            }
+        };
+
+        const HardwareShifts &hardwareShifts() {
+            static const HardwareShifts instance;
+            return instance;
+        }
+
+        __attribute__((target("sse4.2")))
+        uint64_t crcWord(const uint64_t crc, const unsigned char *p) {
+#ifdef __x86_64__
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            return _mm_crc32_u64(crc, word);
+#else
+            uint32_t lo;
+            uint32_t hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            return _mm_crc32_u32(_mm_crc32_u32(static_cast<uint32_t>(crc), lo), hi);
+#endif
+        }
+
+        /// Runs three independent CRCs over consecutive blocks of the given size and stitches them together. The
+        /// crc32 instruction has a latency of 3 cycles but a throughput of 1, so three streams keep it busy.
+        __attribute__((target("sse4.2")))
+        uint32_t threeWay(uint32_t crc, const unsigned char *&p, size_t &len, const size_t block, const uint32_t shift) {
+            while (len >= 3 * block) {
+                uint64_t crc0 = crc;
+                uint64_t crc1 = 0;
+                uint64_t crc2 = 0;
+                const unsigned char *const end = p + block;
+                while (p < end) {
+                    crc0 = crcWord(crc0, p);
+                    crc1 = crcWord(crc1, p + block);
+                    crc2 = crcWord(crc2, p + 2 * block);
+                    p += 8;
+                }
+                crc = multModP(shift, static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+                crc = multModP(shift, crc) ^ static_cast<uint32_t>(crc2);
+                p += 2 * block;
+                len -= 3 * block;
+            }
+            return crc;
+        }
+
+        __attribute__((target("sse4.2")))
+        uint32_t updateHardware(uint32_t crc, const unsigned char *p, size_t len) {
+            while (len && reinterpret_cast<uintptr_t>(p) & 7) {
+                crc = _mm_crc32_u8(crc, *p++);
+                --len;
+            }
+            const HardwareShifts &shifts = hardwareShifts();
+            crc = threeWay(crc, p, len, LONG_BLOCK, shifts.longShift);
+            crc = threeWay(crc, p, len, SHORT_BLOCK, shifts.shortShift);
+            uint64_t crc64 = crc;
+            while (len >= 8) {
+                crc64 = crcWord(crc64, p);
+                p += 8;
+                len -= 8;
+            }
+            crc = static_cast<uint32_t>(crc64);
+            while (len--)
+                crc = _mm_crc32_u8(crc, *p++);
+            return crc;
+        }
+#endif
+
+        typedef uint32_t (*UpdateFn)(uint32_t, const unsigned char *, size_t);
+
+        UpdateFn selectUpdate() {
+#ifdef NAMES_CRC32C_X86
+            if (cpuFeatures().sse42)
+                return updateHardware;
+#endif
+            return updateSoftware;
+        }
+
+        /// Chosen once, on first use.
+        UpdateFn update() {
+            static const UpdateFn fn = selectUpdate();
+            return fn;
+        }
+    }
+
+    uint32_t crc32c(const void *data, const size_t len, const uint32_t crc) {
+        return ~update()(~crc, static_cast<const unsigned char *>(data), len);
+    }
+
+    uint32_t crc32cSoftware(const void *data, const size_t len, const uint32_t crc) {
+        return ~updateSoftware(~crc, static_cast<const unsigned char *>(data), len);
+    }
+
+    bool crc32cHardwareAvailable() {
+        return update() != updateSoftware;
+    }
+
+    uint32_t crc32cCombine(const uint32_t crcA, const uint32_t crcB, const size_t lenB) {
+        return multModP(zeroBytesOperator(lenB), crcA) ^ crcB;
+    }
+}
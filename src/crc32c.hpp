@@ -0,0 +1,28 @@
+/*
+ * crc32c.hpp
+ *
+ * CRC-32C (Castagnoli) checksums for snapshots and logs. On x86 CPUs with SSE4.2 the `crc32` instruction is used on
+ * three interleaved streams, which hides its 3-cycle latency; elsewhere a slice-by-8 table implementation is used.
+ */
+
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace names {
+    /// Extends a running CRC-32C with more data. Start with crc = 0; crc32c(b, crc32c(a)) == crc32c(a + b).
+    uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+
+    /// Portable slice-by-8 implementation, always available.
+    uint32_t crc32cSoftware(const void *data, size_t len, uint32_t crc = 0);
+
+    /// Whether crc32c() is using the SSE4.2 instruction on this machine.
+    bool crc32cHardwareAvailable();
+
+    /// Returns the CRC of A + B given crc(A), crc(B) and the length of B.
+    uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, size_t lenB);
+}
+
+#endif //CRC32C_HPP
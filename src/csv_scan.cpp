@@ -0,0 +1,139 @@
+#include "csv_scan.hpp"
+
+#include <cstring>
+
+#include "cpu_features.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NAMES_SIMD_X86
+// GCC 12 flags the deliberately undefined vectors inside some AVX-512 intrinsics once they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#endif
+
+namespace names {
+    namespace {
+        void scanScalar(const char *p, ScanMasks &masks) {
+            masks.commas = 0;
+            masks.newlines = 0;
+            masks.nonAscii = 0;
+            for (int i = 0; i < 64; ++i) {
+                const unsigned char c = static_cast<unsigned char>(p[i]);
+                masks.commas |= static_cast<uint64_t>(c == ',') << i;
+                masks.newlines |= static_cast<uint64_t>(c == '\n') << i;
+                masks.nonAscii |= static_cast<uint64_t>(c >> 7) << i;
+            }
+        }
+
+#ifdef NAMES_SIMD_X86
+        __attribute__((target("sse2")))
+        void scanSse2(const char *p, ScanMasks &masks) {
+            const __m128i comma = _mm_set1_epi8(',');
+            const __m128i newline = _mm_set1_epi8('\n');
+            uint64_t commas = 0;
+            uint64_t newlines = 0;
+            uint64_t nonAscii = 0;
+            for (int i = 0; i < 4; ++i) {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+                const int shift = 16 * i;
+                commas |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, comma))))
+                        << shift;
+                newlines |= static_cast<uint64_t>(static_cast<uint16_t>(
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))) << shift;
+                // the top bit of every byte is exactly the non-ASCII flag
+                nonAscii |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(bytes))) << shift;
+            }
+            masks.commas = commas;
+            masks.newlines = newlines;
+            masks.nonAscii = nonAscii;
+        }
+
+        __attribute__((target("avx2")))
+        void scanAvx2(const char *p, ScanMasks &masks) {
+            const __m256i comma = _mm256_set1_epi8(',');
+            const __m256i newline = _mm256_set1_epi8('\n');
+            const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+            const auto join = [](const int low, const int high) {
+                return static_cast<uint64_t>(static_cast<uint32_t>(low)) |
+                       static_cast<uint64_t>(static_cast<uint32_t>(high)) << 32;
+            };
+            masks.commas = join(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma)),
+                                _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma)));
+            masks.newlines = join(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)),
+                                  _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)));
+            masks.nonAscii = join(_mm256_movemask_epi8(lo), _mm256_movemask_epi8(hi));
+        }
+
+        __attribute__((target("avx512f,avx512bw")))
+        void scanAvx512(const char *p, ScanMasks &masks) {
+            const __m512i bytes = _mm512_loadu_si512(p);
+            masks.commas = _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(','));
+            masks.newlines = _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('\n'));
+            masks.nonAscii = _mm512_movepi8_mask(bytes);
+        }
+#endif
+    }
+
+    ScanBlockFn scanBlockKernel(const IsaLevel level) {
+#ifdef NAMES_SIMD_X86
+        switch (level) {
+            case IsaLevel::Avx512:
+                return scanAvx512;
+            case IsaLevel::Avx2:
+                return scanAvx2;
+            case IsaLevel::Sse2:
+                return scanSse2;
+            case IsaLevel::Scalar:
+                break;
+        }
+#else
+        static_cast<void>(level);
+#endif
+        return scanScalar;
+    }
+
+    void scanBlock(const char *p, ScanMasks &masks) {
+        scanBlockKernel(isaLevel())(p, masks);
+    }
+
+    CsvScanner::CsvScanner(const char *data, const size_t len)
+        : data_(data),
+          len_(len),
+          blockStart_(0),
+          masks_(),
+          pending_(0),
+          scan_(scanBlockKernel(isaLevel())) {
+        if (len_)
+            loadBlock();
+    }
+
+    void CsvScanner::loadBlock() {
+        if (len_ - blockStart_ >= 64) {
+            scan_(data_ + blockStart_, masks_);
+        } else {
+            char tail[64] = {};
+            std::memcpy(tail, data_ + blockStart_, len_ - blockStart_);
+            scan_(tail, masks_);
+        }
+        pending_ = masks_.commas | masks_.newlines | masks_.nonAscii;
+    }
+
+    bool CsvScanner::next(size_t &pos, Kind &kind) {
+        while (!pending_) {
+            blockStart_ += 64;
+            if (blockStart_ >= len_)
+                return false;
+            loadBlock();
+        }
+        const int bit = __builtin_ctzll(pending_);
+        const uint64_t mask = 1ULL << bit;
+        pending_ &= pending_ - 1;
+        pos = blockStart_ + bit;
+        kind = masks_.commas & mask ? Comma : masks_.newlines & mask ? Newline : NonAscii;
+        return true;
+    }
+}
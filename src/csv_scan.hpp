@@ -0,0 +1,60 @@
+/*
+ * csv_scan.hpp
+ *
+ * SIMD classification of CSV bytes. Input is processed 64 bytes at a time into bitmasks of commas, newlines and
+ * non-ASCII bytes, so a parser can jump straight from one interesting byte to the next instead of testing every byte.
+ * The classifier runs as one AVX-512 compare, two AVX2 compares or four SSE2 compares, whichever the host supports.
+ */
+
+#ifndef CSV_SCAN_HPP
+#define CSV_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+namespace names {
+    /// Classification of one 64-byte block. Bit i describes byte i of the block.
+    struct ScanMasks {
+        uint64_t commas;
+        uint64_t newlines;
+        uint64_t nonAscii;
+    };
+
+    typedef void (*ScanBlockFn)(const char *p, ScanMasks &masks);
+
+    /// The block classifier compiled for the given level: scalar, SSE2, AVX2 or AVX-512BW.
+    ScanBlockFn scanBlockKernel(IsaLevel level);
+
+    /// Classifies exactly 64 bytes starting at p, with the kernel for the active ISA level.
+    void scanBlock(const char *p, ScanMasks &masks);
+
+    /// Walks a buffer block by block, reporting every comma, newline and non-ASCII byte in order. The final partial
+    /// block is copied into a zero-padded buffer, so the input needs no padding.
+    class CsvScanner {
+        const char *data_;
+        size_t len_;
+        size_t blockStart_;
+        ScanMasks masks_;
+        uint64_t pending_;
+        /// Chosen once per scanner rather than per block.
+        ScanBlockFn scan_;
+
+        void loadBlock();
+
+    public:
+        enum Kind {
+            Comma,
+            Newline,
+            NonAscii,
+        };
+
+        CsvScanner(const char *data, size_t len);
+
+        /// Advances to the next interesting byte. Returns false at the end of the input.
+        bool next(size_t &pos, Kind &kind);
+    };
+}
+
+#endif //CSV_SCAN_HPP
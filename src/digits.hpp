@@ -0,0 +1,131 @@
+/*
+ * digits.hpp
+ *
+ * Decimal parsing and formatting for the numeric columns. Parsing checks and converts eight digits at a time inside a
+ * 64-bit word (SWAR) with no per-digit loop or branch; formatting writes two digits per step from a lookup table of
+ * digit pairs. Both are inline because they run once per row of every load and export.
+ */
+
+#ifndef DIGITS_HPP
+#define DIGITS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace names {
+    /// "00", "01", ..., "99" back to back.
+    extern const char DIGIT_PAIRS[200];
+
+    /// Enough room for any uint64_t in decimal.
+    const size_t MAX_DIGITS = 20;
+
+    namespace detail {
+        const uint64_t ZEROS = 0x3030303030303030ULL;
+
+        /// Converts 1-8 ASCII digits to their value, or returns false if any byte is not a digit. Bytes up to end may
+        /// be read even past the digits.
+        inline bool parseEight(const char *p, const size_t len, const char *end, uint64_t &value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint64_t word = 0;
+            if (end - p >= 8) {
+                // one unaligned load; whatever follows the digits is shifted out below
+                std::memcpy(&word, p, 8);
+            } else {
+                for (size_t i = 0; i < len; ++i)
+                    word |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << 8 * i;
+            }
+            // move the digits into the top bytes and pad the bottom with '0', i.e. leading zeros
+            const unsigned pad = static_cast<unsigned>(8 - len) * 8;
+            word = pad ? word << pad | ZEROS >> (64 - pad) : word;
+
+            // every byte must be 0x30-0x39: the high nibble is 3, and adding 6 does not carry into it
+            const uint64_t high = 0xf0f0f0f0f0f0f0f0ULL;
+            if ((word & high) != ZEROS || ((word + 0x0606060606060606ULL) & high) != ZEROS)
+                return false;
+
+            // combine neighbouring digits, then pairs, then quads, multiplying in the place values as we go
+            word -= ZEROS;
+            word = (word * 10 + (word >> 8)) & 0x00ff00ff00ff00ffULL;
+            word = (word * 100 + (word >> 16)) & 0x0000ffff0000ffffULL;
+            value = (word * 10000 + (word >> 32)) & 0xffffffffULL;
+            return true;
+#else
+            static_cast<void>(end);
+            uint64_t result = 0;
+            for (size_t i = 0; i < len; ++i) {
+                const unsigned digit = static_cast<unsigned char>(p[i]) - '0';
+                if (digit > 9)
+                    return false;
+                result = result * 10 + digit;
+            }
+            value = result;
+            return true;
+#endif
+        }
+    }
+
+    /// Parses exactly len decimal digits into value. Returns false if len is 0, any byte is not a digit, or the value
+    /// does not fit in 32 bits. Passing the end of the enclosing buffer lets short fields be read with a single load.
+    inline bool parseUint32(const char *p, const size_t len, uint32_t &value, const char *end = nullptr) {
+        if (!end)
+            end = p + len;
+        if (len - 1 >= 10)
+            return false;
+        uint64_t result;
+        if (len <= 8) {
+            if (!detail::parseEight(p, len, end, result))
+                return false;
+        } else {
+            uint64_t head;
+            uint64_t tail;
+            if (!detail::parseEight(p, len - 8, end, head) || !detail::parseEight(p + len - 8, 8, end, tail))
+                return false;
+            result = head * 100000000 + tail;
+            if (result > UINT32_MAX)
+                return false;
+        }
+        value = static_cast<uint32_t>(result);
+        return true;
+    }
+
+    /// Number of decimal digits in value, at least 1.
+    inline size_t digitCount(const uint64_t value) {
+        size_t digits = 1;
+        for (uint64_t limit = 10; digits < MAX_DIGITS && value >= limit; limit *= 10)
+            ++digits;
+        return digits;
+    }
+
+    /// Writes value in decimal to out, which must have room for MAX_DIGITS bytes, and returns the number written. No
+    /// terminator is added.
+    inline size_t formatUint64(uint64_t value, char *out) {
+        const size_t len = digitCount(value);
+        char *p = out + len;
+        while (value >= 100) {
+            const size_t pair = static_cast<size_t>(value % 100) * 2;
+            value /= 100;
+            p -= 2;
+            p[0] = DIGIT_PAIRS[pair];
+            p[1] = DIGIT_PAIRS[pair + 1];
+        }
+        if (value >= 10) {
+            p -= 2;
+            p[0] = DIGIT_PAIRS[value * 2];
+            p[1] = DIGIT_PAIRS[value * 2 + 1];
+        } else {
+            *--p = static_cast<char>('0' + value);
+        }
+        return len;
+    }
+
+    /// Writes value in decimal, with a leading '-' if negative. out needs MAX_DIGITS + 1 bytes.
+    inline size_t formatInt64(const int64_t value, char *out) {
+        if (value >= 0)
+            return formatUint64(static_cast<uint64_t>(value), out);
+        *out = '-';
+        return 1 + formatUint64(0 - static_cast<uint64_t>(value), out + 1);
+    }
+}
+
+#endif //DIGITS_HPP
@@ -0,0 +1,96 @@
+#include "diversity.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "parallel.hpp"
+#include "simd_kernels.hpp"
+
+namespace names {
+    namespace {
+        /// Births covered by the first n rows, given that the current run [runStart, runEnd) of count c straddles or
+        /// follows row n.
+        void capturePrefix(const size_t n, const size_t runStart, const size_t runEnd, const uint64_t beforeRun,
+                           const uint32_t count, uint64_t &prefix) {
+            if (runStart < n && n <= runEnd)
+                prefix = beforeRun + static_cast<uint64_t>(n - runStart) * count;
+        }
+
+        DiversityMetrics computeSorted(const std::vector<uint32_t> &counts) {
+            DiversityMetrics metrics = DiversityMetrics();
+            const size_t n = counts.size();
+            metrics.names = n;
+
+            // Accumulate over runs of equal counts. Long tails of the same small count (thousands of names at 5) then
+            // cost one log2() and a couple of multiplies rather than work per row.
+            uint64_t total = 0;
+            double weightedRank = 0; // sum of (1-based rank * count)
+            double countLogCount = 0; // sum of count * log2(count)
+            uint64_t top10 = 0;
+            uint64_t top100 = 0;
+            uint64_t top1000 = 0;
+            size_t i = 0;
+            while (i < n) {
+                const uint32_t count = counts[i];
+                size_t end = i + 1;
+                while (end < n && counts[end] == count)
+                    ++end;
+                const uint64_t run = end - i;
+
+                capturePrefix(10, i, end, total, count, top10);
+                capturePrefix(100, i, end, total, count, top100);
+                capturePrefix(1000, i, end, total, count, top1000);
+
+                // ranks i+1 .. end sum to run * (i + 1) + run * (run - 1) / 2
+                weightedRank += static_cast<double>(count) * (static_cast<double>(run) * (i + 1) +
+                                                              static_cast<double>(run) * (run - 1) / 2);
+                if (count > 1)
+                    countLogCount += static_cast<double>(run) * count * std::log2(static_cast<double>(count));
+                total += run * count;
+                i = end;
+            }
+
+            metrics.births = total;
+            if (!total)
+                return metrics;
+            if (n < 10)
+                top10 = total;
+            if (n < 100)
+                top100 = total;
+            if (n < 1000)
+                top1000 = total;
+
+            const double t = static_cast<double>(total);
+            metrics.entropy = std::log2(t) - countLogCount / t;
+            // Gini for descending values: (n + 1) / n - 2 * sum(rank * x) / (n * total)
+            metrics.gini = (static_cast<double>(n) + 1) / n - 2 * weightedRank / (static_cast<double>(n) * t);
+            metrics.top10Share = top10 / t;
+            metrics.top100Share = top100 / t;
+            metrics.top1000Share = top1000 / t;
+            return metrics;
+        }
+    }
+
+    DiversityMetrics computeDiversity(const SexColumn &column) {
+        if (isNonIncreasing(column.counts.data(), column.counts.size()))
+            return computeSorted(column.counts);
+        std::vector<uint32_t> sorted(column.counts);
+        std::sort(sorted.begin(), sorted.end(), std::greater<uint32_t>());
+        return computeSorted(sorted);
+    }
+
+    std::vector<DiversityMetrics> diversityByYear(const Corpus &corpus) {
+        const std::vector<YearTable> &years = corpus.years();
+        std::vector<DiversityMetrics> results(years.size() * SEX_COUNT);
+        parallelFor(results.size(), [&](const size_t i) {
+            const YearTable &table = years[i / SEX_COUNT];
+            const Sex sex = static_cast<Sex>(i % SEX_COUNT);
+            DiversityMetrics metrics = computeDiversity(table.column(sex));
+            metrics.year = table.year;
+            metrics.sex = sex;
+            results[i] = metrics;
+        });
+        return results;
+    }
+}
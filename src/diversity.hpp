@@ -0,0 +1,40 @@
+/*
+ * diversity.hpp
+ *
+ * Name diversity metrics per (year, sex): Shannon entropy, Gini coefficient, and the share of births covered by the
+ * most popular names.
+ */
+
+#ifndef DIVERSITY_HPP
+#define DIVERSITY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "corpus.hpp"
+
+namespace names {
+    struct DiversityMetrics {
+        int year;
+        Sex sex;
+        size_t names;
+        uint64_t births;
+        /// Shannon entropy of the name distribution, in bits.
+        double entropy;
+        /// Gini coefficient of births across names; 0 means every name is equally common.
+        double gini;
+        double top10Share;
+        double top100Share;
+        double top1000Share;
+    };
+
+    /// Computes the metrics for one column in a single pass. Counts are expected in descending order, as they appear in
+    /// yob files, which lets equal counts be handled as one run; unsorted columns are sorted on a copy first.
+    DiversityMetrics computeDiversity(const SexColumn &column);
+
+    /// Computes the metrics for every (year, sex) in the corpus. Results are in year order, females before males.
+    std::vector<DiversityMetrics> diversityByYear(const Corpus &corpus);
+}
+
+#endif //DIVERSITY_HPP
@@ -0,0 +1,472 @@
+#include "external_sort.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+#include "segment_store.hpp"
+
+#ifdef __unix__
+#include <cstdlib>
+#include <unistd.h>
+#endif
+
+namespace names {
+    namespace {
+        /// Longest encoding of one record: two 64-bit varints.
+        const size_t MAX_RECORD_BYTES = 20;
+        /// The record buffer never shrinks below this, whatever the budget.
+        const size_t MIN_RECORDS = 1024;
+
+        std::runtime_error spillError(const std::string &what) {
+            return std::runtime_error("external sort: " + what + ": " + std::strerror(errno));
+        }
+
+        uint64_t zigzag(const int64_t value) {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
+
+        int64_t unzigzag(const uint64_t value) {
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        char *putVarint(char *p, uint64_t value) {
+            while (value >= 0x80) {
+                *p++ = static_cast<char>(value | 0x80);
+                value >>= 7;
+            }
+            *p++ = static_cast<char>(value);
+            return p;
+        }
+
+        /// Creates an anonymous read-write temporary file, in dir if given. Unbuffered, since runs do their own
+        /// block-sized I/O.
+        std::FILE *openSpillFile(const std::string &dir) {
+            std::FILE *file = nullptr;
+#ifdef __unix__
+            if (!dir.empty()) {
+                std::string path = dir + "/names-spill-XXXXXX";
+                const int fd = mkstemp(&path[0]);
+                if (fd < 0)
+                    throw spillError("unable to create a spill file in " + dir);
+                unlink(path.c_str());
+                file = fdopen(fd, "w+b");
+                if (!file)
+                    close(fd);
+            }
+#endif
+            if (!file)
+                file = std::tmpfile();
+            if (!file)
+                throw spillError("unable to create a spill file");
+            std::setvbuf(file, nullptr, _IONBF, 0);
+            return file;
+        }
+    }
+
+    /// Runs every run read and write, in submission order, so run I/O overlaps sorting and merging.
+    class ExternalAggregator::IoThread {
+        BlockingQueue<std::function<void()> > tasks_;
+        std::thread thread_;
+
+    public:
+        IoThread()
+            : thread_([this]() {
+                std::function<void()> task;
+                while (tasks_.pop(task))
+                    task();
+            }) {
+        }
+
+        ~IoThread() {
+            tasks_.close();
+            thread_.join();
+        }
+
+        /// Queues fn; its result, or its exception, comes back through the future.
+        std::future<size_t> submit(const std::function<size_t()> &fn) {
+            const std::shared_ptr<std::packaged_task<size_t()> > task(new std::packaged_task<size_t()>(fn));
+            tasks_.push([task]() { (*task)(); });
+            return task->get_future();
+        }
+    };
+
+    /// A sorted run in its spill file.
+    struct ExternalAggregator::Run {
+        std::FILE *file;
+        uint64_t bytes;
+
+        explicit Run(const std::string &dir)
+            : file(openSpillFile(dir)),
+              bytes(0) {
+        }
+
+        ~Run() {
+            std::fclose(file);
+        }
+
+        Run(const Run &) = delete;
+
+        Run &operator=(const Run &) = delete;
+    };
+
+    namespace {
+        /// Encodes records into two alternating blocks; each full block is written on the I/O thread while the other
+        /// fills.
+        template<typename Run, typename IoThread>
+        class RunWriter {
+            Run &run_;
+            IoThread &io_;
+            std::vector<char> blocks_[2];
+            std::future<size_t> pending_[2];
+            size_t current_;
+            char *p_;
+            char *limit_;
+            uint64_t previous_;
+
+            void submit() {
+                std::vector<char> &block = blocks_[current_];
+                const size_t len = static_cast<size_t>(p_ - block.data());
+                if (len) {
+                    std::FILE *file = run_.file;
+                    const char *data = block.data();
+                    pending_[current_] = io_.submit([file, data, len]() {
+                        if (std::fwrite(data, 1, len, file) != len)
+                            throw spillError("unable to write a run");
+                        return len;
+                    });
+                    run_.bytes += len;
+                }
+                current_ ^= 1;
+                if (pending_[current_].valid())
+                    pending_[current_].get();
+                p_ = blocks_[current_].data();
+                limit_ = p_ + blocks_[current_].size() - MAX_RECORD_BYTES;
+            }
+
+        public:
+            RunWriter(Run &run, IoThread &io, const size_t blockSize)
+                : run_(run),
+                  io_(io),
+                  current_(0),
+                  previous_(0) {
+                for (std::vector<char> &block: blocks_)
+                    block.resize(std::max(blockSize, 2 * MAX_RECORD_BYTES));
+                p_ = blocks_[0].data();
+                limit_ = p_ + blocks_[0].size() - MAX_RECORD_BYTES;
+            }
+
+            ~RunWriter() {
+                // on an error path, the blocks must outlive the writes still queued on them
+                for (std::future<size_t> &pending: pending_) {
+                    if (pending.valid())
+                        pending.wait();
+                }
+            }
+
+            void put(const uint64_t key, const int64_t count) {
+                if (p_ > limit_)
+                    submit();
+                p_ = putVarint(p_, key - previous_);
+                p_ = putVarint(p_, zigzag(count));
+                previous_ = key;
+            }
+
+            /// Writes what is left and waits for every write to land.
+            void finish() {
+                submit();
+                submit();
+                std::fflush(run_.file);
+            }
+        };
+
+        /// Decodes a run, reading the next block on the I/O thread while the current one is consumed.
+        template<typename Run, typename IoThread>
+        class RunReader {
+            IoThread &io_;
+            std::FILE *file_;
+            std::vector<char> blocks_[2];
+            std::future<size_t> pending_;
+            size_t current_;
+            const char *p_;
+            const char *end_;
+            uint64_t left_;
+
+            void request() {
+                if (!left_)
+                    return;
+                std::FILE *file = file_;
+                char *data = blocks_[current_ ^ 1].data();
+                const size_t len = static_cast<size_t>(std::min<uint64_t>(left_, blocks_[0].size()));
+                left_ -= len;
+                pending_ = io_.submit([file, data, len]() {
+                    if (std::fread(data, 1, len, file) != len)
+                        throw spillError("unable to read a run");
+                    return len;
+                });
+            }
+
+            /// Moves on to the block being read in the background. Returns false at the end of the run.
+            bool refill() {
+                if (!pending_.valid())
+                    return false;
+                const size_t len = pending_.get();
+                current_ ^= 1;
+                p_ = blocks_[current_].data();
+                end_ = p_ + len;
+                request();
+                return true;
+            }
+
+            bool varint(uint64_t &value) {
+                value = 0;
+                for (unsigned shift = 0; shift < 64; shift += 7) {
+                    if (p_ == end_ && !refill())
+                        return false;
+                    const unsigned char byte = static_cast<unsigned char>(*p_++);
+                    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        return true;
+                }
+                throw std::runtime_error("external sort: corrupt run");
+            }
+
+        public:
+            uint64_t key;
+            int64_t count;
+            bool done;
+
+            RunReader(Run &run, IoThread &io, const size_t blockSize)
+                : io_(io),
+                  file_(run.file),
+                  current_(1),
+                  p_(nullptr),
+                  end_(nullptr),
+                  left_(run.bytes),
+                  key(0),
+                  count(0),
+                  done(false) {
+                for (std::vector<char> &block: blocks_)
+                    block.resize(blockSize);
+                std::rewind(file_);
+                request();
+                next();
+            }
+
+            ~RunReader() {
+                if (pending_.valid())
+                    pending_.wait();
+            }
+
+            void next() {
+                uint64_t delta;
+                uint64_t encoded;
+                if (!varint(delta)) {
+                    done = true;
+                    return;
+                }
+                if (!varint(encoded))
+                    throw std::runtime_error("external sort: truncated run");
+                key += delta;
+                count = unzigzag(encoded);
+            }
+        };
+
+        /// A tournament tree of losers over k sources: each inner node holds the loser of the match played there and
+        /// node 0 the overall winner, so replacing the winner replays only the log2(k) matches on its path.
+        template<typename Source>
+        class LoserTree {
+            std::vector<Source *> &sources_;
+            std::vector<size_t> nodes_;
+
+            /// Whether source a should come out before source b. Finished sources lose to everything.
+            bool before(const size_t a, const size_t b) const {
+                if (sources_[a]->done || sources_[b]->done)
+                    return !sources_[a]->done && sources_[b]->done;
+                return sources_[a]->key < sources_[b]->key;
+            }
+
+        public:
+            explicit LoserTree(std::vector<Source *> &sources)
+                : sources_(sources),
+                  nodes_(sources.size()) {
+                // play the initial tournament bottom up, with the sources as leaves k..2k-1 of an implicit tree
+                const size_t k = sources.size();
+                std::vector<size_t> winners(2 * k);
+                for (size_t i = 0; i < k; ++i)
+                    winners[k + i] = i;
+                for (size_t node = k - 1; node >= 1; --node) {
+                    const size_t left = winners[2 * node];
+                    const size_t right = winners[2 * node + 1];
+                    const bool leftWins = before(left, right) || (!before(right, left) && left < right);
+                    winners[node] = leftWins ? left : right;
+                    nodes_[node] = leftWins ? right : left;
+                }
+                nodes_[0] = k > 1 ? winners[1] : 0;
+            }
+
+            Source &top() const {
+                return *sources_[nodes_[0]];
+            }
+
+            /// Call after the winning source has advanced.
+            void replay() {
+                size_t winner = nodes_[0];
+                for (size_t node = (winner + sources_.size()) / 2; node >= 1; node /= 2) {
+                    if (before(nodes_[node], winner))
+                        std::swap(nodes_[node], winner);
+                }
+                nodes_[0] = winner;
+            }
+        };
+
+        typedef std::function<void(uint64_t, int64_t)> Emit;
+    }
+
+    ExternalAggregator::ExternalAggregator(const ExternalSortOptions &options)
+        : options_(options),
+          stats_(),
+          io_(new IoThread()) {
+        options_.blockSize = std::max<size_t>(options_.blockSize, 4 * MAX_RECORD_BYTES);
+        // the record buffer and its sort scratch share what is left after a run writer's two blocks
+        const size_t writerBlocks = 2 * options_.blockSize;
+        const size_t left = options_.memoryBudget > writerBlocks ? options_.memoryBudget - writerBlocks : 0;
+        capacity_ = std::max(MIN_RECORDS, left / (2 * sizeof(KeyCount)));
+    }
+
+    ExternalAggregator::~ExternalAggregator() {
+    }
+
+    size_t ExternalAggregator::fanIn() const {
+        // two read blocks per input run, plus a writer's two blocks for the output of an intermediate pass
+        return std::max<size_t>(2, options_.memoryBudget / (2 * options_.blockSize) - 1);
+    }
+
+    void ExternalAggregator::notePeak(const size_t bytes) {
+        stats_.peakMemory = std::max(stats_.peakMemory, bytes);
+    }
+
+    void ExternalAggregator::sortRecords() {
+        // grow() never takes the buffer past capacity_, and the scratch only needs as much as the buffer holds
+        scratch_.reserve(records_.capacity());
+        notePeak((records_.capacity() + scratch_.capacity()) * sizeof(KeyCount));
+        radixSortBy(records_, scratch_, [](const KeyCount &record) { return record.key; });
+        if (!options_.combine || records_.empty())
+            return;
+        size_t out = 0;
+        for (size_t i = 1; i < records_.size(); ++i) {
+            if (records_[i].key == records_[out].key)
+                records_[out].count += records_[i].count;
+            else
+                records_[++out] = records_[i];
+        }
+        records_.resize(out + 1);
+    }
+
+    void ExternalAggregator::spill() {
+        sortRecords();
+        std::unique_ptr<Run> run(new Run(options_.tempDir));
+        {
+            RunWriter<Run, IoThread> writer(*run, *io_, options_.blockSize);
+            notePeak((records_.capacity() + scratch_.capacity()) * sizeof(KeyCount) + 2 * options_.blockSize);
+            for (const KeyCount &record: records_)
+                writer.put(record.key, record.count);
+            writer.finish();
+        }
+        stats_.spilledBytes += run->bytes;
+        ++stats_.runs;
+        runs_.push_back(std::move(run));
+        records_.clear();
+    }
+
+    void ExternalAggregator::grow() {
+        if (records_.size() < capacity_)
+            records_.reserve(std::min(capacity_, std::max<size_t>(MIN_RECORDS, 2 * records_.size())));
+        else
+            spill();
+    }
+
+    void ExternalAggregator::merge(std::vector<std::unique_ptr<Run> > runs, const Emit &emit) {
+        typedef RunReader<Run, IoThread> Reader;
+        std::vector<std::unique_ptr<Reader> > readers;
+        std::vector<Reader *> sources;
+        for (const std::unique_ptr<Run> &run: runs) {
+            readers.push_back(std::unique_ptr<Reader>(new Reader(*run, *io_, options_.blockSize)));
+            sources.push_back(readers.back().get());
+        }
+        LoserTree<Reader> tree(sources);
+        ++stats_.mergePasses;
+        while (!tree.top().done) {
+            Reader &top = tree.top();
+            const uint64_t key = top.key;
+            int64_t count = top.count;
+            top.next();
+            tree.replay();
+            if (options_.combine) {
+                while (!tree.top().done && tree.top().key == key) {
+                    count += tree.top().count;
+                    tree.top().next();
+                    tree.replay();
+                }
+            }
+            emit(key, count);
+        }
+    }
+
+    void ExternalAggregator::finish(const Emit &emit) {
+        if (runs_.empty()) {
+            // everything fit in memory
+            sortRecords();
+            for (const KeyCount &record: records_)
+                emit(record.key, record.count);
+        } else {
+            if (!records_.empty())
+                spill();
+            // the merge's read blocks take the place of the record buffer
+            std::vector<KeyCount>().swap(records_);
+            std::vector<KeyCount>().swap(scratch_);
+
+            const size_t fanIn = this->fanIn();
+            while (runs_.size() > fanIn) {
+                // merge the oldest runs into one new run at the back
+                std::vector<std::unique_ptr<Run> > group;
+                for (size_t i = 0; i < fanIn; ++i)
+                    group.push_back(std::move(runs_[i]));
+                runs_.erase(runs_.begin(), runs_.begin() + fanIn);
+                std::unique_ptr<Run> merged(new Run(options_.tempDir));
+                {
+                    RunWriter<Run, IoThread> writer(*merged, *io_, options_.blockSize);
+                    notePeak((2 * group.size() + 2) * options_.blockSize);
+                    merge(std::move(group), [&](const uint64_t key, const int64_t count) { writer.put(key, count); });
+                    writer.finish();
+                }
+                stats_.spilledBytes += merged->bytes;
+                ++stats_.runs;
+                runs_.push_back(std::move(merged));
+            }
+            notePeak(2 * runs_.size() * options_.blockSize);
+            std::vector<std::unique_ptr<Run> > last;
+            last.swap(runs_);
+            merge(std::move(last), emit);
+        }
+        records_.clear();
+    }
+
+    void addStateRows(ExternalAggregator &aggregator, const StateCorpus &corpus) {
+        for (const StatePartition &partition: corpus.partitions()) {
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                const SexColumn &column = partition.table.columns[s];
+                for (size_t row = 0; row < column.size(); ++row)
+                    aggregator.add(segmentKey(partition.table.year, static_cast<Sex>(s), column.nameIds[row]),
+                                   column.counts[row]);
+            }
+        }
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * external_sort.hpp
+ *
+ * Sorting and aggregation of (key, count) records that do not fit in memory, such as synthetic billion-row corpora or
+ * the full state-by-year history. Records collect in a buffer sized from a memory budget; each time it fills it is
+ * radix sorted, combined and spilled to a temporary file as a compact run (delta-encoded keys and zigzag counts as
+ * varints). Runs are then k-way merged through a tournament tree, over several passes if there are more runs than
+ * the budget has read buffers for. Run writes and reads happen on a separate I/O thread, double-buffered, so the disk
+ * stays busy while records are sorted and merged.
+ */
+
+#ifndef EXTERNAL_SORT_HPP
+#define EXTERNAL_SORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "state.hpp"
+
+namespace names {
+    struct KeyCount {
+        uint64_t key;
+        int64_t count;
+    };
+
+    struct ExternalSortOptions {
+        /// Upper bound on what the aggregator allocates: its record buffer, sort scratch space and I/O blocks.
+        size_t memoryBudget;
+        /// Size of each read or write of a run.
+        size_t blockSize;
+        /// Where runs are spilled; empty for the system's temporary directory. Spill files are unlinked as soon as
+        /// they are created, so nothing is left behind even after a crash. Ignored where that is not supported.
+        std::string tempDir;
+        /// Whether records with equal keys are summed into one. Without it this is a plain external sort.
+        bool combine;
+
+        ExternalSortOptions()
+            : memoryBudget(size_t(256) << 20),
+              blockSize(1 << 20),
+              combine(true) {
+        }
+    };
+
+    struct ExternalSortStats {
+        /// Records passed to add().
+        uint64_t records;
+        /// Runs written, including those produced by intermediate merge passes.
+        size_t runs;
+        /// Merge passes over spilled runs, counting the final one.
+        size_t mergePasses;
+        uint64_t spilledBytes;
+        /// The most the aggregator had allocated at once. Never more than the budget unless the budget is smaller
+        /// than the minimum of a few blocks and a thousand records.
+        size_t peakMemory;
+    };
+
+    class ExternalAggregator {
+        struct Run;
+
+        class IoThread;
+
+        ExternalSortOptions options_;
+        ExternalSortStats stats_;
+        std::vector<KeyCount> records_;
+        std::vector<KeyCount> scratch_;
+        size_t capacity_;
+        std::vector<std::unique_ptr<Run> > runs_;
+        std::unique_ptr<IoThread> io_;
+
+        /// How many runs one merge can read at once within the budget.
+        size_t fanIn() const;
+
+        void notePeak(size_t bytes);
+
+        /// Sorts the buffered records, combining equal keys if asked to.
+        void sortRecords();
+
+        void spill();
+
+        /// Makes room for one more record: grows the buffer, up to capacity_, or spills it when it is full.
+        void grow();
+
+        /// Merges runs into ascending order and passes each record (or combined key) to emit.
+        void merge(std::vector<std::unique_ptr<Run> > runs, const std::function<void(uint64_t, int64_t)> &emit);
+
+    public:
+        explicit ExternalAggregator(const ExternalSortOptions &options = ExternalSortOptions());
+
+        ~ExternalAggregator();
+
+        ExternalAggregator(const ExternalAggregator &) = delete;
+
+        ExternalAggregator &operator=(const ExternalAggregator &) = delete;
+
+        void add(const uint64_t key, const int64_t count) {
+            if (records_.size() == records_.capacity())
+                grow();
+            const KeyCount record = {key, count};
+            records_.push_back(record);
+            ++stats_.records;
+        }
+
+        /// Emits the records in ascending key order: every distinct key once with its counts summed, or with combine
+        /// off, every record with equal keys in no particular order. Leaves the aggregator empty and ready for reuse.
+        /// Throws std::runtime_error if a spill file cannot be written or read.
+        void finish(const std::function<void(uint64_t key, int64_t count)> &emit);
+
+        const ExternalSortStats &stats() const {
+            return stats_;
+        }
+    };
+
+    /// Adds every row of every state partition keyed by segmentKey(year, sex, name ID), so finishing yields the
+    /// national count of each name, sex and year.
+    void addStateRows(ExternalAggregator &aggregator, const StateCorpus &corpus);
+}
+
+#endif //EXTERNAL_SORT_HPP
@@ -0,0 +1,153 @@
+#include "file_io.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    namespace {
+        std::runtime_error ioError(const std::string &what, const std::string &path) {
+            return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+        }
+
+#ifdef __unix__
+        void writeAll(const int fd, const void *data, size_t len, const std::string &path) {
+            const char *p = static_cast<const char *>(data);
+            while (len) {
+                const ssize_t written = ::write(fd, p, len);
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw ioError("unable to write", path);
+                }
+                p += written;
+                len -= static_cast<size_t>(written);
+            }
+        }
+
+        /// Syncs the directory containing path so a rename into it survives a crash.
+        void syncParentDirectory(const std::string &path) {
+            const std::string::size_type slash = path.rfind('/');
+            const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            const int fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            fsync(fd);
+            close(fd);
+        }
+#endif
+    }
+
+    bool fileExists(const std::string &path) {
+        std::ifstream probe(path.c_str());
+        return static_cast<bool>(probe);
+    }
+
+    void writeFileAtomically(const std::string &path, const std::vector<WriteChunk> &chunks) {
+        const std::string tmp = path + ".tmp";
+#ifdef __unix__
+        const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw ioError("unable to create", tmp);
+        try {
+            for (const WriteChunk &chunk: chunks)
+                writeAll(fd, chunk.first, chunk.second, tmp);
+            if (fsync(fd) != 0)
+                throw ioError("unable to sync", tmp);
+        } catch (...) {
+            close(fd);
+            unlink(tmp.c_str());
+            throw;
+        }
+        close(fd);
+        if (rename(tmp.c_str(), path.c_str()) != 0)
+            throw ioError("unable to rename onto", path);
+        syncParentDirectory(path);
+#else
+        {
+            std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            for (const WriteChunk &chunk: chunks)
+                out.write(static_cast<const char *>(chunk.first), static_cast<std::streamsize>(chunk.second));
+            out.flush();
+            if (!out)
+                throw ioError("unable to write", tmp);
+        }
+        std::remove(path.c_str());
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw ioError("unable to rename onto", path);
+#endif
+    }
+
+#ifdef __unix__
+    AppendFile::AppendFile(const std::string &path)
+        : fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)),
+          path_(path) {
+        if (fd_ < 0)
+            throw ioError("unable to open", path);
+    }
+
+    AppendFile::~AppendFile() {
+        close(fd_);
+    }
+
+    void AppendFile::write(const void *data, const size_t len) {
+        writeAll(fd_, data, len, path_);
+    }
+
+    void AppendFile::sync() {
+        if (fdatasync(fd_) != 0)
+            throw ioError("unable to sync", path_);
+    }
+
+    void AppendFile::truncate(const uint64_t length) {
+        if (ftruncate(fd_, static_cast<off_t>(length)) != 0 || fdatasync(fd_) != 0)
+            throw ioError("unable to truncate", path_);
+    }
+#else
+    AppendFile::AppendFile(const std::string &path)
+        : file_(std::fopen(path.c_str(), "ab")),
+          path_(path) {
+        if (!file_)
+            throw ioError("unable to open", path);
+    }
+
+    AppendFile::~AppendFile() {
+        std::fclose(file_);
+    }
+
+    void AppendFile::write(const void *data, const size_t len) {
+        if (std::fwrite(data, 1, len, file_) != len)
+            throw ioError("unable to write", path_);
+    }
+
+    void AppendFile::sync() {
+        if (std::fflush(file_) != 0)
+            throw ioError("unable to flush", path_);
+    }
+
+    void AppendFile::truncate(const uint64_t length) {
+        // stdio has no truncate, so keep the prefix and rewrite the file
+        std::string kept;
+        {
+            std::ifstream in(path_.c_str(), std::ios::in | std::ios::binary);
+            kept.resize(static_cast<size_t>(length));
+            in.read(&kept[0], static_cast<std::streamsize>(length));
+            kept.resize(static_cast<size_t>(in.gcount()));
+        }
+        file_ = std::freopen(path_.c_str(), "wb", file_);
+        if (!file_)
+            throw ioError("unable to truncate", path_);
+        if (std::fwrite(kept.data(), 1, kept.size(), file_) != kept.size())
+            throw ioError("unable to write", path_);
+        file_ = std::freopen(path_.c_str(), "ab", file_);
+        if (!file_)
+            throw ioError("unable to reopen", path_);
+    }
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+ * file_io.hpp
+ *
+ * Small durable-write helpers shared by snapshots and the write-ahead log. On POSIX systems these use raw file
+ * descriptors and fsync; elsewhere they fall back to stdio, which flushes but cannot promise durability.
+ */
+
+#ifndef FILE_IO_HPP
+#define FILE_IO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace names {
+    /// A piece of data to write, as (pointer, length).
+    typedef std::pair<const void *, size_t> WriteChunk;
+
+    bool fileExists(const std::string &path);
+
+    /// Writes the chunks to path via a synced temporary file and an atomic rename. Throws std::runtime_error on
+    /// failure.
+    void writeFileAtomically(const std::string &path, const std::vector<WriteChunk> &chunks);
+
+    /// A file opened for appending, with explicit syncs.
+    class AppendFile {
+#ifdef __unix__
+        int fd_;
+#else
+        std::FILE *file_;
+#endif
+        std::string path_;
+
+    public:
+        /// Opens (creating if needed) the file for appending. Throws std::runtime_error on failure.
+        explicit AppendFile(const std::string &path);
+
+        ~AppendFile();
+
+        AppendFile(const AppendFile &) = delete;
+
+        AppendFile &operator=(const AppendFile &) = delete;
+
+        void write(const void *data, size_t len);
+
+        /// Makes everything written so far durable.
+        void sync();
+
+        /// Cuts the file down to the given length, e.g. to drop a torn record at the end of a log.
+        void truncate(uint64_t length = 0);
+    };
+}
+
+#endif //FILE_IO_HPP
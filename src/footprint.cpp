@@ -0,0 +1,81 @@
+#include "footprint.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+#include "async_loader.hpp"
+#include "batch.hpp"
+#include "corpus.hpp"
+#include "query.hpp"
+#include "snapshot_client.hpp"
+
+namespace names {
+    namespace {
+        void formatPart(const MemoryFootprint &part, const size_t depth, const size_t nameCount, std::string &out) {
+            char line[256];
+            const std::string label = std::string(2 * depth, ' ') + part.name;
+            const double perName = nameCount ? static_cast<double>(part.used) / static_cast<double>(nameCount) : 0.0;
+            const int n = std::snprintf(line, sizeof(line), "%-40s %14zu %14zu %10.2f\n", label.c_str(), part.used,
+                                        part.reserved, perName);
+            out.append(line, static_cast<size_t>(std::max(0, std::min<int>(n, sizeof(line) - 1))));
+            for (const MemoryFootprint &child: part.parts)
+                formatPart(child, depth + 1, nameCount, out);
+        }
+    }
+
+    std::string formatFootprint(const MemoryFootprint &root, const size_t nameCount) {
+        char header[128];
+        std::snprintf(header, sizeof(header), "%-40s %14s %14s %10s\n", "structure", "used", "reserved", "per name");
+        std::string out = header;
+        formatPart(root, 0, nameCount, out);
+        return out;
+    }
+
+    int memoryMain(const int argc, char **argv) {
+        std::string dir = NAMES_DATA_DIR;
+        std::string snapshot;
+        int firstYear = 1880;
+        int lastYear = 9999;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 == argc || (arg != "--data" && arg != "--years" && arg != "--snapshot")) {
+                std::fprintf(stderr, "usage: %s [--data DIR] [--years FIRST-LAST] [--snapshot PATH]\n", argv[0]);
+                return 2;
+            }
+            const char *value = argv[++i];
+            if (arg == "--data") {
+                dir = value;
+            } else if (arg == "--snapshot") {
+                snapshot = value;
+            } else if (!parseYearRange(value, firstYear, lastYear)) {
+                std::fprintf(stderr, "bad year range: %s\n", value);
+                return 2;
+            }
+        }
+
+        try {
+            Corpus corpus;
+            const size_t files = loadYearRangeAsync(corpus, dir, firstYear, lastYear);
+            if (!files) {
+                std::fprintf(stderr, "no yob files for %d-%d in %s\n", firstYear, lastYear, dir.c_str());
+                return 1;
+            }
+            const QueryEngine engine(corpus);
+            MemoryFootprint total("total");
+            total.add(corpus.footprint());
+            total.add(engine.footprint());
+            std::unique_ptr<SnapshotClient> client;
+            if (!snapshot.empty()) {
+                client.reset(new SnapshotClient(snapshot));
+                total.add(client->footprint());
+            }
+            std::printf("%zu names in %zu rows from %zu yob files\n", corpus.dictionary().size(), corpus.rows(), files);
+            std::fputs(formatFootprint(total, corpus.dictionary().size()).c_str(), stdout);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * footprint.hpp
+ *
+ * Memory accounting for the structures built over the name data. Each reports a tree of the arrays it is made of,
+ * with the bytes holding data (used) beside the bytes allocated or mapped for it (reserved), which differ by the
+ * headroom vectors and hash tables keep for growth. formatFootprint() prints such a tree with each line's share per
+ * name, which is what to compare when weighing one index against another for a corpus.
+ */
+
+#ifndef FOOTPRINT_HPP
+#define FOOTPRINT_HPP
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace names {
+    /// The bytes one structure holds, including those of its parts.
+    struct MemoryFootprint {
+        std::string name;
+        size_t used;
+        size_t reserved;
+        std::vector<MemoryFootprint> parts;
+
+        explicit MemoryFootprint(std::string name, const size_t used = 0, const size_t reserved = 0)
+            : name(std::move(name)),
+              used(used),
+              reserved(reserved) {
+        }
+
+        /// Adds a part, counting its bytes in this structure's totals.
+        MemoryFootprint &add(MemoryFootprint part) {
+            used += part.used;
+            reserved += part.reserved;
+            parts.push_back(std::move(part));
+            return *this;
+        }
+
+        /// Adds an array as a part: its elements are used, its capacity reserved.
+        template<typename T, typename Allocator>
+        MemoryFootprint &add(std::string part, const std::vector<T, Allocator> &array) {
+            return add(MemoryFootprint(std::move(part), array.size() * sizeof(T), array.capacity() * sizeof(T)));
+        }
+    };
+
+    /// Estimates the heap a std::unordered_map holds: a pointer per bucket and a node per entry, the node being the
+    /// entry plus the next pointer and the cached hash of libstdc++. Used counts the entries alone.
+    template<typename K, typename V>
+    MemoryFootprint mapFootprint(std::string name, const std::unordered_map<K, V> &map) {
+        const size_t node = sizeof(void *) + sizeof(typename std::unordered_map<K, V>::value_type) + sizeof(size_t);
+        return MemoryFootprint(std::move(name), map.size() * sizeof(typename std::unordered_map<K, V>::value_type),
+                               map.bucket_count() * sizeof(void *) + map.size() * node);
+    }
+
+    /// Formats a footprint as an indented tree, one line per structure with its used and reserved bytes and its used
+    /// bytes per name, nameCount being the names the data holds.
+    std::string formatFootprint(const MemoryFootprint &root, size_t nameCount);
+
+    /// Entry point for `memory [--data DIR] [--years FIRST-LAST] [--snapshot PATH]`, with argv[0] being "memory".
+    /// Loads the corpus and indexes it as the server would, maps the snapshot if given, and prints the footprint of
+    /// each on stdout. Returns the exit code.
+    int memoryMain(int argc, char **argv);
+}
+
+#endif //FOOTPRINT_HPP
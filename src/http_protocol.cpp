@@ -0,0 +1,558 @@
+#include "http_protocol.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "digits.hpp"
+
+namespace names {
+    namespace {
+        struct Text {
+            const char *data;
+            size_t size;
+
+            bool is(const char *literal) const {
+                return size == std::strlen(literal) && !std::memcmp(data, literal, size);
+            }
+        };
+
+        char lower(const char c) {
+            return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        /// Whether text equals literal, which must be lower case, ignoring case.
+        bool equalsIgnoringCase(const char *text, const size_t len, const char *literal) {
+            if (len != std::strlen(literal))
+                return false;
+            for (size_t i = 0; i < len; ++i) {
+                if (lower(text[i]) != literal[i])
+                    return false;
+            }
+            return true;
+        }
+
+        bool isSpace(const char c) {
+            return c == ' ' || c == '\t';
+        }
+
+        int hexDigit(const char c) {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            const char l = lower(c);
+            return l >= 'a' && l <= 'f' ? l - 'a' + 10 : -1;
+        }
+
+        /// Decodes %XX escapes and '+' for space. Returns false on a malformed escape.
+        bool percentDecode(const char *data, const size_t len, std::string &out) {
+            out.clear();
+            for (size_t i = 0; i < len; ++i) {
+                if (data[i] == '+') {
+                    out += ' ';
+                } else if (data[i] != '%') {
+                    out += data[i];
+                } else {
+                    if (len - i < 3 || hexDigit(data[i + 1]) < 0 || hexDigit(data[i + 2]) < 0)
+                        return false;
+                    out += static_cast<char>(hexDigit(data[i + 1]) << 4 | hexDigit(data[i + 2]));
+                    i += 2;
+                }
+            }
+            return true;
+        }
+
+        bool parseSex(const Text &text, Sex &sex) {
+            if (text.is("F"))
+                sex = Sex::Female;
+            else if (text.is("M"))
+                sex = Sex::Male;
+            else
+                return false;
+            return true;
+        }
+
+        bool parseYear(const Text &text, int &year) {
+            uint32_t value;
+            if (!parseUint32(text.data, text.size, value) || value > INT32_MAX)
+                return false;
+            year = static_cast<int>(value);
+            return true;
+        }
+
+        bool parseLimit(const Text &text, uint32_t &limit) {
+            if (!parseUint32(text.data, text.size, limit) || !limit)
+                return false;
+            limit = std::min(limit, MAX_QUERY_LIMIT);
+            return true;
+        }
+
+        const char *reason(const int status) {
+            switch (status) {
+                case 200:
+                    return "OK";
+                case 400:
+                    return "Bad Request";
+                case 404:
+                    return "Not Found";
+                case 405:
+                    return "Method Not Allowed";
+                case 413:
+                    return "Content Too Large";
+                case 431:
+                    return "Request Header Fields Too Large";
+                case 501:
+                    return "Not Implemented";
+                case 503:
+                    return "Service Unavailable";
+                case 505:
+                    return "HTTP Version Not Supported";
+                default:
+                    return "Error";
+            }
+        }
+
+        char *put(char *p, const char *data, const size_t len) {
+            std::memcpy(p, data, len);
+            return p + len;
+        }
+
+        char *put(char *p, const char *literal) {
+            return put(p, literal, std::strlen(literal));
+        }
+
+        /// Room left after "Content-Length:" for the value, which is padded with spaces since it is only known once
+        /// the body has been written. Trailing whitespace is allowed around any header value.
+        const size_t LENGTH_FIELD = 10;
+        /// Upper bound on the response head.
+        const size_t MAX_RESPONSE_HEAD = 160;
+
+        /// Writes the response head up to the padded Content-Length value, whose position is returned in length.
+        char *head(char *p, const int status, const bool keepAlive, char *&length) {
+            char digits[MAX_DIGITS];
+            p = put(p, "HTTP/1.1 ");
+            p = put(p, digits, formatUint64(static_cast<uint64_t>(status), digits));
+            *p++ = ' ';
+            p = put(p, reason(status));
+            p = put(p, "\r\nContent-Type: application/json\r\n");
+            if (status == 405)
+                p = put(p, "Allow: GET\r\n");
+            if (!keepAlive)
+                p = put(p, "Connection: close\r\n");
+            p = put(p, "Content-Length: ");
+            length = p;
+            std::memset(p, ' ', LENGTH_FIELD);
+            p += LENGTH_FIELD;
+            return put(p, "\r\n\r\n");
+        }
+
+        /// Writes data as a JSON string; at most 6 bytes out per byte in, plus the quotes.
+        char *jsonString(char *p, const char *data, const size_t len) {
+            static const char HEX[] = "0123456789abcdef";
+            *p++ = '"';
+            size_t run = 0;
+            for (size_t i = 0; i < len; ++i) {
+                const unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c >= 0x20 && c != '"' && c != '\\')
+                    continue;
+                p = put(p, data + run, i - run);
+                *p++ = '\\';
+                if (c == '"' || c == '\\') {
+                    *p++ = static_cast<char>(c);
+                } else {
+                    p = put(p, "u00");
+                    *p++ = HEX[c >> 4];
+                    *p++ = HEX[c & 15];
+                }
+                run = i + 1;
+            }
+            p = put(p, data + run, len - run);
+            *p++ = '"';
+            return p;
+        }
+
+        char *number(char *p, const uint64_t value) {
+            return p + formatUint64(value, p);
+        }
+    }
+
+    // ---- HttpRequestParser ---- //
+
+    void HttpRequestParser::reset() {
+        state_ = State::RequestLine;
+        scanned_ = 0;
+        headSize_ = 0;
+        contentLength_ = 0;
+        method_ = Span();
+        target_ = Span();
+        keepAlive_ = true;
+        errorStatus_ = 0;
+        error_ = nullptr;
+    }
+
+    HttpRequestParser::State HttpRequestParser::fail(const int status, const char *error) {
+        errorStatus_ = status;
+        error_ = error;
+        state_ = State::Error;
+        keepAlive_ = false;
+        return state_;
+    }
+
+    HttpRequestParser::State HttpRequestParser::requestLine(const char *line, const size_t begin, const size_t len) {
+        const char *end = line + len;
+        const char *methodEnd = static_cast<const char *>(std::memchr(line, ' ', len));
+        if (!methodEnd || methodEnd == line)
+            return fail(400, "malformed request line");
+        const char *target = methodEnd + 1;
+        const char *targetEnd = static_cast<const char *>(std::memchr(target, ' ', end - target));
+        if (!targetEnd || targetEnd == target)
+            return fail(400, "malformed request line");
+        const Text version = {targetEnd + 1, static_cast<size_t>(end - targetEnd - 1)};
+        if (version.is("HTTP/1.1"))
+            keepAlive_ = true;
+        else if (version.is("HTTP/1.0"))
+            keepAlive_ = false;
+        else if (version.size > 5 && !std::memcmp(version.data, "HTTP/", 5))
+            return fail(505, "only HTTP/1.0 and HTTP/1.1 are supported");
+        else
+            return fail(400, "malformed request line");
+        method_.begin = static_cast<uint32_t>(begin);
+        method_.size = static_cast<uint32_t>(methodEnd - line);
+        target_.begin = static_cast<uint32_t>(begin + (target - line));
+        target_.size = static_cast<uint32_t>(targetEnd - target);
+        state_ = State::Headers;
+        return state_;
+    }
+
+    HttpRequestParser::State HttpRequestParser::header(const char *line, const size_t len) {
+        const char *colon = static_cast<const char *>(std::memchr(line, ':', len));
+        // no whitespace is allowed before the colon, and folded continuation lines are obsolete
+        if (!colon || colon == line || isSpace(colon[-1]) || isSpace(line[0]))
+            return fail(400, "malformed header");
+        const size_t nameSize = static_cast<size_t>(colon - line);
+        const char *value = colon + 1;
+        const char *end = line + len;
+        while (value < end && isSpace(*value))
+            ++value;
+        while (end > value && isSpace(end[-1]))
+            --end;
+        const size_t valueSize = static_cast<size_t>(end - value);
+
+        if (equalsIgnoringCase(line, nameSize, "connection")) {
+            // a comma-separated list of options; only close and keep-alive matter
+            const char *option = value;
+            while (option < end) {
+                const char *optionEnd = static_cast<const char *>(std::memchr(option, ',', end - option));
+                if (!optionEnd)
+                    optionEnd = end;
+                const char *last = optionEnd;
+                while (option < last && isSpace(*option))
+                    ++option;
+                while (last > option && isSpace(last[-1]))
+                    --last;
+                if (equalsIgnoringCase(option, last - option, "close"))
+                    keepAlive_ = false;
+                else if (equalsIgnoringCase(option, last - option, "keep-alive"))
+                    keepAlive_ = true;
+                option = optionEnd + 1;
+            }
+        } else if (equalsIgnoringCase(line, nameSize, "content-length")) {
+            uint32_t length;
+            if (!parseUint32(value, valueSize, length))
+                return fail(400, "malformed Content-Length");
+            if (length > MAX_BODY)
+                return fail(413, "request body too large");
+            contentLength_ = length;
+        } else if (equalsIgnoringCase(line, nameSize, "transfer-encoding")) {
+            return fail(501, "transfer codings are not supported");
+        }
+        return state_;
+    }
+
+    HttpRequestParser::State HttpRequestParser::parse(const char *request, const size_t len) {
+        while (state_ == State::RequestLine || state_ == State::Headers) {
+            const char *newline = static_cast<const char *>(std::memchr(request + scanned_, '\n', len - scanned_));
+            if (!newline)
+                return len > MAX_HEAD ? fail(431, "request head too large") : state_;
+            const size_t lineEnd = static_cast<size_t>(newline - request);
+            if (lineEnd >= MAX_HEAD)
+                return fail(431, "request head too large");
+            const size_t begin = scanned_;
+            size_t lineSize = lineEnd - begin;
+            if (lineSize && request[lineEnd - 1] == '\r')
+                --lineSize;
+            scanned_ = lineEnd + 1;
+            if (state_ == State::RequestLine) {
+                // empty lines before a request are to be ignored
+                if (lineSize)
+                    requestLine(request + begin, begin, lineSize);
+            } else if (!lineSize) {
+                headSize_ = scanned_;
+                state_ = contentLength_ ? State::Body : State::Complete;
+            } else {
+                header(request + begin, lineSize);
+            }
+        }
+        if (state_ == State::Body && len >= size())
+            state_ = State::Complete;
+        return state_;
+    }
+
+    // ---- HttpHandler ---- //
+
+    int HttpHandler::route(const char *target, const size_t len, Query &query, const char *&error) {
+        const char *end = target + len;
+        const char *question = static_cast<const char *>(std::memchr(target, '?', len));
+        const Text path = {target, static_cast<size_t>((question ? question : end) - target)};
+        if (path.is("/lookup"))
+            query.type = QueryType::Lookup;
+        else if (path.is("/rank"))
+            query.type = QueryType::Rank;
+        else if (path.is("/prefix"))
+            query.type = QueryType::Prefix;
+        else if (path.is("/top"))
+            query.type = QueryType::Top;
+        else {
+            error = "no such resource";
+            return 404;
+        }
+
+        // parameters are used where they lie in the request; only the name or prefix may need decoding
+        Text text = {nullptr, 0};
+        Text sex = {nullptr, 0};
+        Text year = {nullptr, 0};
+        Text limit = {nullptr, 0};
+        const char *textKey = query.type == QueryType::Prefix ? "prefix" : "name";
+        for (const char *p = question ? question + 1 : end; p < end;) {
+            const char *ampersand = static_cast<const char *>(std::memchr(p, '&', end - p));
+            if (!ampersand)
+                ampersand = end;
+            const char *equals = static_cast<const char *>(std::memchr(p, '=', ampersand - p));
+            const Text key = {p, static_cast<size_t>((equals ? equals : ampersand) - p)};
+            const Text value = {equals ? equals + 1 : ampersand,
+                                static_cast<size_t>(ampersand - (equals ? equals + 1 : ampersand))};
+            if (key.is(textKey))
+                text = value;
+            else if (key.is("sex"))
+                sex = value;
+            else if (key.is("year"))
+                year = value;
+            else if (key.is("limit"))
+                limit = value;
+            p = ampersand + 1;
+        }
+
+        query.text = "";
+        query.textSize = 0;
+        query.hasSex = sex.data != nullptr;
+        query.sex = Sex::Female;
+        query.year = 0;
+        query.limit = DEFAULT_QUERY_LIMIT;
+        if (query.type != QueryType::Top) {
+            if (!text.size) {
+                error = query.type == QueryType::Prefix ? "prefix is required" : "name is required";
+                return 400;
+            }
+            if (std::memchr(text.data, '%', text.size) || std::memchr(text.data, '+', text.size)) {
+                if (!percentDecode(text.data, text.size, decoded_)) {
+                    error = "malformed percent escape";
+                    return 400;
+                }
+                text.data = decoded_.data();
+                text.size = decoded_.size();
+            }
+            query.text = text.data;
+            query.textSize = static_cast<uint32_t>(text.size);
+        }
+        const bool needsSex = query.type == QueryType::Rank || query.type == QueryType::Top;
+        if ((needsSex || query.hasSex) && !parseSex(sex, query.sex)) {
+            error = "sex must be F or M";
+            return 400;
+        }
+        if (needsSex && !parseYear(year, query.year)) {
+            error = "year must be a number";
+            return 400;
+        }
+        if (limit.data && !parseLimit(limit, query.limit)) {
+            error = "limit must be a positive number";
+            return 400;
+        }
+        return 200;
+    }
+
+    bool HttpHandler::respond(const char *request, const size_t answered, SendQueue &out, ConsumeContext &context) {
+        const bool keepAlive = parser_.keepAlive();
+        const HttpRequestParser::Span method = parser_.method();
+        const HttpRequestParser::Span target = parser_.target();
+        if (!Text{request + method.begin, method.size}.is("GET")) {
+            writeHttpResponse(out, 405, "{\"error\":\"only GET is supported\"}", keepAlive);
+            return true;
+        }
+        const char *const targetData = request + target.begin;
+        const char *const question = static_cast<const char *>(std::memchr(targetData, '?', target.size));
+        if (Text{targetData, static_cast<size_t>(question ? question - targetData : target.size)}.is("/stats")) {
+            if (!metrics_) {
+                writeHttpResponse(out, 404, "{\"error\":\"no such resource\"}", keepAlive);
+                return true;
+            }
+            const size_t corpusBytes = engine_.corpus().memoryUsed() + (lazy_ ? lazy_->footprint().used : 0);
+            writeHttpResponse(out, 200, formatStatsJson(*metrics_, corpusBytes), keepAlive);
+            return true;
+        }
+
+        Query query;
+        const char *error = nullptr;
+        const int status = route(request + target.begin, target.size, query, error);
+        if (status != 200) {
+            std::string json = "{\"error\":\"";
+            json += error;
+            json += "\"}";
+            writeHttpResponse(out, status, json, keepAlive);
+            return true;
+        }
+        if (lazy_) {
+            if (query.type != QueryType::Rank && query.type != QueryType::Top) {
+                writeHttpResponse(out, 501, "{\"error\":\"years are loaded lazily, so only rank and top are served\"}",
+                                  keepAlive);
+                return true;
+            }
+            if (lazy_->request(query.year) == YearState::Loading) {
+                waiting_ = true;
+                context.parked = true;
+                return false;
+            }
+        }
+
+        bool expensive = false;
+        if (admission_) {
+            if (admission_->expire(context.arrived, std::chrono::steady_clock::now(), 1)) {
+                writeHttpResponse(out, 503, "{\"error\":\"deadline exceeded\"}", keepAlive);
+                return true;
+            }
+            if (isExpensive(query)) {
+                expensive = admission_->tryAcquireExpensive();
+                if (!expensive)
+                    return false;
+            }
+            if (!admission_->acquire(1, answered < admission_->options().connectionQuota)) {
+                if (expensive)
+                    admission_->releaseExpensive();
+                writeHttpResponse(out, 503, "{\"error\":\"overloaded\"}", keepAlive);
+                return true;
+            }
+        }
+
+        rows_.clear();
+        const LoadedYear *year = lazy_ ? lazy_->tryAnswer(query, rows_) : nullptr;
+        if (!year)
+            engine_.run(query, rows_);
+        else if (metrics_ && waiting_)
+            metrics_->noteCacheMiss();
+        else if (metrics_)
+            metrics_->noteCacheHit();
+
+        // bound the response, then write it in place and fill in its length
+        const NameDictionary &dictionary = year ? year->corpus.dictionary() : engine_.corpus().dictionary();
+        size_t bound = MAX_RESPONSE_HEAD + 16;
+        for (const QueryRow &row: rows_) {
+            const size_t nameSize = row.nameId != NameDictionary::npos ? dictionary.name(row.nameId).size
+                                                                       : query.textSize;
+            bound += 96 + 6 * nameSize;
+        }
+        char *const start = out.reserve(bound);
+        char *length = nullptr;
+        char *p = head(start, 200, keepAlive, length);
+        char *const body = p;
+        p = put(p, "{\"rows\":[");
+        for (size_t r = 0; r < rows_.size(); ++r) {
+            const QueryRow &row = rows_[r];
+            if (r)
+                *p++ = ',';
+            p = put(p, "{\"name\":");
+            if (row.nameId != NameDictionary::npos) {
+                const NameRef name = dictionary.name(row.nameId);
+                p = jsonString(p, name.data, name.size);
+            } else {
+                p = jsonString(p, query.text, query.textSize);
+            }
+            p = put(p, ",\"sex\":");
+            if (row.hasSex) {
+                p = put(p, row.sex == Sex::Female ? "\"F\"" : "\"M\"");
+            } else {
+                p = put(p, "null");
+            }
+            p = put(p, ",\"year\":");
+            p = row.year ? p + formatInt64(row.year, p) : put(p, "null");
+            p = put(p, ",\"count\":");
+            p = number(p, row.count);
+            p = put(p, ",\"rank\":");
+            p = row.rank ? number(p, row.rank) : put(p, "null");
+            *p++ = '}';
+        }
+        p = put(p, "]}");
+        formatUint64(static_cast<uint64_t>(p - body), length);
+        out.commit(static_cast<size_t>(p - start));
+        if (metrics_) {
+            metrics_->record(query.type, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - context.arrived).count()));
+        }
+        if (admission_) {
+            admission_->release(1);
+            if (expensive)
+                admission_->releaseExpensive();
+        }
+        return true;
+    }
+
+    size_t HttpHandler::consume(const char *data, const size_t len, SendQueue &out, ConsumeContext &context) {
+        if (queued_) {
+            admission_->unqueue(1);
+            queued_ = false;
+        }
+        const size_t limit =
+            std::min(context.maxAnswers, admission_ ? admission_->options().maxConnectionInFlight : SIZE_MAX);
+        size_t used = 0;
+        for (size_t answered = 0; used < len; ++answered) {
+            const HttpRequestParser::State state = parser_.parse(data + used, len - used);
+            if (state == HttpRequestParser::State::Error) {
+                // the stream cannot be resynchronised after a malformed request
+                std::string json = "{\"error\":\"";
+                json += parser_.error();
+                json += "\"}";
+                writeHttpResponse(out, parser_.errorStatus(), json, false);
+                context.close = true;
+                return len;
+            }
+            if (state != HttpRequestParser::State::Complete)
+                break;
+            // the parser keeps its place, so a request left for later is not parsed again
+            if (answered == limit || !respond(data + used, answered, out, context)) {
+                // only the request it stopped at has been parsed, so that is all that counts as waiting
+                context.deferred = true;
+                if (admission_) {
+                    admission_->noteDeferred();
+                    admission_->queue(1);
+                    queued_ = true;
+                }
+                break;
+            }
+            used += parser_.size();
+            waiting_ = false;
+            const bool keepAlive = parser_.keepAlive();
+            parser_.reset();
+            if (!keepAlive) {
+                context.close = true;
+                return len;
+            }
+        }
+        return used;
+    }
+
+    void writeHttpResponse(SendQueue &out, const int status, const std::string &json, const bool keepAlive) {
+        char *const start = out.reserve(MAX_RESPONSE_HEAD + json.size());
+        char *length = nullptr;
+        char *p = head(start, status, keepAlive, length);
+        p = put(p, json.data(), json.size());
+        formatUint64(json.size(), length);
+        out.commit(static_cast<size_t>(p - start));
+    }
+}
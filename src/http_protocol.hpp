@@ -0,0 +1,176 @@
+/*
+ * http_protocol.hpp
+ *
+ * A minimal HTTP/1.1 front end to the query engine for clients that only speak HTTP, served by QueryServer alongside
+ * or instead of the binary protocol:
+ *
+ *     GET /lookup?name=NAME[&sex=F|M]
+ *     GET /rank?name=NAME&sex=F|M&year=YEAR
+ *     GET /prefix?prefix=PREFIX[&limit=N]
+ *     GET /top?year=YEAR&sex=F|M[&limit=N]
+ *     GET /stats
+ *
+ * Each answers {"rows":[{"name":...,"sex":...,"year":...,"count":...,"rank":...}, ...]} with the same rows and nulls
+ * as batch mode. Connections are kept alive and requests may be pipelined. Requests are parsed in place in the receive
+ * buffer by a resumable state machine, and the JSON is written from the dictionary arena straight into the send queue,
+ * its Content-Length filled in afterwards, so a response is formatted in one pass with no intermediate strings.
+ * Requests refused by admission control are answered 503 Service Unavailable, and /lookup and /prefix, which span
+ * every year, 501 Not Implemented by a server loading years lazily. /stats answers the server's latency report (see
+ * formatStatsJson()) and bypasses admission control, so it still answers under overload.
+ */
+
+#ifndef HTTP_PROTOCOL_HPP
+#define HTTP_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "admission.hpp"
+#include "latency.hpp"
+#include "lazy_years.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+namespace names {
+    /// Requests of one connection answered per turn when serving HTTP. Parsing and JSON make each cost several binary
+    /// requests, so the turns are shorter than ServerOptions' default to take about as long.
+    const size_t HTTP_TURN_ANSWERS = 8;
+
+    /// Parses one request head at a time. Everything it finds is recorded as offsets from the start of the request,
+    /// so parsing can stop at the end of what has arrived and resume later, even after the server has moved the
+    /// unconsumed bytes to the front of its buffer.
+    class HttpRequestParser {
+    public:
+        enum class State {
+            RequestLine,
+            Headers,
+            /// The head has been parsed but not all of the body has arrived.
+            Body,
+            Complete,
+            Error,
+        };
+
+        struct Span {
+            uint32_t begin;
+            uint32_t size;
+        };
+
+        /// Longest request head accepted. Longer ones are an error.
+        static const size_t MAX_HEAD = 8 << 10;
+        /// Largest request body accepted. The routes take no body, so this only bounds what is skipped.
+        static const size_t MAX_BODY = 64 << 10;
+
+    private:
+        State state_;
+        /// How far the request has been scanned.
+        size_t scanned_;
+        size_t headSize_;
+        uint64_t contentLength_;
+        Span method_;
+        Span target_;
+        bool keepAlive_;
+        int errorStatus_;
+        const char *error_;
+
+        /// Sets the error and returns State::Error.
+        State fail(int status, const char *error);
+        State requestLine(const char *line, size_t begin, size_t len);
+        State header(const char *line, size_t len);
+
+    public:
+        HttpRequestParser() {
+            reset();
+        }
+
+        /// Starts on a new request.
+        void reset();
+
+        /// Continues parsing the request at the start of [request, request + len), which begins with whatever was
+        /// passed before. Returns Complete once the whole request, body included, is there.
+        State parse(const char *request, size_t len);
+
+        State state() const {
+            return state_;
+        }
+
+        /// The complete request's size, body included.
+        size_t size() const {
+            return headSize_ + static_cast<size_t>(contentLength_);
+        }
+
+        Span method() const {
+            return method_;
+        }
+
+        Span target() const {
+            return target_;
+        }
+
+        /// Whether the connection stays open after the response: HTTP/1.1 unless "Connection: close", HTTP/1.0 only
+        /// with "Connection: keep-alive".
+        bool keepAlive() const {
+            return keepAlive_;
+        }
+
+        /// The status to answer with and what was wrong, once parse() has returned Error.
+        int errorStatus() const {
+            return errorStatus_;
+        }
+
+        const char *error() const {
+            return error_;
+        }
+    };
+
+    class HttpHandler : public ProtocolHandler {
+        const QueryEngine &engine_;
+        AdmissionController *admission_;
+        QueryMetrics *metrics_;
+        LazyYearStore *lazy_;
+        HttpRequestParser parser_;
+        /// The percent-decoded name or prefix. Values without escapes are used in place.
+        std::string decoded_;
+        std::vector<QueryRow> rows_;
+        /// Whether a complete request was left for the next turn, and counted as waiting with admission.
+        bool queued_;
+        /// Whether the request left for the next turn waits for its year to load, making it a cache miss.
+        bool waiting_;
+
+        /// Answers the complete request at request, the answered'th of this turn. Returns false, having written
+        /// nothing, if the request has to wait for a later turn.
+        bool respond(const char *request, size_t answered, SendQueue &out, ConsumeContext &context);
+
+        /// Fills query from the path and parameters of a GET target. Returns 200, or the status to answer with and
+        /// the error.
+        int route(const char *target, size_t len, Query &query, const char *&error);
+
+    public:
+        /// Requests are let in by admission, if given, and answered ones recorded in metrics, if given, which also
+        /// enables GET /stats. With lazy, /rank and /top are answered from its years and /lookup and /prefix are
+        /// refused. A request for a year still loading parks the connection, so the server must be resumed from
+        /// LazyYearStore::onLoaded(). All must outlive the handler.
+        explicit HttpHandler(const QueryEngine &engine, AdmissionController *admission = nullptr,
+                             QueryMetrics *metrics = nullptr, LazyYearStore *lazy = nullptr)
+            : engine_(engine),
+              admission_(admission),
+              metrics_(metrics),
+              lazy_(lazy),
+              queued_(false),
+              waiting_(false) {
+        }
+
+        ~HttpHandler() override {
+            if (queued_)
+                admission_->unqueue(1);
+        }
+
+        size_t consume(const char *data, size_t len, SendQueue &out, ConsumeContext &context) override;
+    };
+
+    /// Writes an HTTP/1.1 response with a JSON body to out. For errors and anything outside the query routes.
+    void writeHttpResponse(SendQueue &out, int status, const std::string &json, bool keepAlive);
+}
+
+#endif //HTTP_PROTOCOL_HPP
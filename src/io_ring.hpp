@@ -0,0 +1,218 @@
+/*
+ * io_ring.hpp
+ *
+ * The bare minimum of liburing, for the loaders and readers that overlap file reads through io_uring: one submission
+ * and one completion ring set up with raw system calls. Only available where the kernel headers are, which
+ * NAMES_HAVE_IO_URING says; everything using it needs a fallback.
+ */
+
+#ifndef IO_RING_HPP
+#define IO_RING_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NAMES_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#endif
+
+#ifdef NAMES_HAVE_IO_URING
+namespace names {
+    /// One submission and one completion ring. Queueing and submitting must stay on one thread at a time.
+    class IoRing {
+        int fd_;
+        unsigned entries_;
+        void *sqMap_;
+        size_t sqMapSize_;
+        void *cqMap_;
+        size_t cqMapSize_;
+        io_uring_sqe *sqes_;
+        size_t sqesSize_;
+        unsigned *sqTail_;
+        unsigned *sqMask_;
+        unsigned *sqArray_;
+        unsigned *cqHead_;
+        unsigned *cqTail_;
+        unsigned *cqMask_;
+        io_uring_cqe *cqes_;
+        unsigned queued_;
+
+    public:
+        IoRing()
+            : fd_(-1),
+              entries_(0),
+              sqMap_(MAP_FAILED),
+              sqMapSize_(0),
+              cqMap_(MAP_FAILED),
+              cqMapSize_(0),
+              sqes_(nullptr),
+              sqesSize_(0),
+              queued_(0) {
+        }
+
+        ~IoRing() {
+            if (sqes_)
+                munmap(sqes_, sqesSize_);
+            if (cqMap_ != MAP_FAILED && cqMap_ != sqMap_)
+                munmap(cqMap_, cqMapSize_);
+            if (sqMap_ != MAP_FAILED)
+                munmap(sqMap_, sqMapSize_);
+            if (fd_ >= 0)
+                close(fd_);
+        }
+
+        IoRing(const IoRing &) = delete;
+
+        IoRing &operator=(const IoRing &) = delete;
+
+        /// Returns false, leaving errno set, if the kernel refuses (too old, or io_uring disabled by policy).
+        bool open(const unsigned depth) {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+            if (fd_ < 0)
+                return false;
+            entries_ = params.sq_entries;
+
+            sqMapSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqMapSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single)
+                sqMapSize_ = cqMapSize_ = std::max(sqMapSize_, cqMapSize_);
+            sqMap_ = mmap(nullptr, sqMapSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                          IORING_OFF_SQ_RING);
+            if (sqMap_ == MAP_FAILED)
+                return false;
+            cqMap_ = single
+                         ? sqMap_
+                         : mmap(nullptr, cqMapSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                IORING_OFF_CQ_RING);
+            if (cqMap_ == MAP_FAILED)
+                return false;
+            sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+            void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                              IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+                return false;
+            sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+            char *sq = static_cast<char *>(sqMap_);
+            char *cq = static_cast<char *>(cqMap_);
+            sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            sqMask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cqMask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        unsigned entries() const {
+            return entries_;
+        }
+
+        /// Registers buffers for READ_FIXED. Returns false if the kernel refuses, e.g. over RLIMIT_MEMLOCK.
+        bool registerBuffers(const std::vector<iovec> &buffers) {
+            return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                           static_cast<unsigned>(buffers.size())) == 0;
+        }
+
+        /// Queues a read of len bytes at offset into dest. A non-negative fixedIndex names a registered buffer
+        /// that dest lies in. The caller never queues more than entries() operations between submits.
+        void queueRead(const int fd, char *dest, const unsigned len, const uint64_t offset, const int fixedIndex,
+                       const uint64_t userData) {
+            const unsigned tail = *sqTail_;
+            const unsigned index = tail & *sqMask_;
+            io_uring_sqe &sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = fixedIndex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.off = offset;
+            sqe.addr = reinterpret_cast<uint64_t>(dest);
+            sqe.len = len;
+            if (fixedIndex >= 0)
+                sqe.buf_index = static_cast<uint16_t>(fixedIndex);
+            sqe.user_data = userData;
+            sqArray_[index] = index;
+            // publish the entry before the kernel can see the new tail
+            __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+            ++queued_;
+        }
+
+        /// Queues an operation that does nothing but complete with userData, to wake a thread blocked in wait().
+        void queueNop(const uint64_t userData) {
+            const unsigned tail = *sqTail_;
+            const unsigned index = tail & *sqMask_;
+            io_uring_sqe &sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_NOP;
+            sqe.user_data = userData;
+            sqArray_[index] = index;
+            __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+            ++queued_;
+        }
+
+        /// Submits everything queued and, if wait is set, blocks until at least one completion is available.
+        void submit(const bool wait) {
+            for (;;) {
+                const long rc = syscall(__NR_io_uring_enter, fd_, queued_, wait ? 1u : 0u,
+                                        wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+                if (rc >= 0) {
+                    queued_ -= static_cast<unsigned>(rc);
+                    if (!queued_)
+                        return;
+                } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+                }
+            }
+        }
+
+        /// Blocks until at least one completion is available, without submitting anything. Unlike the other calls this
+        /// may run on a second thread, alongside one that queues and submits.
+        void wait() {
+            while (syscall(__NR_io_uring_enter, fd_, 0u, 1u, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+        }
+
+        /// Calls fn(userData, result) for every available completion.
+        template<typename Fn>
+        void reap(Fn fn) {
+            unsigned head = *cqHead_;
+            const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe &cqe = cqes_[head & *cqMask_];
+                fn(cqe.user_data, cqe.res);
+            }
+            // release the slots only after the entries have been read
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        }
+    };
+
+    /// Opens the ring, or returns nullptr if io_uring is not usable here.
+    inline std::unique_ptr<IoRing> openIoRing(const size_t depth) {
+        std::unique_ptr<IoRing> ring(new IoRing());
+        if (!ring->open(static_cast<unsigned>(std::max<size_t>(depth, 1))))
+            return std::unique_ptr<IoRing>();
+        return ring;
+    }
+}
+#endif
+
+#endif //IO_RING_HPP
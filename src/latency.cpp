@@ -0,0 +1,244 @@
+#include "latency.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+namespace names {
+    // ---- LatencyHistogram ---- //
+
+    size_t LatencyHistogram::bucketOf(const uint64_t value) {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        // the top SUB_BUCKET_BITS + 1 bits: the leading one picks the power of two, the rest the bucket within it
+        const unsigned shift = static_cast<unsigned>(std::bit_width(value)) - 1 - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<size_t>(value >> shift & (SUB_BUCKETS - 1));
+    }
+
+    uint64_t LatencyHistogram::bucketLow(const size_t bucket) {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS - 1);
+        return static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+
+    uint64_t LatencyHistogram::bucketHigh(const size_t bucket) {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS - 1);
+        return bucketLow(bucket) + ((uint64_t(1) << shift) - 1);
+    }
+
+    LatencyHistogram::LatencyHistogram()
+        : counts_(BUCKETS, 0),
+          count_(0),
+          sum_(0),
+          max_(0) {
+    }
+
+    void LatencyHistogram::record(const uint64_t value, const uint64_t times) {
+        counts_[bucketOf(value)] += times;
+        count_ += times;
+        sum_ += value * times;
+        max_ = std::max(max_, value);
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t LatencyHistogram::quantile(const double q) const {
+        if (!count_)
+            return 0;
+        const double wanted = std::ceil(std::min(std::max(q, 0.0), 1.0) * static_cast<double>(count_));
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(wanted));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank)
+                return std::min(bucketHigh(i), max_);
+        }
+        return max_;
+    }
+
+    // ---- QueryMetrics ---- //
+
+    namespace {
+        std::atomic<uint64_t> nextMetricsId(1);
+
+        /// The shards the calling thread has been given, by the ID of the metrics they belong to.
+        struct LocalShard {
+            uint64_t owner;
+            void *shard;
+        };
+
+        thread_local std::vector<LocalShard> localShards;
+
+        void bump(std::atomic<uint64_t> &counter, const uint64_t by) {
+            // only the owning thread writes, so no read-modify-write is needed
+            counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        }
+    }
+
+    QueryMetrics::Shard::Shard() {
+        for (size_t t = 0; t < TYPES; ++t) {
+            for (std::atomic<uint64_t> &count: counts[t])
+                count.store(0, std::memory_order_relaxed);
+            sums[t].store(0, std::memory_order_relaxed);
+            maxes[t].store(0, std::memory_order_relaxed);
+        }
+        cacheHits.store(0, std::memory_order_relaxed);
+        cacheMisses.store(0, std::memory_order_relaxed);
+    }
+
+    QueryMetrics::QueryMetrics()
+        : id_(nextMetricsId++),
+          started_(std::chrono::steady_clock::now()) {
+    }
+
+    QueryMetrics::Shard &QueryMetrics::local() {
+        for (const LocalShard &local: localShards) {
+            if (local.owner == id_)
+                return *static_cast<Shard *>(local.shard);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+        const LocalShard local = {id_, shards_.back().get()};
+        localShards.push_back(local);
+        return *shards_.back();
+    }
+
+    void QueryMetrics::record(const QueryType type, const uint64_t nanos, const uint64_t count) {
+        Shard &shard = local();
+        const size_t t = static_cast<size_t>(type);
+        bump(shard.counts[t][LatencyHistogram::bucketOf(nanos)], count);
+        bump(shard.sums[t], nanos * count);
+        if (nanos > shard.maxes[t].load(std::memory_order_relaxed))
+            shard.maxes[t].store(nanos, std::memory_order_relaxed);
+    }
+
+    LatencyHistogram QueryMetrics::histogram(const QueryType type) const {
+        const size_t t = static_cast<size_t>(type);
+        LatencyHistogram merged;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::unique_ptr<Shard> &shard: shards_) {
+            for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+                const uint64_t count = shard->counts[t][i].load(std::memory_order_relaxed);
+                merged.counts_[i] += count;
+                merged.count_ += count;
+            }
+            merged.sum_ += shard->sums[t].load(std::memory_order_relaxed);
+            merged.max_ = std::max(merged.max_, shard->maxes[t].load(std::memory_order_relaxed));
+        }
+        return merged;
+    }
+
+    uint64_t QueryMetrics::cacheHits() const {
+        uint64_t total = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::unique_ptr<Shard> &shard: shards_)
+            total += shard->cacheHits.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t QueryMetrics::cacheMisses() const {
+        uint64_t total = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::unique_ptr<Shard> &shard: shards_)
+            total += shard->cacheMisses.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    double QueryMetrics::uptime() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+    }
+
+    // ---- Reports ---- //
+
+    namespace {
+        struct TypeStats {
+            QueryType type;
+            LatencyHistogram histogram;
+        };
+
+        std::vector<TypeStats> collect(const QueryMetrics &metrics) {
+            std::vector<TypeStats> types;
+            for (size_t t = 0; t <= static_cast<size_t>(QueryType::Invalid); ++t) {
+                TypeStats stats;
+                stats.type = static_cast<QueryType>(t);
+                stats.histogram = metrics.histogram(stats.type);
+                types.push_back(stats);
+            }
+            return types;
+        }
+
+        double micros(const uint64_t nanos) {
+            return static_cast<double>(nanos) / 1000.0;
+        }
+
+        void appendf(std::string &out, const char *format, ...) {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            const int n = std::vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            out.append(buffer, static_cast<size_t>(std::max(0, std::min<int>(n, sizeof(buffer) - 1))));
+        }
+    }
+
+    std::string formatStatsJson(const QueryMetrics &metrics, const size_t corpusBytes) {
+        const double uptime = std::max(metrics.uptime(), 1e-9);
+        const std::vector<TypeStats> types = collect(metrics);
+        std::string json = "{\"queries\":{";
+        uint64_t total = 0;
+        for (size_t i = 0; i < types.size(); ++i) {
+            const LatencyHistogram &histogram = types[i].histogram;
+            total += histogram.count();
+            appendf(json, "%s\"%s\":{\"count\":%llu,\"qps\":%.1f,\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}",
+                    i ? "," : "", queryTypeName(types[i].type), static_cast<unsigned long long>(histogram.count()),
+                    static_cast<double>(histogram.count()) / uptime, micros(histogram.quantile(0.5)),
+                    micros(histogram.quantile(0.99)), micros(histogram.quantile(0.999)), micros(histogram.max()));
+        }
+        appendf(json, "},\"uptime\":%.3f,\"qps\":%.1f,\"cacheHitRate\":", uptime, static_cast<double>(total) / uptime);
+        const uint64_t hits = metrics.cacheHits();
+        const uint64_t lookups = hits + metrics.cacheMisses();
+        if (lookups)
+            appendf(json, "%.4f", static_cast<double>(hits) / static_cast<double>(lookups));
+        else
+            json += "null";
+        appendf(json, ",\"corpusBytes\":%llu}", static_cast<unsigned long long>(corpusBytes));
+        return json;
+    }
+
+    std::string formatStatsText(const QueryMetrics &metrics, const size_t corpusBytes) {
+        const double uptime = std::max(metrics.uptime(), 1e-9);
+        const std::vector<TypeStats> types = collect(metrics);
+        std::string text;
+        appendf(text, "%-8s %12s %10s %10s %10s %10s %10s\n", "query", "count", "qps", "p50 us", "p99 us", "p999 us",
+                "max us");
+        uint64_t total = 0;
+        for (const TypeStats &stats: types) {
+            const LatencyHistogram &histogram = stats.histogram;
+            total += histogram.count();
+            if (!histogram.count())
+                continue;
+            appendf(text, "%-8s %12llu %10.1f %10.3f %10.3f %10.3f %10.3f\n", queryTypeName(stats.type),
+                    static_cast<unsigned long long>(histogram.count()), static_cast<double>(histogram.count()) / uptime,
+                    micros(histogram.quantile(0.5)), micros(histogram.quantile(0.99)),
+                    micros(histogram.quantile(0.999)), micros(histogram.max()));
+        }
+        appendf(text, "%.1f queries/s over %.1f s", static_cast<double>(total) / uptime, uptime);
+        const uint64_t hits = metrics.cacheHits();
+        const uint64_t lookups = hits + metrics.cacheMisses();
+        if (lookups)
+            appendf(text, ", cache hit rate %.2f%%", 100.0 * static_cast<double>(hits) / static_cast<double>(lookups));
+        appendf(text, ", corpus %llu bytes\n", static_cast<unsigned long long>(corpusBytes));
+        return text;
+    }
+}
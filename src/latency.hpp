@@ -0,0 +1,137 @@
+/*
+ * latency.hpp
+ *
+ * Latency accounting for the serving layer. Every query answered is recorded in a log-linear histogram for its type:
+ * values below 16 ns get a bucket each, and every power of two above is split into 16 equal buckets, so any recorded
+ * latency is known to within 1/16th of itself while a histogram stays a fixed 976 counters. Each thread records into
+ * histograms of its own with plain relaxed stores, so recording costs a few instructions and never waits on another
+ * thread; a report merges every thread's histograms as it is taken.
+ */
+
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "query.hpp"
+
+namespace names {
+    /// Counts of values in log-linear buckets, for reporting; see QueryMetrics for recording from many threads.
+    class LatencyHistogram {
+    public:
+        static const unsigned SUB_BUCKET_BITS = 4;
+        static const size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+        static const size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        static size_t bucketOf(uint64_t value);
+
+        /// The smallest and largest values that land in bucket.
+        static uint64_t bucketLow(size_t bucket);
+        static uint64_t bucketHigh(size_t bucket);
+
+    private:
+        std::vector<uint64_t> counts_;
+        uint64_t count_;
+        uint64_t sum_;
+        uint64_t max_;
+
+    public:
+        LatencyHistogram();
+
+        /// Records value times times.
+        void record(uint64_t value, uint64_t times = 1);
+
+        void merge(const LatencyHistogram &other);
+
+        uint64_t count() const {
+            return count_;
+        }
+
+        uint64_t max() const {
+            return max_;
+        }
+
+        double mean() const {
+            return count_ ? static_cast<double>(sum_) / static_cast<double>(count_) : 0.0;
+        }
+
+        /// The smallest value at least q (in [0, 1]) of the recorded values are no greater than, rounded up to the end
+        /// of its bucket but never past the largest value recorded. 0 if nothing has been recorded.
+        uint64_t quantile(double q) const;
+
+        friend class QueryMetrics;
+    };
+
+    /// Per-thread latency histograms for each query type, plus the hit counts of whatever cache sits in front of the
+    /// engine, shared by every handler of a server.
+    class QueryMetrics {
+        static const size_t TYPES = static_cast<size_t>(QueryType::Invalid) + 1;
+
+        struct Shard {
+            std::atomic<uint64_t> counts[TYPES][LatencyHistogram::BUCKETS];
+            std::atomic<uint64_t> sums[TYPES];
+            std::atomic<uint64_t> maxes[TYPES];
+            std::atomic<uint64_t> cacheHits;
+            std::atomic<uint64_t> cacheMisses;
+
+            Shard();
+        };
+
+        /// Distinguishes this instance in the threads' caches of their shards, even once another takes its address.
+        uint64_t id_;
+        std::chrono::steady_clock::time_point started_;
+        mutable std::mutex mutex_;
+        std::vector<std::unique_ptr<Shard> > shards_;
+
+        /// The calling thread's shard, created on its first use.
+        Shard &local();
+
+    public:
+        QueryMetrics();
+
+        QueryMetrics(const QueryMetrics &) = delete;
+
+        QueryMetrics &operator=(const QueryMetrics &) = delete;
+
+        /// Records count queries of a type that each took nanos.
+        void record(QueryType type, uint64_t nanos, uint64_t count = 1);
+
+        /// A query served from lazily loaded years found its year in memory.
+        void noteCacheHit() {
+            Shard &shard = local();
+            shard.cacheHits.store(shard.cacheHits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        /// A query served from lazily loaded years had to wait for its year to be read.
+        void noteCacheMiss() {
+            Shard &shard = local();
+            shard.cacheMisses.store(shard.cacheMisses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        /// Every thread's histogram for a type, merged.
+        LatencyHistogram histogram(QueryType type) const;
+
+        uint64_t cacheHits() const;
+        uint64_t cacheMisses() const;
+
+        /// Seconds since the metrics were created.
+        double uptime() const;
+    };
+
+    /// Formats the `stats` report: per query type the count, QPS over the uptime and p50/p99/p999/max in
+    /// microseconds, then the overall QPS, the cache hit rate (null without cache traffic, as when every year is loaded
+    /// up front) and corpusBytes, as JSON.
+    std::string formatStatsJson(const QueryMetrics &metrics, size_t corpusBytes);
+
+    /// The same report as text, one line per query type, for the console.
+    std::string formatStatsText(const QueryMetrics &metrics, size_t corpusBytes);
+}
+
+#endif //LATENCY_HPP
@@ -0,0 +1,157 @@
+#include "lazy_years.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace names {
+    LazyYearStore::LazyYearStore(std::string dir, const int firstYear, const int lastYear, AsyncFileReader &reader,
+                                 TaskPool &pool)
+        : dir_(std::move(dir)),
+          firstYear_(firstYear),
+          reader_(reader),
+          pool_(pool),
+          loads_(0) {
+        for (int year = firstYear; year <= lastYear; ++year)
+            slots_.push_back(std::unique_ptr<Slot>(new Slot()));
+    }
+
+    LazyYearStore::Slot *LazyYearStore::slot(const int year) const {
+        if (year < firstYear_ || year - firstYear_ >= static_cast<int>(slots_.size()))
+            return nullptr;
+        return slots_[static_cast<size_t>(year - firstYear_)].get();
+    }
+
+    const LoadedYear *LazyYearStore::find(const int year) const {
+        const Slot *found = slot(year);
+        return found ? found->ready.load(std::memory_order_acquire) : nullptr;
+    }
+
+    Async<const LoadedYear *> LazyYearStore::load(const int year) {
+        Slot *found = slot(year);
+        if (!found) {
+            std::stringstream message;
+            message << "year " << year << " is outside the store";
+            throw std::out_of_range(message.str());
+        }
+        Slot &entry = *found;
+        if (const LoadedYear *ready = entry.ready.load(std::memory_order_acquire))
+            co_return ready;
+
+        std::shared_ptr<PendingLoad> pending;
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> lock(entry.mutex);
+            if (const LoadedYear *ready = entry.ready.load(std::memory_order_acquire))
+                co_return ready;
+            if (!entry.pending) {
+                entry.pending = std::make_shared<PendingLoad>(pool_);
+                first = true;
+            }
+            pending = entry.pending;
+        }
+
+        if (first) {
+            try {
+                std::stringstream path;
+                path << dir_ << "/yob" << year << ".txt";
+                const std::string data = co_await reader_.read(path.str());
+                std::unique_ptr<LoadedYear> loaded(new LoadedYear());
+                loadYearData(loaded->corpus, year, data.data(), data.size());
+                loaded->engine.reset(new QueryEngine(loaded->corpus));
+                std::lock_guard<std::mutex> lock(entry.mutex);
+                entry.year = std::move(loaded);
+                entry.ready.store(entry.year.get(), std::memory_order_release);
+                entry.failed.store(false, std::memory_order_relaxed);
+            } catch (...) {
+                pending->error = std::current_exception();
+            }
+            loads_.fetch_add(1, std::memory_order_relaxed);
+            {
+                // the next caller of load() starts afresh, which after a failure means trying again; request() sees
+                // the failure first, so it never starts the load again
+                std::lock_guard<std::mutex> lock(entry.mutex);
+                if (pending->error)
+                    entry.failed.store(true, std::memory_order_release);
+                entry.pending.reset();
+            }
+            pending->done.set();
+            {
+                std::lock_guard<std::mutex> lock(listenerMutex_);
+                if (listener_)
+                    listener_();
+            }
+        } else {
+            co_await pending->done.wait();
+        }
+        if (pending->error)
+            std::rethrow_exception(pending->error);
+        co_return entry.ready.load(std::memory_order_acquire);
+    }
+
+    Async<void> LazyYearStore::warm(const int year) {
+        try {
+            co_await load(year);
+        } catch (const std::exception &) {
+            // load() has marked the year as failed
+        }
+    }
+
+    YearState LazyYearStore::request(const int year) {
+        Slot *found = slot(year);
+        if (!found || found->failed.load(std::memory_order_acquire))
+            return YearState::Missing;
+        if (found->ready.load(std::memory_order_acquire))
+            return YearState::Resident;
+        bool loading;
+        {
+            std::lock_guard<std::mutex> lock(found->mutex);
+            loading = found->pending != nullptr;
+        }
+        // the load runs here until it first suspends, so by the time spawn() returns it is pending or has finished;
+        // two threads racing to start it both join the same load
+        if (!loading)
+            warming_.spawn(warm(year));
+        if (found->failed.load(std::memory_order_acquire))
+            return YearState::Missing;
+        return found->ready.load(std::memory_order_acquire) ? YearState::Resident : YearState::Loading;
+    }
+
+    void LazyYearStore::onLoaded(std::function<void()> listener) {
+        std::lock_guard<std::mutex> lock(listenerMutex_);
+        listener_ = std::move(listener);
+    }
+
+    MemoryFootprint LazyYearStore::footprint() const {
+        MemoryFootprint store("resident years");
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            const LoadedYear *year = slots_[i]->ready.load(std::memory_order_acquire);
+            if (!year)
+                continue;
+            MemoryFootprint loaded(std::to_string(firstYear_ + static_cast<int>(i)));
+            loaded.add(year->corpus.footprint());
+            loaded.add(year->engine->footprint());
+            store.add(loaded);
+        }
+        return store;
+    }
+
+    const LoadedYear *LazyYearStore::tryAnswer(const Query &query, std::vector<QueryRow> &rows) const {
+        if (query.type != QueryType::Rank && query.type != QueryType::Top)
+            return nullptr;
+        const LoadedYear *year = find(query.year);
+        if (year)
+            year->engine->run(query, rows);
+        return year;
+    }
+
+    Async<const LoadedYear *> LazyYearStore::answer(const Query &query, std::vector<QueryRow> &rows) {
+        if (query.type != QueryType::Rank && query.type != QueryType::Top) {
+            throw std::invalid_argument(std::string("a lazily loaded year cannot answer a ") +
+                                        queryTypeName(query.type) + " query");
+        }
+        const LoadedYear *year = co_await load(query.year);
+        year->engine->run(query, rows);
+        co_return year;
+    }
+}
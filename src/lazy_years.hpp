@@ -0,0 +1,128 @@
+/*
+ * lazy_years.hpp
+ *
+ * Queries over a directory of yob files that are only read when a query first needs them. Each year is loaded into a
+ * corpus and query engine of its own, so loading one never disturbs queries running against another. A query whose
+ * year is already in memory is answered on the spot; one whose year is not suspends until the file has been read
+ * through an AsyncFileReader and parsed, without holding a thread meanwhile, and queries arriving for a year already
+ * being loaded wait for that same load. Callers that cannot suspend, such as the server's event loops, ask for a year
+ * with request() instead and come back for it once it is in memory.
+ */
+
+#ifndef LAZY_YEARS_HPP
+#define LAZY_YEARS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "async_io.hpp"
+#include "coroutine.hpp"
+#include "corpus.hpp"
+#include "query.hpp"
+
+namespace names {
+    /// One year, loaded on its own.
+    struct LoadedYear {
+        Corpus corpus;
+        std::unique_ptr<QueryEngine> engine;
+    };
+
+    /// Where a year of a LazyYearStore stands.
+    enum class YearState {
+        /// In memory; tryAnswer() answers it.
+        Resident,
+        /// Being read or parsed.
+        Loading,
+        /// Outside the store's range, or its file could not be read or parsed.
+        Missing,
+    };
+
+    class LazyYearStore {
+        /// A load in progress, shared by every coroutine waiting for it.
+        struct PendingLoad {
+            AsyncEvent done;
+            std::exception_ptr error;
+
+            explicit PendingLoad(TaskPool &pool)
+                : done(pool) {
+            }
+        };
+
+        struct Slot {
+            std::atomic<const LoadedYear *> ready;
+            std::unique_ptr<LoadedYear> year;
+            std::mutex mutex;
+            std::shared_ptr<PendingLoad> pending;
+            /// Whether the last load failed, which request() takes as final. Set before the load stops being pending.
+            std::atomic<bool> failed;
+
+            Slot()
+                : ready(nullptr),
+                  failed(false) {
+            }
+        };
+
+        std::string dir_;
+        int firstYear_;
+        AsyncFileReader &reader_;
+        TaskPool &pool_;
+        std::vector<std::unique_ptr<Slot> > slots_;
+        std::atomic<uint64_t> loads_;
+        /// Called whenever a load finishes; see onLoaded().
+        std::function<void()> listener_;
+        std::mutex listenerMutex_;
+        /// Loads started by request(), which nothing waits for until the store is destroyed.
+        AsyncScope warming_;
+
+        Slot *slot(int year) const;
+
+        /// Loads year for request(), which learns of a failure from the slot.
+        Async<void> warm(int year);
+
+    public:
+        /// Serves the years [firstYear, lastYear] from dir/yobYEAR.txt, reading through reader and resuming on pool.
+        LazyYearStore(std::string dir, int firstYear, int lastYear, AsyncFileReader &reader,
+                      TaskPool &pool = TaskPool::shared());
+
+        /// The year if it is already in memory, else nullptr. Never blocks.
+        const LoadedYear *find(int year) const;
+
+        /// The year, loading it first if need be. Throws std::out_of_range for a year outside the store's range, and
+        /// std::runtime_error if the file cannot be read or parsed; a later call tries again.
+        Async<const LoadedYear *> load(int year);
+
+        /// Where year stands, starting to load it in the background if it is neither in memory nor known to be
+        /// missing. Never blocks; the load continues on the pool.
+        YearState request(int year);
+
+        /// Has listener called, on the thread that finished it, each time a year has been loaded or has failed to, so
+        /// callers of request() know when to ask again. Passing an empty function stops the calls; once onLoaded()
+        /// returns, the previous listener is no longer running.
+        void onLoaded(std::function<void()> listener);
+
+        /// The synchronous fast path: answers a query about a year already in memory, appending its rows, and returns
+        /// the year its name IDs refer to. Returns nullptr, touching nothing, if the year has to be loaded first.
+        const LoadedYear *tryAnswer(const Query &query, std::vector<QueryRow> &rows) const;
+
+        /// Answers a rank or top query, loading its year if need be, and returns the year its rows' name IDs refer
+        /// to. Throws std::invalid_argument for other query types, which span every year.
+        Async<const LoadedYear *> answer(const Query &query, std::vector<QueryRow> &rows);
+
+        /// Every year in memory, each with its corpus and indexes.
+        MemoryFootprint footprint() const;
+
+        /// Years read from disk so far.
+        uint64_t loads() const {
+            return loads_.load(std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif //LAZY_YEARS_HPP
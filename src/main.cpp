@@ -1,8 +1,23 @@
+#include <cstring>
 #include <iostream>
+#include "batch.hpp"
+#include "binary_protocol.hpp"
+#include "footprint.hpp"
 #include "ktest.hpp"
+#include "server.hpp"
+
+int main(const int argc, char **argv) {
+    // the subcommands answer queries instead of running the tests
+    if (argc > 1 && !std::strcmp(argv[1], "batch"))
+        return names::batchMain(argc - 1, argv + 1);
+    if (argc > 1 && !std::strcmp(argv[1], "serve"))
+        return names::serveMain(argc - 1, argv + 1);
+    if (argc > 1 && !std::strcmp(argv[1], "load"))
+        return names::loadMain(argc - 1, argv + 1);
+    if (argc > 1 && !std::strcmp(argv[1], "memory"))
+        return names::memoryMain(argc - 1, argv + 1);
 
-int main() {
     ktest::runAllTests();
     std::cout << "Hello, World!" << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,95 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "corpus.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    MappedFile::MappedFile(const std::string &path, const MappingHints &hints)
+        : data_(nullptr),
+          size_(0),
+          mapped_(false) {
+#ifdef __unix__
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("unable to open " + path + ": " + std::strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("unable to stat " + path + ": " + std::strerror(err));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_) {
+            void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | (hints.populate ? MAP_POPULATE : 0), fd, 0);
+            if (addr == MAP_FAILED) {
+                const int err = errno;
+                close(fd);
+                throw std::runtime_error("unable to map " + path + ": " + std::strerror(err));
+            }
+            data_ = static_cast<const char *>(addr);
+            mapped_ = true;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+            if (hints.hugePages == HugePages::Disabled)
+                madvise(addr, size_, MADV_NOHUGEPAGE);
+            else if (hints.hugePages != HugePages::Default)
+                madvise(addr, size_, MADV_HUGEPAGE);
+#endif
+            if (hints.willNeed)
+                madvise(addr, size_, MADV_WILLNEED);
+        }
+        close(fd);
+#else
+        static_cast<void>(hints);
+        buffer_ = readFile(path);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+        release();
+    }
+
+    void MappedFile::release() {
+#ifdef __unix__
+        if (mapped_)
+            munmap(const_cast<char *>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+        buffer_.clear();
+    }
+
+    MappedFile::MappedFile(MappedFile &&other) noexcept
+        : data_(nullptr),
+          size_(0),
+          mapped_(false) {
+        *this = std::move(other);
+    }
+
+    MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+        if (this == &other)
+            return *this;
+        release();
+        mapped_ = other.mapped_;
+        size_ = other.size_;
+        buffer_ = std::move(other.buffer_);
+        data_ = mapped_ ? other.data_ : buffer_.data();
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+        return *this;
+    }
+}
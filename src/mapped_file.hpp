@@ -0,0 +1,56 @@
+/*
+ * mapped_file.hpp
+ *
+ * Read-only view of a whole file. Uses mmap on POSIX systems so large snapshots and logs are paged in on demand, and
+ * falls back to reading the file into memory elsewhere.
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "page_memory.hpp"
+
+namespace names {
+    class MappedFile {
+        const char *data_;
+        size_t size_;
+        bool mapped_;
+        std::string buffer_;
+
+        void release();
+
+    public:
+        MappedFile()
+            : data_(nullptr),
+              size_(0),
+              mapped_(false) {
+        }
+
+        /// Maps the given file. Throws std::runtime_error if it cannot be opened. File mappings cannot use MAP_HUGETLB,
+        /// so either huge page mode only asks for transparent huge pages, which the kernel may not support for files.
+        explicit MappedFile(const std::string &path, const MappingHints &hints = MappingHints());
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        MappedFile(MappedFile &&other) noexcept;
+
+        MappedFile &operator=(MappedFile &&other) noexcept;
+
+        const char *data() const {
+            return data_;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+    };
+}
+
+#endif //MAPPED_FILE_HPP
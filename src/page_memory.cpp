@@ -0,0 +1,82 @@
+#include "page_memory.hpp"
+
+#include <cstdint>
+#include <mutex>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+namespace names {
+    namespace {
+        std::mutex hintsMutex;
+        MappingHints currentHints;
+
+        size_t roundToLargePages(const size_t bytes) {
+            return (bytes + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE;
+        }
+    }
+
+    void setArenaHints(const MappingHints &hints) {
+        std::lock_guard<std::mutex> lock(hintsMutex);
+        currentHints = hints;
+    }
+
+    MappingHints arenaHints() {
+        std::lock_guard<std::mutex> lock(hintsMutex);
+        return currentHints;
+    }
+
+#ifdef __unix__
+    void *mapPages(const size_t bytes, const MappingHints &hints) {
+        const size_t length = roundToLargePages(bytes);
+#ifdef MAP_HUGETLB
+        if (hints.hugePages == HugePages::Explicit) {
+            // huge page mappings come back aligned to the huge page size
+            void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (hints.populate ? MAP_POPULATE : 0), -1, 0);
+            if (p != MAP_FAILED)
+                return p;
+        }
+#endif
+
+        // over-map by one large page and trim, so the region can be backed by huge pages from its first byte
+        void *raw = mmap(nullptr, length + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                         0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+        const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        const uintptr_t aligned = (start + LARGE_PAGE_SIZE - 1) & ~(uintptr_t(LARGE_PAGE_SIZE) - 1);
+        if (aligned > start)
+            munmap(raw, aligned - start);
+        if (start + LARGE_PAGE_SIZE > aligned)
+            munmap(reinterpret_cast<void *>(aligned + length), start + LARGE_PAGE_SIZE - aligned);
+        char *p = reinterpret_cast<char *>(aligned);
+
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+        if (hints.hugePages == HugePages::Disabled)
+            madvise(p, length, MADV_NOHUGEPAGE);
+        else if (hints.hugePages != HugePages::Default)
+            madvise(p, length, MADV_HUGEPAGE);
+#endif
+        if (hints.populate) {
+            // MAP_POPULATE would have faulted the pages in before the advice above, so touch them now instead
+            for (size_t offset = 0; offset < length; offset += 4096)
+                static_cast<volatile char *>(p)[offset] = 0;
+        }
+        return p;
+    }
+
+    void unmapPages(void *p, const size_t bytes) {
+        munmap(p, roundToLargePages(bytes));
+    }
+#else
+    void *mapPages(const size_t bytes, const MappingHints &) {
+        return ::operator new(roundToLargePages(bytes));
+    }
+
+    void unmapPages(void *p, size_t) {
+        ::operator delete(p);
+    }
+#endif
+}
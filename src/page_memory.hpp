@@ -0,0 +1,101 @@
+/*
+ * page_memory.hpp
+ *
+ * Page-level control over large allocations and file mappings. Random lookups into big arrays such as the dictionary's
+ * hash table miss the TLB on nearly every probe with 4 KiB pages; backing them with 2 MiB pages and pre-faulting them
+ * keeps those misses down. Everything here is a hint: where the system cannot honour it, memory is still returned.
+ */
+
+#ifndef PAGE_MEMORY_HPP
+#define PAGE_MEMORY_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace names {
+    enum class HugePages {
+        /// Leave the choice to the system.
+        Default,
+        /// Keep to base pages (MADV_NOHUGEPAGE), even where the system would use huge pages on its own.
+        Disabled,
+        /// Transparent huge pages through madvise(MADV_HUGEPAGE).
+        Transparent,
+        /// Reserved huge pages through MAP_HUGETLB, falling back to Transparent when none are free.
+        Explicit,
+    };
+
+    struct MappingHints {
+        HugePages hugePages;
+        /// Fault every page in up front (MAP_POPULATE) instead of on first touch.
+        bool populate;
+        /// Start reading file-backed pages in the background (MADV_WILLNEED).
+        bool willNeed;
+
+        MappingHints()
+            : hugePages(HugePages::Default),
+              populate(false),
+              willNeed(false) {
+        }
+    };
+
+    /// Allocations at least this large are mapped directly, in multiples of it, so hints can apply to them.
+    const size_t LARGE_PAGE_SIZE = size_t(2) << 20;
+
+    /// Hints applied to arena allocations made from now on. Existing allocations keep the pages they have.
+    void setArenaHints(const MappingHints &hints);
+
+    MappingHints arenaHints();
+
+    /// Maps zeroed anonymous memory for at least bytes bytes, aligned to LARGE_PAGE_SIZE. Throws std::bad_alloc on
+    /// failure.
+    void *mapPages(size_t bytes, const MappingHints &hints);
+
+    /// Releases memory from mapPages(); bytes must be the size that was requested.
+    void unmapPages(void *p, size_t bytes);
+
+    /// A std::allocator replacement that sends large blocks through mapPages() with the current arena hints. Small
+    /// blocks use operator new as usual.
+    template<typename T>
+    struct PageAllocator {
+        typedef T value_type;
+
+        PageAllocator() {
+        }
+
+        template<typename U>
+        PageAllocator(const PageAllocator<U> &) {
+        }
+
+        T *allocate(const size_t n) {
+            const size_t bytes = n * sizeof(T);
+            if (bytes >= LARGE_PAGE_SIZE)
+                return static_cast<T *>(mapPages(bytes, arenaHints()));
+            return static_cast<T *>(::operator new(bytes));
+        }
+
+        void deallocate(T *p, const size_t n) {
+            const size_t bytes = n * sizeof(T);
+            if (bytes >= LARGE_PAGE_SIZE)
+                unmapPages(p, bytes);
+            else
+                ::operator delete(p);
+        }
+
+        template<typename U>
+        bool operator==(const PageAllocator<U> &) const {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const PageAllocator<U> &) const {
+            return false;
+        }
+    };
+
+    /// A vector whose storage honours the arena hints once it grows past LARGE_PAGE_SIZE.
+    template<typename T>
+    using ArenaVector = std::vector<T, PageAllocator<T> >;
+}
+
+#endif //PAGE_MEMORY_HPP
@@ -0,0 +1,139 @@
+/*
+ * parallel.hpp
+ *
+ * Minimal fork/join helpers for running independent pieces of work across the machine's cores, on the shared task
+ * pool (see task_pool.hpp).
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "task_pool.hpp"
+
+namespace names {
+    /// Number of worker threads to use for parallel work.
+    inline size_t workerCount() {
+        const unsigned hw = std::thread::hardware_concurrency();
+        return hw ? hw : 1;
+    }
+
+    /// Calls fn(i) for every i in [0, n), spreading the calls over up to workerCount() threads of the shared task
+    /// pool, the calling thread being one of them. Indices are handed out dynamically so uneven work items still
+    /// balance. Blocks until every call has returned, and rethrows the first exception one of them threw. Safe to
+    /// call from inside a task, since the waiting thread keeps running tasks.
+    inline void parallelFor(const size_t n, const std::function<void(size_t)> &fn,
+                            const TaskPriority priority = TaskPriority::Interactive) {
+        const size_t threads = std::min(workerCount(), n);
+        if (threads <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                fn(i);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        const auto worker = [&]() {
+            for (size_t i = next++; i < n; i = next++)
+                fn(i);
+        };
+        TaskGroup group;
+        for (size_t t = 1; t < threads; ++t)
+            group.run(worker, priority);
+        try {
+            worker();
+        } catch (...) {
+            // the other calls still use next and fn, so they have to finish first
+            next = n;
+            try {
+                group.wait();
+            } catch (...) {
+                // the first error is the one reported
+            }
+            throw;
+        }
+        group.wait();
+    }
+
+    /// Rows per morsel when a scan is split across the pool: enough that a morsel's bookkeeping is noise next to its
+    /// scan, small enough that a handful of them keep every worker busy and a slow one does not hold up the rest.
+    const size_t MORSEL_ROWS = 10000;
+
+    /// Number of morsels parallelMorsels() splits rows into.
+    inline size_t morselCount(const size_t rows) {
+        return (rows + MORSEL_ROWS - 1) / MORSEL_ROWS;
+    }
+
+    /// Calls fn(morsel, begin, end) for each of the morselCount(rows) consecutive ranges of MORSEL_ROWS rows (the
+    /// last one shorter) covering [0, rows), in parallel as with parallelFor(). Callers keep one partial result per
+    /// morsel and merge them afterwards, so no morsel waits on another. A scan of a single morsel runs inline.
+    inline void parallelMorsels(const size_t rows, const std::function<void(size_t, size_t, size_t)> &fn,
+                                const TaskPriority priority = TaskPriority::Interactive) {
+        parallelFor(morselCount(rows), [&](const size_t morsel) {
+            const size_t begin = morsel * MORSEL_ROWS;
+            fn(morsel, begin, std::min(rows, begin + MORSEL_ROWS));
+        }, priority);
+    }
+
+    /// A FIFO handoff between threads. pop() blocks until an item arrives or the queue is closed and drained. With a
+    /// capacity, push() blocks while the queue is full, so a fast producer cannot run arbitrarily far ahead.
+    template<typename T>
+    class BlockingQueue {
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::deque<T> items_;
+        size_t capacity_;
+        bool closed_;
+
+    public:
+        explicit BlockingQueue(const size_t capacity = SIZE_MAX)
+            : capacity_(std::max<size_t>(capacity, 1)),
+              closed_(false) {
+        }
+
+        void push(T item) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+                items_.push_back(std::move(item));
+            }
+            changed_.notify_all();
+        }
+
+        /// Returns false once the queue is closed and empty.
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+            if (items_.empty())
+                return false;
+            item = std::move(items_.front());
+            items_.pop_front();
+            if (capacity_ != SIZE_MAX) {
+                lock.unlock();
+                changed_.notify_all();
+            }
+            return true;
+        }
+
+        /// Wakes every waiting pop() once the remaining items are gone.
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+            }
+            changed_.notify_all();
+        }
+    };
+}
+
+#endif //PARALLEL_HPP
@@ -0,0 +1,370 @@
+#include "query.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "digits.hpp"
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+#include "simd_kernels.hpp"
+
+namespace names {
+    const char *queryTypeName(const QueryType type) {
+        switch (type) {
+            case QueryType::Lookup:
+                return "lookup";
+            case QueryType::Rank:
+                return "rank";
+            case QueryType::Prefix:
+                return "prefix";
+            case QueryType::Top:
+                return "top";
+            case QueryType::Invalid:
+                break;
+        }
+        return "invalid";
+    }
+
+    namespace {
+        struct Word {
+            const char *data;
+            size_t size;
+
+            bool is(const char *literal) const {
+                return size == std::strlen(literal) && !std::memcmp(data, literal, size);
+            }
+        };
+
+        bool parseSex(const Word &word, Sex &sex) {
+            if (word.is("F"))
+                sex = Sex::Female;
+            else if (word.is("M"))
+                sex = Sex::Male;
+            else
+                return false;
+            return true;
+        }
+
+        bool parseYear(const Word &word, int &year) {
+            uint32_t value;
+            if (!parseUint32(word.data, word.size, value) || value > INT32_MAX)
+                return false;
+            year = static_cast<int>(value);
+            return true;
+        }
+
+        bool parseLimit(const Word &word, uint32_t &limit) {
+            if (!parseUint32(word.data, word.size, limit) || !limit)
+                return false;
+            limit = std::min(limit, MAX_QUERY_LIMIT);
+            return true;
+        }
+
+        bool lessBytes(const NameRef &a, const char *b, const size_t bSize) {
+            const int order = std::memcmp(a.data, b, std::min<size_t>(a.size, bSize));
+            return order < 0 || (order == 0 && a.size < bSize);
+        }
+
+        /// Competition rank of count within counts, which must be in descending order.
+        uint32_t descendingRank(const uint64_t *begin, const uint64_t *end, const uint64_t count) {
+            return static_cast<uint32_t>(std::lower_bound(begin, end, count, [](uint64_t a, uint64_t b) {
+                return a > b;
+            }) - begin) + 1;
+        }
+    }
+
+    bool parseQuery(const char *line, size_t len, Query &query) {
+        while (len && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+            --len;
+        query.type = QueryType::Invalid;
+        query.text = line;
+        query.textSize = static_cast<uint32_t>(len);
+        query.hasSex = false;
+        query.sex = Sex::Female;
+        query.year = 0;
+        query.limit = DEFAULT_QUERY_LIMIT;
+
+        Word words[5];
+        size_t count = 0;
+        for (size_t i = 0; i < len;) {
+            if (line[i] == ' ' || line[i] == '\t') {
+                ++i;
+                continue;
+            }
+            const size_t begin = i;
+            while (i < len && line[i] != ' ' && line[i] != '\t')
+                ++i;
+            if (count == 5)
+                return false;
+            words[count].data = line + begin;
+            words[count].size = i - begin;
+            ++count;
+        }
+        if (count < 2)
+            return false;
+
+        const Word &verb = words[0];
+        bool valid = false;
+        if (verb.is("lookup")) {
+            query.hasSex = count == 3;
+            valid = count <= 3 && (count == 2 || parseSex(words[2], query.sex));
+            query.type = QueryType::Lookup;
+        } else if (verb.is("rank")) {
+            query.hasSex = true;
+            valid = count == 4 && parseSex(words[2], query.sex) && parseYear(words[3], query.year);
+            query.type = QueryType::Rank;
+        } else if (verb.is("prefix")) {
+            valid = count <= 3 && (count == 2 || parseLimit(words[2], query.limit));
+            query.type = QueryType::Prefix;
+        } else if (verb.is("top")) {
+            query.hasSex = true;
+            valid = (count == 3 || count == 4) && parseYear(words[1], query.year) && parseSex(words[2], query.sex) &&
+                    (count == 3 || parseLimit(words[3], query.limit));
+            query.type = QueryType::Top;
+        }
+        if (!valid) {
+            query.type = QueryType::Invalid;
+            query.hasSex = false;
+            return false;
+        }
+        if (query.type != QueryType::Top) {
+            query.text = words[1].data;
+            query.textSize = static_cast<uint32_t>(words[1].size);
+        }
+        return true;
+    }
+
+    QueryEngine::QueryEngine(const Corpus &corpus)
+        : corpus_(corpus) {
+        const NameDictionary &dictionary = corpus.dictionary();
+        const std::vector<YearTable> &years = corpus.years();
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            totals_[s].assign(dictionary.size(), 0);
+            rowsByName_[s].resize(years.size());
+            descending_[s].resize(years.size());
+        }
+
+        for (const YearTable &table: years) {
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                const SexColumn &column = table.columns[s];
+                for (size_t row = 0; row < column.size(); ++row)
+                    totals_[s][column.nameIds[row]] += column.counts[row];
+            }
+        }
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            for (const uint64_t total: totals_[s]) {
+                if (total)
+                    rankedTotals_[s].push_back(total);
+            }
+            std::sort(rankedTotals_[s].begin(), rankedTotals_[s].end(), [](uint64_t a, uint64_t b) { return a > b; });
+        }
+
+        // the per-column indexes are independent of each other and of the name ordering
+        parallelFor(years.size() * SEX_COUNT + 1, [&](const size_t task) {
+            if (task == years.size() * SEX_COUNT) {
+                byName_.resize(dictionary.size());
+                for (uint32_t id = 0; id < byName_.size(); ++id)
+                    byName_[id] = id;
+                sortByName(dictionary, byName_);
+                return;
+            }
+            const size_t year = task / SEX_COUNT;
+            const size_t s = task % SEX_COUNT;
+            const SexColumn &column = years[year].columns[s];
+            std::vector<KeyedId> keyed(column.size());
+            for (uint32_t row = 0; row < keyed.size(); ++row) {
+                keyed[row].key = column.nameIds[row];
+                keyed[row].id = row;
+            }
+            radixSort(keyed);
+            std::vector<uint32_t> &rows = rowsByName_[s][year];
+            rows.resize(keyed.size());
+            for (size_t i = 0; i < keyed.size(); ++i)
+                rows[i] = keyed[i].id;
+            descending_[s][year] = isNonIncreasing(column.counts.data(), column.size());
+        });
+    }
+
+    MemoryFootprint QueryEngine::footprint() const {
+        MemoryFootprint engine("query engine");
+        MemoryFootprint totals("all-time totals");
+        MemoryFootprint ranked("ranked totals");
+        MemoryFootprint rowsByName("rows by name");
+        MemoryFootprint descending("descending flags");
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            const char *sex = s == static_cast<size_t>(Sex::Female) ? "female" : "male";
+            totals.add(sex, totals_[s]);
+            ranked.add(sex, rankedTotals_[s]);
+            MemoryFootprint columns(sex);
+            columns.add("year table", rowsByName_[s]);
+            for (const std::vector<uint32_t> &rows: rowsByName_[s]) {
+                columns.used += rows.size() * sizeof(uint32_t);
+                columns.reserved += rows.capacity() * sizeof(uint32_t);
+            }
+            rowsByName.add(columns);
+            descending.add(sex, descending_[s]);
+        }
+        engine.add(totals);
+        engine.add(ranked);
+        engine.add("sorted index", byName_);
+        engine.add(rowsByName);
+        engine.add(descending);
+        return engine;
+    }
+
+    void QueryEngine::lookup(const Query &query, const uint32_t nameId, std::vector<QueryRow> &rows) const {
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            if (query.hasSex && static_cast<size_t>(query.sex) != s)
+                continue;
+            QueryRow row = {nameId, true, static_cast<Sex>(s), 0, 0, 0};
+            if (nameId != NameDictionary::npos)
+                row.count = totals_[s][nameId];
+            if (row.count) {
+                const std::vector<uint64_t> &ranked = rankedTotals_[s];
+                row.rank = descendingRank(ranked.data(), ranked.data() + ranked.size(), row.count);
+            }
+            rows.push_back(row);
+        }
+    }
+
+    void QueryEngine::rank(const Query &query, const uint32_t nameId, std::vector<QueryRow> &rows) const {
+        QueryRow result = {nameId, true, query.sex, query.year, 0, 0};
+        const YearTable *table = corpus_.findYear(query.year);
+        if (table && nameId != NameDictionary::npos) {
+            const size_t year = static_cast<size_t>(table - corpus_.years().data());
+            const size_t s = static_cast<size_t>(query.sex);
+            const SexColumn &column = table->columns[s];
+            const std::vector<uint32_t> &byName = rowsByName_[s][year];
+            const std::vector<uint32_t>::const_iterator found = std::lower_bound(
+                byName.begin(), byName.end(), nameId, [&](uint32_t row, uint32_t id) {
+                    return column.nameIds[row] < id;
+                });
+            if (found != byName.end() && column.nameIds[*found] == nameId) {
+                const uint32_t count = column.counts[*found];
+                result.count = count;
+                if (descending_[s][year]) {
+                    result.rank = static_cast<uint32_t>(std::lower_bound(
+                        column.counts.begin(), column.counts.end(), count, [](uint32_t a, uint32_t b) {
+                            return a > b;
+                        }) - column.counts.begin()) + 1;
+                } else {
+                    result.rank = 1;
+                    for (const uint32_t other: column.counts)
+                        result.rank += other > count;
+                }
+            }
+        }
+        rows.push_back(result);
+    }
+
+    void QueryEngine::prefix(const Query &query, std::vector<QueryRow> &rows) const {
+        const NameDictionary &dictionary = corpus_.dictionary();
+        const std::vector<uint32_t>::const_iterator first = std::lower_bound(
+            byName_.begin(), byName_.end(), 0u, [&](uint32_t id, uint32_t) {
+                return lessBytes(dictionary.name(id), query.text, query.textSize);
+            });
+        const std::vector<uint32_t>::const_iterator last = std::partition_point(first, byName_.end(), [&](uint32_t id) {
+            const NameRef name = dictionary.name(id);
+            return name.size >= query.textSize && !std::memcmp(name.data, query.text, query.textSize);
+        });
+
+        // most births first, alphabetical among equal totals
+        const auto before = [&](const NameCount &a, const NameCount &b) {
+            if (a.count != b.count)
+                return a.count > b.count;
+            const NameRef right = dictionary.name(b.nameId);
+            return lessBytes(dictionary.name(a.nameId), right.data, right.size);
+        };
+        const auto keepTop = [&](std::vector<NameCount> &matches) {
+            const size_t n = std::min<size_t>(query.limit, matches.size());
+            std::partial_sort(matches.begin(), matches.begin() + n, matches.end(), before);
+            matches.resize(n);
+        };
+
+        // A short prefix matches a large part of the dictionary, so the range is scanned in morsels, each keeping its
+        // own top rows. The overall top rows are among those, since the order has no ties.
+        const size_t matching = static_cast<size_t>(last - first);
+        std::vector<std::vector<NameCount> > partial(morselCount(matching));
+        parallelMorsels(matching, [&](const size_t morsel, const size_t begin, const size_t end) {
+            std::vector<NameCount> &matches = partial[morsel];
+            for (std::vector<uint32_t>::const_iterator it = first + begin; it != first + end; ++it) {
+                uint64_t total = 0;
+                for (size_t s = 0; s < SEX_COUNT; ++s)
+                    total += totals_[s][*it];
+                if (total) {
+                    NameCount match = {*it, total};
+                    matches.push_back(match);
+                }
+            }
+            keepTop(matches);
+        });
+        std::vector<NameCount> matches;
+        for (const std::vector<NameCount> &part: partial)
+            matches.insert(matches.end(), part.begin(), part.end());
+        keepTop(matches);
+
+        for (size_t i = 0; i < matches.size(); ++i) {
+            QueryRow row = {matches[i].nameId, false, Sex::Female, 0, matches[i].count, 0};
+            row.rank = i && matches[i].count == matches[i - 1].count ? rows.back().rank : static_cast<uint32_t>(i + 1);
+            rows.push_back(row);
+        }
+    }
+
+    void QueryEngine::top(const Query &query, std::vector<QueryRow> &rows) const {
+        const YearTable *table = corpus_.findYear(query.year);
+        if (!table)
+            return;
+        const std::vector<NameCount> names = table->column(query.sex).top(query.limit);
+        for (size_t i = 0; i < names.size(); ++i) {
+            QueryRow row = {names[i].nameId, true, query.sex, query.year, names[i].count, 0};
+            row.rank = i && names[i].count == names[i - 1].count ? rows.back().rank : static_cast<uint32_t>(i + 1);
+            rows.push_back(row);
+        }
+    }
+
+    void QueryEngine::run(const Query &query, const uint32_t nameId, std::vector<QueryRow> &rows) const {
+        switch (query.type) {
+            case QueryType::Lookup:
+                lookup(query, nameId, rows);
+                break;
+            case QueryType::Rank:
+                rank(query, nameId, rows);
+                break;
+            case QueryType::Prefix:
+                prefix(query, rows);
+                break;
+            case QueryType::Top:
+                top(query, rows);
+                break;
+            case QueryType::Invalid: {
+                const QueryRow row = {NameDictionary::npos, false, Sex::Female, 0, 0, 0};
+                rows.push_back(row);
+                break;
+            }
+        }
+    }
+
+    void QueryEngine::run(const Query &query, std::vector<QueryRow> &rows) const {
+        const bool named = query.type == QueryType::Lookup || query.type == QueryType::Rank;
+        run(query, named ? corpus_.dictionary().find(query.text, query.textSize) : NameDictionary::npos, rows);
+    }
+
+    void QueryEngine::runBatch(const Query *queries, const size_t count, std::vector<QueryRow> &rows,
+                               std::vector<size_t> &rowEnds) const {
+        const NameDictionary &dictionary = corpus_.dictionary();
+        std::vector<uint64_t> hashes(count);
+        for (size_t i = 0; i < count; ++i) {
+            const Query &query = queries[i];
+            if (query.type == QueryType::Lookup || query.type == QueryType::Rank) {
+                hashes[i] = NameDictionary::hash(query.text, query.textSize);
+                dictionary.prefetch(hashes[i]);
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const Query &query = queries[i];
+            const bool named = query.type == QueryType::Lookup || query.type == QueryType::Rank;
+            run(query, named ? dictionary.find(query.text, query.textSize, hashes[i]) : NameDictionary::npos, rows);
+            rowEnds.push_back(rows.size());
+        }
+    }
+}
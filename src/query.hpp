@@ -0,0 +1,133 @@
+/*
+ * query.hpp
+ *
+ * Read-only queries over a loaded corpus: a name's births across all years, its rank within a year, the most popular
+ * names starting with a prefix, and a year's top names. The indexes they need are built once up front, so every query
+ * is a hash lookup plus a few binary searches.
+ */
+
+#ifndef QUERY_HPP
+#define QUERY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "corpus.hpp"
+
+namespace names {
+    enum class QueryType : uint8_t {
+        Lookup,
+        Rank,
+        Prefix,
+        Top,
+        /// A line that did not parse. Answered with a single row echoing the line.
+        Invalid,
+    };
+
+    const char *queryTypeName(QueryType type);
+
+    /// A parsed query. text points into the line it was parsed from, which must outlive the query.
+    struct Query {
+        QueryType type;
+        /// The name for Lookup and Rank, the prefix for Prefix, and the whole line for Invalid.
+        const char *text;
+        uint32_t textSize;
+        /// Lookup reports both sexes unless one is given. Rank and Top always have one.
+        bool hasSex;
+        Sex sex;
+        int year;
+        uint32_t limit;
+    };
+
+    /// Default and maximum number of rows for Prefix and Top.
+    const uint32_t DEFAULT_QUERY_LIMIT = 10;
+    const uint32_t MAX_QUERY_LIMIT = 1000;
+
+    /// Parses one query line, whose words are separated by spaces or tabs:
+    ///
+    ///     lookup NAME [F|M]
+    ///     rank NAME F|M YEAR
+    ///     prefix PREFIX [LIMIT]
+    ///     top YEAR F|M [LIMIT]
+    ///
+    /// Returns false, with the query set to Invalid, if the line does not match any of them.
+    bool parseQuery(const char *line, size_t len, Query &query);
+
+    /// One row of an answer. Fields a query type does not produce are left at their "none" values.
+    struct QueryRow {
+        /// NameDictionary::npos if the queried name is unknown; the query's text names it instead.
+        uint32_t nameId;
+        /// Whether sex applies; Prefix totals span both sexes.
+        bool hasSex;
+        Sex sex;
+        /// 0 for all-time figures.
+        int year;
+        uint64_t count;
+        /// 1 for the most common name, names with equal counts sharing a rank. 0 if unranked.
+        uint32_t rank;
+    };
+
+    class QueryEngine {
+        const Corpus &corpus_;
+        /// Births per name ID across every year, per sex.
+        std::vector<uint64_t> totals_[SEX_COUNT];
+        /// The non-zero totals of each sex in descending order, for all-time ranks.
+        std::vector<uint64_t> rankedTotals_[SEX_COUNT];
+        /// Every name ID, sorted by name bytes.
+        std::vector<uint32_t> byName_;
+        /// For each year (in corpus order) and sex, the column's row numbers sorted by name ID.
+        std::vector<std::vector<uint32_t> > rowsByName_[SEX_COUNT];
+        /// Whether each year and sex column is in descending count order, which yob files always are.
+        std::vector<uint8_t> descending_[SEX_COUNT];
+
+        void lookup(const Query &query, uint32_t nameId, std::vector<QueryRow> &rows) const;
+        void rank(const Query &query, uint32_t nameId, std::vector<QueryRow> &rows) const;
+        void prefix(const Query &query, std::vector<QueryRow> &rows) const;
+        void top(const Query &query, std::vector<QueryRow> &rows) const;
+        void run(const Query &query, uint32_t nameId, std::vector<QueryRow> &rows) const;
+
+    public:
+        /// Indexes the corpus, which must stay alive and unchanged for as long as the engine is used.
+        explicit QueryEngine(const Corpus &corpus);
+
+        const Corpus &corpus() const {
+            return corpus_;
+        }
+
+        /// The indexes themselves, which publishing a snapshot writes out alongside the corpus.
+        const std::vector<uint64_t> &totals(const Sex sex) const {
+            return totals_[static_cast<size_t>(sex)];
+        }
+
+        const std::vector<uint64_t> &rankedTotals(const Sex sex) const {
+            return rankedTotals_[static_cast<size_t>(sex)];
+        }
+
+        const std::vector<uint32_t> &byName() const {
+            return byName_;
+        }
+
+        /// yearIndex is the year's position in corpus().years().
+        const std::vector<uint32_t> &rowsByName(const Sex sex, const size_t yearIndex) const {
+            return rowsByName_[static_cast<size_t>(sex)][yearIndex];
+        }
+
+        bool descending(const Sex sex, const size_t yearIndex) const {
+            return descending_[static_cast<size_t>(sex)][yearIndex] != 0;
+        }
+
+        /// The indexes, not counting the corpus they are built over.
+        MemoryFootprint footprint() const;
+
+        /// Appends the answer to one query to rows.
+        void run(const Query &query, std::vector<QueryRow> &rows) const;
+
+        /// Answers count queries at once, appending their rows to rows and, for each query, the end of its rows to
+        /// rowEnds. Names are hashed and their table slots prefetched for the whole batch before any is looked up.
+        void runBatch(const Query *queries, size_t count, std::vector<QueryRow> &rows,
+                      std::vector<size_t> &rowEnds) const;
+    };
+}
+
+#endif //QUERY_HPP
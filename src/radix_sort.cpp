@@ -0,0 +1,108 @@
+#include "radix_sort.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "parallel.hpp"
+
+namespace names {
+    namespace {
+        using detail::BUCKETS;
+        using detail::INSERTION_SORT_LIMIT;
+
+        /// Sorts names by their bytes from depth on, the bytes before depth being equal in every name of a range.
+        class NameSorter {
+            const NameDictionary &dictionary_;
+            uint32_t *ids_;
+            std::vector<uint32_t> scratch_;
+            /// Each ID's byte at the current depth plus one, or 0 past the end of its name, so a range is only read
+            /// from the dictionary once per level.
+            std::vector<uint16_t> digits_;
+
+            uint16_t digitAt(const uint32_t id, const size_t depth) const {
+                const NameRef name = dictionary_.name(id);
+                return depth < name.size ? static_cast<uint16_t>(static_cast<unsigned char>(name.data[depth]) + 1) : 0;
+            }
+
+            bool less(const uint32_t a, const uint32_t b, const size_t depth) const {
+                const NameRef left = dictionary_.name(a);
+                const NameRef right = dictionary_.name(b);
+                const size_t common = std::min(left.size, right.size);
+                const int order = depth < common ? std::memcmp(left.data + depth, right.data + depth, common - depth) : 0;
+                return order < 0 || (order == 0 && left.size < right.size);
+            }
+
+            void insertionSort(const size_t begin, const size_t n, const size_t depth) {
+                uint32_t *ids = ids_ + begin;
+                for (size_t i = 1; i < n; ++i) {
+                    const uint32_t id = ids[i];
+                    size_t j = i;
+                    for (; j > 0 && less(id, ids[j - 1], depth); --j)
+                        ids[j] = ids[j - 1];
+                    ids[j] = id;
+                }
+            }
+
+        public:
+            NameSorter(const NameDictionary &dictionary, std::vector<uint32_t> &ids)
+                : dictionary_(dictionary),
+                  ids_(ids.data()),
+                  scratch_(ids.size()),
+                  digits_(ids.size()) {
+            }
+
+            /// Sorts [begin, begin + n). With parallel set, the buckets of the first split are sorted concurrently.
+            void sort(const size_t begin, const size_t n, size_t depth, const bool parallel) {
+                size_t counts[BUCKETS + 1];
+                while (true) {
+                    if (n <= INSERTION_SORT_LIMIT) {
+                        insertionSort(begin, n, depth);
+                        return;
+                    }
+                    std::fill(counts, counts + BUCKETS + 1, 0);
+                    for (size_t i = begin; i < begin + n; ++i)
+                        ++counts[digits_[i] = digitAt(ids_[i], depth)];
+                    if (counts[0] == n)
+                        return;
+                    // a byte every name shares needs no pass; move straight on to the next one
+                    if (counts[digits_[begin]] != n)
+                        break;
+                    ++depth;
+                }
+
+                size_t offsets[BUCKETS + 1];
+                size_t running = begin;
+                for (size_t bucket = 0; bucket <= BUCKETS; ++bucket) {
+                    offsets[bucket] = running;
+                    running += counts[bucket];
+                }
+                for (size_t i = begin; i < begin + n; ++i)
+                    scratch_[offsets[digits_[i]]++] = ids_[i];
+                std::memcpy(ids_ + begin, scratch_.data() + begin, n * sizeof(uint32_t));
+
+                // names that ended at this depth are equal and already in order; the rest continue one byte deeper
+                std::vector<std::pair<size_t, size_t> > buckets;
+                size_t start = begin + counts[0];
+                for (size_t bucket = 1; bucket <= BUCKETS; ++bucket) {
+                    if (counts[bucket] > 1)
+                        buckets.push_back(std::make_pair(start, counts[bucket]));
+                    start += counts[bucket];
+                }
+                const auto sortBucket = [&](const size_t i) {
+                    sort(buckets[i].first, buckets[i].second, depth + 1, false);
+                };
+                if (parallel) {
+                    parallelFor(buckets.size(), sortBucket);
+                } else {
+                    for (size_t i = 0; i < buckets.size(); ++i)
+                        sortBucket(i);
+                }
+            }
+        };
+    }
+
+    void sortByName(const NameDictionary &dictionary, std::vector<uint32_t> &ids) {
+        NameSorter sorter(dictionary, ids);
+        sorter.sort(0, ids.size(), 0, detail::sortChunks(ids.size()) > 1);
+    }
+}
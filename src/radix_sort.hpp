@@ -0,0 +1,137 @@
+/*
+ * radix_sort.hpp
+ *
+ * Radix sorts for re-ordering name records. Integer keys (counts, lengths, years) are sorted least significant byte
+ * first, skipping bytes that are the same in every key; names are sorted most significant byte first, finishing small
+ * buckets with insertion sort. Both are stable and split large inputs across workerCount() threads.
+ */
+
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "corpus.hpp"
+#include "parallel.hpp"
+
+namespace names {
+    /// An ID (a name ID, a row number, ...) and the key to order it by.
+    struct KeyedId {
+        uint64_t key;
+        uint32_t id;
+    };
+
+    /// Below this many items the sorts run on the calling thread only.
+    const size_t PARALLEL_SORT_THRESHOLD = 1 << 16;
+
+    namespace detail {
+        const size_t KEY_BYTES = sizeof(uint64_t);
+        const size_t BUCKETS = 256;
+        /// Ranges at most this long are finished with insertion sort, which beats another bucketing pass on them.
+        const size_t INSERTION_SORT_LIMIT = 32;
+
+        /// How many threads to split a sort of n items over.
+        inline size_t sortChunks(const size_t n) {
+            if (n < PARALLEL_SORT_THRESHOLD)
+                return 1;
+            return std::max<size_t>(1, std::min(workerCount(), n / (PARALLEL_SORT_THRESHOLD / 4)));
+        }
+
+        inline size_t digit(const uint64_t key, const size_t byte) {
+            return static_cast<size_t>(key >> byte * 8 & 0xff);
+        }
+    }
+
+    /// Sorts by ascending keyOf(item), a uint64_t, keeping items with equal keys in their original order. scratch is
+    /// resized to match items and may be reused across calls to save the allocation.
+    template<typename T, typename KeyOf>
+    void radixSortBy(std::vector<T> &items, std::vector<T> &scratch, const KeyOf keyOf) {
+        using namespace detail;
+        const size_t n = items.size();
+        if (n <= INSERTION_SORT_LIMIT) {
+            std::stable_sort(items.begin(), items.end(), [&](const T &a, const T &b) {
+                return keyOf(a) < keyOf(b);
+            });
+            return;
+        }
+
+        // a byte that is the same in every key (the high bytes of small counts, say) needs no pass
+        const size_t chunks = sortChunks(n);
+        const auto chunkBegin = [&](const size_t chunk) { return n * chunk / chunks; };
+        std::vector<uint64_t> differences(chunks, 0);
+        parallelFor(chunks, [&](const size_t chunk) {
+            const uint64_t first = keyOf(items[0]);
+            uint64_t different = 0;
+            for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+                different |= keyOf(items[i]) ^ first;
+            differences[chunk] = different;
+        });
+        uint64_t different = 0;
+        for (const uint64_t chunkDifferent: differences)
+            different |= chunkDifferent;
+        std::vector<size_t> bytes;
+        for (size_t byte = 0; byte < KEY_BYTES; ++byte) {
+            if (digit(different, byte))
+                bytes.push_back(byte);
+        }
+
+        // per-chunk histograms of every byte that varies, all gathered in a single read of the input
+        std::vector<size_t> counts(chunks * KEY_BYTES * BUCKETS, 0);
+        parallelFor(chunks, [&](const size_t chunk) {
+            size_t *histograms = counts.data() + chunk * KEY_BYTES * BUCKETS;
+            for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i) {
+                const uint64_t key = keyOf(items[i]);
+                for (const size_t byte: bytes)
+                    ++histograms[byte * BUCKETS + digit(key, byte)];
+            }
+        });
+
+        scratch.resize(n);
+        T *from = items.data();
+        T *to = scratch.data();
+        std::vector<size_t> offsets(chunks * BUCKETS);
+        for (size_t pass = 0; pass < bytes.size(); ++pass) {
+            const size_t byte = bytes[pass];
+            // after the first pass the chunks hold different items, so their histograms must be taken again
+            if (pass && chunks > 1) {
+                parallelFor(chunks, [&](const size_t chunk) {
+                    size_t *histogram = counts.data() + (chunk * KEY_BYTES + byte) * BUCKETS;
+                    std::fill(histogram, histogram + BUCKETS, 0);
+                    for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+                        ++histogram[digit(keyOf(from[i]), byte)];
+                });
+            }
+            size_t running = 0;
+            for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                    offsets[chunk * BUCKETS + bucket] = running;
+                    running += counts[(chunk * KEY_BYTES + byte) * BUCKETS + bucket];
+                }
+            }
+            parallelFor(chunks, [&](const size_t chunk) {
+                size_t *next = offsets.data() + chunk * BUCKETS;
+                for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+                    to[next[digit(keyOf(from[i]), byte)]++] = from[i];
+            });
+            std::swap(from, to);
+        }
+        if (from != items.data())
+            std::copy(from, from + n, items.data());
+    }
+
+    /// Sorts by ascending key, keeping items with equal keys in their original order. For descending order, sort by
+    /// UINT64_MAX - key.
+    inline void radixSort(std::vector<KeyedId> &items) {
+        std::vector<KeyedId> scratch;
+        radixSortBy(items, scratch, [](const KeyedId &item) { return item.key; });
+    }
+
+    /// Sorts name IDs by the bytes of their names, as unsigned bytes, shorter names first when one is a prefix of the
+    /// other (the same order as std::string comparison). Equal names, i.e. repeated IDs, keep their original order.
+    void sortByName(const NameDictionary &dictionary, std::vector<uint32_t> &ids);
+}
+
+#endif //RADIX_SORT_HPP
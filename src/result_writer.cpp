@@ -0,0 +1,313 @@
+#include "result_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "digits.hpp"
+
+#ifdef __unix__
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace names {
+    OutputFormat outputFormat(const std::string &name) {
+        if (name == "csv")
+            return OutputFormat::Csv;
+        if (name == "tsv")
+            return OutputFormat::Tsv;
+        if (name == "jsonl")
+            return OutputFormat::JsonLines;
+        throw std::invalid_argument("unknown output format: " + name);
+    }
+
+    namespace {
+        bool needsCsvQuotes(const char *data, const size_t len) {
+            for (size_t i = 0; i < len; ++i) {
+                const char c = data[i];
+                if (c == ',' || c == '"' || c == '\n' || c == '\r')
+                    return true;
+            }
+            return false;
+        }
+
+        bool needsTsvEscapes(const char *data, const size_t len) {
+            for (size_t i = 0; i < len; ++i) {
+                const char c = data[i];
+                if (c == '\t' || c == '\n' || c == '\r' || c == '\\')
+                    return true;
+            }
+            return false;
+        }
+
+        bool needsJsonEscapes(const char *data, const size_t len) {
+            for (size_t i = 0; i < len; ++i) {
+                const unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c < 0x20 || c == '"' || c == '\\')
+                    return true;
+            }
+            return false;
+        }
+    }
+
+    ResultWriter::ResultWriter(std::FILE *out, const OutputFormat format, const std::vector<std::string> &columns,
+                               const size_t bufferSize, const size_t bufferCount)
+        : out_(out),
+          format_(format),
+          keys_(columns),
+          used_(std::max<size_t>(1, bufferCount), 0),
+          // every reservation must fit in an empty buffer
+          bufferSize_(std::max<size_t>(bufferSize, 64)),
+          current_(0),
+          column_(0),
+          bytesWritten_(0) {
+        for (size_t i = 0; i < used_.size(); ++i)
+            buffers_.push_back(std::unique_ptr<char[]>(new char[bufferSize_]));
+        cursor_ = buffers_[0].get();
+        limit_ = cursor_ + bufferSize_;
+        if (format_ == OutputFormat::JsonLines) {
+            for (std::string &key: keys_) {
+                std::string formatted("\"");
+                for (const char c: key) {
+                    if (c == '"' || c == '\\')
+                        formatted += '\\';
+                    formatted += c;
+                }
+                key = formatted + "\":";
+            }
+        }
+    }
+
+    ResultWriter::~ResultWriter() {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    void ResultWriter::nextBuffer() {
+        if (current_ + 1 == buffers_.size()) {
+            flush();
+            return;
+        }
+        used_[current_] = static_cast<size_t>(cursor_ - buffers_[current_].get());
+        ++current_;
+        cursor_ = buffers_[current_].get();
+        limit_ = cursor_ + bufferSize_;
+    }
+
+    void ResultWriter::putSlow(const char *data, size_t len) {
+        while (len) {
+            if (cursor_ == limit_)
+                nextBuffer();
+            const size_t chunk = std::min(len, static_cast<size_t>(limit_ - cursor_));
+            std::memcpy(cursor_, data, chunk);
+            cursor_ += chunk;
+            data += chunk;
+            len -= chunk;
+        }
+    }
+
+    void ResultWriter::separator() {
+        switch (format_) {
+            case OutputFormat::Csv:
+                if (column_)
+                    put(',');
+                break;
+            case OutputFormat::Tsv:
+                if (column_)
+                    put('\t');
+                break;
+            case OutputFormat::JsonLines:
+                put(column_ ? ',' : '{');
+                if (column_ < keys_.size())
+                    put(keys_[column_].data(), keys_[column_].size());
+                break;
+        }
+        ++column_;
+    }
+
+    void ResultWriter::header() {
+        if (format_ == OutputFormat::JsonLines)
+            return;
+        for (const std::string &key: keys_)
+            text(key);
+        endRow();
+    }
+
+    void ResultWriter::quoted(const char *data, const size_t len) {
+        // escapes are rare in name data, so copy clean runs in bulk and only stop at the bytes that need them
+        size_t run = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            const char *escape = nullptr;
+            char buffer[7];
+            if (format_ == OutputFormat::Csv) {
+                if (c == '"')
+                    escape = "\"\"";
+            } else if (format_ == OutputFormat::Tsv) {
+                escape = c == '\t' ? "\\t" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : c == '\\' ? "\\\\" : nullptr;
+            } else if (c == '"' || c == '\\') {
+                buffer[0] = '\\';
+                buffer[1] = static_cast<char>(c);
+                buffer[2] = 0;
+                escape = buffer;
+            } else if (c < 0x20) {
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                escape = buffer;
+            }
+            if (!escape)
+                continue;
+            put(data + run, i - run);
+            put(escape, std::strlen(escape));
+            run = i + 1;
+        }
+        put(data + run, len - run);
+    }
+
+    ResultWriter &ResultWriter::text(const char *data, const size_t len) {
+        separator();
+        switch (format_) {
+            case OutputFormat::Csv:
+                if (needsCsvQuotes(data, len)) {
+                    put('"');
+                    quoted(data, len);
+                    put('"');
+                    return *this;
+                }
+                break;
+            case OutputFormat::Tsv:
+                if (needsTsvEscapes(data, len)) {
+                    quoted(data, len);
+                    return *this;
+                }
+                break;
+            case OutputFormat::JsonLines:
+                put('"');
+                if (needsJsonEscapes(data, len))
+                    quoted(data, len);
+                else
+                    put(data, len);
+                put('"');
+                return *this;
+        }
+        put(data, len);
+        return *this;
+    }
+
+    ResultWriter &ResultWriter::number(const uint64_t value) {
+        separator();
+        advance(formatUint64(value, reserve(MAX_DIGITS)));
+        return *this;
+    }
+
+    ResultWriter &ResultWriter::number(const int64_t value) {
+        separator();
+        advance(formatInt64(value, reserve(MAX_DIGITS + 1)));
+        return *this;
+    }
+
+    ResultWriter &ResultWriter::number(const double value) {
+        separator();
+        if (format_ == OutputFormat::JsonLines && !std::isfinite(value)) {
+            put("null", 4);
+            return *this;
+        }
+        char *p = reserve(32);
+        advance(static_cast<size_t>(std::snprintf(p, 32, "%.15g", value)));
+        return *this;
+    }
+
+    ResultWriter &ResultWriter::null() {
+        separator();
+        if (format_ == OutputFormat::JsonLines)
+            put("null", 4);
+        return *this;
+    }
+
+    void ResultWriter::endRow() {
+        if (format_ == OutputFormat::JsonLines)
+            put('}');
+        put('\n');
+        column_ = 0;
+    }
+
+    void ResultWriter::flush() {
+        used_[current_] = static_cast<size_t>(cursor_ - buffers_[current_].get());
+        const size_t count = used_[current_] ? current_ + 1 : current_;
+        if (!count)
+            return;
+        std::fflush(out_);
+#ifdef __unix__
+        std::vector<iovec> pending(count);
+        for (size_t i = 0; i < count; ++i) {
+            pending[i].iov_base = buffers_[i].get();
+            pending[i].iov_len = used_[i];
+        }
+        const int fd = fileno(out_);
+        iovec *next = pending.data();
+        size_t left = pending.size();
+        while (left) {
+            const ssize_t n = writev(fd, next, static_cast<int>(left));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw std::runtime_error(std::string("unable to write results: ") + std::strerror(errno));
+            bytesWritten_ += static_cast<uint64_t>(n);
+            // skip what a short write did take and resume mid-buffer
+            size_t done = static_cast<size_t>(n);
+            while (left && done >= next->iov_len) {
+                done -= next->iov_len;
+                ++next;
+                --left;
+            }
+            if (left) {
+                next->iov_base = static_cast<char *>(next->iov_base) + done;
+                next->iov_len -= done;
+            }
+        }
+#else
+        for (size_t i = 0; i < count; ++i) {
+            if (std::fwrite(buffers_[i].get(), 1, used_[i], out_) != used_[i])
+                throw std::runtime_error("unable to write results");
+            bytesWritten_ += used_[i];
+        }
+        std::fflush(out_);
+#endif
+        std::fill(used_.begin(), used_.end(), 0);
+        current_ = 0;
+        cursor_ = buffers_[0].get();
+        limit_ = cursor_ + bufferSize_;
+    }
+
+    std::vector<std::string> yearRowColumns() {
+        std::vector<std::string> columns;
+        columns.push_back("year");
+        columns.push_back("sex");
+        columns.push_back("name");
+        columns.push_back("count");
+        return columns;
+    }
+
+    void writeYearTable(ResultWriter &writer, const NameDictionary &dictionary, const YearTable &table) {
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            const char sex = sexChar(static_cast<Sex>(s));
+            const SexColumn &column = table.columns[s];
+            for (size_t row = 0; row < column.size(); ++row) {
+                writer.number(static_cast<int64_t>(table.year))
+                        .text(&sex, 1)
+                        .text(dictionary.name(column.nameIds[row]))
+                        .number(static_cast<uint64_t>(column.counts[row]));
+                writer.endRow();
+            }
+        }
+    }
+
+    void writeCorpus(ResultWriter &writer, const Corpus &corpus) {
+        for (const YearTable &table: corpus.years())
+            writeYearTable(writer, corpus.dictionary(), table);
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * result_writer.hpp
+ *
+ * Buffered output of query results and exports as CSV, TSV or JSON lines. Rows are formatted straight into a set of
+ * large reusable buffers, and once they are all full they go to the kernel together in one writev, so output costs a
+ * syscall per few megabytes instead of one per line.
+ */
+
+#ifndef RESULT_WRITER_HPP
+#define RESULT_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "corpus.hpp"
+
+namespace names {
+    enum class OutputFormat {
+        /// RFC 4180: fields containing a comma, quote or line break are quoted.
+        Csv,
+        /// Tabs, line breaks and backslashes in fields are written as \t, \n, \r and \\.
+        Tsv,
+        /// One JSON object per row, keyed by column name.
+        JsonLines,
+    };
+
+    /// Parses "csv", "tsv" or "jsonl". Throws std::invalid_argument for anything else.
+    OutputFormat outputFormat(const std::string &name);
+
+    class ResultWriter {
+        std::FILE *out_;
+        OutputFormat format_;
+        /// Column names, already formatted as JSON keys for JsonLines.
+        std::vector<std::string> keys_;
+        std::vector<std::unique_ptr<char[]> > buffers_;
+        /// Bytes used in each buffer before the current one; the current buffer's fill is cursor_.
+        std::vector<size_t> used_;
+        size_t bufferSize_;
+        size_t current_;
+        char *cursor_;
+        char *limit_;
+        size_t column_;
+        uint64_t bytesWritten_;
+
+        /// Moves on to the next buffer, flushing first if they are all full.
+        void nextBuffer();
+
+        /// Returns room for at least n (<= bufferSize_) contiguous bytes. The caller commits what it used with
+        /// advance().
+        char *reserve(const size_t n) {
+            if (static_cast<size_t>(limit_ - cursor_) < n)
+                nextBuffer();
+            return cursor_;
+        }
+
+        void advance(const size_t n) {
+            cursor_ += n;
+        }
+
+        void put(const char *data, size_t len) {
+            if (static_cast<size_t>(limit_ - cursor_) >= len) {
+                std::memcpy(cursor_, data, len);
+                cursor_ += len;
+            } else {
+                putSlow(data, len);
+            }
+        }
+
+        void put(const char c) {
+            *reserve(1) = c;
+            ++cursor_;
+        }
+
+        void putSlow(const char *data, size_t len);
+        void separator();
+        void quoted(const char *data, size_t len);
+
+    public:
+        /// Writes to out, which stays owned by the caller. Prior stdio output to out is flushed before each write.
+        ResultWriter(std::FILE *out, OutputFormat format, const std::vector<std::string> &columns,
+                     size_t bufferSize = 1 << 20, size_t bufferCount = 8);
+
+        /// Flushes what is left. Errors at this point are ignored; call flush() first to see them.
+        ~ResultWriter();
+
+        ResultWriter(const ResultWriter &) = delete;
+
+        ResultWriter &operator=(const ResultWriter &) = delete;
+
+        /// Writes the column names as a header line. Does nothing for JsonLines, whose rows carry their keys.
+        void header();
+
+        ResultWriter &text(const char *data, size_t len);
+
+        ResultWriter &text(const std::string &value) {
+            return text(value.data(), value.size());
+        }
+
+        ResultWriter &text(const NameRef &name) {
+            return text(name.data, name.size);
+        }
+
+        ResultWriter &number(uint64_t value);
+        ResultWriter &number(int64_t value);
+        ResultWriter &number(double value);
+
+        /// A missing value: an empty field in CSV and TSV, null in JSON.
+        ResultWriter &null();
+
+        /// Ends the current row. Every row must have one field per column.
+        void endRow();
+
+        /// Writes out everything buffered. Throws std::runtime_error on failure.
+        void flush();
+
+        /// Bytes handed to the output so far, excluding what is still buffered.
+        uint64_t bytesWritten() const {
+            return bytesWritten_;
+        }
+    };
+
+    /// The columns writeYearTable() produces.
+    std::vector<std::string> yearRowColumns();
+
+    /// Writes every row of the table as (year, sex, name, count).
+    void writeYearTable(ResultWriter &writer, const NameDictionary &dictionary, const YearTable &table);
+
+    /// Writes every year of the corpus as (year, sex, name, count).
+    void writeCorpus(ResultWriter &writer, const Corpus &corpus);
+}
+
+#endif //RESULT_WRITER_HPP
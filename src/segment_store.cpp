@@ -0,0 +1,292 @@
+#include "segment_store.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace names {
+    namespace {
+        /// A position inside one segment's sorted key column, used by the k-way merges.
+        struct Cursor {
+            const Segment *segment;
+            size_t pos;
+            size_t end;
+
+            uint64_t key() const {
+                return segment->keys()[pos];
+            }
+        };
+
+        struct CursorAfter {
+            bool operator()(const Cursor &a, const Cursor &b) const {
+                return a.key() > b.key();
+            }
+        };
+
+        /// Merges the cursors in key order, calling emit(key, sum) once per distinct key.
+        void mergeCursors(const std::vector<Cursor> &cursors, const std::function<void(uint64_t, int64_t)> &emit) {
+            std::priority_queue<Cursor, std::vector<Cursor>, CursorAfter> heap;
+            for (const Cursor &cursor: cursors) {
+                if (cursor.pos < cursor.end)
+                    heap.push(cursor);
+            }
+            while (!heap.empty()) {
+                const uint64_t key = heap.top().key();
+                int64_t sum = 0;
+                while (!heap.empty() && heap.top().key() == key) {
+                    Cursor cursor = heap.top();
+                    heap.pop();
+                    sum += cursor.segment->counts()[cursor.pos];
+                    if (++cursor.pos < cursor.end)
+                        heap.push(cursor);
+                }
+                emit(key, sum);
+            }
+        }
+
+        bool byCountDescending(const NameCount &a, const NameCount &b) {
+            return a.count != b.count ? a.count > b.count : a.nameId < b.nameId;
+        }
+
+        /// Fans out over every segment's (year, sex) range and merges them into positive per-name totals.
+        std::vector<NameCount> mergedRows(const SegmentStore::SegmentList &segments, const int year, const Sex sex) {
+            std::vector<Cursor> cursors;
+            for (const std::shared_ptr<const Segment> &segment: segments) {
+                const std::pair<size_t, size_t> range = segment->range(year, sex);
+                Cursor cursor;
+                cursor.segment = segment.get();
+                cursor.pos = range.first;
+                cursor.end = range.second;
+                cursors.push_back(cursor);
+            }
+
+            std::vector<NameCount> rows;
+            mergeCursors(cursors, [&](const uint64_t key, const int64_t count) {
+                if (count > 0) {
+                    NameCount row;
+                    row.nameId = segmentKeyName(key);
+                    row.count = static_cast<uint64_t>(count);
+                    rows.push_back(row);
+                }
+            });
+            return rows;
+        }
+    }
+
+    // ---- Segment ---- //
+
+    Segment::Segment(std::vector<uint64_t> keys, std::vector<int64_t> counts, const uint64_t sequence)
+        : keys_(std::move(keys)),
+          counts_(std::move(counts)),
+          sequence_(sequence) {
+    }
+
+    std::shared_ptr<const Segment> Segment::fromYearTable(const YearTable &table, const uint64_t sequence) {
+        std::vector<CountDelta> deltas;
+        deltas.reserve(table.rows());
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            const SexColumn &column = table.columns[s];
+            for (size_t row = 0; row < column.size(); ++row) {
+                CountDelta delta;
+                delta.year = table.year;
+                delta.sex = static_cast<Sex>(s);
+                delta.nameId = column.nameIds[row];
+                delta.count = column.counts[row];
+                deltas.push_back(delta);
+            }
+        }
+        return fromDeltas(std::move(deltas), sequence);
+    }
+
+    std::shared_ptr<const Segment> Segment::fromDeltas(std::vector<CountDelta> deltas, const uint64_t sequence) {
+        std::vector<std::pair<uint64_t, int64_t> > rows(deltas.size());
+        for (size_t i = 0; i < deltas.size(); ++i)
+            rows[i] = std::make_pair(segmentKey(deltas[i].year, deltas[i].sex, deltas[i].nameId), deltas[i].count);
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<uint64_t, int64_t> &a, const std::pair<uint64_t, int64_t> &b) {
+                      return a.first < b.first;
+                  });
+
+        std::vector<uint64_t> keys;
+        std::vector<int64_t> counts;
+        keys.reserve(rows.size());
+        counts.reserve(rows.size());
+        for (const std::pair<uint64_t, int64_t> &row: rows) {
+            if (!keys.empty() && keys.back() == row.first) {
+                counts.back() += row.second;
+            } else {
+                keys.push_back(row.first);
+                counts.push_back(row.second);
+            }
+        }
+        return std::make_shared<const Segment>(std::move(keys), std::move(counts), sequence);
+    }
+
+    std::shared_ptr<const Segment> Segment::merge(const std::vector<std::shared_ptr<const Segment> > &segments,
+                                                  const uint64_t sequence) {
+        std::vector<Cursor> cursors;
+        size_t total = 0;
+        for (const std::shared_ptr<const Segment> &segment: segments) {
+            Cursor cursor;
+            cursor.segment = segment.get();
+            cursor.pos = 0;
+            cursor.end = segment->size();
+            cursors.push_back(cursor);
+            total += segment->size();
+        }
+
+        std::vector<uint64_t> keys;
+        std::vector<int64_t> counts;
+        keys.reserve(total);
+        counts.reserve(total);
+        mergeCursors(cursors, [&](const uint64_t key, const int64_t count) {
+            if (count) {
+                keys.push_back(key);
+                counts.push_back(count);
+            }
+        });
+        return std::make_shared<const Segment>(std::move(keys), std::move(counts), sequence);
+    }
+
+    std::pair<size_t, size_t> Segment::range(const int year, const Sex sex) const {
+        const uint64_t first = segmentKey(year, sex, 0);
+        const uint64_t last = segmentKey(year, sex, UINT32_MAX);
+        const size_t begin = std::lower_bound(keys_.begin(), keys_.end(), first) - keys_.begin();
+        const size_t end = std::upper_bound(keys_.begin() + begin, keys_.end(), last) - keys_.begin();
+        return std::make_pair(begin, end);
+    }
+
+    int64_t Segment::count(const uint64_t key) const {
+        const std::vector<uint64_t>::const_iterator it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        if (it == keys_.end() || *it != key)
+            return 0;
+        return counts_[it - keys_.begin()];
+    }
+
+    // ---- SegmentStore ---- //
+
+    SegmentStore::SegmentStore(const SegmentStoreOptions &options)
+        : options_(options),
+          segments_(std::make_shared<const SegmentList>()),
+          nextSequence_(0),
+          stopping_(false),
+          compactionQueued_(false) {
+    }
+
+    SegmentStore::~SegmentStore() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        compactions_.wait();
+    }
+
+    uint64_t SegmentStore::nextSequence() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return nextSequence_++;
+    }
+
+    void SegmentStore::add(const std::shared_ptr<const Segment> &segment) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::shared_ptr<SegmentList> next = std::make_shared<SegmentList>(*segments_);
+            next->push_back(segment);
+            segments_ = next;
+            scheduleCompaction();
+        }
+    }
+
+    std::shared_ptr<const SegmentStore::SegmentList> SegmentStore::segments() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return segments_;
+    }
+
+    SegmentStore::SegmentList SegmentStore::pickCompaction(const SegmentList &segments) const {
+        SegmentList small;
+        for (const std::shared_ptr<const Segment> &segment: segments) {
+            if (segment->size() < options_.smallSegmentRows)
+                small.push_back(segment);
+        }
+        if (small.size() < std::max<size_t>(2, options_.mergeFanIn))
+            small.clear();
+        return small;
+    }
+
+    bool SegmentStore::compactOnce() {
+        std::lock_guard<std::mutex> compactionLock(compactionMutex_);
+        const SegmentList inputs = pickCompaction(*segments());
+        if (inputs.empty())
+            return false;
+
+        uint64_t sequence = 0;
+        for (const std::shared_ptr<const Segment> &segment: inputs)
+            sequence = std::max(sequence, segment->sequence());
+        // merge outside the lock; readers and writers keep going against the old list meanwhile
+        const std::shared_ptr<const Segment> merged = Segment::merge(inputs, sequence);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<SegmentList> next = std::make_shared<SegmentList>();
+        for (const std::shared_ptr<const Segment> &segment: *segments_) {
+            if (std::find(inputs.begin(), inputs.end(), segment) == inputs.end())
+                next->push_back(segment);
+        }
+        next->push_back(merged);
+        std::stable_sort(next->begin(), next->end(),
+                         [](const std::shared_ptr<const Segment> &a, const std::shared_ptr<const Segment> &b) {
+                             return a->sequence() < b->sequence();
+                         });
+        segments_ = next;
+        return true;
+    }
+
+    void SegmentStore::scheduleCompaction() {
+        if (!options_.backgroundCompaction || stopping_ || compactionQueued_ || pickCompaction(*segments_).empty())
+            return;
+        compactionQueued_ = true;
+        compactions_.run([this]() { compactStep(); }, TaskPriority::Background);
+    }
+
+    void SegmentStore::compactStep() {
+        compactOnce();
+        // one merge per task, so queued interactive work goes first between merges
+        std::lock_guard<std::mutex> lock(mutex_);
+        compactionQueued_ = false;
+        scheduleCompaction();
+    }
+
+    int64_t SegmentStore::count(const int year, const Sex sex, const uint32_t nameId) const {
+        const std::shared_ptr<const SegmentList> segments = this->segments();
+        const uint64_t key = segmentKey(year, sex, nameId);
+        int64_t total = 0;
+        for (const std::shared_ptr<const Segment> &segment: *segments)
+            total += segment->count(key);
+        return total;
+    }
+
+    std::vector<NameCount> SegmentStore::top(const int year, const Sex sex, const size_t k) const {
+        std::vector<NameCount> rows = mergedRows(*segments(), year, sex);
+        const size_t n = std::min(k, rows.size());
+        std::partial_sort(rows.begin(), rows.begin() + n, rows.end(), byCountDescending);
+        rows.resize(n);
+        return rows;
+    }
+
+    YearTable SegmentStore::yearTable(const int year) const {
+        const std::shared_ptr<const SegmentList> segments = this->segments();
+        YearTable table(year);
+        for (size_t s = 0; s < SEX_COUNT; ++s) {
+            std::vector<NameCount> rows = mergedRows(*segments, year, static_cast<Sex>(s));
+            std::sort(rows.begin(), rows.end(), byCountDescending);
+
+            SexColumn &column = table.columns[s];
+            column.nameIds.reserve(rows.size());
+            column.counts.reserve(rows.size());
+            for (const NameCount &row: rows) {
+                column.nameIds.push_back(row.nameId);
+                column.counts.push_back(static_cast<uint32_t>(row.count));
+            }
+        }
+        return table;
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * segment_store.hpp
+ *
+ * Log-structured storage for name counts. Every loaded yob file or streaming batch becomes an immutable, sorted
+ * segment. Queries fan out over the current set of segments and merge their answers, while background tasks on the
+ * shared task pool merge small segments together so the fan-out stays short.
+ */
+
+#ifndef SEGMENT_STORE_HPP
+#define SEGMENT_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "corpus.hpp"
+#include "task_pool.hpp"
+
+namespace names {
+    /// Packs (year, sex, name ID) into a key that sorts by year, then sex, then name ID.
+    inline uint64_t segmentKey(const int year, const Sex sex, const uint32_t nameId) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(year)) << 33 |
+               static_cast<uint64_t>(sex) << 32 | nameId;
+    }
+
+    inline int segmentKeyYear(const uint64_t key) {
+        return static_cast<int>(key >> 33);
+    }
+
+    inline Sex segmentKeySex(const uint64_t key) {
+        return static_cast<Sex>(key >> 32 & 1);
+    }
+
+    inline uint32_t segmentKeyName(const uint64_t key) {
+        return static_cast<uint32_t>(key);
+    }
+
+    /// A single count change, as carried by a streaming batch. Counts may be negative for corrections.
+    struct CountDelta {
+        int year;
+        Sex sex;
+        uint32_t nameId;
+        int64_t count;
+    };
+
+    /// An immutable run of (key, count) rows, sorted by key with no duplicate keys. Counts from different segments are
+    /// added together, so a correction batch is a segment of deltas.
+    class Segment {
+        std::vector<uint64_t> keys_;
+        std::vector<int64_t> counts_;
+        uint64_t sequence_;
+
+    public:
+        /// Takes ownership of already sorted, duplicate-free columns.
+        Segment(std::vector<uint64_t> keys, std::vector<int64_t> counts, uint64_t sequence);
+
+        /// Builds a segment from one year of a corpus.
+        static std::shared_ptr<const Segment> fromYearTable(const YearTable &table, uint64_t sequence);
+
+        /// Builds a segment from arbitrary deltas, summing deltas to the same key.
+        static std::shared_ptr<const Segment> fromDeltas(std::vector<CountDelta> deltas, uint64_t sequence);
+
+        /// K-way merges the given segments into one, summing counts and dropping keys that cancel out to zero.
+        static std::shared_ptr<const Segment> merge(const std::vector<std::shared_ptr<const Segment> > &segments,
+                                                    uint64_t sequence);
+
+        const std::vector<uint64_t> &keys() const {
+            return keys_;
+        }
+
+        const std::vector<int64_t> &counts() const {
+            return counts_;
+        }
+
+        size_t size() const {
+            return keys_.size();
+        }
+
+        /// Order in which the segment was added. Merged segments take the highest sequence of their inputs.
+        uint64_t sequence() const {
+            return sequence_;
+        }
+
+        /// Returns the row range [begin, end) holding the given year and sex.
+        std::pair<size_t, size_t> range(int year, Sex sex) const;
+
+        /// Returns the count for a key, or 0 if the segment does not mention it.
+        int64_t count(uint64_t key) const;
+    };
+
+    struct SegmentStoreOptions {
+        /// Segments with fewer rows than this are candidates for compaction.
+        size_t smallSegmentRows;
+        /// How many small segments must pile up before they are merged.
+        size_t mergeFanIn;
+        /// Whether to compact in background-priority tasks on the shared task pool whenever enough small segments
+        /// have piled up. Without it, compactOnce() must be called explicitly.
+        bool backgroundCompaction;
+
+        SegmentStoreOptions()
+            : smallSegmentRows(1 << 16),
+              mergeFanIn(4),
+              backgroundCompaction(true) {
+        }
+    };
+
+    class SegmentStore {
+    public:
+        typedef std::vector<std::shared_ptr<const Segment> > SegmentList;
+
+    private:
+        SegmentStoreOptions options_;
+        mutable std::mutex mutex_;
+        std::mutex compactionMutex_;
+        std::shared_ptr<const SegmentList> segments_;
+        uint64_t nextSequence_;
+        bool stopping_;
+        /// Whether a compaction task is queued or running. At most one is, since they would only contend.
+        bool compactionQueued_;
+        TaskGroup compactions_;
+
+        /// Queues a compaction task if there is work for one and none is queued. Called with mutex_ held.
+        void scheduleCompaction();
+
+        /// The body of a compaction task: merges one batch, then queues the next task if more remain.
+        void compactStep();
+
+        /// Picks small segments to merge. Returns an empty list if there are not enough of them.
+        SegmentList pickCompaction(const SegmentList &segments) const;
+
+    public:
+        explicit SegmentStore(const SegmentStoreOptions &options = SegmentStoreOptions());
+
+        ~SegmentStore();
+
+        SegmentStore(const SegmentStore &) = delete;
+
+        SegmentStore &operator=(const SegmentStore &) = delete;
+
+        /// Returns a sequence number for a segment about to be added.
+        uint64_t nextSequence();
+
+        /// Publishes a new segment. Existing segments are untouched, so this costs only a pointer-list copy.
+        void add(const std::shared_ptr<const Segment> &segment);
+
+        void addYearTable(const YearTable &table) {
+            add(Segment::fromYearTable(table, nextSequence()));
+        }
+
+        void addDeltas(const std::vector<CountDelta> &deltas) {
+            add(Segment::fromDeltas(deltas, nextSequence()));
+        }
+
+        /// The segments visible right now. Queries run against this snapshot while new segments keep arriving.
+        std::shared_ptr<const SegmentList> segments() const;
+
+        /// Merges one batch of small segments if enough have accumulated. Returns whether anything was merged.
+        bool compactOnce();
+
+        /// Total count for one (year, sex, name) across all segments.
+        int64_t count(int year, Sex sex, uint32_t nameId) const;
+
+        /// The k most common names for a year and sex after merging all segments.
+        std::vector<NameCount> top(int year, Sex sex, size_t k) const;
+
+        /// Materializes one year as a regular table, in descending count order.
+        YearTable yearTable(int year) const;
+    };
+}
+
+#endif //SEGMENT_STORE_HPP
@@ -0,0 +1,678 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "admission.hpp"
+#include "async_io.hpp"
+#include "async_loader.hpp"
+#include "batch.hpp"
+#include "binary_protocol.hpp"
+#include "http_protocol.hpp"
+#include "latency.hpp"
+#include "lazy_years.hpp"
+#include "parallel.hpp"
+
+#ifdef __unix__
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+
+namespace names {
+    // ---- SendQueue ---- //
+
+    SendQueue::SendQueue(const size_t blockSize)
+        : sent_(0),
+          size_(0),
+          blockSize_(blockSize) {
+    }
+
+    void SendQueue::addBlock(const size_t capacity) {
+        Block block;
+        block.capacity = std::max(capacity, blockSize_);
+        block.data.reset(new char[block.capacity]);
+        block.used = 0;
+        blocks_.push_back(std::move(block));
+    }
+
+    void SendQueue::append(const void *data, size_t len) {
+        const char *bytes = static_cast<const char *>(data);
+        while (len) {
+            if (blocks_.empty() || blocks_.back().used == blocks_.back().capacity)
+                addBlock(blockSize_);
+            Block &block = blocks_.back();
+            const size_t n = std::min(len, block.capacity - block.used);
+            std::memcpy(block.data.get() + block.used, bytes, n);
+            block.used += n;
+            size_ += n;
+            bytes += n;
+            len -= n;
+        }
+    }
+
+    long SendQueue::send(const int fd) {
+#ifdef __unix__
+        if (!size_)
+            return 0;
+        iovec iov[64];
+        int count = 0;
+        for (std::deque<Block>::iterator it = blocks_.begin(); it != blocks_.end() && count < 64; ++it) {
+            const size_t skip = it == blocks_.begin() ? sent_ : 0;
+            if (it->used == skip)
+                continue;
+            iov[count].iov_base = it->data.get() + skip;
+            iov[count].iov_len = it->used - skip;
+            ++count;
+        }
+        ssize_t n;
+        do {
+            n = writev(fd, iov, count);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+        // drop what went out, keeping the last block to fill again once it is empty
+        size_ -= static_cast<size_t>(n);
+        size_t left = static_cast<size_t>(n);
+        while (!blocks_.empty()) {
+            Block &front = blocks_.front();
+            const size_t pending = front.used - sent_;
+            if (left < pending) {
+                sent_ += left;
+                break;
+            }
+            left -= pending;
+            sent_ = 0;
+            if (blocks_.size() == 1) {
+                front.used = 0;
+                break;
+            }
+            blocks_.pop_front();
+        }
+        return static_cast<long>(n);
+#else
+        static_cast<void>(fd);
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    std::string SendQueue::take() {
+        std::string bytes;
+        bytes.reserve(size_);
+        for (size_t i = 0; i < blocks_.size(); ++i) {
+            const size_t skip = i ? 0 : sent_;
+            bytes.append(blocks_[i].data.get() + skip, blocks_[i].used - skip);
+        }
+        blocks_.clear();
+        sent_ = 0;
+        size_ = 0;
+        return bytes;
+    }
+
+    // ---- QueryServer ---- //
+
+#ifdef __linux__
+    namespace {
+        std::runtime_error socketError(const std::string &what) {
+            return std::runtime_error("server: " + what + ": " + std::strerror(errno));
+        }
+
+        /// Opens a non-blocking listening socket on host:port that other loops can share with SO_REUSEPORT.
+        int listenOn(const std::string &host, const uint16_t port) {
+            sockaddr_in address = sockaddr_in();
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+                throw std::runtime_error("server: not an IPv4 address: " + host);
+            const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                throw socketError("socket");
+            const int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+                bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 1024) != 0) {
+                const std::runtime_error error = socketError("unable to listen on " + host + ":" + std::to_string(port));
+                close(fd);
+                throw error;
+            }
+            return fd;
+        }
+
+        uint16_t boundPort(const int fd) {
+            sockaddr_in address = sockaddr_in();
+            socklen_t len = sizeof(address);
+            if (getsockname(fd, reinterpret_cast<sockaddr *>(&address), &len) != 0)
+                throw socketError("getsockname");
+            return ntohs(address.sin_port);
+        }
+
+        struct Connection {
+            int fd;
+            std::unique_ptr<ProtocolHandler> handler;
+            std::vector<char> input;
+            size_t inputUsed;
+            SendQueue output;
+            /// The events the connection is registered for.
+            uint32_t events;
+            /// When the oldest unanswered input arrived.
+            std::chrono::steady_clock::time_point arrived;
+            bool closing;
+            /// Whether the peer has shut down its side. What it sent is still answered before the connection closes.
+            bool halfClosed;
+            /// Whether the handler left requests for a later turn, in which case the connection is on the loop's
+            /// ready list, or parked, and nothing more is read from it until they have been answered.
+            bool deferred;
+        };
+    }
+
+    struct QueryServer::Loop {
+        const ServerOptions &options;
+        const HandlerFactory &factory;
+        int listenFd;
+        int epollFd;
+        int wakeFd;
+        std::thread thread;
+        std::unordered_map<int, std::unique_ptr<Connection> > connections;
+        /// Connections with deferred requests, served in turn once the ready events have been handled.
+        std::vector<int> ready;
+        std::vector<int> turn;
+        /// Connections whose deferred requests wait for resume() rather than a turn.
+        std::vector<int> parked;
+        /// What the wake descriptor was signalled for.
+        std::atomic<bool> stopping;
+        std::atomic<bool> resumed;
+        std::atomic<uint64_t> accepted;
+        std::atomic<uint64_t> bytesIn;
+        std::atomic<uint64_t> bytesOut;
+        std::atomic<uint64_t> writes;
+
+        Loop(const ServerOptions &options, const HandlerFactory &factory, const int listenFd)
+            : options(options),
+              factory(factory),
+              listenFd(listenFd),
+              epollFd(-1),
+              wakeFd(-1),
+              stopping(false),
+              resumed(false),
+              accepted(0),
+              bytesIn(0),
+              bytesOut(0),
+              writes(0) {
+            epollFd = epoll_create1(EPOLL_CLOEXEC);
+            wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epollFd < 0 || wakeFd < 0) {
+                const std::runtime_error error = socketError("unable to create an event loop");
+                closeAll();
+                throw error;
+            }
+            watch(listenFd, EPOLLIN);
+            watch(wakeFd, EPOLLIN);
+        }
+
+        ~Loop() {
+            closeAll();
+        }
+
+        void closeAll() {
+            for (const std::pair<const int, std::unique_ptr<Connection> > &entry: connections)
+                close(entry.first);
+            connections.clear();
+            ready.clear();
+            parked.clear();
+            for (int *fd: {&listenFd, &epollFd, &wakeFd}) {
+                if (*fd >= 0)
+                    close(*fd);
+                *fd = -1;
+            }
+        }
+
+        void watch(const int fd, const uint32_t events) {
+            epoll_event event = epoll_event();
+            event.events = events;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        void update(Connection &connection, const uint32_t events) {
+            if (connection.events == events)
+                return;
+            epoll_event event = epoll_event();
+            event.events = events;
+            event.data.fd = connection.fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.events = events;
+        }
+
+        void drop(const int fd) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            connections.erase(fd);
+        }
+
+        void acceptAll() {
+            while (true) {
+                const int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                    return;
+                const int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                std::unique_ptr<Connection> connection(new Connection());
+                connection->fd = fd;
+                connection->handler = factory();
+                connection->input.resize(options.readSize);
+                connection->inputUsed = 0;
+                connection->events = EPOLLIN;
+                connection->closing = false;
+                connection->halfClosed = false;
+                connection->deferred = false;
+                watch(fd, EPOLLIN);
+                connections[fd] = std::move(connection);
+                ++accepted;
+            }
+        }
+
+        /// Sends what is waiting and picks the events to wait for next. Returns false if the connection is done.
+        bool flush(Connection &connection) {
+            const long sent = connection.output.send(connection.fd);
+            if (sent < 0)
+                return false;
+            if (sent > 0) {
+                bytesOut += static_cast<uint64_t>(sent);
+                ++writes;
+            }
+            if (connection.closing && connection.output.empty())
+                return false;
+            uint32_t events = 0;
+            if (!connection.closing && !connection.halfClosed && !connection.deferred &&
+                connection.output.size() <= options.maxPendingOutput)
+                events |= EPOLLIN;
+            if (!connection.output.empty())
+                events |= EPOLLOUT;
+            update(connection, events);
+            return true;
+        }
+
+        /// Reads what has arrived and answers the complete requests in it. Returns false if the connection is done.
+        bool receive(Connection &connection) {
+            std::vector<char> &input = connection.input;
+            const bool wasEmpty = !connection.inputUsed;
+            // read until the socket is drained, but only one buffer's worth per wakeup so busy connections share
+            size_t budget = options.readSize;
+            while (budget) {
+                if (connection.inputUsed == input.size()) {
+                    if (input.size() >= options.maxRequest + options.readSize)
+                        return false;
+                    input.resize(input.size() * 2);
+                }
+                const size_t room = std::min(budget, input.size() - connection.inputUsed);
+                const ssize_t n = read(connection.fd, input.data() + connection.inputUsed, room);
+                if (n == 0) {
+                    // a client may pipeline its requests and then shut down its side; they are still answered
+                    connection.halfClosed = true;
+                    break;
+                }
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+                    return false;
+                }
+                connection.inputUsed += static_cast<size_t>(n);
+                bytesIn += static_cast<uint64_t>(n);
+                budget -= static_cast<size_t>(n);
+            }
+            if (wasEmpty)
+                connection.arrived = std::chrono::steady_clock::now();
+            return answer(connection);
+        }
+
+        /// Has the handler answer what it can of the input. Returns false if the connection is done.
+        bool answer(Connection &connection) {
+            std::vector<char> &input = connection.input;
+            ConsumeContext context;
+            context.arrived = connection.arrived;
+            context.close = connection.closing;
+            context.maxRequest = options.maxRequest;
+            context.maxAnswers = options.maxTurnAnswers;
+            const size_t used = connection.handler->consume(input.data(), connection.inputUsed, connection.output,
+                                                            context);
+            connection.closing = context.close;
+            connection.deferred = context.deferred && !context.close;
+            // nothing more will arrive, so once the deferred requests are answered the connection is done
+            if (connection.halfClosed && !connection.deferred)
+                connection.closing = true;
+            if (connection.deferred)
+                (context.parked ? parked : ready).push_back(connection.fd);
+            if (used) {
+                std::memmove(input.data(), input.data() + used, connection.inputUsed - used);
+                connection.inputUsed -= used;
+                // what is left is the start of a request still arriving, unless requests were deferred
+                if (!connection.deferred)
+                    connection.arrived = std::chrono::steady_clock::now();
+            }
+            if (!connection.deferred && connection.inputUsed > options.maxRequest)
+                connection.closing = true;
+            // give back a buffer that grew for one large request
+            if (!connection.inputUsed && input.size() > options.readSize) {
+                std::vector<char>(options.readSize).swap(input);
+            }
+            return flush(connection);
+        }
+
+        /// Gives every connection on the ready list a turn. Returns whether any of them got anything answered.
+        bool serveReady() {
+            turn.clear();
+            turn.swap(ready);
+            bool progress = false;
+            for (const int fd: turn) {
+                const std::unordered_map<int, std::unique_ptr<Connection> >::iterator it = connections.find(fd);
+                // the connection may have been dropped, and its descriptor reused, since it was deferred
+                if (it == connections.end() || !it->second->deferred)
+                    continue;
+                Connection &connection = *it->second;
+                // answering more than the client reads would only grow its output; wait for that to go out first
+                if (connection.output.size() > options.maxPendingOutput) {
+                    ready.push_back(fd);
+                    continue;
+                }
+                connection.deferred = false;
+                const size_t before = connection.inputUsed;
+                const bool alive = answer(connection);
+                progress = progress || !alive || connection.inputUsed != before;
+                if (!alive)
+                    drop(fd);
+            }
+            return progress;
+        }
+
+        void run() {
+            epoll_event events[256];
+            bool stalled = false;
+            while (true) {
+                // deferred requests only poll for new events, unless none of them could be answered last time, as
+                // when every expensive slot is taken, in which case they wait a little; parked ones wait for a wakeup
+                const int timeout = ready.empty() ? -1 : stalled ? 1 : 0;
+                const int n = epoll_wait(epollFd, events, 256, timeout);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+                for (int i = 0; i < n; ++i) {
+                    const int fd = events[i].data.fd;
+                    if (fd == wakeFd) {
+                        uint64_t count;
+                        if (read(wakeFd, &count, sizeof(count)) < 0) {
+                            // another wakeup already reset it
+                        }
+                        if (stopping.load())
+                            return;
+                        // every parked connection gets a turn; those still waiting park again
+                        if (resumed.exchange(false)) {
+                            ready.insert(ready.end(), parked.begin(), parked.end());
+                            parked.clear();
+                        }
+                        continue;
+                    }
+                    if (fd == listenFd) {
+                        acceptAll();
+                        continue;
+                    }
+                    const std::unordered_map<int, std::unique_ptr<Connection> >::iterator it = connections.find(fd);
+                    if (it == connections.end())
+                        continue;
+                    Connection &connection = *it->second;
+                    bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP)) || (events[i].events & EPOLLIN);
+                    if (alive && (events[i].events & EPOLLOUT))
+                        alive = flush(connection);
+                    if (alive && (events[i].events & EPOLLIN) && (connection.events & EPOLLIN))
+                        alive = receive(connection);
+                    if (!alive)
+                        drop(fd);
+                }
+                if (!ready.empty())
+                    stalled = !serveReady();
+            }
+        }
+    };
+#else
+    struct QueryServer::Loop {
+        std::atomic<uint64_t> accepted;
+        std::atomic<uint64_t> bytesIn;
+        std::atomic<uint64_t> bytesOut;
+        std::atomic<uint64_t> writes;
+    };
+#endif
+
+    QueryServer::QueryServer(const ServerOptions &options, const HandlerFactory &factory)
+        : options_(options),
+          factory_(factory),
+          port_(0) {
+    }
+
+    QueryServer::~QueryServer() {
+        stop();
+    }
+
+    void QueryServer::start() {
+#ifdef __linux__
+        if (!loops_.empty() && loops_.front()->thread.joinable())
+            return;
+        loops_.clear();
+        const size_t count = options_.loops ? options_.loops : workerCount();
+        // the first socket settles the port when asked for any free one; the rest join it
+        uint16_t port = options_.port;
+        try {
+            for (size_t i = 0; i < count; ++i) {
+                const int fd = listenOn(options_.host, port);
+                if (!i)
+                    port = boundPort(fd);
+                // the loop owns the socket from here, closing it even if it fails to start
+                loops_.push_back(std::unique_ptr<Loop>(new Loop(options_, factory_, fd)));
+            }
+        } catch (...) {
+            loops_.clear();
+            throw;
+        }
+        port_ = port;
+        for (const std::unique_ptr<Loop> &loop: loops_) {
+            Loop *running = loop.get();
+            loop->thread = std::thread([running]() { running->run(); });
+        }
+#else
+        throw std::runtime_error("server: not supported on this platform");
+#endif
+    }
+
+    void QueryServer::stop() {
+#ifdef __linux__
+        for (const std::unique_ptr<Loop> &loop: loops_) {
+            const uint64_t one = 1;
+            loop->stopping = true;
+            if (write(loop->wakeFd, &one, sizeof(one)) < 0) {
+                // the loop is already being woken
+            }
+        }
+        // the loops stay around, closed, so their counts can still be read
+        for (const std::unique_ptr<Loop> &loop: loops_) {
+            if (loop->thread.joinable()) {
+                loop->thread.join();
+                loop->closeAll();
+            }
+        }
+#endif
+    }
+
+    void QueryServer::resume() {
+#ifdef __linux__
+        for (const std::unique_ptr<Loop> &loop: loops_) {
+            const uint64_t one = 1;
+            loop->resumed = true;
+            if (write(loop->wakeFd, &one, sizeof(one)) < 0) {
+                // the loop is already being woken
+            }
+        }
+#endif
+    }
+
+    ServerStats QueryServer::stats() const {
+        ServerStats stats = ServerStats();
+        for (const std::unique_ptr<Loop> &loop: loops_) {
+            stats.connections += loop->accepted.load();
+            stats.bytesIn += loop->bytesIn.load();
+            stats.bytesOut += loop->bytesOut.load();
+            stats.writes += loop->writes.load();
+        }
+        return stats;
+    }
+
+    int serveMain(const int argc, char **argv) {
+        std::string dir = NAMES_DATA_DIR;
+        int firstYear = 1880;
+        int lastYear = 9999;
+        ServerOptions options;
+        options.port = 7343;
+        AdmissionOptions admissionOptions;
+        bool http = false;
+        bool lazy = false;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--lazy") {
+                lazy = true;
+                continue;
+            }
+            if (i + 1 == argc || (arg != "--data" && arg != "--years" && arg != "--host" && arg != "--port" &&
+                                  arg != "--loops" && arg != "--protocol" && arg != "--max-in-flight" &&
+                                  arg != "--deadline-ms")) {
+                std::fprintf(stderr, "usage: %s [--data DIR] [--years FIRST-LAST] [--host ADDRESS] [--port PORT] "
+                                     "[--loops N] [--protocol binary|http] [--max-in-flight N] [--deadline-ms MS] "
+                                     "[--lazy]\n",
+                             argv[0]);
+                return 2;
+            }
+            const char *value = argv[++i];
+            if (arg == "--max-in-flight") {
+                admissionOptions.maxInFlight = std::max<size_t>(1, std::strtoul(value, nullptr, 10));
+            } else if (arg == "--deadline-ms") {
+                admissionOptions.deadline = std::chrono::milliseconds(std::atoi(value));
+            } else if (arg == "--protocol") {
+                const std::string protocol = value;
+                if (protocol != "binary" && protocol != "http") {
+                    std::fprintf(stderr, "unknown protocol: %s\n", value);
+                    return 2;
+                }
+                http = protocol == "http";
+            } else if (arg == "--data") {
+                dir = value;
+            } else if (arg == "--host") {
+                options.host = value;
+            } else if (arg == "--port") {
+                options.port = static_cast<uint16_t>(std::atoi(value));
+            } else if (arg == "--loops") {
+                options.loops = static_cast<size_t>(std::atoi(value));
+            } else if (!parseYearRange(value, firstYear, lastYear)) {
+                std::fprintf(stderr, "bad year range: %s\n", value);
+                return 2;
+            }
+        }
+
+        try {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            Corpus corpus;
+            std::unique_ptr<AsyncFileReader> reader;
+            std::unique_ptr<LazyYearStore> years;
+            if (lazy) {
+                // the corpus stays empty, answering only for years the store does not have
+                reader.reset(new AsyncFileReader());
+                years.reset(new LazyYearStore(dir, firstYear, lastYear, *reader));
+                std::fprintf(stderr, "loading years %d-%d from %s as they are asked for\n", firstYear, lastYear,
+                             dir.c_str());
+            } else {
+                const size_t files = loadYearRangeAsync(corpus, dir, firstYear, lastYear);
+                if (!files) {
+                    std::fprintf(stderr, "no yob files for %d-%d in %s\n", firstYear, lastYear, dir.c_str());
+                    return 1;
+                }
+                const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+                std::fprintf(stderr, "loaded %zu yob files (%zu rows) in %.1f ms\n", files, corpus.rows(),
+                             took.count());
+            }
+            const QueryEngine engine(corpus);
+
+#ifdef __unix__
+            // the loops inherit a mask without the stop signals, so only this thread waits for them
+            sigset_t stopSignals;
+            sigemptyset(&stopSignals);
+            sigaddset(&stopSignals, SIGINT);
+            sigaddset(&stopSignals, SIGTERM);
+            pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+#endif
+            AdmissionController admission(admissionOptions);
+            QueryMetrics metrics;
+            LazyYearStore *lazyYears = years.get();
+            if (http)
+                options.maxTurnAnswers = HTTP_TURN_ANSWERS;
+            QueryServer server(options, [&engine, &admission, &metrics, lazyYears, http]() {
+                if (http)
+                    return std::unique_ptr<ProtocolHandler>(new HttpHandler(engine, &admission, &metrics, lazyYears));
+                return std::unique_ptr<ProtocolHandler>(new BinaryHandler(engine, &admission, &metrics, lazyYears));
+            });
+            server.start();
+            // connections waiting for a year are woken as soon as it is in memory
+            if (years)
+                years->onLoaded([&server]() { server.resume(); });
+            std::fprintf(stderr, "serving %s on %s:%u with %zu event loops\n", http ? "HTTP" : "the binary protocol",
+                         options.host.c_str(), server.port(), server.loopCount());
+#ifdef __unix__
+            int caught = 0;
+            sigwait(&stopSignals, &caught);
+#endif
+            if (years)
+                years->onLoaded(nullptr);
+            server.stop();
+            const ServerStats stats = server.stats();
+            std::fprintf(stderr, "served %llu connections, %llu bytes in, %llu bytes out in %llu writes\n",
+                         static_cast<unsigned long long>(stats.connections),
+                         static_cast<unsigned long long>(stats.bytesIn),
+                         static_cast<unsigned long long>(stats.bytesOut),
+                         static_cast<unsigned long long>(stats.writes));
+            const AdmissionStats admitted = admission.stats();
+            std::fprintf(stderr, "admitted %llu requests, refused %llu overloaded and %llu expired, deferred %llu "
+                                 "turns\n", static_cast<unsigned long long>(admitted.admitted),
+                         static_cast<unsigned long long>(admitted.overloaded),
+                         static_cast<unsigned long long>(admitted.expired),
+                         static_cast<unsigned long long>(admitted.deferred));
+            if (years) {
+                std::fprintf(stderr, "read %llu yob files on demand\n",
+                             static_cast<unsigned long long>(years->loads()));
+            }
+            std::fputs(formatStatsText(metrics, corpus.memoryUsed() + (years ? years->footprint().used : 0)).c_str(),
+                       stderr);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,207 @@
+/*
+ * server.hpp
+ *
+ * The TCP front end shared by the query protocols. One event loop runs per core, each with its own epoll instance and
+ * its own listening socket bound to the same port with SO_REUSEPORT, so the kernel spreads incoming connections
+ * across the loops and no state is shared between them. A connection's protocol handler is given everything that has
+ * arrived and answers as many pipelined requests as are complete; the responses collect in the connection's send
+ * queue and go out in a single writev once the whole read has been answered.
+ */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace names {
+    /// Outgoing bytes of one connection, kept as a list of blocks so large backlogs never move. Protocol handlers
+    /// format straight into it with reserve() and commit().
+    class SendQueue {
+        struct Block {
+            std::unique_ptr<char[]> data;
+            size_t capacity;
+            size_t used;
+        };
+
+        std::deque<Block> blocks_;
+        /// Bytes of the first block already sent.
+        size_t sent_;
+        size_t size_;
+        size_t blockSize_;
+
+        void addBlock(size_t capacity);
+
+    public:
+        explicit SendQueue(size_t blockSize = 64 << 10);
+
+        /// Returns room for n contiguous bytes at the end of the queue; commit() what was used.
+        char *reserve(const size_t n) {
+            if (blocks_.empty() || blocks_.back().capacity - blocks_.back().used < n)
+                addBlock(n);
+            return blocks_.back().data.get() + blocks_.back().used;
+        }
+
+        void commit(const size_t n) {
+            blocks_.back().used += n;
+            size_ += n;
+        }
+
+        void append(const void *data, size_t len);
+
+        /// Bytes waiting to be sent.
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return !size_;
+        }
+
+        /// Hands every waiting block to fd in one writev, or as many as fit in one call. Returns the bytes written,
+        /// 0 if the socket would block, or -1 with errno set if the connection failed.
+        long send(int fd);
+
+        /// Copies out everything waiting and empties the queue. For tests and in-process use.
+        std::string take();
+    };
+
+    /// What the server tells a handler about the bytes it is given, and what the handler tells it back.
+    struct ConsumeContext {
+        /// When the oldest of the bytes arrived, for shedding requests that have waited too long.
+        std::chrono::steady_clock::time_point arrived;
+        /// Set by the handler to end the connection once its output has been sent, e.g. after a malformed request.
+        bool close;
+        /// Set by the handler when it left complete requests unanswered for now (see AdmissionController). The
+        /// server passes them again after other connections have had a turn, without reading more first.
+        bool deferred;
+        /// Set by the handler, along with deferred, when the requests wait for something other than a turn, such as a
+        /// year being loaded. The server then leaves the connection alone until QueryServer::resume() is called.
+        bool parked;
+        /// The largest request the server buffers. A handler that can tell a request's size from its start closes the
+        /// connection as soon as it sees one larger.
+        size_t maxRequest;
+        /// Requests to answer this turn at most. A handler defers the rest, so one deep pipeline cannot hold the loop
+        /// while other connections' requests wait.
+        size_t maxAnswers;
+
+        ConsumeContext()
+            : arrived(std::chrono::steady_clock::now()),
+              close(false),
+              deferred(false),
+              parked(false),
+              maxRequest(SIZE_MAX),
+              maxAnswers(SIZE_MAX) {
+        }
+    };
+
+    /// Speaks one protocol on one connection.
+    class ProtocolHandler {
+    public:
+        virtual ~ProtocolHandler() {
+        }
+
+        /// Answers the complete requests at the start of [data, data + len), appending the responses to out, and
+        /// returns how many bytes it used. The rest is passed again, with more data after it once more has arrived
+        /// unless the handler deferred it.
+        virtual size_t consume(const char *data, size_t len, SendQueue &out, ConsumeContext &context) = 0;
+    };
+
+    typedef std::function<std::unique_ptr<ProtocolHandler>()> HandlerFactory;
+
+    struct ServerOptions {
+        /// Address to listen on. Loopback by default, since the server is for other processes on the same host.
+        std::string host;
+        /// 0 picks a free port; see QueryServer::port().
+        uint16_t port;
+        /// Number of event loops, each on its own thread. 0 means one per core.
+        size_t loops;
+        /// Bytes read from a connection at a time.
+        size_t readSize;
+        /// A single request larger than this closes its connection.
+        size_t maxRequest;
+        /// While more than this many response bytes wait on a connection, no more of its requests are read, so a
+        /// client that stops reading cannot make the server buffer without bound.
+        size_t maxPendingOutput;
+        /// Requests of one connection answered before the loop gives the others a turn. Small, since a request waits
+        /// for every batch answered ahead of it on its loop.
+        size_t maxTurnAnswers;
+
+        ServerOptions()
+            : host("127.0.0.1"),
+              port(0),
+              loops(0),
+              readSize(64 << 10),
+              maxRequest(1 << 20),
+              maxPendingOutput(4 << 20),
+              maxTurnAnswers(64) {
+        }
+    };
+
+    struct ServerStats {
+        uint64_t connections;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+        /// writev calls made, each sending every response that was waiting.
+        uint64_t writes;
+    };
+
+    class QueryServer {
+        struct Loop;
+
+        ServerOptions options_;
+        HandlerFactory factory_;
+        std::vector<std::unique_ptr<Loop> > loops_;
+        uint16_t port_;
+
+    public:
+        /// Every accepted connection gets its own handler from factory, which is called on the connection's loop.
+        QueryServer(const ServerOptions &options, const HandlerFactory &factory);
+
+        /// Stops the server if it is running.
+        ~QueryServer();
+
+        QueryServer(const QueryServer &) = delete;
+
+        QueryServer &operator=(const QueryServer &) = delete;
+
+        /// Binds every loop's socket and starts the loops. Throws std::runtime_error if the address cannot be bound
+        /// or the platform has no epoll.
+        void start();
+
+        /// Closes every connection and joins the loops. Safe to call more than once; start() starts afresh.
+        void stop();
+
+        /// Gives every parked connection (see ConsumeContext::parked) a turn again. Can be called from any thread
+        /// while the server runs, but not concurrently with start() or stop().
+        void resume();
+
+        /// The port being listened on, once started.
+        uint16_t port() const {
+            return port_;
+        }
+
+        size_t loopCount() const {
+            return loops_.size();
+        }
+
+        /// Totals over every loop since the last start(), also once stopped.
+        ServerStats stats() const;
+    };
+
+    /// Entry point for `serve [--data DIR] [--years FIRST-LAST] [--host ADDRESS] [--port PORT] [--loops N]
+    /// [--protocol binary|http] [--max-in-flight N] [--deadline-ms MS] [--lazy]`, with argv[0] being "serve". Loads
+    /// the corpus and answers the binary protocol (see binary_protocol.hpp) or HTTP (see http_protocol.hpp) until
+    /// interrupted, under admission control (see admission.hpp). With --lazy nothing is loaded up front: only rank and
+    /// top are served, each year being read when first asked about (see lazy_years.hpp) while the connections asking
+    /// wait, parked, until it is in memory. Returns the exit code.
+    int serveMain(int argc, char **argv);
+}
+
+#endif //SERVER_HPP
@@ -0,0 +1,294 @@
+#include "simd_kernels.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define NAMES_SIMD_X86
+// GCC 12 flags the deliberately undefined vectors inside some AVX-512 intrinsics once they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#endif
+
+namespace names {
+    namespace {
+        // ---- Scalar ---- //
+
+        uint64_t popcountScalar(const uint64_t *words, const size_t n) {
+            uint64_t total = 0;
+            for (size_t i = 0; i < n; ++i)
+                total += __builtin_popcountll(words[i]);
+            return total;
+        }
+
+        uint64_t popcountAndScalar(const uint64_t *a, const uint64_t *b, const size_t n) {
+            uint64_t total = 0;
+            for (size_t i = 0; i < n; ++i)
+                total += __builtin_popcountll(a[i] & b[i]);
+            return total;
+        }
+
+        void andScalar(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = a[i] & b[i];
+        }
+
+        void orScalar(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = a[i] | b[i];
+        }
+
+        void andNotScalar(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = a[i] & ~b[i];
+        }
+
+        bool isNonIncreasingScalar(const uint32_t *values, const size_t n) {
+            for (size_t i = 1; i < n; ++i) {
+                if (values[i] > values[i - 1])
+                    return false;
+            }
+            return true;
+        }
+
+        SimdKernels scalarKernels() {
+            SimdKernels kernels;
+            kernels.popcount = popcountScalar;
+            kernels.popcountAnd = popcountAndScalar;
+            kernels.andWords = andScalar;
+            kernels.orWords = orScalar;
+            kernels.andNotWords = andNotScalar;
+            kernels.isNonIncreasing = isNonIncreasingScalar;
+            return kernels;
+        }
+
+#ifdef NAMES_SIMD_X86
+        // ---- SSE2 (plus POPCNT where present) ---- //
+
+        __attribute__((target("popcnt")))
+        uint64_t popcountHardware(const uint64_t *words, const size_t n) {
+            uint64_t total = 0;
+            for (size_t i = 0; i < n; ++i)
+                total += __builtin_popcountll(words[i]);
+            return total;
+        }
+
+        __attribute__((target("popcnt")))
+        uint64_t popcountAndHardware(const uint64_t *a, const uint64_t *b, const size_t n) {
+            uint64_t total = 0;
+            for (size_t i = 0; i < n; ++i)
+                total += __builtin_popcountll(a[i] & b[i]);
+            return total;
+        }
+
+        /// Generates dst = op(a, b) over 16-byte vectors with a scalar tail.
+#define NAMES_SSE2_BINARY(name, vectorOp, scalarExpr)                                                                  \
+        __attribute__((target("sse2")))                                                                                \
+        void name(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {                               \
+            size_t i = 0;                                                                                              \
+            for (; i + 2 <= n; i += 2) {                                                                               \
+                const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));                           \
+                const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));                           \
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), vectorOp);                                      \
+            }                                                                                                          \
+            for (; i < n; ++i)                                                                                         \
+                dst[i] = scalarExpr;                                                                                   \
+        }
+
+        NAMES_SSE2_BINARY(andSse2, _mm_and_si128(x, y), a[i] & b[i])
+        NAMES_SSE2_BINARY(orSse2, _mm_or_si128(x, y), a[i] | b[i])
+        // andnot complements its first operand
+        NAMES_SSE2_BINARY(andNotSse2, _mm_andnot_si128(y, x), a[i] & ~b[i])
+#undef NAMES_SSE2_BINARY
+
+        __attribute__((target("sse2")))
+        bool isNonIncreasingSse2(const uint32_t *values, const size_t n) {
+            // SSE2 only compares signed integers, so flip the sign bits to get an unsigned comparison
+            const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+            size_t i = 1;
+            for (; i + 4 <= n; i += 4) {
+                const __m128i cur = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i)), bias);
+                const __m128i prev = _mm_xor_si128(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i - 1)), bias);
+                if (_mm_movemask_epi8(_mm_cmpgt_epi32(cur, prev)))
+                    return false;
+            }
+            return isNonIncreasingScalar(values + i - 1, n - (i - 1));
+        }
+
+        SimdKernels sse2Kernels() {
+            SimdKernels kernels = scalarKernels();
+            if (cpuFeatures().popcnt) {
+                kernels.popcount = popcountHardware;
+                kernels.popcountAnd = popcountAndHardware;
+            }
+            kernels.andWords = andSse2;
+            kernels.orWords = orSse2;
+            kernels.andNotWords = andNotSse2;
+            kernels.isNonIncreasing = isNonIncreasingSse2;
+            return kernels;
+        }
+
+        // ---- AVX2 ---- //
+
+        /// Per-byte popcounts of v via a nibble lookup table, summed into four 64-bit lanes.
+        __attribute__((target("avx2")))
+        inline __m256i popcountLanes(const __m256i v) {
+            const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                   0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+            const __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+        }
+
+        __attribute__((target("avx2")))
+        inline uint64_t sumLanes(const __m256i v) {
+            uint64_t lanes[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+
+        __attribute__((target("avx2")))
+        uint64_t popcountAvx2(const uint64_t *words, const size_t n) {
+            __m256i sum = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+                sum = _mm256_add_epi64(sum, popcountLanes(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i))));
+            return sumLanes(sum) + popcountScalar(words + i, n - i);
+        }
+
+        __attribute__((target("avx2")))
+        uint64_t popcountAndAvx2(const uint64_t *a, const uint64_t *b, const size_t n) {
+            __m256i sum = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+                const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+                sum = _mm256_add_epi64(sum, popcountLanes(_mm256_and_si256(x, y)));
+            }
+            return sumLanes(sum) + popcountAndScalar(a + i, b + i, n - i);
+        }
+
+#define NAMES_AVX2_BINARY(name, vectorOp, scalarExpr)                                                                  \
+        __attribute__((target("avx2")))                                                                                \
+        void name(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {                               \
+            size_t i = 0;                                                                                              \
+            for (; i + 4 <= n; i += 4) {                                                                               \
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));                        \
+                const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));                        \
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), vectorOp);                                   \
+            }                                                                                                          \
+            for (; i < n; ++i)                                                                                         \
+                dst[i] = scalarExpr;                                                                                   \
+        }
+
+        NAMES_AVX2_BINARY(andAvx2, _mm256_and_si256(x, y), a[i] & b[i])
+        NAMES_AVX2_BINARY(orAvx2, _mm256_or_si256(x, y), a[i] | b[i])
+        NAMES_AVX2_BINARY(andNotAvx2, _mm256_andnot_si256(y, x), a[i] & ~b[i])
+#undef NAMES_AVX2_BINARY
+
+        __attribute__((target("avx2")))
+        bool isNonIncreasingAvx2(const uint32_t *values, const size_t n) {
+            size_t i = 1;
+            for (; i + 8 <= n; i += 8) {
+                const __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+                const __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i - 1));
+                // cur <= prev in every lane exactly when max(cur, prev) == prev
+                const __m256i same = _mm256_cmpeq_epi32(_mm256_max_epu32(cur, prev), prev);
+                if (_mm256_movemask_epi8(same) != -1)
+                    return false;
+            }
+            return isNonIncreasingScalar(values + i - 1, n - (i - 1));
+        }
+
+        SimdKernels avx2Kernels() {
+            SimdKernels kernels;
+            kernels.popcount = popcountAvx2;
+            kernels.popcountAnd = popcountAndAvx2;
+            kernels.andWords = andAvx2;
+            kernels.orWords = orAvx2;
+            kernels.andNotWords = andNotAvx2;
+            kernels.isNonIncreasing = isNonIncreasingAvx2;
+            return kernels;
+        }
+
+        // ---- AVX-512 ---- //
+
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        uint64_t popcountAvx512(const uint64_t *words, const size_t n) {
+            __m512i sum = _mm512_setzero_si512();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+                sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+            return static_cast<uint64_t>(_mm512_reduce_add_epi64(sum)) + popcountScalar(words + i, n - i);
+        }
+
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        uint64_t popcountAndAvx512(const uint64_t *a, const uint64_t *b, const size_t n) {
+            __m512i sum = _mm512_setzero_si512();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                const __m512i both = _mm512_and_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+                sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(both));
+            }
+            return static_cast<uint64_t>(_mm512_reduce_add_epi64(sum)) + popcountAndScalar(a + i, b + i, n - i);
+        }
+
+#define NAMES_AVX512_BINARY(name, vectorOp, scalarExpr)                                                                \
+        __attribute__((target("avx512f")))                                                                             \
+        void name(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {                               \
+            size_t i = 0;                                                                                              \
+            for (; i + 8 <= n; i += 8) {                                                                               \
+                const __m512i x = _mm512_loadu_si512(a + i);                                                           \
+                const __m512i y = _mm512_loadu_si512(b + i);                                                           \
+                _mm512_storeu_si512(dst + i, vectorOp);                                                                \
+            }                                                                                                          \
+            for (; i < n; ++i)                                                                                         \
+                dst[i] = scalarExpr;                                                                                   \
+        }
+
+        NAMES_AVX512_BINARY(andAvx512, _mm512_and_si512(x, y), a[i] & b[i])
+        NAMES_AVX512_BINARY(orAvx512, _mm512_or_si512(x, y), a[i] | b[i])
+        NAMES_AVX512_BINARY(andNotAvx512, _mm512_andnot_si512(y, x), a[i] & ~b[i])
+#undef NAMES_AVX512_BINARY
+
+        __attribute__((target("avx512f")))
+        bool isNonIncreasingAvx512(const uint32_t *values, const size_t n) {
+            size_t i = 1;
+            for (; i + 16 <= n; i += 16) {
+                const __m512i cur = _mm512_loadu_si512(values + i);
+                const __m512i prev = _mm512_loadu_si512(values + i - 1);
+                if (_mm512_cmpgt_epu32_mask(cur, prev))
+                    return false;
+            }
+            return isNonIncreasingScalar(values + i - 1, n - (i - 1));
+        }
+
+        SimdKernels avx512Kernels() {
+            SimdKernels kernels = avx2Kernels();
+            if (cpuFeatures().avx512Popcnt) {
+                kernels.popcount = popcountAvx512;
+                kernels.popcountAnd = popcountAndAvx512;
+            }
+            kernels.andWords = andAvx512;
+            kernels.orWords = orAvx512;
+            kernels.andNotWords = andNotAvx512;
+            kernels.isNonIncreasing = isNonIncreasingAvx512;
+            return kernels;
+        }
+#endif
+    }
+
+    const SimdKernels &simdKernels(const IsaLevel level) {
+#ifdef NAMES_SIMD_X86
+        static const SimdKernels tables[] = {scalarKernels(), sse2Kernels(), avx2Kernels(), avx512Kernels()};
+        return tables[static_cast<int>(level)];
+#else
+        static_cast<void>(level);
+        static const SimdKernels scalar = scalarKernels();
+        return scalar;
+#endif
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * simd_kernels.hpp
+ *
+ * Array kernels with scalar, SSE2, AVX2 and AVX-512 variants, dispatched on isaLevel() at each call. Inputs need no
+ * alignment or padding; the vector loops finish with a scalar tail.
+ */
+
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+namespace names {
+    /// One ISA level's implementation of every kernel.
+    struct SimdKernels {
+        uint64_t (*popcount)(const uint64_t *words, size_t n);
+        uint64_t (*popcountAnd)(const uint64_t *a, const uint64_t *b, size_t n);
+        void (*andWords)(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n);
+        void (*orWords)(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n);
+        void (*andNotWords)(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n);
+        bool (*isNonIncreasing)(const uint32_t *values, size_t n);
+    };
+
+    /// The kernels for a level, which must be supported by this host.
+    const SimdKernels &simdKernels(IsaLevel level);
+
+    /// Number of set bits in words[0, n).
+    inline uint64_t popcount(const uint64_t *words, const size_t n) {
+        return simdKernels(isaLevel()).popcount(words, n);
+    }
+
+    /// Number of bits set in both a and b.
+    inline uint64_t popcountAnd(const uint64_t *a, const uint64_t *b, const size_t n) {
+        return simdKernels(isaLevel()).popcountAnd(a, b, n);
+    }
+
+    /// dst = a & b. dst may be a or b.
+    inline void andWords(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+        simdKernels(isaLevel()).andWords(dst, a, b, n);
+    }
+
+    /// dst = a | b. dst may be a or b.
+    inline void orWords(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+        simdKernels(isaLevel()).orWords(dst, a, b, n);
+    }
+
+    /// dst = a & ~b. dst may be a or b.
+    inline void andNotWords(uint64_t *dst, const uint64_t *a, const uint64_t *b, const size_t n) {
+        simdKernels(isaLevel()).andNotWords(dst, a, b, n);
+    }
+
+    /// Whether values[i] <= values[i - 1] for every i, i.e. the array is in descending order with ties allowed.
+    inline bool isNonIncreasing(const uint32_t *values, const size_t n) {
+        return simdKernels(isaLevel()).isNonIncreasing(values, n);
+    }
+}
+
+#endif //SIMD_KERNELS_HPP
@@ -0,0 +1,271 @@
+#include "snapshot.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "file_io.hpp"
+#include "query.hpp"
+
+namespace names {
+    const size_t SnapshotReader::npos;
+
+    namespace {
+        const uint64_t SECTION_ALIGN = 8;
+
+        uint64_t alignUp(const uint64_t value) {
+            return (value + SECTION_ALIGN - 1) & ~(SECTION_ALIGN - 1);
+        }
+
+        /// Serializes sections into owned buffers, then lays them out after the header and section table.
+        class SnapshotBuilder {
+            std::vector<SnapshotSection> sections_;
+            std::vector<std::string> bodies_;
+
+        public:
+            std::string &add(const SectionType type, const int year) {
+                SnapshotSection section = SnapshotSection();
+                section.type = static_cast<uint32_t>(type);
+                section.year = year;
+                sections_.push_back(section);
+                bodies_.push_back(std::string());
+                return bodies_.back();
+            }
+
+            void write(const std::string &path, const uint64_t lastLsn) {
+                SnapshotHeader header = SnapshotHeader();
+                std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+                header.version = SNAPSHOT_VERSION;
+                header.sectionCount = static_cast<uint32_t>(sections_.size());
+                header.lastLsn = lastLsn;
+
+                uint64_t offset = sizeof(SnapshotHeader) + sections_.size() * sizeof(SnapshotSection);
+                std::vector<uint64_t> padding(sections_.size());
+                for (size_t i = 0; i < sections_.size(); ++i) {
+                    const uint64_t aligned = alignUp(offset);
+                    padding[i] = aligned - offset;
+                    sections_[i].offset = aligned;
+                    sections_[i].size = bodies_[i].size();
+                    sections_[i].crc = crc32c(bodies_[i].data(), bodies_[i].size());
+                    offset = aligned + bodies_[i].size();
+                }
+                header.tableCrc = crc32c(sections_.data(), sections_.size() * sizeof(SnapshotSection));
+
+                static const char zeros[SECTION_ALIGN] = {};
+                std::vector<WriteChunk> chunks;
+                chunks.push_back(WriteChunk(&header, sizeof(header)));
+                chunks.push_back(WriteChunk(sections_.data(), sections_.size() * sizeof(SnapshotSection)));
+                for (size_t i = 0; i < sections_.size(); ++i) {
+                    chunks.push_back(WriteChunk(zeros, padding[i]));
+                    chunks.push_back(WriteChunk(bodies_[i].data(), bodies_[i].size()));
+                }
+                writeFileAtomically(path, chunks);
+            }
+        };
+
+        template<typename T>
+        void append(std::string &out, const T &value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        template<typename T>
+        void appendArray(std::string &out, const std::vector<T> &values) {
+            if (!values.empty())
+                out.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+        }
+
+        std::runtime_error corrupt(const std::string &what) {
+            return std::runtime_error("corrupt snapshot: " + what);
+        }
+
+        void addCorpus(SnapshotBuilder &builder, const Corpus &corpus) {
+            // dictionary: count, byte length, count + 1 offsets, name bytes
+            const NameDictionary &dictionary = corpus.dictionary();
+            std::string &dict = builder.add(SectionType::Dictionary, 0);
+            const uint32_t count = static_cast<uint32_t>(dictionary.size());
+            std::vector<uint32_t> offsets(count + 1, 0);
+            std::string bytes;
+            for (uint32_t id = 0; id < count; ++id) {
+                const NameRef name = dictionary.name(id);
+                bytes.append(name.data, name.size);
+                offsets[id + 1] = static_cast<uint32_t>(bytes.size());
+            }
+            append(dict, count);
+            append(dict, static_cast<uint32_t>(bytes.size()));
+            appendArray(dict, offsets);
+            dict += bytes;
+
+            // year: female rows, male rows, then each sex's name IDs followed by its counts
+            for (const YearTable &table: corpus.years()) {
+                std::string &body = builder.add(SectionType::Year, table.year);
+                for (size_t s = 0; s < SEX_COUNT; ++s)
+                    append(body, static_cast<uint32_t>(table.columns[s].size()));
+                for (size_t s = 0; s < SEX_COUNT; ++s) {
+                    appendArray(body, table.columns[s].nameIds);
+                    appendArray(body, table.columns[s].counts);
+                }
+            }
+        }
+
+        void addIndexes(SnapshotBuilder &builder, const QueryEngine &engine) {
+            const NameDictionary &dictionary = engine.corpus().dictionary();
+            const uint32_t count = static_cast<uint32_t>(dictionary.size());
+
+            // a fresh table at a load factor of at most 1/4, so probes rarely go past the first slot
+            uint32_t slotCount = 16;
+            while (slotCount < 4 * static_cast<uint64_t>(count))
+                slotCount *= 2;
+            std::vector<uint32_t> slots(slotCount, NameDictionary::npos);
+            for (uint32_t id = 0; id < count; ++id) {
+                const NameRef name = dictionary.name(id);
+                size_t slot = NameDictionary::hash(name.data, name.size) & (slotCount - 1);
+                while (slots[slot] != NameDictionary::npos)
+                    slot = (slot + 1) & (slotCount - 1);
+                slots[slot] = id;
+            }
+            std::string &hash = builder.add(SectionType::NameHash, 0);
+            append(hash, slotCount);
+            append(hash, static_cast<uint32_t>(0));
+            appendArray(hash, slots);
+
+            appendArray(builder.add(SectionType::NameOrder, 0), engine.byName());
+
+            std::string &totals = builder.add(SectionType::Totals, 0);
+            for (size_t s = 0; s < SEX_COUNT; ++s)
+                append(totals, static_cast<uint32_t>(engine.rankedTotals(static_cast<Sex>(s)).size()));
+            for (size_t s = 0; s < SEX_COUNT; ++s)
+                appendArray(totals, engine.totals(static_cast<Sex>(s)));
+            for (size_t s = 0; s < SEX_COUNT; ++s)
+                appendArray(totals, engine.rankedTotals(static_cast<Sex>(s)));
+
+            const std::vector<YearTable> &years = engine.corpus().years();
+            for (size_t year = 0; year < years.size(); ++year) {
+                std::string &body = builder.add(SectionType::YearIndex, years[year].year);
+                for (size_t s = 0; s < SEX_COUNT; ++s)
+                    append(body, static_cast<uint32_t>(engine.descending(static_cast<Sex>(s), year)));
+                for (size_t s = 0; s < SEX_COUNT; ++s)
+                    appendArray(body, engine.rowsByName(static_cast<Sex>(s), year));
+            }
+        }
+    }
+
+    void writeSnapshot(const Corpus &corpus, const std::string &path, const uint64_t lastLsn) {
+        SnapshotBuilder builder;
+        addCorpus(builder, corpus);
+        builder.write(path, lastLsn);
+    }
+
+    void publishSnapshot(const QueryEngine &engine, const std::string &path, const uint64_t lastLsn) {
+        SnapshotBuilder builder;
+        addCorpus(builder, engine.corpus());
+        addIndexes(builder, engine);
+        builder.write(path, lastLsn);
+    }
+
+    SnapshotReader::SnapshotReader(const std::string &path, const MappingHints &hints)
+        : file_(path, hints),
+          header_(nullptr),
+          sections_(nullptr) {
+        if (file_.size() < sizeof(SnapshotHeader))
+            throw corrupt(path + " is too small");
+        header_ = reinterpret_cast<const SnapshotHeader *>(file_.data());
+        if (std::memcmp(header_->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+            throw corrupt(path + " has the wrong magic number");
+        if (header_->version != SNAPSHOT_VERSION)
+            throw corrupt(path + " has an unsupported version");
+
+        const uint64_t tableSize = static_cast<uint64_t>(header_->sectionCount) * sizeof(SnapshotSection);
+        if (file_.size() - sizeof(SnapshotHeader) < tableSize)
+            throw corrupt(path + " has a truncated section table");
+        sections_ = reinterpret_cast<const SnapshotSection *>(file_.data() + sizeof(SnapshotHeader));
+        if (crc32c(sections_, tableSize) != header_->tableCrc)
+            throw corrupt(path + " has a damaged section table");
+        for (size_t i = 0; i < header_->sectionCount; ++i) {
+            if (sections_[i].offset > file_.size() || sections_[i].size > file_.size() - sections_[i].offset)
+                throw corrupt(path + " has a section past the end of the file");
+        }
+
+        verified_.reset(new std::atomic<uint8_t>[header_->sectionCount]);
+        for (size_t i = 0; i < header_->sectionCount; ++i)
+            verified_[i].store(0, std::memory_order_relaxed);
+    }
+
+    size_t SnapshotReader::findSection(const SectionType type, const int year) const {
+        for (size_t i = 0; i < header_->sectionCount; ++i) {
+            if (sections_[i].type == static_cast<uint32_t>(type) && sections_[i].year == year)
+                return i;
+        }
+        return npos;
+    }
+
+    const char *SnapshotReader::sectionData(const size_t index) const {
+        const SnapshotSection &section = sections_[index];
+        const char *data = file_.data() + section.offset;
+        uint8_t state = verified_[index].load(std::memory_order_acquire);
+        if (!state) {
+            // Racing first readers may both compute the checksum; they agree on the answer, so that is harmless.
+            state = crc32c(data, section.size) == section.crc ? 1 : 2;
+            verified_[index].store(state, std::memory_order_release);
+        }
+        if (state != 1)
+            throw corrupt("checksum mismatch in section " + std::to_string(index));
+        return data;
+    }
+
+    void SnapshotReader::verifyAll() const {
+        for (size_t i = 0; i < header_->sectionCount; ++i)
+            sectionData(i);
+    }
+
+    uint64_t loadSnapshot(const std::string &path, Corpus &corpus) {
+        if (corpus.dictionary().size() || !corpus.years().empty())
+            throw std::logic_error("snapshots can only be loaded into an empty corpus");
+
+        // every section is about to be read front to back, so start the readahead now
+        MappingHints hints;
+        hints.willNeed = true;
+        const SnapshotReader reader(path, hints);
+        for (size_t i = 0; i < reader.sectionCount(); ++i) {
+            const SnapshotSection &section = reader.section(i);
+            const char *data = reader.sectionData(i);
+
+            if (section.type == static_cast<uint32_t>(SectionType::Dictionary)) {
+                uint32_t header[2];
+                if (section.size < sizeof(header))
+                    throw corrupt("dictionary section is truncated");
+                std::memcpy(header, data, sizeof(header));
+                const uint64_t expected = sizeof(header) + (static_cast<uint64_t>(header[0]) + 1) * 4 + header[1];
+                if (section.size != expected)
+                    throw corrupt("dictionary section has the wrong size");
+                const uint32_t *offsets = reinterpret_cast<const uint32_t *>(data + sizeof(header));
+                const char *bytes = data + sizeof(header) + (header[0] + 1) * 4;
+                for (uint32_t id = 0; id < header[0]; ++id) {
+                    if (offsets[id] > offsets[id + 1] || offsets[id + 1] > header[1])
+                        throw corrupt("dictionary offsets are out of order");
+                    if (corpus.dictionary().intern(bytes + offsets[id], offsets[id + 1] - offsets[id]) != id)
+                        throw corrupt("dictionary contains duplicate names");
+                }
+            } else if (section.type == static_cast<uint32_t>(SectionType::Year)) {
+                uint32_t rows[SEX_COUNT];
+                if (section.size < sizeof(rows))
+                    throw corrupt("year section is truncated");
+                std::memcpy(rows, data, sizeof(rows));
+                if (section.size != sizeof(rows) + (static_cast<uint64_t>(rows[0]) + rows[1]) * 8)
+                    throw corrupt("year section has the wrong size");
+                YearTable &table = corpus.yearTable(section.year);
+                const uint32_t *column = reinterpret_cast<const uint32_t *>(data + sizeof(rows));
+                for (size_t s = 0; s < SEX_COUNT; ++s) {
+                    for (uint32_t row = 0; row < rows[s]; ++row) {
+                        if (column[row] >= corpus.dictionary().size())
+                            throw corrupt("year section refers to an unknown name");
+                    }
+                    table.columns[s].nameIds.assign(column, column + rows[s]);
+                    table.columns[s].counts.assign(column + rows[s], column + 2 * rows[s]);
+                    column += 2 * rows[s];
+                }
+            }
+        }
+        return reader.lastLsn();
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * snapshot.hpp
+ *
+ * Binary snapshots of a Corpus. A snapshot is a header, a table of sections, and the section bodies: one section for
+ * the name dictionary and one per year. Every section carries its own CRC-32C. All integers are stored in native byte
+ * order (little-endian on every platform we build for).
+ *
+ * A published snapshot also carries a QueryEngine's indexes (a name hash table, the names in byte order, all-time
+ * totals and per-year rows by name) so that SnapshotClient can answer queries straight from a read-only mapping.
+ * Readers that predate those sections skip them.
+ */
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "corpus.hpp"
+#include "mapped_file.hpp"
+
+namespace names {
+    const char SNAPSHOT_MAGIC[8] = {'N', 'A', 'M', 'E', 'S', 'N', 'A', 'P'};
+    const uint32_t SNAPSHOT_VERSION = 1;
+
+    enum class SectionType : uint32_t {
+        Dictionary = 1,
+        Year = 2,
+        /// Open-addressing table of name IDs: slot count, then the slots, empty ones holding NameDictionary::npos.
+        /// Probed linearly from NameDictionary::hash(name) & (slot count - 1).
+        NameHash = 3,
+        /// Every name ID, ordered by name bytes.
+        NameOrder = 4,
+        /// The non-zero total count of each sex, then each sex's all-time totals by name ID, then each sex's non-zero
+        /// totals in descending order.
+        Totals = 5,
+        /// For one year: whether each sex's column is in descending count order, then each sex's row numbers sorted
+        /// by name ID.
+        YearIndex = 6,
+    };
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t sectionCount;
+        /// The last write-ahead log sequence number whose update is included in this snapshot.
+        uint64_t lastLsn;
+        /// CRC-32C of the section table that follows the header.
+        uint32_t tableCrc;
+        uint32_t reserved;
+    };
+
+    struct SnapshotSection {
+        uint32_t type;
+        int32_t year;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t crc;
+        uint32_t reserved;
+    };
+
+    class QueryEngine;
+
+    /// Writes the corpus to path. The file is written under a temporary name, synced, and renamed into place, so a
+    /// crash leaves either the old or the new snapshot. Throws std::runtime_error on I/O failure.
+    void writeSnapshot(const Corpus &corpus, const std::string &path, uint64_t lastLsn = 0);
+
+    /// Writes a snapshot of the engine's corpus together with the engine's indexes, for SnapshotClient. Published the
+    /// same way, so clients that open the path see either the old or the new snapshot in full.
+    void publishSnapshot(const QueryEngine &engine, const std::string &path, uint64_t lastLsn = 0);
+
+    /// Maps a snapshot and gives checked access to its sections. Opening only validates the header and section table;
+    /// each section's checksum is verified lazily the first time the section is read, so opening a large snapshot
+    /// costs nothing until the data is actually touched.
+    class SnapshotReader {
+        MappedFile file_;
+        const SnapshotHeader *header_;
+        const SnapshotSection *sections_;
+        /// Per-section verification state: 0 = not checked yet, 1 = verified, 2 = checksum mismatch.
+        std::unique_ptr<std::atomic<uint8_t>[]> verified_;
+
+    public:
+        static const size_t npos = SIZE_MAX;
+
+        /// Opens the snapshot and validates the header and section table. Throws std::runtime_error if it is corrupt.
+        /// The hints are passed on to the file mapping.
+        explicit SnapshotReader(const std::string &path, const MappingHints &hints = MappingHints());
+
+        uint64_t lastLsn() const {
+            return header_->lastLsn;
+        }
+
+        size_t sectionCount() const {
+            return header_->sectionCount;
+        }
+
+        const SnapshotSection &section(const size_t index) const {
+            return sections_[index];
+        }
+
+        /// Returns the index of the first section with the given type and year, or npos.
+        size_t findSection(SectionType type, int year = 0) const;
+
+        /// Returns the body of a section, verifying its checksum on first access. Throws std::runtime_error on a
+        /// mismatch. Safe to call from several threads at once.
+        const char *sectionData(size_t index) const;
+
+        /// Whether the section's checksum has already been verified.
+        bool sectionVerified(size_t index) const {
+            return verified_[index].load(std::memory_order_acquire) == 1;
+        }
+
+        /// Verifies every section up front. Throws std::runtime_error on the first mismatch.
+        void verifyAll() const;
+    };
+
+    /// Loads a snapshot into an empty corpus and returns its last log sequence number.
+    uint64_t loadSnapshot(const std::string &path, Corpus &corpus);
+}
+
+#endif //SNAPSHOT_HPP
@@ -0,0 +1,446 @@
+/*
+ * snapshot_client.hpp
+ *
+ * Header-only, read-only query client over a snapshot written by publishSnapshot(). The snapshot file is mapped
+ * shared and read-only, so every process on a machine that opens the same snapshot shares one copy of it in the page
+ * cache, and lookups, ranks, prefix and top queries run in the caller's process at in-memory speed with no IPC. The
+ * answers are the same rows a QueryEngine over the snapshotted corpus gives.
+ *
+ * Nothing here needs the names library at link time, so other programs can use it with just the headers. Opening
+ * checks the header and that every section the client needs is present and the right size, but not the section
+ * checksums, which would mean reading the whole file; the publisher verifies those. Values inside sections that would
+ * point out of bounds are treated as absent rather than trusted.
+ */
+
+#ifndef SNAPSHOT_CLIENT_HPP
+#define SNAPSHOT_CLIENT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "query.hpp"
+#include "snapshot.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <sstream>
+#endif
+
+namespace names {
+    class SnapshotClient {
+        struct Year {
+            int year;
+            uint32_t rows[SEX_COUNT];
+            const uint32_t *nameIds[SEX_COUNT];
+            const uint32_t *counts[SEX_COUNT];
+            const uint32_t *rowsByName[SEX_COUNT];
+            bool descending[SEX_COUNT];
+        };
+
+        const char *data_;
+        size_t size_;
+        std::string buffer_;
+        uint64_t lastLsn_;
+        uint32_t nameCount_;
+        uint32_t bytesSize_;
+        const uint32_t *offsets_;
+        const char *bytes_;
+        uint32_t slotMask_;
+        const uint32_t *slots_;
+        const uint32_t *byName_;
+        uint32_t rankedCount_[SEX_COUNT];
+        const uint64_t *totals_[SEX_COUNT];
+        const uint64_t *ranked_[SEX_COUNT];
+        /// Sorted by year.
+        std::vector<Year> years_;
+
+        static std::runtime_error error(const std::string &path, const std::string &what) {
+            return std::runtime_error("snapshot client: " + path + " " + what);
+        }
+
+        void map(const std::string &path) {
+#ifdef __unix__
+            const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                throw error(path, std::string("cannot be opened: ") + std::strerror(errno));
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                const int err = errno;
+                close(fd);
+                throw error(path, std::string("cannot be read: ") + std::strerror(err));
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_) {
+                void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                if (addr == MAP_FAILED) {
+                    const int err = errno;
+                    close(fd);
+                    throw error(path, std::string("cannot be mapped: ") + std::strerror(err));
+                }
+                data_ = static_cast<const char *>(addr);
+            }
+            close(fd);
+#else
+            std::ifstream in(path.c_str(), std::ios::binary);
+            if (!in)
+                throw error(path, "cannot be opened");
+            std::ostringstream contents;
+            contents << in.rdbuf();
+            buffer_ = contents.str();
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#endif
+        }
+
+        void unmap() {
+#ifdef __unix__
+            if (data_)
+                munmap(const_cast<char *>(data_), size_);
+#endif
+            data_ = nullptr;
+        }
+
+        /// Points body at the first section of the given type and year, checking it lies inside the file.
+        bool section(const SectionType type, const int year, const char *&body, uint64_t &size) const {
+            const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(data_);
+            const SnapshotSection *sections = reinterpret_cast<const SnapshotSection *>(data_ + sizeof(SnapshotHeader));
+            for (uint32_t i = 0; i < header->sectionCount; ++i) {
+                const SnapshotSection &section = sections[i];
+                if (section.type != static_cast<uint32_t>(type) || section.year != year)
+                    continue;
+                if (section.offset > size_ || section.size > size_ - section.offset || section.offset % 8)
+                    return false;
+                body = data_ + section.offset;
+                size = section.size;
+                return true;
+            }
+            return false;
+        }
+
+        void parse(const std::string &path) {
+            if (size_ < sizeof(SnapshotHeader) || std::memcmp(data_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+                throw error(path, "is not a snapshot");
+            const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(data_);
+            if (header->version != SNAPSHOT_VERSION)
+                throw error(path, "has an unsupported version");
+            if ((size_ - sizeof(SnapshotHeader)) / sizeof(SnapshotSection) < header->sectionCount)
+                throw error(path, "has a truncated section table");
+            lastLsn_ = header->lastLsn;
+
+            const char *body;
+            uint64_t size;
+            uint32_t counts[SEX_COUNT];
+            if (!section(SectionType::Dictionary, 0, body, size) || size < sizeof(counts))
+                throw error(path, "has no dictionary");
+            std::memcpy(counts, body, sizeof(counts));
+            nameCount_ = counts[0];
+            bytesSize_ = counts[1];
+            if (size != sizeof(counts) + (static_cast<uint64_t>(nameCount_) + 1) * 4 + bytesSize_)
+                throw error(path, "has a dictionary of the wrong size");
+            offsets_ = reinterpret_cast<const uint32_t *>(body + sizeof(counts));
+            bytes_ = body + sizeof(counts) + (static_cast<uint64_t>(nameCount_) + 1) * 4;
+
+            // the index sections are only there if the snapshot was published with publishSnapshot()
+            if (!section(SectionType::NameHash, 0, body, size) || size < 8)
+                throw error(path, "has no query indexes; publish it with publishSnapshot()");
+            const uint32_t slotCount = *reinterpret_cast<const uint32_t *>(body);
+            if (!slotCount || slotCount & (slotCount - 1) || slotCount <= nameCount_ || size != 8 + slotCount * 4ull)
+                throw error(path, "has a damaged name table");
+            slotMask_ = slotCount - 1;
+            slots_ = reinterpret_cast<const uint32_t *>(body + 8);
+
+            if (!section(SectionType::NameOrder, 0, body, size) || size != nameCount_ * 4ull)
+                throw error(path, "has a damaged name order");
+            byName_ = reinterpret_cast<const uint32_t *>(body);
+
+            if (!section(SectionType::Totals, 0, body, size) || size < sizeof(rankedCount_))
+                throw error(path, "has no totals");
+            std::memcpy(rankedCount_, body, sizeof(rankedCount_));
+            if (size != sizeof(rankedCount_) + 8ull * (SEX_COUNT * nameCount_ + rankedCount_[0] + rankedCount_[1]))
+                throw error(path, "has totals of the wrong size");
+            const uint64_t *totals = reinterpret_cast<const uint64_t *>(body + sizeof(rankedCount_));
+            for (size_t s = 0; s < SEX_COUNT; ++s)
+                totals_[s] = totals + s * nameCount_;
+            ranked_[0] = totals + SEX_COUNT * nameCount_;
+            ranked_[1] = ranked_[0] + rankedCount_[0];
+
+            const SnapshotSection *sections = reinterpret_cast<const SnapshotSection *>(data_ + sizeof(SnapshotHeader));
+            for (uint32_t i = 0; i < header->sectionCount; ++i) {
+                if (sections[i].type != static_cast<uint32_t>(SectionType::Year))
+                    continue;
+                Year year = Year();
+                year.year = sections[i].year;
+                if (!section(SectionType::Year, year.year, body, size) || size < sizeof(year.rows))
+                    throw error(path, "has a damaged year " + std::to_string(year.year));
+                std::memcpy(year.rows, body, sizeof(year.rows));
+                if (size != sizeof(year.rows) + 8ull * (static_cast<uint64_t>(year.rows[0]) + year.rows[1]))
+                    throw error(path, "has a year of the wrong size: " + std::to_string(year.year));
+                const uint32_t *column = reinterpret_cast<const uint32_t *>(body + sizeof(year.rows));
+                for (size_t s = 0; s < SEX_COUNT; ++s) {
+                    year.nameIds[s] = column;
+                    year.counts[s] = column + year.rows[s];
+                    column += 2 * static_cast<size_t>(year.rows[s]);
+                }
+
+                uint32_t descending[SEX_COUNT];
+                if (!section(SectionType::YearIndex, year.year, body, size) ||
+                    size != sizeof(descending) + 4ull * (static_cast<uint64_t>(year.rows[0]) + year.rows[1]))
+                    throw error(path, "has no index for year " + std::to_string(year.year));
+                std::memcpy(descending, body, sizeof(descending));
+                const uint32_t *rows = reinterpret_cast<const uint32_t *>(body + sizeof(descending));
+                for (size_t s = 0; s < SEX_COUNT; ++s) {
+                    year.descending[s] = descending[s] != 0;
+                    year.rowsByName[s] = rows;
+                    rows += year.rows[s];
+                }
+                years_.push_back(year);
+            }
+            std::sort(years_.begin(), years_.end(), [](const Year &a, const Year &b) { return a.year < b.year; });
+        }
+
+        const Year *findYear(const int year) const {
+            const std::vector<Year>::const_iterator it = std::lower_bound(
+                years_.begin(), years_.end(), year, [](const Year &entry, const int y) { return entry.year < y; });
+            return it == years_.end() || it->year != year ? nullptr : &*it;
+        }
+
+        static bool lessBytes(const NameRef &a, const char *b, const size_t bSize) {
+            const int order = std::memcmp(a.data, b, std::min<size_t>(a.size, bSize));
+            return order < 0 || (order == 0 && a.size < bSize);
+        }
+
+        static uint32_t descendingRank(const uint64_t *begin, const uint64_t *end, const uint64_t count) {
+            return static_cast<uint32_t>(std::lower_bound(begin, end, count, [](uint64_t a, uint64_t b) {
+                return a > b;
+            }) - begin) + 1;
+        }
+
+        void lookup(const Query &query, const uint32_t nameId, std::vector<QueryRow> &rows) const {
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                if (query.hasSex && static_cast<size_t>(query.sex) != s)
+                    continue;
+                QueryRow row = {nameId, true, static_cast<Sex>(s), 0, 0, 0};
+                if (nameId != NameDictionary::npos)
+                    row.count = totals_[s][nameId];
+                if (row.count)
+                    row.rank = descendingRank(ranked_[s], ranked_[s] + rankedCount_[s], row.count);
+                rows.push_back(row);
+            }
+        }
+
+        void rank(const Query &query, const uint32_t nameId, std::vector<QueryRow> &rows) const {
+            QueryRow result = {nameId, true, query.sex, query.year, 0, 0};
+            const Year *year = findYear(query.year);
+            if (year && nameId != NameDictionary::npos) {
+                const size_t s = static_cast<size_t>(query.sex);
+                const uint32_t n = year->rows[s];
+                const uint32_t *nameIds = year->nameIds[s];
+                const uint32_t *counts = year->counts[s];
+                const uint32_t *byName = year->rowsByName[s];
+                const uint32_t *found = std::lower_bound(byName, byName + n, nameId, [&](uint32_t row, uint32_t id) {
+                    return row < n && nameIds[row] < id;
+                });
+                if (found != byName + n && *found < n && nameIds[*found] == nameId) {
+                    const uint32_t count = counts[*found];
+                    result.count = count;
+                    if (year->descending[s]) {
+                        result.rank = static_cast<uint32_t>(std::lower_bound(counts, counts + n, count,
+                                                                             [](uint32_t a, uint32_t b) {
+                                                                                 return a > b;
+                                                                             }) - counts) + 1;
+                    } else {
+                        result.rank = 1;
+                        for (uint32_t row = 0; row < n; ++row)
+                            result.rank += counts[row] > count;
+                    }
+                }
+            }
+            rows.push_back(result);
+        }
+
+        void prefix(const Query &query, std::vector<QueryRow> &rows) const {
+            const uint32_t *end = byName_ + nameCount_;
+            const uint32_t *it = std::lower_bound(byName_, end, 0u, [&](uint32_t id, uint32_t) {
+                return lessBytes(name(id), query.text, query.textSize);
+            });
+            std::vector<NameCount> matches;
+            for (; it != end; ++it) {
+                const NameRef match = name(*it);
+                if (match.size < query.textSize || std::memcmp(match.data, query.text, query.textSize))
+                    break;
+                uint64_t total = 0;
+                for (size_t s = 0; s < SEX_COUNT; ++s)
+                    total += *it < nameCount_ ? totals_[s][*it] : 0;
+                if (total) {
+                    const NameCount count = {*it, total};
+                    matches.push_back(count);
+                }
+            }
+
+            // most births first, alphabetical among equal totals
+            const size_t n = std::min<size_t>(query.limit, matches.size());
+            std::partial_sort(matches.begin(), matches.begin() + n, matches.end(),
+                              [&](const NameCount &a, const NameCount &b) {
+                                  if (a.count != b.count)
+                                      return a.count > b.count;
+                                  const NameRef right = name(b.nameId);
+                                  return lessBytes(name(a.nameId), right.data, right.size);
+                              });
+            for (size_t i = 0; i < n; ++i) {
+                QueryRow row = {matches[i].nameId, false, Sex::Female, 0, matches[i].count, 0};
+                row.rank = i && matches[i].count == matches[i - 1].count ? rows.back().rank
+                                                                           : static_cast<uint32_t>(i + 1);
+                rows.push_back(row);
+            }
+        }
+
+        void top(const Query &query, std::vector<QueryRow> &rows) const {
+            const Year *year = findYear(query.year);
+            if (!year)
+                return;
+            const size_t s = static_cast<size_t>(query.sex);
+            const bool descending = year->descending[s];
+            std::vector<NameCount> names(descending ? std::min<size_t>(query.limit, year->rows[s]) : year->rows[s]);
+            for (size_t i = 0; i < names.size(); ++i) {
+                names[i].nameId = year->nameIds[s][i];
+                names[i].count = year->counts[s][i];
+            }
+            if (!descending) {
+                const size_t n = std::min<size_t>(query.limit, names.size());
+                std::partial_sort(names.begin(), names.begin() + n, names.end(),
+                                  [](const NameCount &a, const NameCount &b) { return a.count > b.count; });
+                names.resize(n);
+            }
+            for (size_t i = 0; i < names.size(); ++i) {
+                QueryRow row = {names[i].nameId, true, query.sex, query.year, names[i].count, 0};
+                row.rank = i && names[i].count == names[i - 1].count ? rows.back().rank : static_cast<uint32_t>(i + 1);
+                rows.push_back(row);
+            }
+        }
+
+    public:
+        /// Maps and checks the snapshot at path. Throws std::runtime_error if it cannot be read, is damaged, or was
+        /// written by writeSnapshot() without the query indexes. A snapshot published over path later is not seen; the
+        /// client keeps the version it opened until it is destroyed.
+        explicit SnapshotClient(const std::string &path)
+            : data_(nullptr),
+              size_(0),
+              lastLsn_(0) {
+            map(path);
+            try {
+                parse(path);
+            } catch (...) {
+                unmap();
+                throw;
+            }
+        }
+
+        ~SnapshotClient() {
+            unmap();
+        }
+
+        SnapshotClient(const SnapshotClient &) = delete;
+
+        SnapshotClient &operator=(const SnapshotClient &) = delete;
+
+        uint64_t lastLsn() const {
+            return lastLsn_;
+        }
+
+        size_t nameCount() const {
+            return nameCount_;
+        }
+
+        /// The name with the given ID, or an empty name if the ID or the dictionary entry is out of range.
+        NameRef name(const uint32_t id) const {
+            NameRef ref = {bytes_, 0};
+            if (id < nameCount_ && offsets_[id] <= offsets_[id + 1] && offsets_[id + 1] <= bytesSize_) {
+                ref.data = bytes_ + offsets_[id];
+                ref.size = offsets_[id + 1] - offsets_[id];
+            }
+            return ref;
+        }
+
+        /// Returns the ID of the given name, or NameDictionary::npos.
+        uint32_t find(const char *data, const size_t len) const {
+            size_t slot = NameDictionary::hash(data, len) & slotMask_;
+            for (size_t probes = 0; probes <= slotMask_; ++probes, slot = (slot + 1) & slotMask_) {
+                const uint32_t id = slots_[slot];
+                if (id >= nameCount_)
+                    break;
+                const NameRef candidate = name(id);
+                if (candidate.size == len && !std::memcmp(candidate.data, data, len))
+                    return id;
+            }
+            return NameDictionary::npos;
+        }
+
+        uint32_t find(const std::string &name) const {
+            return find(name.data(), name.size());
+        }
+
+        /// The sections of the mapping each structure lies in, which every process mapping the snapshot shares, and
+        /// the client's own table of years.
+        MemoryFootprint footprint() const {
+            const auto mapped = [](const char *part, const size_t bytes) {
+                return MemoryFootprint(part, bytes, bytes);
+            };
+            MemoryFootprint client("snapshot mapping");
+            MemoryFootprint dictionary("dictionary");
+            dictionary.add(mapped("name arena", bytesSize_));
+            dictionary.add(mapped("offsets", (static_cast<size_t>(nameCount_) + 1) * 4));
+            dictionary.add(mapped("hash index", (static_cast<size_t>(slotMask_) + 1) * 4));
+            client.add(dictionary);
+            client.add(mapped("sorted index", static_cast<size_t>(nameCount_) * 4));
+            client.add(mapped("totals", 8 * (SEX_COUNT * static_cast<size_t>(nameCount_) + rankedCount_[0] +
+                                             rankedCount_[1])));
+            size_t rows = 0;
+            for (const Year &year: years_)
+                rows += static_cast<size_t>(year.rows[0]) + year.rows[1];
+            client.add(mapped("year columns", rows * 8));
+            client.add(mapped("rows by name", rows * 4));
+            // the rest of the file is the header, the section table and the counts leading each section
+            client.add(MemoryFootprint("headers", 0, size_ > client.reserved ? size_ - client.reserved : 0));
+            client.add("year table", years_);
+            return client;
+        }
+
+        /// Appends the answer to one query to rows, exactly as QueryEngine::run() would.
+        void run(const Query &query, std::vector<QueryRow> &rows) const {
+            const bool named = query.type == QueryType::Lookup || query.type == QueryType::Rank;
+            const uint32_t nameId = named ? find(query.text, query.textSize) : NameDictionary::npos;
+            switch (query.type) {
+                case QueryType::Lookup:
+                    lookup(query, nameId, rows);
+                    break;
+                case QueryType::Rank:
+                    rank(query, nameId, rows);
+                    break;
+                case QueryType::Prefix:
+                    prefix(query, rows);
+                    break;
+                case QueryType::Top:
+                    top(query, rows);
+                    break;
+                case QueryType::Invalid: {
+                    const QueryRow row = {NameDictionary::npos, false, Sex::Female, 0, 0, 0};
+                    rows.push_back(row);
+                    break;
+                }
+            }
+        }
+    };
+}
+
+#endif //SNAPSHOT_CLIENT_HPP
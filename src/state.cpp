@@ -0,0 +1,289 @@
+#include "state.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "digits.hpp"
+#include "parallel.hpp"
+
+namespace names {
+    StateCode stateCode(const std::string &code) {
+        if (code.size() != 2 || code[0] < 'A' || code[0] > 'Z' || code[1] < 'A' || code[1] > 'Z')
+            throw std::invalid_argument("invalid state code: " + code);
+        return static_cast<StateCode>(code[0] << 8 | code[1]);
+    }
+
+    std::string stateName(const StateCode code) {
+        std::string name(2, ' ');
+        name[0] = static_cast<char>(code >> 8);
+        name[1] = static_cast<char>(code & 0xff);
+        return name;
+    }
+
+    const std::vector<std::string> &allStateCodes() {
+        static const char *const codes[] = {
+            "AK", "AL", "AR", "AZ", "CA", "CO", "CT", "DC", "DE", "FL", "GA", "HI", "IA", "ID", "IL", "IN", "KS",
+            "KY", "LA", "MA", "MD", "ME", "MI", "MN", "MO", "MS", "MT", "NC", "ND", "NE", "NH", "NJ", "NM", "NV",
+            "NY", "OH", "OK", "OR", "PA", "RI", "SC", "SD", "TN", "TX", "UT", "VA", "VT", "WA", "WI", "WV", "WY",
+        };
+        static const std::vector<std::string> all(codes, codes + sizeof(codes) / sizeof(codes[0]));
+        return all;
+    }
+
+    // ---- StateCorpus ---- //
+
+    namespace {
+        bool partitionBefore(const StatePartition &partition, const StateCode state, const int year) {
+            return partition.state < state || (partition.state == state && partition.table.year < year);
+        }
+
+        std::vector<StatePartition>::const_iterator lowerBound(const std::vector<StatePartition> &partitions,
+                                                               const StateCode state, const int year) {
+            std::vector<StatePartition>::const_iterator lo = partitions.begin();
+            size_t len = partitions.size();
+            while (len) {
+                const size_t half = len / 2;
+                if (partitionBefore(lo[half], state, year)) {
+                    lo += half + 1;
+                    len -= half + 1;
+                } else {
+                    len = half;
+                }
+            }
+            return lo;
+        }
+    }
+
+    StatePartition &StateCorpus::partition(const StateCode state, const int year) {
+        const size_t index = lowerBound(partitions_, state, year) - partitions_.begin();
+        if (index == partitions_.size() || partitions_[index].state != state || partitions_[index].table.year != year) {
+            StatePartition partition;
+            partition.state = state;
+            partition.table.year = year;
+            partitions_.insert(partitions_.begin() + index, partition);
+        }
+        return partitions_[index];
+    }
+
+    const StatePartition *StateCorpus::findPartition(const StateCode state, const int year) const {
+        const std::vector<StatePartition>::const_iterator it = lowerBound(partitions_, state, year);
+        if (it == partitions_.end() || it->state != state || it->table.year != year)
+            return nullptr;
+        return &*it;
+    }
+
+    std::vector<NameCount> StateCorpus::topNames(const StateCode state, const int year, const Sex sex,
+                                                 const size_t k) const {
+        const StatePartition *partition = findPartition(state, year);
+        if (!partition)
+            return std::vector<NameCount>();
+        return partition->table.column(sex).top(k);
+    }
+
+    YearTable StateCorpus::nationalTotals(const int year) const {
+        std::vector<const StatePartition *> matching;
+        for (const StatePartition &partition: partitions_) {
+            if (partition.table.year == year)
+                matching.push_back(&partition);
+        }
+
+        // The partitions are split into chunks, one task per chunk and sex. Each task's partial sum holds only the
+        // names its partitions have, sorted by ID, so it stays as small as the state tables it reads. The partials
+        // are then added into one dense per-name array per sex.
+        const size_t chunks = std::max<size_t>(1, std::min(workerCount(), matching.size()));
+        std::vector<std::vector<NameCount> > partials(SEX_COUNT * chunks);
+        parallelFor(partials.size(), [&](const size_t task) {
+            const size_t s = task / chunks;
+            const size_t chunk = task % chunks;
+            std::vector<NameCount> &partial = partials[task];
+            for (size_t p = chunk; p < matching.size(); p += chunks) {
+                const SexColumn &column = matching[p]->table.columns[s];
+                for (size_t row = 0; row < column.size(); ++row) {
+                    NameCount entry;
+                    entry.nameId = column.nameIds[row];
+                    entry.count = column.counts[row];
+                    partial.push_back(entry);
+                }
+            }
+            std::sort(partial.begin(), partial.end(), [](const NameCount &a, const NameCount &b) {
+                return a.nameId < b.nameId;
+            });
+            size_t kept = 0;
+            for (size_t i = 0; i < partial.size(); ++i) {
+                if (kept && partial[kept - 1].nameId == partial[i].nameId)
+                    partial[kept - 1].count += partial[i].count;
+                else
+                    partial[kept++] = partial[i];
+            }
+            partial.resize(kept);
+        });
+
+        const size_t names = dictionary_.size();
+        YearTable table(year);
+        parallelFor(SEX_COUNT, [&](const size_t s) {
+            std::vector<uint64_t> total(names, 0);
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                for (const NameCount &entry: partials[s * chunks + chunk])
+                    total[entry.nameId] += entry.count;
+            }
+
+            std::vector<NameCount> rows;
+            for (uint32_t id = 0; id < names; ++id) {
+                if (!total[id])
+                    continue;
+                // the table's counts are 32 bits wide, as they are in the national files
+                if (total[id] > UINT32_MAX) {
+                    std::stringstream message;
+                    message << "national total of " << dictionary_.name(id).str() << " in " << year
+                            << " overflows a 32-bit count";
+                    throw std::overflow_error(message.str());
+                }
+                NameCount row;
+                row.nameId = id;
+                row.count = total[id];
+                rows.push_back(row);
+            }
+            // same order as the national yob files: descending count, then alphabetical
+            const NameDictionary &dictionary = dictionary_;
+            std::sort(rows.begin(), rows.end(), [&dictionary](const NameCount &a, const NameCount &b) {
+                if (a.count != b.count)
+                    return a.count > b.count;
+                const NameRef nameA = dictionary.name(a.nameId);
+                const NameRef nameB = dictionary.name(b.nameId);
+                const int cmp = std::memcmp(nameA.data, nameB.data, std::min(nameA.size, nameB.size));
+                return cmp ? cmp < 0 : nameA.size < nameB.size;
+            });
+            SexColumn &column = table.columns[s];
+            for (const NameCount &row: rows) {
+                column.nameIds.push_back(row.nameId);
+                column.counts.push_back(static_cast<uint32_t>(row.count));
+            }
+        });
+        return table;
+    }
+
+    size_t StateCorpus::rows() const {
+        size_t total = 0;
+        for (const StatePartition &partition: partitions_)
+            total += partition.table.rows();
+        return total;
+    }
+
+    void mergeInto(StateCorpus &target, const StateCorpus &source) {
+        const NameDictionary &from = source.dictionary();
+        std::vector<uint32_t> remap(from.size());
+        for (uint32_t id = 0; id < remap.size(); ++id) {
+            const NameRef name = from.name(id);
+            remap[id] = target.dictionary().intern(name.data, name.size);
+        }
+        for (const StatePartition &partition: source.partitions()) {
+            YearTable &into = target.partition(partition.state, partition.table.year).table;
+            for (size_t s = 0; s < SEX_COUNT; ++s) {
+                const SexColumn &column = partition.table.columns[s];
+                SexColumn &out = into.columns[s];
+                out.nameIds.reserve(out.size() + column.size());
+                for (const uint32_t id: column.nameIds)
+                    out.nameIds.push_back(remap[id]);
+                out.counts.insert(out.counts.end(), column.counts.begin(), column.counts.end());
+            }
+        }
+    }
+
+    // ---- Loading ---- //
+
+    namespace {
+        std::runtime_error parseError(const size_t line, const std::string &what) {
+            std::stringstream ss;
+            ss << "state file line " << line << ": " << what;
+            return std::runtime_error(ss.str());
+        }
+
+        /// Returns the end of the next comma-separated field starting at p, or throws if there is no comma.
+        const char *fieldEnd(const char *p, const char *lineEnd, const size_t line, const char *field) {
+            const char *comma = static_cast<const char *>(std::memchr(p, ',', lineEnd - p));
+            if (!comma)
+                throw parseError(line, std::string("missing field after ") + field);
+            return comma;
+        }
+    }
+
+    void loadStateData(StateCorpus &corpus, const char *data, const size_t len) {
+        NameDictionary &dictionary = corpus.dictionary();
+        const char *p = data;
+        const char *const end = data + len;
+        size_t line = 0;
+
+        // Rows arrive grouped by state and year, so remember the partition and only look it up when the key changes.
+        StatePartition *current = nullptr;
+
+        while (p < end) {
+            ++line;
+            const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if (!eol)
+                eol = end;
+            const char *lineEnd = eol;
+            if (lineEnd > p && lineEnd[-1] == '\r')
+                --lineEnd;
+            if (lineEnd == p) {
+                p = eol + 1;
+                continue;
+            }
+
+            const char *stateEnd = fieldEnd(p, lineEnd, line, "state");
+            if (stateEnd - p != 2 || p[0] < 'A' || p[0] > 'Z' || p[1] < 'A' || p[1] > 'Z')
+                throw parseError(line, "state must be a two-letter code");
+            const StateCode state = static_cast<StateCode>(p[0] << 8 | p[1]);
+
+            const char *sexField = stateEnd + 1;
+            const char *sexEnd = fieldEnd(sexField, lineEnd, line, "sex");
+            if (sexEnd - sexField != 1 || (*sexField != 'F' && *sexField != 'M'))
+                throw parseError(line, "sex must be 'F' or 'M'");
+            const Sex sex = *sexField == 'F' ? Sex::Female : Sex::Male;
+
+            const char *yearField = sexEnd + 1;
+            const char *yearEnd = fieldEnd(yearField, lineEnd, line, "year");
+            uint32_t year;
+            if (!parseUint32(yearField, yearEnd - yearField, year, end) || year > INT32_MAX)
+                throw parseError(line, "year must be a decimal number");
+
+            const char *nameField = yearEnd + 1;
+            const char *nameEnd = fieldEnd(nameField, lineEnd, line, "name");
+            if (nameEnd == nameField)
+                throw parseError(line, "name must not be empty");
+
+            uint32_t count;
+            if (!parseUint32(nameEnd + 1, lineEnd - nameEnd - 1, count, end))
+                throw parseError(line, "count must be a decimal number");
+
+            if (!current || current->state != state || current->table.year != static_cast<int>(year))
+                current = &corpus.partition(state, static_cast<int>(year));
+            SexColumn &column = current->table.column(sex);
+            column.nameIds.push_back(dictionary.intern(nameField, nameEnd - nameField));
+            column.counts.push_back(count);
+            p = eol + 1;
+        }
+    }
+
+    void loadStateFile(StateCorpus &corpus, const std::string &path) {
+        const std::string contents = readFile(path);
+        loadStateData(corpus, contents.data(), contents.size());
+    }
+
+    size_t loadStateDirectory(StateCorpus &corpus, const std::string &dir) {
+        size_t loaded = 0;
+        for (const std::string &code: allStateCodes()) {
+            const std::string path = dir + "/" + code + ".TXT";
+            std::ifstream probe(path.c_str());
+            if (!probe)
+                continue;
+            probe.close();
+            loadStateFile(corpus, path);
+            ++loaded;
+        }
+        return loaded;
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * state.hpp
+ *
+ * SSA state-level name data (`STATE,SEX,YEAR,NAME,COUNT` per line). Rows are partitioned by (state, year) so a query
+ * about one state and year only touches that partition. Names are interned into a dictionary shared with the national
+ * corpus.
+ */
+
+#ifndef STATE_HPP
+#define STATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "corpus.hpp"
+
+namespace names {
+    /// Two-letter postal code packed into 16 bits, e.g. "WA".
+    typedef uint16_t StateCode;
+
+    /// Packs a two-letter state code. Throws std::invalid_argument if it is not two uppercase letters.
+    StateCode stateCode(const std::string &code);
+
+    std::string stateName(StateCode code);
+
+    /// The postal codes of the 50 states plus DC, as used for the SSA per-state file names.
+    const std::vector<std::string> &allStateCodes();
+
+    /// All rows for one (state, year).
+    struct StatePartition {
+        StateCode state;
+        YearTable table;
+    };
+
+    class StateCorpus {
+        NameDictionary &dictionary_;
+        std::vector<StatePartition> partitions_;
+
+    public:
+        /// The dictionary is borrowed, normally from the national Corpus, so IDs are comparable across both.
+        explicit StateCorpus(NameDictionary &dictionary)
+            : dictionary_(dictionary) {
+        }
+
+        NameDictionary &dictionary() {
+            return dictionary_;
+        }
+
+        const NameDictionary &dictionary() const {
+            return dictionary_;
+        }
+
+        /// Partitions ordered by (state, year).
+        const std::vector<StatePartition> &partitions() const {
+            return partitions_;
+        }
+
+        /// Returns the partition for (state, year), creating an empty one if needed.
+        StatePartition &partition(StateCode state, int year);
+
+        /// Returns the partition for (state, year), or nullptr if there is none.
+        const StatePartition *findPartition(StateCode state, int year) const;
+
+        /// The k most common names for one state, year and sex. Only that partition is read.
+        std::vector<NameCount> topNames(StateCode state, int year, Sex sex, size_t k) const;
+
+        /// Sums every state's partition for the given year into a national table, in descending count order. Chunks of
+        /// partitions are aggregated in parallel, for both sexes at once. Throws std::overflow_error if a name's total
+        /// does not fit the table's 32-bit counts.
+        YearTable nationalTotals(int year) const;
+
+        size_t rows() const;
+    };
+
+    /// Moves every partition of source into target, re-interning names into target's dictionary. Rows for a partition
+    /// target already has are appended after its existing rows.
+    void mergeInto(StateCorpus &target, const StateCorpus &source);
+
+    /// Parses the contents of a state file into the corpus.
+    void loadStateData(StateCorpus &corpus, const char *data, size_t len);
+
+    /// Reads and parses a single state file. Throws std::runtime_error if it cannot be read or is malformed.
+    void loadStateFile(StateCorpus &corpus, const std::string &path);
+
+    /// Loads every `<ST>.TXT` file in the given directory. Missing states are skipped. Returns the number of files
+    /// loaded.
+    size_t loadStateDirectory(StateCorpus &corpus, const std::string &dir);
+}
+
+#endif //STATE_HPP
@@ -0,0 +1,251 @@
+#include "task_pool.hpp"
+
+#include <chrono>
+
+#include "parallel.hpp"
+
+namespace names {
+    struct TaskPool::Task {
+        std::function<void()> run;
+        TaskGroup *group;
+    };
+
+    struct TaskPool::Worker {
+        ChaseLevDeque<Task *> deques[TASK_PRIORITY_COUNT];
+        size_t index;
+        /// Where the next search for a victim starts, so thieves spread out.
+        size_t victim;
+        std::thread thread;
+    };
+
+    namespace {
+        /// The pool and worker the calling thread belongs to, if any.
+        thread_local const TaskPool *currentPool = nullptr;
+        thread_local void *currentWorker = nullptr;
+    }
+
+    // ---- TaskGroup ---- //
+
+    TaskGroup::TaskGroup(TaskPool &pool)
+        : pool_(pool),
+          pending_(0),
+          lowest_(static_cast<size_t>(TaskPriority::Interactive)) {
+    }
+
+    TaskGroup::TaskGroup()
+        : TaskGroup(TaskPool::shared()) {
+    }
+
+    TaskGroup::~TaskGroup() {
+        try {
+            wait();
+        } catch (...) {
+            // the owner chose not to wait for the error
+        }
+    }
+
+    void TaskGroup::run(std::function<void()> task, const TaskPriority priority) {
+        pool_.submit(*this, std::move(task), priority);
+    }
+
+    void TaskGroup::wait() {
+        while (pending_.load(std::memory_order_acquire)) {
+            if (pool_.runOne(static_cast<TaskPriority>(lowest_.load(std::memory_order_relaxed))))
+                continue;
+            // the group's tasks are all running elsewhere; new work may still turn up, so look again now and then
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait_for(lock, std::chrono::microseconds(200), [this]() { return done(); });
+        }
+        // the last task decrements under the lock, so once it is released here the group can safely go away
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    // ---- TaskPool ---- //
+
+    TaskPool::TaskPool(const size_t threads)
+        : epoch_(0),
+          sleeping_(0),
+          stopping_(false),
+          executed_(0),
+          stolen_(0),
+          parked_(0) {
+        for (std::atomic<size_t> &count: injectedCount_)
+            count.store(0);
+        const size_t count = std::max<size_t>(1, threads ? threads : workerCount());
+        for (size_t i = 0; i < count; ++i) {
+            workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+            workers_.back()->index = i;
+            workers_.back()->victim = i + 1;
+        }
+        // every deque exists before any thread might steal from it
+        for (const std::unique_ptr<Worker> &worker: workers_) {
+            Worker *running = worker.get();
+            worker->thread = std::thread([this, running]() { workerLoop(running); });
+        }
+    }
+
+    TaskPool::~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(parkMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (const std::unique_ptr<Worker> &worker: workers_)
+            worker->thread.join();
+        for (const std::unique_ptr<Worker> &worker: workers_) {
+            for (ChaseLevDeque<Task *> &deque: worker->deques) {
+                Task *task;
+                while (deque.pop(task))
+                    delete task;
+            }
+        }
+        for (std::deque<Task *> &queue: injected_) {
+            for (Task *task: queue)
+                delete task;
+        }
+    }
+
+    TaskPool &TaskPool::shared() {
+        static TaskPool pool;
+        return pool;
+    }
+
+    TaskPool::Worker *TaskPool::self() const {
+        return currentPool == this ? static_cast<Worker *>(currentWorker) : nullptr;
+    }
+
+    void TaskPool::submit(TaskGroup &group, std::function<void()> task, const TaskPriority priority) {
+        group.pending_.fetch_add(1, std::memory_order_relaxed);
+        const size_t p = static_cast<size_t>(priority);
+        size_t lowest = group.lowest_.load(std::memory_order_relaxed);
+        while (lowest < p && !group.lowest_.compare_exchange_weak(lowest, p, std::memory_order_relaxed)) {
+        }
+        enqueue(&group, std::move(task), priority);
+    }
+
+    void TaskPool::post(std::function<void()> task, const TaskPriority priority) {
+        enqueue(nullptr, std::move(task), priority);
+    }
+
+    void TaskPool::enqueue(TaskGroup *group, std::function<void()> task, const TaskPriority priority) {
+        const size_t p = static_cast<size_t>(priority);
+        Task *queued = new Task();
+        queued->run = std::move(task);
+        queued->group = group;
+        Worker *worker = self();
+        if (worker) {
+            worker->deques[p].push(queued);
+        } else {
+            std::lock_guard<std::mutex> lock(injectedMutex_);
+            injected_[p].push_back(queued);
+            injectedCount_[p].fetch_add(1, std::memory_order_relaxed);
+        }
+        // a worker about to park either sees the new epoch or is already counted as sleeping and gets woken
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_seq_cst)) {
+            { std::lock_guard<std::mutex> lock(parkMutex_); }
+            wake_.notify_one();
+        }
+    }
+
+    TaskPool::Task *TaskPool::find(Worker *worker, const TaskPriority lowest) {
+        Task *task = nullptr;
+        for (size_t p = 0; p <= static_cast<size_t>(lowest); ++p) {
+            if (worker && worker->deques[p].pop(task))
+                return task;
+            if (injectedCount_[p].load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(injectedMutex_);
+                if (!injected_[p].empty()) {
+                    task = injected_[p].front();
+                    injected_[p].pop_front();
+                    injectedCount_[p].fetch_sub(1, std::memory_order_relaxed);
+                    return task;
+                }
+            }
+            const size_t start = worker ? worker->victim : 0;
+            for (size_t i = 0; i < workers_.size(); ++i) {
+                Worker &victim = *workers_[(start + i) % workers_.size()];
+                if (&victim == worker || !victim.deques[p].sizeHint())
+                    continue;
+                if (victim.deques[p].steal(task)) {
+                    if (worker)
+                        worker->victim = victim.index;
+                    stolen_.fetch_add(1, std::memory_order_relaxed);
+                    return task;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void TaskPool::execute(Task *task) {
+        TaskGroup *group = task->group;
+        if (!group) {
+            // posted tasks handle their own errors
+            task->run();
+            delete task;
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        try {
+            task->run();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(group->mutex_);
+            if (!group->error_)
+                group->error_ = std::current_exception();
+        }
+        delete task;
+        executed_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(group->mutex_);
+        if (group->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            group->done_.notify_all();
+    }
+
+    bool TaskPool::runOne(const TaskPriority lowest) {
+        Task *task = find(self(), lowest);
+        if (!task)
+            return false;
+        execute(task);
+        return true;
+    }
+
+    void TaskPool::workerLoop(Worker *worker) {
+        currentPool = this;
+        currentWorker = worker;
+        while (!stopping_.load(std::memory_order_relaxed)) {
+            Task *task = find(worker);
+            if (task) {
+                execute(task);
+                continue;
+            }
+            const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+            sleeping_.fetch_add(1, std::memory_order_seq_cst);
+            // anything submitted before the epoch was read is visible now
+            task = find(worker);
+            if (task) {
+                sleeping_.fetch_sub(1, std::memory_order_relaxed);
+                execute(task);
+                continue;
+            }
+            parked_.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(parkMutex_);
+            wake_.wait(lock, [this, epoch]() {
+                return stopping_.load(std::memory_order_relaxed) || epoch_.load(std::memory_order_seq_cst) != epoch;
+            });
+            sleeping_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    TaskPoolStats TaskPool::stats() const {
+        TaskPoolStats stats;
+        stats.executed = executed_.load();
+        stats.stolen = stolen_.load();
+        stats.parked = parked_.load();
+        return stats;
+    }
+}
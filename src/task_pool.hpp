@@ -0,0 +1,267 @@
+/*
+ * task_pool.hpp
+ *
+ * The process-wide work-stealing scheduler. Loading, index building, aggregation, compaction and queries all submit
+ * their parallel work here, so they share one set of threads sized to the machine instead of each starting its own
+ * and oversubscribing it.
+ *
+ * Every worker owns a Chase-Lev deque per priority. It pushes and pops the tasks it submits itself at the bottom, most
+ * recent first, which keeps nested work cache-warm, while idle workers steal the oldest tasks from the top of someone
+ * else's. Tasks submitted from outside the pool go to a shared queue. A worker with nothing to do parks on a condition
+ * variable, and every submission wakes one if any are parked.
+ *
+ * Running tasks are never interrupted, but at every scheduling point a worker takes any interactive task, its own or
+ * one it can steal, before a background one. Background work split into tasks therefore gives way to queries within
+ * one task's time. A thread waiting for a group only helps with tasks as urgent as the group's, so a waiting query is
+ * never held up by a background task it picked up meanwhile.
+ */
+
+#ifndef TASK_POOL_HPP
+#define TASK_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace names {
+    /// A single-owner work-stealing deque (Chase and Lev, with the memory orderings of Lê et al., "Correct and
+    /// Efficient Work-Stealing for Weak Memory Models"). Only the owning thread may push() and pop(); any thread may
+    /// steal(). T must be trivially copyable, typically a pointer. The buffer grows as needed; outgrown buffers are
+    /// kept until the deque is destroyed, since a thief may still be reading one.
+    template<typename T>
+    class ChaseLevDeque {
+        struct Buffer {
+            int64_t capacity;
+            std::unique_ptr<std::atomic<T>[]> items;
+
+            explicit Buffer(const int64_t capacity)
+                : capacity(capacity),
+                  items(new std::atomic<T>[static_cast<size_t>(capacity)]) {
+            }
+
+            T get(const int64_t i) const {
+                return items[static_cast<size_t>(i & (capacity - 1))].load(std::memory_order_relaxed);
+            }
+
+            void put(const int64_t i, const T value) {
+                items[static_cast<size_t>(i & (capacity - 1))].store(value, std::memory_order_relaxed);
+            }
+        };
+
+        std::atomic<int64_t> top_;
+        std::atomic<int64_t> bottom_;
+        std::atomic<Buffer *> buffer_;
+        /// Every buffer ever used, the current one last. Only the owner changes it.
+        std::vector<std::unique_ptr<Buffer> > buffers_;
+
+        Buffer *grow(Buffer *old, const int64_t top, const int64_t bottom) {
+            buffers_.push_back(std::unique_ptr<Buffer>(new Buffer(old->capacity * 2)));
+            Buffer *bigger = buffers_.back().get();
+            for (int64_t i = top; i < bottom; ++i)
+                bigger->put(i, old->get(i));
+            buffer_.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+    public:
+        /// capacity must be a power of two.
+        explicit ChaseLevDeque(const int64_t capacity = 256)
+            : top_(0),
+              bottom_(0) {
+            buffers_.push_back(std::unique_ptr<Buffer>(new Buffer(capacity)));
+            buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+        }
+
+        ChaseLevDeque(const ChaseLevDeque &) = delete;
+
+        ChaseLevDeque &operator=(const ChaseLevDeque &) = delete;
+
+        void push(const T value) {
+            const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+            const int64_t top = top_.load(std::memory_order_acquire);
+            Buffer *buffer = buffer_.load(std::memory_order_relaxed);
+            if (bottom - top > buffer->capacity - 1)
+                buffer = grow(buffer, top, bottom);
+            buffer->put(bottom, value);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        /// Takes the most recently pushed item. Returns false if the deque is empty or a thief took the last one.
+        bool pop(T &value) {
+            const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+            Buffer *buffer = buffer_.load(std::memory_order_relaxed);
+            bottom_.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = top_.load(std::memory_order_relaxed);
+            if (top > bottom) {
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                return false;
+            }
+            value = buffer->get(bottom);
+            if (top == bottom) {
+                // the last item: race the thieves for it
+                const bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                              std::memory_order_relaxed);
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /// Takes the oldest item. Returns false if the deque is empty or another thread got there first.
+        bool steal(T &value) {
+            int64_t top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int64_t bottom = bottom_.load(std::memory_order_acquire);
+            if (top >= bottom)
+                return false;
+            value = buffer_.load(std::memory_order_acquire)->get(top);
+            return top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+        /// A snapshot of the size, possibly already out of date.
+        size_t sizeHint() const {
+            const int64_t size = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+    };
+
+    enum class TaskPriority {
+        /// Work someone is waiting on: queries, loading, index building.
+        Interactive = 0,
+        /// Work that only has to happen eventually, such as compaction.
+        Background = 1,
+    };
+
+    const size_t TASK_PRIORITY_COUNT = 2;
+
+    class TaskPool;
+
+    /// Tasks that are waited for together. The group must outlive its tasks; wait() before destroying it.
+    class TaskGroup {
+        friend class TaskPool;
+
+        TaskPool &pool_;
+        std::atomic<size_t> pending_;
+        /// The least urgent priority any of the group's tasks was run at; wait() runs nothing less urgent.
+        std::atomic<size_t> lowest_;
+        std::mutex mutex_;
+        std::condition_variable done_;
+        std::exception_ptr error_;
+
+    public:
+        explicit TaskGroup(TaskPool &pool);
+
+        /// A group on TaskPool::shared().
+        TaskGroup();
+
+        /// Waits for any tasks still running, without rethrowing their errors.
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup &) = delete;
+
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        TaskPool &pool() const {
+            return pool_;
+        }
+
+        /// Runs task on the pool as part of this group.
+        void run(std::function<void()> task, TaskPriority priority = TaskPriority::Interactive);
+
+        /// Blocks until every task of the group has finished, running waiting tasks of any group on this thread
+        /// meanwhile, so waiting inside a task cannot deadlock the pool. Only tasks at least as urgent as the group's
+        /// own are taken, so a query waiting for its interactive tasks never finds itself running a compaction step.
+        /// Rethrows the first exception a task threw.
+        void wait();
+
+        /// Whether every task has finished.
+        bool done() const {
+            return !pending_.load(std::memory_order_acquire);
+        }
+    };
+
+    struct TaskPoolStats {
+        uint64_t executed;
+        /// Tasks taken from another worker's deque.
+        uint64_t stolen;
+        /// Times a worker went to sleep for lack of work.
+        uint64_t parked;
+    };
+
+    class TaskPool {
+        struct Task;
+        struct Worker;
+
+        std::vector<std::unique_ptr<Worker> > workers_;
+        /// Tasks submitted from outside the pool, per priority.
+        std::mutex injectedMutex_;
+        std::deque<Task *> injected_[TASK_PRIORITY_COUNT];
+        std::atomic<size_t> injectedCount_[TASK_PRIORITY_COUNT];
+        /// Bumped by every submission; a worker only parks if it has not changed since it last looked for work.
+        std::atomic<uint64_t> epoch_;
+        std::atomic<size_t> sleeping_;
+        std::mutex parkMutex_;
+        std::condition_variable wake_;
+        std::atomic<bool> stopping_;
+        std::atomic<uint64_t> executed_;
+        std::atomic<uint64_t> stolen_;
+        std::atomic<uint64_t> parked_;
+
+        /// The calling thread's worker if it is one of this pool's, else nullptr.
+        Worker *self() const;
+
+        /// Finds a task for worker (nullptr for a thread outside the pool), interactive ones first, of priority
+        /// lowest or more urgent.
+        Task *find(Worker *worker, TaskPriority lowest = TaskPriority::Background);
+
+        /// Queues a task for group, which is nullptr for a posted one, and wakes a worker if one is parked.
+        void enqueue(TaskGroup *group, std::function<void()> task, TaskPriority priority);
+
+        void execute(Task *task);
+
+        void workerLoop(Worker *worker);
+
+    public:
+        /// Starts threads workers; 0 means workerCount(). There is always at least one.
+        explicit TaskPool(size_t threads = 0);
+
+        /// Stops and joins the workers. Tasks still waiting are dropped, so wait for every group first.
+        ~TaskPool();
+
+        TaskPool(const TaskPool &) = delete;
+
+        TaskPool &operator=(const TaskPool &) = delete;
+
+        /// The pool everything submits to by default, started on first use.
+        static TaskPool &shared();
+
+        size_t size() const {
+            return workers_.size();
+        }
+
+        /// Queues task as part of group; see TaskGroup::run().
+        void submit(TaskGroup &group, std::function<void()> task, TaskPriority priority = TaskPriority::Interactive);
+
+        /// Queues a task that belongs to no group, such as resuming a coroutine. Nothing waits for it, so it must not
+        /// throw, and it must not outlive the pool.
+        void post(std::function<void()> task, TaskPriority priority = TaskPriority::Interactive);
+
+        /// Runs one waiting task of priority lowest or more urgent on the calling thread, if there is any. Returns
+        /// whether it did.
+        bool runOne(TaskPriority lowest = TaskPriority::Background);
+
+        TaskPoolStats stats() const;
+    };
+}
+
+#endif //TASK_POOL_HPP
@@ -4,6 +4,64 @@
 
 #include "ktest.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "admission.hpp"
+#include "arrow_export.hpp"
+#include "async_io.hpp"
+#include "async_loader.hpp"
+#include "batch.hpp"
+#include "binary_protocol.hpp"
+#include "bitmap.hpp"
+#include "coroutine.hpp"
+#include "corpus.hpp"
+#include "cpu_features.hpp"
+#include "diversity.hpp"
+#include "external_sort.hpp"
+#include "footprint.hpp"
+#include "http_protocol.hpp"
+#include "latency.hpp"
+#include "lazy_years.hpp"
+#include "crc32c.hpp"
+#include "csv_scan.hpp"
+#include "digits.hpp"
+#include "page_memory.hpp"
+#include "parallel.hpp"
+#include "query.hpp"
+#include "radix_sort.hpp"
+#include "result_writer.hpp"
+#include "segment_store.hpp"
+#include "server.hpp"
+#include "snapshot.hpp"
+#include "snapshot_client.hpp"
+#include "state.hpp"
+#include "task_pool.hpp"
+#include "unisex.hpp"
+#include "validator.hpp"
+#include "wal.hpp"
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
 KTEST(hello_test) {
     const std::vector<std::string> vec;
     KASSERT_TRUE(vec.empty());
@@ -12,3 +70,1708 @@ KTEST(hello_test) {
 KTEST(hello_other_test) {
     KASSERT_EQ(5, 2 + 3);
 }
+
+// ---- Corpus ---- //
+
+namespace {
+    /// Creates a fresh directory for tests that write files.
+    std::string scratchDir() {
+#ifdef __unix__
+        char path[] = "/tmp/names-test-XXXXXX";
+        if (mkdtemp(path))
+            return path;
+#endif
+        return ".";
+    }
+
+    const names::Corpus &corpus2024() {
+        static names::Corpus corpus;
+        if (corpus.years().empty())
+            names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        return corpus;
+    }
+}
+
+KTEST(dictionary_interns_once) {
+    names::NameDictionary dictionary;
+    const uint32_t olivia = dictionary.intern("Olivia");
+    const uint32_t liam = dictionary.intern("Liam");
+    KASSERT_NE(olivia, liam);
+    KASSERT_EQ(olivia, dictionary.intern("Olivia"));
+    KASSERT_EQ(liam, dictionary.find("Liam"));
+    KASSERT_EQ(names::NameDictionary::npos, dictionary.find("Noah"));
+    KASSERT_EQ(std::string("Liam"), dictionary.name(liam).str());
+}
+
+KTEST(load_yob2024) {
+    const names::Corpus &corpus = corpus2024();
+    const names::YearTable *table = corpus.findYear(2024);
+    KASSERT_TRUE(table != nullptr);
+    KASSERT_EQ(17661u, table->column(names::Sex::Female).size());
+    KASSERT_EQ(14243u, table->column(names::Sex::Male).size());
+    KASSERT_EQ(std::string("Olivia"), corpus.dictionary().name(table->column(names::Sex::Female).nameIds[0]).str());
+    KASSERT_EQ(14718u, table->column(names::Sex::Female).counts[0]);
+}
+
+KTEST(load_rejects_bad_sex) {
+    names::Corpus corpus;
+    KASSERT_THROWS(std::runtime_error, [&], { names::loadYearData(corpus, 2000, "Pat,X,5\n", 8); });
+}
+
+// ---- Validation ---- //
+
+KTEST(validate_yob2024) {
+    const names::ValidationReport report = names::validateYearFile(std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+    KASSERT_TRUE(report.ok());
+    KASSERT_EQ(31904u, report.rows);
+}
+
+KTEST(validate_reports_every_issue) {
+    const char data[] =
+            "Ava,F,100\n"
+            "Ava,F,90\n"        // duplicate
+            "Zoë,F,80\n"        // non-ASCII
+            "Mia,F,85\n"        // out of order
+            "Ivy,X,50\n"        // bad sex
+            "Eve,F,4\n"         // below minimum
+            "Lou,F\n"           // missing count
+            "Kai,M,4x\r\n"     // bad count
+            ",M,30\n"           // empty name
+            "Leo,M,20,extra";   // too many fields, no trailing newline
+    names::Corpus corpus;
+    names::ValidationReport report;
+    names::loadYearData(corpus, 2000, data, sizeof(data) - 1, &report);
+    KASSERT_EQ(10u, report.rows);
+    KASSERT_EQ(9u, report.issueCount);
+
+    const names::IssueKind expected[] = {
+        names::IssueKind::Duplicate, names::IssueKind::NonAsciiName, names::IssueKind::OutOfOrder,
+        names::IssueKind::BadSex, names::IssueKind::LowCount, names::IssueKind::FieldCount,
+        names::IssueKind::BadCount, names::IssueKind::EmptyName, names::IssueKind::FieldCount,
+    };
+    const size_t rows[] = {2, 3, 4, 5, 6, 7, 8, 9, 10};
+    for (size_t i = 0; i < 9; ++i) {
+        KASSERT_TRUE(report.issues[i].kind == expected[i]);
+        KASSERT_EQ(rows[i], report.issues[i].row);
+    }
+    KASSERT_EQ(3u, report.issues[1].column);
+    KASSERT_EQ(5u, report.issues[3].column);
+
+    // structurally broken rows and duplicates are skipped, the rest still load
+    KASSERT_EQ(4u, corpus.findYear(2000)->column(names::Sex::Female).size());
+    KASSERT_EQ(0u, corpus.findYear(2000)->column(names::Sex::Male).size());
+}
+
+// ---- Unisex ---- //
+
+KTEST(unisex_merge_join) {
+    const names::Corpus &corpus = corpus2024();
+    const names::UnisexYear year = names::analyzeUnisex(*corpus.findYear(2024));
+    const uint32_t avery = corpus.dictionary().find("Avery");
+    const std::vector<names::RatioPoint> drift = names::ratioDrift(std::vector<names::UnisexYear>(1, year), avery);
+    KASSERT_EQ(1u, drift.size());
+    KASSERT_EQ(5632u, drift[0].female);
+    KASSERT_EQ(1348u, drift[0].male);
+    for (size_t i = 1; i < year.names.size(); ++i)
+        KASSERT_LT(year.names[i - 1].nameId, year.names[i].nameId);
+}
+
+KTEST(unisex_rank_by_balance) {
+    names::Corpus corpus;
+    const char data[] = "Avery,F,90\nCharlie,F,50\nJordan,F,30\nCharlie,M,49\nAvery,M,10\nJordan,M,30\n";
+    names::loadYearData(corpus, 2000, data, sizeof(data) - 1);
+    const std::vector<names::UnisexYear> years = names::analyzeUnisexAllYears(corpus);
+    KASSERT_EQ(1u, years.size());
+    const std::vector<names::UnisexName> ranked = names::rankByBalance(years[0].names);
+    KASSERT_EQ(3u, ranked.size());
+    KASSERT_EQ(std::string("Jordan"), corpus.dictionary().name(ranked[0].nameId).str());
+    KASSERT_EQ(std::string("Charlie"), corpus.dictionary().name(ranked[1].nameId).str());
+    KASSERT_EQ(std::string("Avery"), corpus.dictionary().name(ranked[2].nameId).str());
+    KASSERT_EQ(1u, names::rankByBalance(years[0].names, 100).size());
+
+    // updates can take both halves of a name to zero, which is neither a share nor a balance
+    names::CorpusUpdater updater(corpus);
+    updater.apply(2000, names::Sex::Female, "Jordan", 6, -30);
+    updater.apply(2000, names::Sex::Male, "Jordan", 6, -30);
+    const names::UnisexYear emptied = names::analyzeUnisex(*corpus.findYear(2000));
+    KASSERT_EQ(3u, emptied.names.size());
+    for (const names::UnisexName &name: emptied.names) {
+        KASSERT_FALSE(std::isnan(name.femaleShare()));
+        KASSERT_FALSE(std::isnan(name.balance()));
+    }
+    const std::vector<names::UnisexName> remaining = names::rankByBalance(emptied.names);
+    KASSERT_EQ(2u, remaining.size());
+    KASSERT_EQ(std::string("Charlie"), corpus.dictionary().name(remaining[0].nameId).str());
+
+    // counts near the top of their range neither overflow a total nor the balance comparison
+    names::UnisexName big = {0, UINT32_MAX, UINT32_MAX - 1};
+    names::UnisexName bigger = {1, UINT32_MAX, UINT32_MAX - 2};
+    KASSERT_EQ(static_cast<uint64_t>(UINT32_MAX) * 2 - 1, big.total());
+    std::vector<names::UnisexName> extremes;
+    extremes.push_back(bigger);
+    extremes.push_back(big);
+    KASSERT_EQ(0u, names::rankByBalance(extremes)[0].nameId);
+}
+
+// ---- Diversity ---- //
+
+KTEST(diversity_small_column) {
+    names::SexColumn column;
+    const uint32_t counts[] = {4, 2, 1, 1};
+    column.counts.assign(counts, counts + 4);
+    column.nameIds.assign(4, 0);
+    const names::DiversityMetrics metrics = names::computeDiversity(column);
+    KASSERT_EQ(8u, metrics.births);
+    KASSERT_LT(std::fabs(metrics.entropy - 1.75), 1e-9);
+    KASSERT_LT(std::fabs(metrics.gini - 0.3125), 1e-9);
+    KASSERT_LT(std::fabs(metrics.top10Share - 1.0), 1e-9);
+
+    // unsorted input gives the same answer
+    std::swap(column.counts[0], column.counts[3]);
+    KASSERT_LT(std::fabs(names::computeDiversity(column).gini - 0.3125), 1e-9);
+}
+
+KTEST(diversity_by_year) {
+    const std::vector<names::DiversityMetrics> metrics = names::diversityByYear(corpus2024());
+    KASSERT_EQ(2u, metrics.size());
+    for (const names::DiversityMetrics &m: metrics) {
+        KASSERT_EQ(2024, m.year);
+        KASSERT_GT(m.entropy, 10.0);
+        KASSERT_GT(m.gini, 0.5);
+        KASSERT_LT(m.top10Share, m.top100Share);
+        KASSERT_LT(m.top100Share, m.top1000Share);
+        KASSERT_LT(m.top1000Share, 1.0);
+    }
+    KASSERT_EQ('M', names::sexChar(metrics[1].sex));
+    KASSERT_EQ(corpus2024().findYear(2024)->column(names::Sex::Male).births(), metrics[1].births);
+}
+
+// ---- State Data ---- //
+
+KTEST(state_partitions) {
+    names::Corpus national;
+    names::StateCorpus states(national.dictionary());
+    const char wa[] = "WA,F,2024,Olivia,300\r\nWA,F,2024,Emma,200\r\nWA,M,2024,Liam,250\r\nWA,F,2023,Emma,310\r\n";
+    const char or_[] = "OR,F,2024,Emma,150\nOR,F,2024,Olivia,100\nOR,M,2024,Noah,90\n";
+    names::loadStateData(states, wa, sizeof(wa) - 1);
+    names::loadStateData(states, or_, sizeof(or_) - 1);
+    KASSERT_EQ(3u, states.partitions().size());
+    KASSERT_EQ(7u, states.rows());
+
+    const std::vector<names::NameCount> top = states.topNames(names::stateCode("WA"), 2024, names::Sex::Female, 1);
+    KASSERT_EQ(1u, top.size());
+    KASSERT_EQ(std::string("Olivia"), national.dictionary().name(top[0].nameId).str());
+    KASSERT_TRUE(states.topNames(names::stateCode("WA"), 1999, names::Sex::Female, 1).empty());
+
+    const names::YearTable totals = states.nationalTotals(2024);
+    const names::SexColumn &female = totals.column(names::Sex::Female);
+    KASSERT_EQ(2u, female.size());
+    KASSERT_EQ(std::string("Olivia"), national.dictionary().name(female.nameIds[0]).str());
+    KASSERT_EQ(400u, female.counts[0]);
+    KASSERT_EQ(350u, female.counts[1]);
+    KASSERT_EQ(2u, totals.column(names::Sex::Male).size());
+
+    // a national total past the table's 32-bit counts is refused rather than truncated
+    const uint32_t ava = national.dictionary().intern("Ava", 3);
+    for (const char *code: {"WA", "OR"}) {
+        names::SexColumn &column = states.partition(names::stateCode(code), 2020).table.column(names::Sex::Female);
+        column.nameIds.push_back(ava);
+        column.counts.push_back(3000000000u);
+    }
+    KASSERT_THROWS(std::overflow_error, [&], { states.nationalTotals(2020); });
+}
+
+KTEST(state_rejects_bad_code) {
+    names::NameDictionary dictionary;
+    names::StateCorpus states(dictionary);
+    KASSERT_THROWS(std::runtime_error, [&], { names::loadStateData(states, "Wa,F,2024,Emma,5\n", 17); });
+    KASSERT_THROWS(std::invalid_argument, [], { names::stateCode("W"); });
+}
+
+// ---- Segment Store ---- //
+
+KTEST(segment_store_fan_out) {
+    names::SegmentStoreOptions options;
+    options.backgroundCompaction = false;
+    options.mergeFanIn = 3;
+    options.smallSegmentRows = 1000;
+    names::SegmentStore store(options);
+
+    const names::Corpus &corpus = corpus2024();
+    store.addYearTable(*corpus.findYear(2024));
+    const uint32_t olivia = corpus.dictionary().find("Olivia");
+    const uint32_t emma = corpus.dictionary().find("Emma");
+
+    // a correction batch moves Olivia below Emma
+    std::vector<names::CountDelta> correction(1);
+    correction[0].year = 2024;
+    correction[0].sex = names::Sex::Female;
+    correction[0].nameId = olivia;
+    correction[0].count = -1500;
+    store.addDeltas(correction);
+    KASSERT_EQ(13218, store.count(2024, names::Sex::Female, olivia));
+    const std::vector<names::NameCount> top = store.top(2024, names::Sex::Female, 2);
+    KASSERT_EQ(emma, top[0].nameId);
+    KASSERT_EQ(olivia, top[1].nameId);
+
+    // the year segment is too big to compact; the correction batches are merged once three pile up
+    KASSERT_FALSE(store.compactOnce());
+    store.addDeltas(correction);
+    store.addDeltas(correction);
+    KASSERT_EQ(4u, store.segments()->size());
+    KASSERT_TRUE(store.compactOnce());
+    KASSERT_EQ(2u, store.segments()->size());
+    KASSERT_EQ(10218, store.count(2024, names::Sex::Female, olivia));
+    KASSERT_EQ(corpus.findYear(2024)->rows(), store.yearTable(2024).rows());
+}
+
+KTEST(segment_store_background_compaction) {
+    names::SegmentStoreOptions options;
+    options.mergeFanIn = 2;
+    names::SegmentStore store(options);
+    std::vector<names::CountDelta> batch(1);
+    batch[0].year = 1990;
+    batch[0].sex = names::Sex::Male;
+    batch[0].nameId = 7;
+    batch[0].count = 5;
+    for (int i = 0; i < 10; ++i)
+        store.addDeltas(batch);
+    // queries see every batch whether or not the compactor has caught up
+    KASSERT_EQ(50, store.count(1990, names::Sex::Male, 7));
+    for (int i = 0; i < 1000 && store.segments()->size() > 1; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    KASSERT_EQ(1u, store.segments()->size());
+    KASSERT_EQ(50, store.count(1990, names::Sex::Male, 7));
+}
+
+// ---- Task Pool ---- //
+
+KTEST(chase_lev_deque_hands_out_once) {
+    // the owner pushes and pops while thieves steal; every item must come out exactly once
+    names::ChaseLevDeque<uint32_t> deque(4);
+    const uint32_t count = 200000;
+    std::vector<std::atomic<uint32_t> > seen(count);
+    std::atomic<bool> pushing(true);
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.push_back(std::thread([&]() {
+            uint32_t item;
+            while (pushing || deque.sizeHint()) {
+                if (deque.steal(item))
+                    ++seen[item];
+            }
+        }));
+    }
+    uint32_t item;
+    for (uint32_t i = 0; i < count; ++i) {
+        deque.push(i);
+        if (i % 3 == 0 && deque.pop(item))
+            ++seen[item];
+    }
+    while (deque.pop(item))
+        ++seen[item];
+    pushing = false;
+    for (std::thread &thread: thieves)
+        thread.join();
+    bool once = true;
+    for (const std::atomic<uint32_t> &times: seen)
+        once = once && times == 1;
+    KASSERT_TRUE(once);
+}
+
+KTEST(task_pool_nests_and_prioritises) {
+    names::TaskPool pool(4);
+    // tasks that fan out further and wait inside the pool
+    std::atomic<uint64_t> sum(0);
+    names::TaskGroup outer(pool);
+    for (uint64_t i = 0; i < 16; ++i) {
+        outer.run([&pool, &sum, i]() {
+            names::TaskGroup inner(pool);
+            for (uint64_t j = 0; j < 64; ++j)
+                inner.run([&sum, i, j]() { sum += i * 64 + j; });
+            inner.wait();
+        });
+    }
+    outer.wait();
+    KASSERT_EQ(static_cast<uint64_t>(1024 * 1023 / 2), sum.load());
+
+    // a task's exception comes out of wait()
+    names::TaskGroup failing(pool);
+    failing.run([]() { throw std::runtime_error("task failed"); });
+    KASSERT_THROWS(std::runtime_error, [&], { failing.wait(); });
+
+    // with one worker busy, queued interactive tasks start before background ones queued earlier
+    names::TaskPool single(1);
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    std::mutex orderMutex;
+    std::string order;
+    names::TaskGroup group(single);
+    group.run([&started, &release]() {
+        started = true;
+        while (!release)
+            std::this_thread::yield();
+    });
+    while (!started)
+        std::this_thread::yield();
+    const auto record = [&](const char tag) {
+        return [&orderMutex, &order, tag]() {
+            std::lock_guard<std::mutex> lock(orderMutex);
+            order += tag;
+        };
+    };
+    group.run(record('b'), names::TaskPriority::Background);
+    group.run(record('b'), names::TaskPriority::Background);
+    group.run(record('i'));
+    group.run(record('i'));
+    release = true;
+    group.wait();
+    KASSERT_EQ(std::string("iibb"), order);
+}
+
+KTEST(task_group_wait_skips_background) {
+    // the only worker runs the interactive group's task, leaving a background task queued behind it
+    names::TaskPool pool(1);
+    std::atomic<bool> started(false);
+    std::atomic<bool> backgroundRan(false);
+    std::thread::id backgroundThread;
+    names::TaskGroup background(pool);
+    names::TaskGroup interactive(pool);
+    interactive.run([&started]() {
+        started = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    });
+    while (!started)
+        std::this_thread::yield();
+    background.run([&backgroundRan, &backgroundThread]() {
+        backgroundThread = std::this_thread::get_id();
+        backgroundRan = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }, names::TaskPriority::Background);
+
+    // waiting for the interactive group does not take up the background task meanwhile
+    interactive.wait();
+    KASSERT_FALSE(backgroundRan && backgroundThread == std::this_thread::get_id());
+    background.wait();
+    KASSERT_TRUE(backgroundRan.load());
+}
+
+// ---- Snapshots and Write-Ahead Log ---- //
+
+KTEST(crc32c_known_value) {
+    // standard check value for CRC-32C
+    KASSERT_EQ(0xe3069283u, names::crc32c("123456789", 9));
+    KASSERT_EQ(names::crc32c("123456789", 9), names::crc32c("6789", 4, names::crc32c("12345", 5)));
+    KASSERT_EQ(0xe3069283u, names::crc32cSoftware("123456789", 9));
+    KASSERT_EQ(0xe3069283u, names::crc32cCombine(names::crc32c("12345", 5), names::crc32c("6789", 4), 4));
+}
+
+KTEST(crc32c_hardware_matches_software) {
+    // long enough to exercise both interleaved block sizes, with every start alignment and ragged tails
+    std::vector<unsigned char> data(3 * 8192 * 2 + 3 * 256 + 123);
+    uint32_t seed = 12345;
+    for (unsigned char &byte: data) {
+        seed = seed * 1103515245 + 12345;
+        byte = static_cast<unsigned char>(seed >> 16);
+    }
+    const size_t lengths[] = {0, 1, 7, 8, 9, 255, 3 * 256, 3 * 256 + 5, 3 * 8192, data.size() - 8};
+    for (const size_t len: lengths) {
+        for (size_t offset = 0; offset < 8; ++offset)
+            KASSERT_EQ(names::crc32cSoftware(&data[offset], len, 7), names::crc32c(&data[offset], len, 7));
+    }
+}
+
+KTEST(snapshot_round_trip) {
+    const std::string path = scratchDir() + "/round_trip.snap";
+    names::writeSnapshot(corpus2024(), path, 42);
+
+    names::Corpus loaded;
+    KASSERT_EQ(42u, names::loadSnapshot(path, loaded));
+    KASSERT_EQ(corpus2024().rows(), loaded.rows());
+    KASSERT_EQ(corpus2024().dictionary().size(), loaded.dictionary().size());
+    const names::SexColumn &male = loaded.findYear(2024)->column(names::Sex::Male);
+    KASSERT_TRUE(corpus2024().findYear(2024)->column(names::Sex::Male).counts == male.counts);
+    KASSERT_EQ(std::string("Liam"), loaded.dictionary().name(male.nameIds[0]).str());
+
+    // flip a byte in the year section
+    const names::SnapshotSection last = names::SnapshotReader(path).section(1);
+    {
+        std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(last.offset + last.size / 2));
+        file.put('\x7f');
+    }
+    names::Corpus damaged;
+    KASSERT_THROWS(std::runtime_error, [&], { names::loadSnapshot(path, damaged); });
+
+    // opening stays cheap and only the damaged section fails, when it is first touched
+    const names::SnapshotReader reader(path);
+    const size_t dictionary = reader.findSection(names::SectionType::Dictionary);
+    const size_t year = reader.findSection(names::SectionType::Year, 2024);
+    KASSERT_FALSE(reader.sectionVerified(dictionary));
+    reader.sectionData(dictionary);
+    KASSERT_TRUE(reader.sectionVerified(dictionary));
+    KASSERT_THROWS(std::runtime_error, [&], { reader.sectionData(year); });
+    KASSERT_EQ(names::SnapshotReader::npos, reader.findSection(names::SectionType::Year, 1880));
+}
+
+KTEST(wal_recovers_updates) {
+    const std::string dir = scratchDir();
+    const size_t threads = 4;
+    const size_t perThread = 50;
+    {
+        names::DurableOptions options;
+        options.checkpointEvery = 0;
+        names::DurableCorpus corpus(dir, options);
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < threads; ++t) {
+            writers.push_back(std::thread([&corpus, t]() {
+                names::NameUpdate update;
+                update.year = 2025;
+                update.sex = t % 2 ? names::Sex::Male : names::Sex::Female;
+                update.name = "Remy";
+                update.delta = 1;
+                for (size_t i = 0; i < perThread; ++i)
+                    corpus.apply(update);
+            }));
+        }
+        for (std::thread &writer: writers)
+            writer.join();
+    }
+
+    // simulate a crash mid-append with a torn record at the end of the log
+    {
+        std::ofstream log(names::DurableCorpus::logPath(dir).c_str(), std::ios::app | std::ios::binary);
+        log.write("\x30\0\0\0garbage", 11);
+    }
+
+    names::DurableCorpus recovered(dir);
+    KASSERT_EQ(threads * perThread, recovered.recovery().applied);
+    const names::Corpus &corpus = recovered.corpus();
+    const uint32_t remy = corpus.dictionary().find("Remy");
+    KASSERT_EQ(100u, corpus.findYear(2025)->column(names::Sex::Female).counts[0]);
+    KASSERT_EQ(remy, corpus.findYear(2025)->column(names::Sex::Male).nameIds[0]);
+    KASSERT_EQ(threads * perThread, recovered.recovery().lastLsn);
+}
+
+KTEST(wal_checkpoint_bounds_replay) {
+    const std::string dir = scratchDir();
+    names::writeSnapshot(corpus2024(), names::DurableCorpus::snapshotPath(dir));
+    names::DurableOptions options;
+    options.checkpointEvery = 10;
+    {
+        names::DurableCorpus corpus(dir, options);
+        names::NameUpdate update;
+        update.year = 2024;
+        update.sex = names::Sex::Female;
+        update.name = "Olivia";
+        update.delta = 2;
+        for (int i = 0; i < 25; ++i)
+            corpus.apply(update);
+    }
+
+    names::DurableCorpus recovered(dir, options);
+    KASSERT_EQ(5u, recovered.recovery().applied);
+    KASSERT_EQ(25u, recovered.recovery().lastLsn);
+    KASSERT_EQ(14768u, recovered.corpus().findYear(2024)->column(names::Sex::Female).counts[0]);
+}
+
+#ifdef __linux__
+KTEST(wal_failed_sync_leaves_memory_alone) {
+    const std::string dir = scratchDir();
+    names::writeSnapshot(corpus2024(), names::DurableCorpus::snapshotPath(dir));
+    names::DurableCorpus corpus(dir);
+    names::NameUpdate update;
+    update.year = 2024;
+    update.sex = names::Sex::Female;
+    update.name = "Olivia";
+    update.delta = 2;
+    corpus.apply(update);
+
+    // cap the file size at what the log already holds so the next append fails with EFBIG
+    struct stat log;
+    KASSERT_EQ(0, stat(names::DurableCorpus::logPath(dir).c_str(), &log));
+    struct rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    struct rlimit capped = saved;
+    capped.rlim_cur = static_cast<rlim_t>(log.st_size);
+    void (*previous)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &capped);
+    bool threw = false;
+    try {
+        corpus.apply(update);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, previous);
+
+    KASSERT_TRUE(threw);
+    KASSERT_EQ(14720u, corpus.corpus().findYear(2024)->column(names::Sex::Female).counts[0]);
+}
+#endif
+
+// ---- Async I/O ---- //
+
+KTEST(async_load_matches_sequential) {
+    const std::string dir = scratchDir();
+    const std::string contents = names::readFile(std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+    for (int year = 2020; year <= 2024; year += 2) {
+        std::ofstream out((dir + "/yob" + std::to_string(year) + ".txt").c_str(), std::ios::binary);
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    }
+    names::Corpus expected;
+    KASSERT_EQ(3u, names::loadYearRange(expected, dir, 2019, 2025));
+
+    const names::IoBackend backends[] = {names::IoBackend::Auto, names::IoBackend::ThreadPool};
+    for (const names::IoBackend backend: backends) {
+        names::AsyncLoadOptions options;
+        options.backend = backend;
+        // two buffers smaller than the files: every read takes the private-buffer path and waits on the parsers
+        options.queueDepth = 2;
+        options.bufferSize = 4096;
+        names::Corpus loaded;
+        KASSERT_EQ(3u, names::loadYearRangeAsync(loaded, dir, 2019, 2025, options));
+        KASSERT_EQ(expected.rows(), loaded.rows());
+        KASSERT_EQ(expected.dictionary().size(), loaded.dictionary().size());
+        KASSERT_EQ(2022, loaded.years()[1].year);
+        const names::SexColumn &male = loaded.findYear(2022)->column(names::Sex::Male);
+        KASSERT_TRUE(expected.findYear(2022)->column(names::Sex::Male).nameIds == male.nameIds);
+        KASSERT_TRUE(expected.findYear(2022)->column(names::Sex::Male).counts == male.counts);
+    }
+}
+
+KTEST(async_load_states) {
+    const std::string dir = scratchDir();
+    {
+        std::ofstream wa((dir + "/WA.TXT").c_str(), std::ios::binary);
+        wa << "WA,F,2024,Olivia,300\r\nWA,F,2024,Emma,200\r\nWA,M,2024,Liam,250\r\n";
+        std::ofstream or_((dir + "/OR.TXT").c_str(), std::ios::binary);
+        or_ << "OR,F,2024,Emma,150\nOR,F,2024,Juniper,100\n";
+    }
+    names::NameDictionary dictionary;
+    names::StateCorpus states(dictionary);
+    KASSERT_EQ(2u, names::loadStateDirectoryAsync(states, dir));
+    KASSERT_EQ(5u, states.rows());
+    // merged in state order, so OR's names are interned first
+    KASSERT_EQ(std::string("Emma"), dictionary.name(0).str());
+    const names::SexColumn female = states.nationalTotals(2024).column(names::Sex::Female);
+    KASSERT_EQ(3u, female.size());
+    KASSERT_EQ(350u, female.counts[0]);
+
+    std::ofstream((dir + "/TX.TXT").c_str()) << "TX,X,2024,Emma,5\n";
+    names::StateCorpus broken(dictionary);
+    KASSERT_THROWS(std::runtime_error, [&], { names::loadStateDirectoryAsync(broken, dir); });
+}
+
+namespace {
+    names::Async<int> addLater(names::TaskPool &pool, const int a, const int b, std::thread::id &resumedOn) {
+        co_await names::resumeOn(pool);
+        resumedOn = std::this_thread::get_id();
+        co_return a + b;
+    }
+
+    names::Async<int> sumTwice(names::TaskPool &pool, const int a, std::thread::id &resumedOn) {
+        const int once = co_await addLater(pool, a, a, resumedOn);
+        co_return once + co_await addLater(pool, once, 0, resumedOn);
+    }
+
+    names::Async<void> failLater(names::TaskPool &pool) {
+        co_await names::resumeOn(pool);
+        throw std::runtime_error("coroutine failed");
+    }
+}
+
+KTEST(coroutines_resume_on_pool) {
+    names::TaskPool pool(2);
+    std::thread::id resumedOn;
+    KASSERT_EQ(28, names::syncWait(sumTwice(pool, 7, resumedOn)));
+    KASSERT_TRUE(resumedOn != std::this_thread::get_id());
+    KASSERT_THROWS(std::runtime_error, [&], { names::syncWait(failLater(pool)); });
+
+    names::AsyncEvent event(pool);
+    std::atomic<int> woken(0);
+    names::AsyncScope scope;
+    const auto waitForEvent = [](names::AsyncEvent &e, std::atomic<int> &count) -> names::Async<void> {
+        co_await e.wait();
+        ++count;
+    };
+    for (int i = 0; i < 100; ++i)
+        scope.spawn(waitForEvent(event, woken));
+    KASSERT_EQ(0, woken.load());
+    event.set();
+    scope.wait();
+    KASSERT_EQ(100, woken.load());
+    // once set, waiting does not suspend
+    names::syncWait(waitForEvent(event, woken));
+    KASSERT_EQ(101, woken.load());
+}
+
+KTEST(lazy_years_load_once_on_demand) {
+    const std::string dir = scratchDir();
+    {
+        const std::string contents = names::readFile(std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        std::ofstream full((dir + "/yob2024.txt").c_str(), std::ios::binary);
+        full.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        std::ofstream((dir + "/yob2023.txt").c_str()) << "Olivia,F,20\nEmma,F,30\nLiam,M,25\n";
+        std::ofstream((dir + "/yob2022.txt").c_str()) << "Olivia,F,-1\n";
+    }
+    const char *lines[] = {"rank Olivia F 2024", "top 2024 M 3", "rank Olivia F 2023", "top 2023 F 5"};
+    std::vector<names::Query> queries(4);
+    for (size_t i = 0; i < queries.size(); ++i)
+        names::parseQuery(lines[i], std::strlen(lines[i]), queries[i]);
+
+    names::TaskPool pool(2);
+    const names::IoBackend backends[] = {names::IoBackend::Auto, names::IoBackend::ThreadPool};
+    for (const names::IoBackend backend: backends) {
+        names::AsyncReaderOptions options;
+        options.backend = backend;
+        names::AsyncFileReader reader(pool, options);
+        names::LazyYearStore store(dir, 2000, 2030, reader, pool);
+        std::vector<names::QueryRow> rows;
+        KASSERT_TRUE(store.tryAnswer(queries[0], rows) == nullptr);
+        KASSERT_TRUE(rows.empty());
+
+        // a burst of queries for two cold years shares one read of each
+        std::vector<std::vector<names::QueryRow> > answers(1000);
+        {
+            names::AsyncScope scope;
+            for (size_t i = 0; i < answers.size(); ++i)
+                scope.spawn(store.answer(queries[i % queries.size()], answers[i]));
+            scope.wait();
+        }
+        KASSERT_EQ(static_cast<uint64_t>(2), store.loads());
+        KASSERT_EQ(static_cast<uint64_t>(2), reader.reads());
+        bool same = true;
+        for (size_t i = queries.size(); i < answers.size(); ++i) {
+            const std::vector<names::QueryRow> &first = answers[i % queries.size()];
+            same = same && answers[i].size() == first.size();
+            for (size_t r = 0; same && r < first.size(); ++r)
+                same = answers[i][r].nameId == first[r].nameId && answers[i][r].rank == first[r].rank;
+        }
+        KASSERT_TRUE(same);
+        KASSERT_EQ(2u, answers[2][0].rank);
+        KASSERT_EQ(static_cast<size_t>(2), answers[3].size());
+
+        // now in memory, so answered without suspending
+        const names::LoadedYear *year = store.tryAnswer(queries[0], rows);
+        KASSERT_TRUE(year == store.find(2024));
+        KASSERT_EQ(std::string("Olivia"), year->corpus.dictionary().name(rows[0].nameId).str());
+        KASSERT_EQ(answers[0][0].count, rows[0].count);
+
+        KASSERT_THROWS(std::runtime_error, [&], { names::syncWait(store.load(2021)); });
+        KASSERT_THROWS(std::runtime_error, [&], { names::syncWait(store.load(2022)); });
+        KASSERT_THROWS(std::out_of_range, [&], { names::syncWait(store.load(1999)); });
+        names::Query lookup;
+        names::parseQuery("lookup Emma", 11, lookup);
+        KASSERT_THROWS(std::invalid_argument, [&], { names::syncWait(store.answer(lookup, rows)); });
+        KASSERT_TRUE(store.find(2022) == nullptr);
+    }
+}
+
+// ---- Page Memory ---- //
+
+KTEST(page_memory_hints) {
+    names::MappingHints hints;
+    hints.hugePages = names::HugePages::Explicit;
+    hints.populate = true;
+    // no huge pages are normally reserved, so this exercises the fallback to transparent huge pages
+    char *p = static_cast<char *>(names::mapPages(3 << 20, hints));
+#ifdef __unix__
+    KASSERT_EQ(0u, reinterpret_cast<uintptr_t>(p) % names::LARGE_PAGE_SIZE);
+    KASSERT_EQ(0, p[(3 << 20) - 1]);
+#endif
+    p[0] = 1;
+    names::unmapPages(p, 3 << 20);
+
+    hints.hugePages = names::HugePages::Transparent;
+    names::setArenaHints(hints);
+    {
+        names::ArenaVector<uint32_t> large(1 << 20, 7);
+#ifdef __unix__
+        KASSERT_EQ(0u, reinterpret_cast<uintptr_t>(large.data()) % names::LARGE_PAGE_SIZE);
+#endif
+        large.resize(3 << 20, 9);
+        KASSERT_EQ(7u, large[(1 << 20) - 1]);
+        KASSERT_EQ(9u, large.back());
+    }
+    names::setArenaHints(names::MappingHints());
+}
+
+// ---- SIMD Kernels ---- //
+
+KTEST(simd_variants_agree) {
+    const names::IsaLevel detected = names::detectedIsaLevel();
+    std::string csv;
+    for (int i = 0; csv.size() < 1000; ++i)
+        csv += "Zo\xc3\xab," + std::string(i % 2 ? "F" : "M") + "," + std::to_string(i * 37) + "\r\n";
+    std::vector<uint64_t> a(1003);
+    std::vector<uint64_t> b(a.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+        a[i] = i * 0x9e3779b97f4a7c15ULL;
+        b[i] = ~a[i] ^ (i << 7);
+    }
+    std::vector<uint32_t> counts(999);
+    for (size_t i = 0; i < counts.size(); ++i)
+        counts[i] = static_cast<uint32_t>(4000000000u - i * 3);
+
+    const names::SimdKernels &scalar = names::simdKernels(names::IsaLevel::Scalar);
+    for (int level = 0; level <= static_cast<int>(detected); ++level) {
+        const names::IsaLevel isa = static_cast<names::IsaLevel>(level);
+        const names::SimdKernels &kernels = names::simdKernels(isa);
+        for (size_t block = 0; block + 64 <= csv.size(); block += 64) {
+            names::ScanMasks expected;
+            names::ScanMasks actual;
+            names::scanBlockKernel(names::IsaLevel::Scalar)(csv.data() + block, expected);
+            names::scanBlockKernel(isa)(csv.data() + block, actual);
+            KASSERT_EQ(expected.commas, actual.commas);
+            KASSERT_EQ(expected.newlines, actual.newlines);
+            KASSERT_EQ(expected.nonAscii, actual.nonAscii);
+        }
+        KASSERT_EQ(scalar.popcount(a.data(), a.size()), kernels.popcount(a.data(), a.size()));
+        KASSERT_EQ(scalar.popcountAnd(a.data(), b.data(), a.size()), kernels.popcountAnd(a.data(), b.data(), a.size()));
+        std::vector<uint64_t> expected(a.size());
+        std::vector<uint64_t> actual(a.size());
+        scalar.andNotWords(expected.data(), a.data(), b.data(), a.size());
+        kernels.andNotWords(actual.data(), a.data(), b.data(), a.size());
+        KASSERT_TRUE(expected == actual);
+        KASSERT_TRUE(kernels.isNonIncreasing(counts.data(), counts.size()));
+        const uint32_t saved = counts[997];
+        counts[997] = 4000000000u;
+        KASSERT_FALSE(kernels.isNonIncreasing(counts.data(), counts.size()));
+        counts[997] = saved;
+    }
+
+    // the whole loader still agrees when forced down to scalar code
+    names::setIsaLevel(names::IsaLevel::Scalar);
+    names::Corpus corpus;
+    names::loadYearFile(corpus, 2024, std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+    names::setIsaLevel(detected);
+    KASSERT_EQ(corpus2024().rows(), corpus.rows());
+
+    names::Bitmap seen(130);
+    seen.set(3);
+    seen.set(129);
+    names::Bitmap other(70);
+    other.set(3);
+    other.set(64);
+    KASSERT_EQ(1u, seen.countAnd(other));
+    seen |= other;
+    KASSERT_EQ(3u, seen.count());
+    seen.subtract(other);
+    KASSERT_EQ(1u, seen.count());
+    KASSERT_TRUE(seen.test(129));
+}
+
+// ---- Digits ---- //
+
+KTEST(digits_parse_and_format) {
+    const char *valid[] = {"0", "5", "14718", "00042", "12345678", "123456789", "4294967295"};
+    for (const char *text: valid) {
+        uint32_t value = 0;
+        KASSERT_TRUE(names::parseUint32(text, std::strlen(text), value));
+        KASSERT_EQ(std::strtoul(text, nullptr, 10), value);
+    }
+    const char *invalid[] = {"", "12a4", "-5", " 7", "1234567:", "4294967296", "12345678901"};
+    for (const char *text: invalid) {
+        uint32_t value;
+        KASSERT_FALSE(names::parseUint32(text, std::strlen(text), value));
+    }
+
+    char out[names::MAX_DIGITS + 1];
+    const uint64_t values[] = {0, 7, 10, 99, 100, 14718, 1000000, 4294967295ULL, 18446744073709551615ULL};
+    for (const uint64_t value: values) {
+        const size_t len = names::formatUint64(value, out);
+        KASSERT_EQ(std::to_string(value), std::string(out, len));
+    }
+    KASSERT_EQ(std::string("-1500"), std::string(out, names::formatInt64(-1500, out)));
+    KASSERT_EQ(std::string("-9223372036854775808"), std::string(out, names::formatInt64(INT64_MIN, out)));
+}
+
+// ---- Result Writer ---- //
+
+namespace {
+    /// Runs fn against a writer with tiny buffers, so rows straddle buffers and trigger flushes, and returns the output.
+    std::string writeWith(const names::OutputFormat format, const std::function<void(names::ResultWriter &)> &fn) {
+        std::FILE *file = std::tmpfile();
+        {
+            names::ResultWriter writer(file, format, names::yearRowColumns(), 64, 2);
+            fn(writer);
+        }
+        std::string contents(static_cast<size_t>(std::ftell(file)), '\0');
+        std::rewind(file);
+        const size_t read = std::fread(&contents[0], 1, contents.size(), file);
+        std::fclose(file);
+        contents.resize(read);
+        return contents;
+    }
+}
+
+KTEST(result_writer_formats) {
+    const auto rows = [](names::ResultWriter &writer) {
+        writer.header();
+        writer.number(int64_t(2024)).text("F").text("O'Neil, \"Jr\"\tII").number(uint64_t(14718));
+        writer.endRow();
+        writer.number(int64_t(-1)).text("M").text("Liam").number(0.25);
+        writer.endRow();
+    };
+    KASSERT_EQ(std::string("year,sex,name,count\n2024,F,\"O'Neil, \"\"Jr\"\"\tII\",14718\n-1,M,Liam,0.25\n"),
+               writeWith(names::OutputFormat::Csv, rows));
+    KASSERT_EQ(std::string("year\tsex\tname\tcount\n2024\tF\tO'Neil, \"Jr\"\\tII\t14718\n-1\tM\tLiam\t0.25\n"),
+               writeWith(names::OutputFormat::Tsv, rows));
+    KASSERT_EQ(std::string("{\"year\":2024,\"sex\":\"F\",\"name\":\"O'Neil, \\\"Jr\\\"\\u0009II\",\"count\":14718}\n"
+                           "{\"year\":-1,\"sex\":\"M\",\"name\":\"Liam\",\"count\":0.25}\n"),
+               writeWith(names::OutputFormat::JsonLines, rows));
+
+    // the whole year, through many flushes
+    const std::string csv = writeWith(names::OutputFormat::Csv, [](names::ResultWriter &writer) {
+        names::writeCorpus(writer, corpus2024());
+    });
+    KASSERT_EQ(0u, csv.find("2024,F,Olivia,14718\n2024,F,Emma,13485\n"));
+    KASSERT_EQ(static_cast<size_t>(corpus2024().rows()),
+               static_cast<size_t>(std::count(csv.begin(), csv.end(), '\n')));
+}
+
+// ---- Queries ---- //
+
+namespace {
+    template<typename Engine>
+    std::vector<names::QueryRow> answer(const Engine &engine, const std::string &line) {
+        names::Query query;
+        names::parseQuery(line.data(), line.size(), query);
+        std::vector<names::QueryRow> rows;
+        engine.run(query, rows);
+        return rows;
+    }
+}
+
+KTEST(query_engine_answers) {
+    const names::Corpus &corpus = corpus2024();
+    const names::QueryEngine engine(corpus);
+    names::Query query;
+    KASSERT_TRUE(names::parseQuery("rank\tOlivia F  2024\r\n", 21, query));
+    KASSERT_TRUE(query.type == names::QueryType::Rank);
+    KASSERT_EQ(std::string("Olivia"), std::string(query.text, query.textSize));
+    KASSERT_FALSE(names::parseQuery("rank Olivia X 2024", 18, query));
+    KASSERT_FALSE(names::parseQuery("top 2024 F 0", 12, query));
+    KASSERT_FALSE(names::parseQuery("lookup", 6, query));
+
+    std::vector<names::QueryRow> rows = answer(engine, "lookup Emma");
+    KASSERT_EQ(static_cast<size_t>(2), rows.size());
+    KASSERT_EQ(static_cast<uint64_t>(13485), rows[0].count);
+    KASSERT_EQ(2u, rows[0].rank);
+    KASSERT_EQ(static_cast<uint64_t>(16), rows[1].count);
+    // with a single year loaded, all-time ranks are that year's ranks
+    KASSERT_EQ(rows[1].rank, answer(engine, "rank Emma M 2024")[0].rank);
+
+    // every name with 5 births ties behind the 12300 boys' names with more
+    rows = answer(engine, "rank Aadarsh M 2024");
+    KASSERT_EQ(static_cast<uint64_t>(5), rows[0].count);
+    KASSERT_EQ(12301u, rows[0].rank);
+    rows = answer(engine, "rank Nobodyname F 2024");
+    KASSERT_EQ(names::NameDictionary::npos, rows[0].nameId);
+    KASSERT_EQ(0u, rows[0].rank);
+    KASSERT_EQ(0u, answer(engine, "rank Olivia F 1999")[0].rank);
+
+    rows = answer(engine, "prefix Oliv 3");
+    KASSERT_EQ(static_cast<size_t>(3), rows.size());
+    KASSERT_EQ(std::string("Oliver"), corpus.dictionary().name(rows[0].nameId).str());
+    KASSERT_EQ(static_cast<uint64_t>(15343 + 25), rows[0].count);
+    KASSERT_EQ(std::string("Olivia"), corpus.dictionary().name(rows[1].nameId).str());
+    KASSERT_EQ(std::string("Olive"), corpus.dictionary().name(rows[2].nameId).str());
+    KASSERT_TRUE(answer(engine, "prefix Qqqq").empty());
+
+    rows = answer(engine, "top 2024 F 3");
+    KASSERT_EQ(static_cast<size_t>(3), rows.size());
+    KASSERT_EQ(3u, rows[2].rank);
+    KASSERT_EQ(std::string("Amelia"), corpus.dictionary().name(rows[2].nameId).str());
+}
+
+KTEST(query_prefix_scans_in_morsels) {
+    std::vector<uint8_t> seen(25 * names::MORSEL_ROWS + 7, 0);
+    names::parallelMorsels(seen.size(), [&](const size_t morsel, const size_t begin, const size_t end) {
+        if (morsel == begin / names::MORSEL_ROWS && end - begin <= names::MORSEL_ROWS) {
+            for (size_t i = begin; i < end; ++i)
+                ++seen[i];
+        }
+    });
+    KASSERT_EQ(seen.size(), static_cast<size_t>(std::count(seen.begin(), seen.end(), 1)));
+
+    // an empty prefix matches every name, several morsels' worth, and must rank exactly like a sequential scan
+    const names::Corpus &corpus = corpus2024();
+    const names::NameDictionary &dictionary = corpus.dictionary();
+    KASSERT_TRUE(dictionary.size() > 2 * names::MORSEL_ROWS);
+    const names::QueryEngine engine(corpus);
+    std::vector<names::NameCount> expected;
+    for (uint32_t id = 0; id < dictionary.size(); ++id) {
+        const uint64_t total = engine.totals(names::Sex::Female)[id] + engine.totals(names::Sex::Male)[id];
+        const names::NameCount match = {id, total};
+        if (match.count)
+            expected.push_back(match);
+    }
+    std::sort(expected.begin(), expected.end(), [&](const names::NameCount &a, const names::NameCount &b) {
+        if (a.count != b.count)
+            return a.count > b.count;
+        return dictionary.name(a.nameId).str() < dictionary.name(b.nameId).str();
+    });
+    names::Query query = {names::QueryType::Prefix, "", 0, false, names::Sex::Female, 0, names::MAX_QUERY_LIMIT};
+    std::vector<names::QueryRow> rows;
+    engine.run(query, rows);
+    KASSERT_EQ(static_cast<size_t>(names::MAX_QUERY_LIMIT), rows.size());
+    bool same = true;
+    for (size_t i = 0; i < rows.size(); ++i)
+        same = same && rows[i].nameId == expected[i].nameId && rows[i].count == expected[i].count;
+    KASSERT_TRUE(same);
+    KASSERT_EQ(1u, rows[0].rank);
+}
+
+KTEST(snapshot_client_matches_engine) {
+    // the 2024 names plus a year whose columns are not in descending order
+    const std::string plain = scratchDir() + "/client_plain.snap";
+    names::writeSnapshot(corpus2024(), plain);
+    names::Corpus corpus;
+    names::loadSnapshot(plain, corpus);
+    names::CorpusUpdater updater(corpus);
+    const char *extra[] = {"Zelda", "Olivia", "Oliviana", "Emma"};
+    for (size_t i = 0; i < 4; ++i)
+        updater.apply(2025, names::Sex::Female, extra[i], std::strlen(extra[i]), static_cast<int64_t>(10 + i * 7 % 3));
+    const names::QueryEngine engine(corpus);
+    const std::string path = scratchDir() + "/client.snap";
+    names::publishSnapshot(engine, path, 9);
+
+    const names::SnapshotClient client(path);
+    KASSERT_EQ(9u, client.lastLsn());
+    KASSERT_EQ(corpus.dictionary().size(), client.nameCount());
+    KASSERT_EQ(corpus.dictionary().find("Olivia"), client.find("Olivia"));
+    KASSERT_EQ(names::NameDictionary::npos, client.find("Nobodyname"));
+    const char *queries[] = {
+        "lookup Emma", "lookup Oliviana F", "lookup Nobodyname", "rank Aadarsh M 2024", "rank Olivia F 2025",
+        "rank Zelda F 2025", "rank Olivia F 1999", "prefix Oliv 5", "prefix Qqqq", "prefix E 1000", "top 2024 M 20",
+        "top 2025 F", "top 1999 F", "bogus query",
+    };
+    for (const char *line: queries) {
+        const std::vector<names::QueryRow> expected = answer(engine, line);
+        const std::vector<names::QueryRow> actual = answer(client, line);
+        bool same = expected.size() == actual.size();
+        for (size_t i = 0; same && i < expected.size(); ++i) {
+            same = expected[i].nameId == actual[i].nameId && expected[i].hasSex == actual[i].hasSex &&
+                   expected[i].sex == actual[i].sex && expected[i].year == actual[i].year &&
+                   expected[i].count == actual[i].count && expected[i].rank == actual[i].rank;
+        }
+        if (!same)
+            std::fprintf(stderr, "differs: %s\n", line);
+        KASSERT_TRUE(same);
+    }
+
+    // a snapshot written without the indexes is refused
+    KASSERT_THROWS(std::runtime_error, [&], { names::SnapshotClient unindexed(plain); });
+}
+
+// ---- Memory Footprint ---- //
+
+namespace {
+    /// Checks that every structure holds at least what it uses and that its totals are those of its parts.
+    bool footprintAddsUp(const names::MemoryFootprint &footprint) {
+        if (footprint.used > footprint.reserved)
+            return false;
+        if (footprint.parts.empty())
+            return true;
+        size_t used = 0;
+        size_t reserved = 0;
+        for (const names::MemoryFootprint &part: footprint.parts) {
+            if (!footprintAddsUp(part))
+                return false;
+            used += part.used;
+            reserved += part.reserved;
+        }
+        return used <= footprint.used && reserved <= footprint.reserved;
+    }
+
+    const names::MemoryFootprint *findPart(const names::MemoryFootprint &footprint, const std::string &name) {
+        for (const names::MemoryFootprint &part: footprint.parts) {
+            if (part.name == name)
+                return &part;
+        }
+        return nullptr;
+    }
+}
+
+KTEST(footprints_add_up) {
+    const names::Corpus &corpus = corpus2024();
+    const names::QueryEngine engine(corpus);
+    const names::MemoryFootprint data = corpus.footprint();
+    KASSERT_TRUE(footprintAddsUp(data));
+    KASSERT_EQ(data.used, corpus.memoryUsed());
+    const names::MemoryFootprint *dictionary = findPart(data, "dictionary");
+    KASSERT_TRUE(dictionary != nullptr);
+    const names::MemoryFootprint *arena = findPart(*dictionary, "name arena");
+    KASSERT_TRUE(arena != nullptr);
+    KASSERT_EQ(corpus.dictionary().bytes().size(), arena->used);
+    // the columns hold a name ID and a count per row
+    const names::MemoryFootprint *years = findPart(data, "years");
+    KASSERT_TRUE(years != nullptr);
+    KASSERT_EQ(corpus.rows() * 8, findPart(*years, "female columns")->used + findPart(*years, "male columns")->used);
+
+    const names::MemoryFootprint indexes = engine.footprint();
+    KASSERT_TRUE(footprintAddsUp(indexes));
+    KASSERT_EQ(corpus.dictionary().size() * 4, findPart(indexes, "sorted index")->used);
+
+    // a published snapshot maps the same structures, and every byte of the file is accounted for
+    const std::string path = scratchDir() + "/footprint.snap";
+    names::publishSnapshot(engine, path);
+    const names::SnapshotClient client(path);
+    const names::MemoryFootprint mapped = client.footprint();
+    KASSERT_TRUE(footprintAddsUp(mapped));
+    KASSERT_EQ(arena->used, findPart(*findPart(mapped, "dictionary"), "name arena")->used);
+    KASSERT_EQ(findPart(indexes, "sorted index")->used, findPart(mapped, "sorted index")->used);
+    KASSERT_EQ(corpus.rows() * 8, findPart(mapped, "year columns")->used);
+    const size_t year = findPart(mapped, "year table")->reserved;
+    KASSERT_EQ(names::readFile(path).size(), mapped.reserved - year);
+
+    names::MemoryFootprint total("total");
+    total.add(data);
+    total.add(indexes);
+    const std::string report = names::formatFootprint(total, corpus.dictionary().size());
+    KASSERT_EQ(static_cast<size_t>(0), report.find("structure"));
+    KASSERT_NE(std::string::npos, report.find("\n      name arena "));
+    KASSERT_NE(std::string::npos, report.find("\n  query engine "));
+}
+
+// ---- Server ---- //
+
+#ifdef __linux__
+KTEST(binary_server_pipelines) {
+    const names::QueryEngine engine(corpus2024());
+    names::ServerOptions options;
+    options.loops = 2;
+    // small reads, so the end of a stream arrives together with requests still to answer
+    options.readSize = 4096;
+    // small turns, so the pipeline is answered a piece at a time off the loop's ready list
+    options.maxTurnAnswers = 64;
+    names::AdmissionOptions limits;
+    limits.maxConnectionInFlight = 64;
+    limits.deadline = std::chrono::microseconds(0);
+    names::AdmissionController admission(limits);
+    names::QueryServer server(options, [&engine, &admission]() {
+        return std::unique_ptr<names::ProtocolHandler>(new names::BinaryHandler(engine, &admission));
+    });
+    server.start();
+    KASSERT_NE(0, server.port());
+    KASSERT_EQ(static_cast<size_t>(2), server.loopCount());
+
+    // every request is sent before any answer is read
+    const char *lines[] = {"lookup Emma", "rank Aadarsh M 2024", "prefix Oliv 3", "top 2024 F 5", "lookup Nobodyname F"};
+    names::BinaryClient client("127.0.0.1", server.port());
+    for (uint32_t round = 0; round < 100; ++round) {
+        for (uint32_t i = 0; i < 5; ++i) {
+            names::Query query;
+            names::parseQuery(lines[i], std::strlen(lines[i]), query);
+            client.send(query, round * 5 + i);
+        }
+    }
+    // a query type that does not exist
+    names::Query bogus;
+    names::parseQuery("lookup Emma", 11, bogus);
+    bogus.type = static_cast<names::QueryType>(9);
+    client.send(bogus, 7777);
+    // a client that has nothing more to ask shuts its side down, and is still answered in full
+    client.finish();
+
+    bool same = true;
+    names::BinaryResponse response;
+    for (uint32_t n = 0; n < 500; ++n) {
+        client.receive(response);
+        const std::vector<names::QueryRow> expected = answer(engine, lines[n % 5]);
+        same = same && response.id == n && response.status == names::BinaryStatus::Ok &&
+               response.rows.size() == expected.size();
+        for (size_t r = 0; same && r < expected.size(); ++r) {
+            const names::BinaryRow &row = response.rows[r];
+            same = row.nameId == expected[r].nameId && row.count == expected[r].count &&
+                   row.rank == expected[r].rank && row.year == expected[r].year &&
+                   row.hasSex == expected[r].hasSex && (!row.hasSex || row.sex == expected[r].sex) &&
+                   (row.nameId == names::NameDictionary::npos ||
+                    row.name == corpus2024().dictionary().name(row.nameId).str());
+        }
+    }
+    KASSERT_TRUE(same);
+    client.receive(response);
+    KASSERT_EQ(7777u, response.id);
+    KASSERT_TRUE(response.status == names::BinaryStatus::Invalid);
+    KASSERT_TRUE(response.rows.empty());
+    // then the server closes its side too
+    KASSERT_THROWS(std::runtime_error, [&], { client.receive(response); });
+
+    // a few requests read together with the end of the stream are answered too
+    names::BinaryClient brief("127.0.0.1", server.port());
+    for (uint32_t i = 0; i < 3; ++i) {
+        names::Query query;
+        names::parseQuery(lines[i], std::strlen(lines[i]), query);
+        brief.send(query, i);
+    }
+    brief.finish();
+    for (uint32_t i = 0; i < 3; ++i) {
+        brief.receive(response);
+        KASSERT_EQ(i, response.id);
+    }
+    KASSERT_THROWS(std::runtime_error, [&], { brief.receive(response); });
+
+    server.stop();
+    const names::ServerStats stats = server.stats();
+    KASSERT_EQ(static_cast<uint64_t>(2), stats.connections);
+    // the pipelined answers went out in far fewer writes than there were requests
+    KASSERT_TRUE(stats.writes < 50);
+    KASSERT_TRUE(admission.stats().deferred > 0);
+    KASSERT_EQ(static_cast<uint64_t>(504), admission.stats().admitted);
+
+    // a length prefix past the request limit, here "GET " read as one, closes the connection before it is buffered
+    names::BinaryHandler handler(engine);
+    names::SendQueue out;
+    names::ConsumeContext context;
+    context.maxRequest = options.maxRequest;
+    const std::string http = "GET /lookup?name=Emma HTTP/1.1\r\n\r\n";
+    KASSERT_EQ(static_cast<size_t>(0), handler.consume(http.data(), http.size(), out, context));
+    KASSERT_TRUE(context.close);
+}
+#endif
+
+KTEST(admission_defers_and_refuses) {
+    const names::QueryEngine engine(corpus2024());
+    names::AdmissionOptions limits;
+    limits.maxInFlight = 4;
+    limits.maxConnectionInFlight = 2;
+    limits.connectionQuota = 0;
+    limits.maxExpensive = 1;
+    limits.deadline = std::chrono::milliseconds(50);
+    names::AdmissionController admission(limits);
+    names::BinaryHandler handler(engine, &admission);
+    const char *lines[] = {"lookup Emma", "prefix Oliv 3", "lookup Olivia", "top 2024 F 5", "lookup Noah M"};
+    std::string requests;
+    for (uint32_t i = 0; i < 5; ++i) {
+        names::Query query;
+        names::parseQuery(lines[i], std::strlen(lines[i]), query);
+        names::encodeBinaryRequest(query, i, requests);
+    }
+    const auto statuses = [](names::SendQueue &out) {
+        const std::string bytes = out.take();
+        std::vector<names::BinaryResponse> responses;
+        names::BinaryResponse response;
+        for (size_t at = 0; at < bytes.size(); responses.push_back(response))
+            at += names::decodeBinaryResponse(bytes.data() + at, bytes.size() - at, response);
+        return responses;
+    };
+
+    // while the only expensive slot is taken, the prefix query and everything after it wait
+    KASSERT_TRUE(admission.tryAcquireExpensive());
+    names::SendQueue out;
+    names::ConsumeContext context;
+    size_t used = handler.consume(requests.data(), requests.size(), out, context);
+    KASSERT_TRUE(context.deferred);
+    KASSERT_EQ(static_cast<size_t>(1), statuses(out).size());
+    context = names::ConsumeContext();
+    KASSERT_EQ(static_cast<size_t>(0), handler.consume(requests.data() + used, requests.size() - used, out, context));
+    KASSERT_TRUE(context.deferred);
+
+    // once it is free, the rest are answered two a turn, in order
+    admission.releaseExpensive();
+    size_t turns = 0;
+    while (used < requests.size()) {
+        context = names::ConsumeContext();
+        used += handler.consume(requests.data() + used, requests.size() - used, out, context);
+        ++turns;
+    }
+    KASSERT_EQ(static_cast<size_t>(2), turns);
+    const std::vector<names::BinaryResponse> rest = statuses(out);
+    KASSERT_EQ(static_cast<size_t>(4), rest.size());
+    for (uint32_t i = 0; i < 4; ++i) {
+        KASSERT_EQ(i + 1, rest[i].id);
+        KASSERT_TRUE(rest[i].status == names::BinaryStatus::Ok);
+        KASSERT_FALSE(rest[i].rows.empty());
+    }
+
+    // with every in-flight slot taken, requests are refused at once
+    KASSERT_EQ(static_cast<size_t>(4), admission.acquire(10));
+    context = names::ConsumeContext();
+    handler.consume(requests.data(), requests.size(), out, context);
+    std::vector<names::BinaryResponse> refused = statuses(out);
+    KASSERT_EQ(static_cast<size_t>(2), refused.size());
+    KASSERT_TRUE(refused[0].status == names::BinaryStatus::Overloaded && refused[0].rows.empty());
+    KASSERT_TRUE(refused[1].status == names::BinaryStatus::Overloaded && refused[1].rows.empty());
+    admission.release(4);
+
+    // and requests that waited past the deadline are refused unanswered
+    context = names::ConsumeContext();
+    context.arrived -= std::chrono::seconds(1);
+    handler.consume(requests.data(), requests.size(), out, context);
+    refused = statuses(out);
+    KASSERT_EQ(static_cast<size_t>(2), refused.size());
+    KASSERT_TRUE(refused[0].status == names::BinaryStatus::Expired);
+    KASSERT_TRUE(refused[1].status == names::BinaryStatus::Expired);
+
+    // the three requests that connection left for its next turn count against the limit for everyone else
+    KASSERT_EQ(static_cast<size_t>(3), admission.queued());
+    {
+        names::BinaryHandler other(engine, &admission);
+        context = names::ConsumeContext();
+        other.consume(requests.data(), requests.size(), out, context);
+        refused = statuses(out);
+        KASSERT_EQ(static_cast<size_t>(2), refused.size());
+        KASSERT_TRUE(refused[0].status == names::BinaryStatus::Ok);
+        KASSERT_TRUE(refused[1].status == names::BinaryStatus::Overloaded);
+        KASSERT_EQ(static_cast<size_t>(6), admission.queued());
+    }
+    // and stop counting once their connection has gone
+    KASSERT_EQ(static_cast<size_t>(3), admission.queued());
+
+    const names::AdmissionStats stats = admission.stats();
+    KASSERT_EQ(static_cast<uint64_t>(5 + 4 + 1), stats.admitted);
+    KASSERT_EQ(static_cast<uint64_t>(6 + 2 + 1), stats.overloaded);
+    KASSERT_EQ(static_cast<uint64_t>(2), stats.expired);
+
+    // with a quota, a connection gets its first requests answered however deep the backlog of others
+    limits.connectionQuota = 2;
+    names::AdmissionController shared(limits);
+    shared.queue(100);
+    names::BinaryHandler pipelined(engine, &shared);
+    context = names::ConsumeContext();
+    pipelined.consume(requests.data(), requests.size(), out, context);
+    const std::vector<names::BinaryResponse> answered = statuses(out);
+    KASSERT_EQ(static_cast<size_t>(2), answered.size());
+    KASSERT_TRUE(answered[0].status == names::BinaryStatus::Ok);
+    KASSERT_TRUE(answered[1].status == names::BinaryStatus::Ok);
+    KASSERT_EQ(static_cast<uint64_t>(0), shared.stats().overloaded);
+}
+
+KTEST(http_handler_pipelines) {
+    const names::QueryEngine engine(corpus2024());
+    names::HttpHandler handler(engine);
+    // three pipelined requests arriving a few bytes at a time, as the server would pass them
+    const std::string requests = "GET /lookup?name=Emm%61&sex=F HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                 "GET /top?year=2024&sex=F&limit=2 HTTP/1.1\r\nContent-Length: 2\r\n\r\nxx"
+                                 "GET /nothing HTTP/1.1\r\n\r\n";
+    names::SendQueue out;
+    std::string input;
+    names::ConsumeContext context;
+    for (size_t i = 0; i < requests.size(); i += 7) {
+        input.append(requests, i, 7);
+        input.erase(0, handler.consume(input.data(), input.size(), out, context));
+    }
+    KASSERT_TRUE(input.empty());
+    KASSERT_FALSE(context.close);
+
+    // responses come back in order, each with its exact length
+    const std::string output = out.take();
+    std::vector<std::string> bodies;
+    std::vector<std::string> statusLines;
+    for (size_t at = 0; at < output.size();) {
+        const size_t headEnd = output.find("\r\n\r\n", at);
+        KASSERT_NE(std::string::npos, headEnd);
+        const std::string head = output.substr(at, headEnd - at);
+        const size_t length = head.find("Content-Length:");
+        KASSERT_NE(std::string::npos, length);
+        const size_t size = std::strtoul(head.c_str() + length + 15, nullptr, 10);
+        statusLines.push_back(head.substr(0, head.find("\r\n")));
+        bodies.push_back(output.substr(headEnd + 4, size));
+        at = headEnd + 4 + size;
+    }
+    KASSERT_EQ(static_cast<size_t>(3), bodies.size());
+    KASSERT_EQ(std::string("HTTP/1.1 200 OK"), statusLines[0]);
+    const std::vector<names::QueryRow> emma = answer(engine, "lookup Emma F");
+    KASSERT_EQ(static_cast<size_t>(1), emma.size());
+    KASSERT_EQ("{\"rows\":[{\"name\":\"Emma\",\"sex\":\"F\",\"year\":null,\"count\":" +
+               std::to_string(emma[0].count) + ",\"rank\":" + std::to_string(emma[0].rank) + "}]}", bodies[0]);
+    const std::vector<names::QueryRow> top = answer(engine, "top 2024 F 2");
+    std::string expected = "{\"rows\":[";
+    for (size_t r = 0; r < top.size(); ++r) {
+        expected += r ? "," : "";
+        expected += "{\"name\":\"" + corpus2024().dictionary().name(top[r].nameId).str() +
+                    "\",\"sex\":\"F\",\"year\":2024,\"count\":" + std::to_string(top[r].count) + ",\"rank\":" +
+                    std::to_string(top[r].rank) + "}";
+    }
+    KASSERT_EQ(expected + "]}", bodies[1]);
+    KASSERT_EQ(std::string("HTTP/1.1 404 Not Found"), statusLines[2]);
+
+    // a bad parameter is answered, and HTTP/1.0 closes unless asked not to
+    const std::string rank = "GET /rank?name=Aadarsh&sex=X&year=2024 HTTP/1.0\r\n\r\n";
+    KASSERT_EQ(rank.size(), handler.consume(rank.data(), rank.size(), out, context));
+    KASSERT_TRUE(context.close);
+    const std::string refused = out.take();
+    KASSERT_EQ(static_cast<size_t>(0), refused.find("HTTP/1.1 400 Bad Request\r\n"));
+    KASSERT_NE(std::string::npos, refused.find("Connection: close\r\n"));
+    KASSERT_NE(std::string::npos, refused.find("{\"error\":\"sex must be F or M\"}"));
+
+    // a malformed stream cannot be resynchronised
+    names::HttpHandler fresh(engine);
+    context = names::ConsumeContext();
+    const std::string chunked = "POST /lookup HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    fresh.consume(chunked.data(), chunked.size(), out, context);
+    KASSERT_TRUE(context.close);
+    KASSERT_EQ(static_cast<size_t>(0), out.take().find("HTTP/1.1 501 Not Implemented\r\n"));
+
+    // a turn answers at most maxAnswers requests and defers the rest
+    names::HttpHandler capped(engine);
+    context = names::ConsumeContext();
+    context.maxAnswers = 1;
+    const std::string two = "GET /nothing HTTP/1.1\r\n\r\nGET /nothing HTTP/1.1\r\n\r\n";
+    KASSERT_EQ(two.size() / 2, capped.consume(two.data(), two.size(), out, context));
+    KASSERT_TRUE(context.deferred);
+    const std::string first = out.take();
+    KASSERT_EQ(static_cast<size_t>(0), first.find("HTTP/1.1 404 Not Found\r\n"));
+    KASSERT_EQ(std::string::npos, first.find("HTTP/1.1", 1));
+}
+
+#ifdef __linux__
+KTEST(lazy_server_loads_years_on_demand) {
+    const std::string dir = scratchDir();
+    {
+        const std::string contents = names::readFile(std::string(NAMES_DATA_DIR) + "/yob2024.txt");
+        std::ofstream full((dir + "/yob2024.txt").c_str(), std::ios::binary);
+        full.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        std::ofstream((dir + "/yob2023.txt").c_str()) << "Olivia,F,20\nEmma,F,30\nLiam,M,25\n";
+    }
+    names::TaskPool pool(2);
+    names::AsyncFileReader reader(pool);
+    const names::Corpus empty;
+    const names::QueryEngine engine(empty);
+    const names::QueryEngine full(corpus2024());
+    {
+        names::LazyYearStore store(dir, 2000, 2030, reader, pool);
+        names::QueryMetrics metrics;
+        names::ServerOptions options;
+        options.loops = 1;
+        names::QueryServer server(options, [&engine, &metrics, &store]() {
+            return std::unique_ptr<names::ProtocolHandler>(new names::BinaryHandler(engine, nullptr, &metrics, &store));
+        });
+        server.start();
+        store.onLoaded([&server]() { server.resume(); });
+
+        // both years are cold, so the connection is parked until each has been read
+        const char *lines[] = {"rank Olivia F 2023", "top 2024 M 3", "lookup Emma", "top 1999 F 5", "rank Emma F 2023"};
+        names::BinaryClient client("127.0.0.1", server.port());
+        for (uint32_t i = 0; i < 5; ++i) {
+            names::Query query;
+            names::parseQuery(lines[i], std::strlen(lines[i]), query);
+            client.send(query, i);
+        }
+        client.finish();
+        names::BinaryResponse response;
+        client.receive(response);
+        KASSERT_TRUE(response.status == names::BinaryStatus::Ok);
+        KASSERT_EQ(static_cast<size_t>(1), response.rows.size());
+        KASSERT_EQ(std::string("Olivia"), response.rows[0].name);
+        KASSERT_EQ(2u, response.rows[0].rank);
+        client.receive(response);
+        const std::vector<names::QueryRow> top = answer(full, lines[1]);
+        KASSERT_EQ(top.size(), response.rows.size());
+        bool same = true;
+        for (size_t r = 0; r < top.size(); ++r) {
+            same = same && response.rows[r].name == corpus2024().dictionary().name(top[r].nameId).str() &&
+                   response.rows[r].count == top[r].count && response.rows[r].rank == top[r].rank;
+        }
+        KASSERT_TRUE(same);
+        // lookups span every year, so a lazy server refuses them
+        client.receive(response);
+        KASSERT_EQ(2u, response.id);
+        KASSERT_TRUE(response.status == names::BinaryStatus::Invalid);
+        // a year outside the store is answered as one without data
+        client.receive(response);
+        KASSERT_TRUE(response.status == names::BinaryStatus::Ok);
+        KASSERT_TRUE(response.rows.empty());
+        client.receive(response);
+        KASSERT_EQ(4u, response.id);
+        KASSERT_EQ(1u, response.rows[0].rank);
+        store.onLoaded(nullptr);
+        server.stop();
+        KASSERT_EQ(static_cast<uint64_t>(2), store.loads());
+        // the three answered from a year in memory count as cache lookups, and the first had to wait for its year
+        KASSERT_EQ(static_cast<uint64_t>(3), metrics.cacheHits() + metrics.cacheMisses());
+        KASSERT_NE(static_cast<uint64_t>(0), metrics.cacheMisses());
+    }
+
+    // the pool's only worker is kept busy, so the year cannot finish loading before the request has been deferred
+    names::TaskPool held(1);
+    names::AsyncFileReader heldReader(held);
+    std::atomic<int> busy(0);
+    names::TaskGroup group(held);
+    held.submit(group, [&busy]() {
+        busy = 1;
+        while (busy == 1)
+            std::this_thread::yield();
+    });
+    while (busy != 1)
+        std::this_thread::yield();
+    names::LazyYearStore store(dir, 2000, 2030, heldReader, held);
+    names::QueryMetrics metrics;
+    names::HttpHandler handler(engine, nullptr, &metrics, &store);
+    const std::string requests = "GET /rank?name=Olivia&sex=F&year=2023 HTTP/1.1\r\n\r\n"
+                                 "GET /lookup?name=Emma HTTP/1.1\r\n\r\n"
+                                 "GET /rank?name=Emma&sex=F&year=2023 HTTP/1.1\r\n\r\n";
+    names::SendQueue out;
+    names::ConsumeContext context;
+    KASSERT_EQ(static_cast<size_t>(0), handler.consume(requests.data(), requests.size(), out, context));
+    KASSERT_TRUE(context.deferred);
+    KASSERT_TRUE(context.parked);
+    KASSERT_TRUE(out.empty());
+    busy = 2;
+    group.wait();
+    while (store.request(2023) == names::YearState::Loading)
+        std::this_thread::yield();
+    context = names::ConsumeContext();
+    KASSERT_EQ(requests.size(), handler.consume(requests.data(), requests.size(), out, context));
+    KASSERT_FALSE(context.deferred);
+    const std::string output = out.take();
+    KASSERT_EQ(static_cast<size_t>(0), output.find("HTTP/1.1 200 OK\r\n"));
+    KASSERT_NE(std::string::npos, output.find("{\"rows\":[{\"name\":\"Olivia\",\"sex\":\"F\",\"year\":2023,"
+                                              "\"count\":20,\"rank\":2}]}"));
+    KASSERT_NE(std::string::npos, output.find("HTTP/1.1 501 Not Implemented\r\n"));
+    KASSERT_NE(std::string::npos, output.find("\"count\":30,\"rank\":1}]}"));
+    // the request that waited for the load was a miss, the one after it a hit
+    KASSERT_EQ(static_cast<uint64_t>(1), metrics.cacheMisses());
+    KASSERT_EQ(static_cast<uint64_t>(1), metrics.cacheHits());
+    KASSERT_NE(std::string::npos, names::formatStatsJson(metrics, 0).find("\"cacheHitRate\":0.5000,"));
+    // a year without a file is tried once and then taken as missing
+    while (store.request(2021) == names::YearState::Loading)
+        std::this_thread::yield();
+    KASSERT_TRUE(store.request(2021) == names::YearState::Missing);
+    KASSERT_EQ(static_cast<uint64_t>(2), store.loads());
+}
+#endif
+
+// ---- Latency ---- //
+
+KTEST(latency_histograms_merge_across_threads) {
+    // every value lands in a bucket whose bounds hold it, within a 16th of itself
+    for (uint64_t value: {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull}) {
+        const size_t bucket = names::LatencyHistogram::bucketOf(value);
+        KASSERT_TRUE(bucket < names::LatencyHistogram::BUCKETS);
+        KASSERT_TRUE(names::LatencyHistogram::bucketLow(bucket) <= value);
+        KASSERT_TRUE(value <= names::LatencyHistogram::bucketHigh(bucket));
+        KASSERT_TRUE(names::LatencyHistogram::bucketHigh(bucket) - names::LatencyHistogram::bucketLow(bucket) <=
+                     value / 16);
+    }
+
+    names::LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 1000; ++value)
+        histogram.record(value * 1000);
+    KASSERT_EQ(static_cast<uint64_t>(1000), histogram.count());
+    KASSERT_EQ(static_cast<uint64_t>(1000000), histogram.max());
+    const uint64_t p50 = histogram.quantile(0.5);
+    const uint64_t p99 = histogram.quantile(0.99);
+    KASSERT_TRUE(p50 >= 500000 && p50 <= 500000 + 500000 / 16);
+    KASSERT_TRUE(p99 >= 990000 && p99 <= 1000000);
+    KASSERT_EQ(static_cast<uint64_t>(1000000), histogram.quantile(1.0));
+
+    // threads record on their own, and a report sees them all
+    names::QueryMetrics metrics;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&metrics, t]() {
+            for (int i = 0; i < 1000; ++i)
+                metrics.record(names::QueryType::Lookup, static_cast<uint64_t>(1000 * (t + 1)));
+            metrics.record(names::QueryType::Top, 5000000, 10);
+            if (t)
+                metrics.noteCacheHit();
+            else
+                metrics.noteCacheMiss();
+        }));
+    }
+    for (std::thread &thread: threads)
+        thread.join();
+    const names::LatencyHistogram lookups = metrics.histogram(names::QueryType::Lookup);
+    KASSERT_EQ(static_cast<uint64_t>(4000), lookups.count());
+    KASSERT_EQ(static_cast<uint64_t>(4000), lookups.max());
+    KASSERT_EQ(static_cast<uint64_t>(40), metrics.histogram(names::QueryType::Top).count());
+    KASSERT_EQ(static_cast<uint64_t>(0), metrics.histogram(names::QueryType::Rank).count());
+    KASSERT_EQ(static_cast<uint64_t>(3), metrics.cacheHits());
+    KASSERT_EQ(static_cast<uint64_t>(1), metrics.cacheMisses());
+    const std::string json = names::formatStatsJson(metrics, 1234);
+    KASSERT_NE(std::string::npos, json.find("\"lookup\":{\"count\":4000,"));
+    KASSERT_NE(std::string::npos, json.find("\"cacheHitRate\":0.7500,\"corpusBytes\":1234}"));
+
+    // the HTTP endpoint records what it answers and reports it under /stats
+    const names::QueryEngine engine(corpus2024());
+    names::QueryMetrics served;
+    names::HttpHandler handler(engine, nullptr, &served);
+    const std::string requests = "GET /lookup?name=Emma&sex=F HTTP/1.1\r\n\r\n"
+                                 "GET /stats HTTP/1.1\r\n\r\n";
+    names::SendQueue out;
+    names::ConsumeContext context;
+    KASSERT_EQ(requests.size(), handler.consume(requests.data(), requests.size(), out, context));
+    const std::string output = out.take();
+    const size_t stats = output.find("{\"queries\":");
+    KASSERT_NE(std::string::npos, stats);
+    KASSERT_NE(std::string::npos, output.find("\"lookup\":{\"count\":1,", stats));
+    KASSERT_NE(std::string::npos, output.find("\"cacheHitRate\":null,\"corpusBytes\":" +
+                                              std::to_string(corpus2024().memoryUsed()) + "}", stats));
+    names::HttpHandler plain(engine);
+    const std::string unserved = "GET /stats HTTP/1.1\r\n\r\n";
+    plain.consume(unserved.data(), unserved.size(), out, context);
+    KASSERT_EQ(static_cast<size_t>(0), out.take().find("HTTP/1.1 404 Not Found\r\n"));
+}
+
+// ---- Batch Mode ---- //
+
+KTEST(batch_answers_in_order) {
+    const names::QueryEngine engine(corpus2024());
+    std::FILE *in = std::tmpfile();
+    std::string queries;
+    for (int i = 0; i < 1000; ++i)
+        queries += i % 2 ? "lookup Olivia F\n" : "rank Liam M 2024\n";
+    queries += "\nprefix Oliv 2\nbogus line\nlookup \"Zo\xc3\xab\" F";
+    std::fwrite(queries.data(), 1, queries.size(), in);
+    std::rewind(in);
+    std::FILE *out = std::tmpfile();
+
+    // tiny reads and queues, so lines straddle reads and every stage waits on the others
+    names::BatchOptions options;
+    options.readSize = 7;
+    options.queueDepth = 1;
+    const names::BatchStats stats = names::runBatch(engine, in, out, options);
+    KASSERT_EQ(static_cast<uint64_t>(1003), stats.queries);
+    KASSERT_EQ(static_cast<uint64_t>(1), stats.invalid);
+    KASSERT_EQ(static_cast<uint64_t>(1004), stats.rows);
+
+    std::string output(static_cast<size_t>(std::ftell(out)), '\0');
+    std::rewind(out);
+    output.resize(std::fread(&output[0], 1, output.size(), out));
+    std::fclose(in);
+    std::fclose(out);
+    KASSERT_EQ(0u, output.find("id,query,name,sex,year,count,rank\n1,rank,Liam,M,2024,22164,1\n"
+                               "2,lookup,Olivia,F,,14718,1\n"));
+    KASSERT_NE(std::string::npos, output.find("\n1001,prefix,Oliver,,,15368,1\n1001,prefix,Olivia,,,14734,2\n"
+                                              "1002,invalid,bogus line,,,,\n1003,lookup,\"\"\"Zo\xc3\xab\"\"\",F,,0,\n"));
+
+#ifdef __linux__
+    // a failed write is reported while the producer still holds its end of the pipe open
+    int producer[2];
+    KASSERT_EQ(0, pipe(producer));
+    std::string tops;
+    for (int i = 0; i < 1000; ++i)
+        tops += "top 2024 F 1000\n";
+    KASSERT_EQ(static_cast<ssize_t>(tops.size()), write(producer[1], tops.data(), tops.size()));
+    in = fdopen(producer[0], "r");
+    out = std::fopen("/dev/full", "w");
+    KASSERT_THROWS(std::runtime_error, [&], { names::runBatch(engine, in, out); });
+    std::fclose(in);
+    std::fclose(out);
+    close(producer[1]);
+#endif
+}
+
+// ---- Arrow export ---- //
+
+KTEST(arrow_file_layout) {
+    const names::Corpus &corpus = corpus2024();
+    const std::string path = scratchDir() + "/names.arrow";
+    names::writeArrowFile(corpus, path);
+    const std::string file = names::readFile(path);
+    std::remove(path.c_str());
+
+    KASSERT_EQ(0, std::memcmp(file.data(), "ARROW1\0\0", 8));
+    KASSERT_EQ(std::string("ARROW1"), file.substr(file.size() - 6));
+    int32_t footer;
+    std::memcpy(&footer, file.data() + file.size() - 10, 4);
+    KASSERT_TRUE(footer > 0 && static_cast<size_t>(footer) < file.size());
+
+    // the dictionary arena and a column's counts are written out as they are, aligned for mapping
+    const names::NameDictionary &dictionary = corpus.dictionary();
+    const size_t names = file.find(std::string(dictionary.bytes().data(), dictionary.bytes().size()));
+    KASSERT_NE(std::string::npos, names);
+    KASSERT_EQ(static_cast<size_t>(0), names % names::ARROW_ALIGNMENT);
+    const std::vector<uint32_t> &counts = corpus.years()[0].columns[1].counts;
+    const size_t column = file.find(std::string(reinterpret_cast<const char *>(counts.data()), counts.size() * 4));
+    KASSERT_NE(std::string::npos, column);
+    KASSERT_EQ(static_cast<size_t>(0), column % names::ARROW_ALIGNMENT);
+}
+
+// ---- Sorting ---- //
+
+KTEST(radix_sort_matches_stable_sort) {
+    // enough items for the parallel path, with many equal keys to show stability and a varying high byte
+    std::mt19937_64 rng(7);
+    std::vector<names::KeyedId> items(200000);
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].key = rng() % 1000 | (rng() % 3) << 40;
+        items[i].id = static_cast<uint32_t>(i);
+    }
+    std::vector<names::KeyedId> expected = items;
+    std::stable_sort(expected.begin(), expected.end(), [](const names::KeyedId &a, const names::KeyedId &b) {
+        return a.key < b.key;
+    });
+    names::radixSort(items);
+    bool same = true;
+    for (size_t i = 0; i < items.size(); ++i)
+        same = same && items[i].key == expected[i].key && items[i].id == expected[i].id;
+    KASSERT_TRUE(same);
+
+    // every name twice, plus a few that are prefixes of each other
+    names::NameDictionary dictionary;
+    for (const names::YearTable &table: corpus2024().years()) {
+        for (const names::SexColumn &column: table.columns) {
+            for (const uint32_t id: column.nameIds)
+                dictionary.intern(corpus2024().dictionary().name(id).str());
+        }
+    }
+    dictionary.intern("Ann");
+    dictionary.intern("Anna");
+    dictionary.intern("Ann\xc3\xa9");
+    dictionary.intern("");
+    std::vector<uint32_t> ids;
+    for (uint32_t round = 0; round < 2; ++round) {
+        for (uint32_t id = 0; id < dictionary.size(); ++id)
+            ids.push_back(id);
+    }
+    std::shuffle(ids.begin(), ids.end(), rng);
+    std::vector<uint32_t> sorted = ids;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+        return dictionary.name(a).str() < dictionary.name(b).str();
+    });
+    names::sortByName(dictionary, ids);
+    KASSERT_TRUE(ids == sorted);
+}
+
+KTEST(external_aggregation_matches_map) {
+    // a budget small enough to force many runs and more than one merge pass
+    names::ExternalSortOptions options;
+    options.memoryBudget = 64 << 10;
+    options.blockSize = 4 << 10;
+    names::ExternalAggregator aggregator(options);
+    std::mt19937_64 rng(11);
+    std::map<uint64_t, int64_t> expected;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < 100000; ++i) {
+        const uint64_t key = rng() % 20000 * 0x9e3779b97f4a7c15ull;
+        const int64_t count = static_cast<int64_t>(rng() % 1000) - 100;
+        aggregator.add(key, count);
+        expected[key] += count;
+        keys.push_back(key);
+    }
+    std::vector<std::pair<uint64_t, int64_t> > actual;
+    aggregator.finish([&](const uint64_t key, const int64_t count) { actual.push_back(std::make_pair(key, count)); });
+    const std::vector<std::pair<uint64_t, int64_t> > aggregated(expected.begin(), expected.end());
+    KASSERT_TRUE(actual == aggregated);
+    KASSERT_EQ(static_cast<uint64_t>(100000), aggregator.stats().records);
+    KASSERT_TRUE(aggregator.stats().mergePasses > 1);
+    KASSERT_TRUE(aggregator.stats().peakMemory <= options.memoryBudget);
+
+    // without combining it is a plain sort; reused after finish
+    options.combine = false;
+    names::ExternalAggregator sorter(options);
+    for (const uint64_t key: keys)
+        sorter.add(key, 1);
+    std::vector<uint64_t> sorted;
+    sorter.finish([&](const uint64_t key, int64_t) { sorted.push_back(key); });
+    std::sort(keys.begin(), keys.end());
+    KASSERT_TRUE(sorted == keys);
+
+    // state rows sum to the national totals
+    names::Corpus national;
+    names::StateCorpus states(national.dictionary());
+    const char rows[] = "WA,F,2024,Emma,200\nOR,F,2024,Emma,150\nOR,M,2023,Noah,90\n";
+    names::loadStateData(states, rows, sizeof(rows) - 1);
+    names::ExternalAggregator totals;
+    names::addStateRows(totals, states);
+    std::vector<std::pair<uint64_t, int64_t> > summed;
+    totals.finish([&](const uint64_t key, const int64_t count) { summed.push_back(std::make_pair(key, count)); });
+    KASSERT_EQ(2u, summed.size());
+    KASSERT_EQ(2023, names::segmentKeyYear(summed[0].first));
+    KASSERT_EQ(static_cast<int64_t>(350), summed[1].second);
+}
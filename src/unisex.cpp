@@ -0,0 +1,106 @@
+#include "unisex.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "parallel.hpp"
+
+namespace names {
+    namespace {
+        typedef std::pair<uint32_t, uint32_t> IdCount;
+
+        /// Wide enough for a 32-bit difference times a 33-bit total.
+#ifdef __SIZEOF_INT128__
+        typedef unsigned __int128 BalanceProduct;
+#else
+        typedef long double BalanceProduct;
+#endif
+
+        std::vector<IdCount> idOrdered(const SexColumn &column) {
+            std::vector<IdCount> pairs(column.size());
+            bool sorted = true;
+            for (size_t i = 0; i < pairs.size(); ++i) {
+                pairs[i] = IdCount(column.nameIds[i], column.counts[i]);
+                if (i && pairs[i - 1].first > pairs[i].first)
+                    sorted = false;
+            }
+            // IDs are assigned in load order, so a half is often already in ID order.
+            if (!sorted)
+                std::sort(pairs.begin(), pairs.end());
+            return pairs;
+        }
+    }
+
+    UnisexYear analyzeUnisex(const YearTable &table) {
+        const std::vector<IdCount> female = idOrdered(table.column(Sex::Female));
+        const std::vector<IdCount> male = idOrdered(table.column(Sex::Male));
+
+        UnisexYear result;
+        result.year = table.year;
+        size_t f = 0;
+        size_t m = 0;
+        while (f < female.size() && m < male.size()) {
+            if (female[f].first < male[m].first) {
+                ++f;
+            } else if (male[m].first < female[f].first) {
+                ++m;
+            } else {
+                UnisexName name;
+                name.nameId = female[f].first;
+                name.female = female[f].second;
+                name.male = male[m].second;
+                result.names.push_back(name);
+                ++f;
+                ++m;
+            }
+        }
+        return result;
+    }
+
+    std::vector<UnisexYear> analyzeUnisexAllYears(const Corpus &corpus) {
+        const std::vector<YearTable> &years = corpus.years();
+        std::vector<UnisexYear> results(years.size());
+        parallelFor(years.size(), [&](const size_t i) {
+            results[i] = analyzeUnisex(years[i]);
+        });
+        return results;
+    }
+
+    std::vector<UnisexName> rankByBalance(const std::vector<UnisexName> &names, const uint32_t minTotal) {
+        std::vector<UnisexName> ranked;
+        for (const UnisexName &name: names) {
+            if (name.total() && name.total() >= minTotal)
+                ranked.push_back(name);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const UnisexName &a, const UnisexName &b) {
+            // compare |f - m| / total without dividing: a is more balanced if diffA * totalB < diffB * totalA
+            const uint64_t diffA = a.female > a.male ? a.female - a.male : a.male - a.female;
+            const uint64_t diffB = b.female > b.male ? b.female - b.male : b.male - b.female;
+            const BalanceProduct lhs = static_cast<BalanceProduct>(diffA) * b.total();
+            const BalanceProduct rhs = static_cast<BalanceProduct>(diffB) * a.total();
+            if (lhs != rhs)
+                return lhs < rhs;
+            if (a.total() != b.total())
+                return a.total() > b.total();
+            return a.nameId < b.nameId;
+        });
+        return ranked;
+    }
+
+    std::vector<RatioPoint> ratioDrift(const std::vector<UnisexYear> &years, const uint32_t nameId) {
+        std::vector<RatioPoint> points;
+        for (const UnisexYear &year: years) {
+            const std::vector<UnisexName>::const_iterator it = std::lower_bound(
+                year.names.begin(), year.names.end(), nameId,
+                [](const UnisexName &name, const uint32_t id) { return name.nameId < id; });
+            if (it == year.names.end() || it->nameId != nameId)
+                continue;
+            RatioPoint point;
+            point.year = year.year;
+            point.female = it->female;
+            point.male = it->male;
+            points.push_back(point);
+        }
+        return points;
+    }
+}
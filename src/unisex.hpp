@@ -0,0 +1,70 @@
+/*
+ * unisex.hpp
+ *
+ * Unisex name analysis. Each year's female and male halves are joined on interned name ID to find names given to both
+ * sexes, along with their gender ratio.
+ */
+
+#ifndef UNISEX_HPP
+#define UNISEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "corpus.hpp"
+
+namespace names {
+    /// A name that appears under both F and M in the same year.
+    struct UnisexName {
+        uint32_t nameId;
+        uint32_t female;
+        uint32_t male;
+
+        uint64_t total() const {
+            return static_cast<uint64_t>(female) + male;
+        }
+
+        /// Fraction of births that were female, in [0, 1]. 0 for a name whose counts have both been updated to 0.
+        double femaleShare() const {
+            return total() ? static_cast<double>(female) / static_cast<double>(total()) : 0.0;
+        }
+
+        /// 1 for a perfect 50/50 split, approaching 0 as the name leans entirely to one sex. 0 without any births.
+        double balance() const {
+            if (!total())
+                return 0.0;
+            const double diff = female > male ? female - male : male - female;
+            return 1.0 - diff / static_cast<double>(total());
+        }
+    };
+
+    /// The unisex names of a single year, ordered by name ID.
+    struct UnisexYear {
+        int year;
+        std::vector<UnisexName> names;
+    };
+
+    /// Joins the F and M halves of a year. Both halves are put into name ID order and merged in a single pass.
+    UnisexYear analyzeUnisex(const YearTable &table);
+
+    /// Runs analyzeUnisex() over every loaded year in parallel. Results are in year order.
+    std::vector<UnisexYear> analyzeUnisexAllYears(const Corpus &corpus);
+
+    /// Returns the names sorted from most to least balanced, ignoring names with fewer than minTotal births and those
+    /// with none at all. Ties are broken by total births, then name ID.
+    std::vector<UnisexName> rankByBalance(const std::vector<UnisexName> &names, uint32_t minTotal = 0);
+
+    /// One point of a name's gender ratio over time.
+    struct RatioPoint {
+        int year;
+        uint32_t female;
+        uint32_t male;
+    };
+
+    /// Tracks how the F/M split of a single name drifts across the analyzed years. Years where the name was not unisex
+    /// are omitted.
+    std::vector<RatioPoint> ratioDrift(const std::vector<UnisexYear> &years, uint32_t nameId);
+}
+
+#endif //UNISEX_HPP
@@ -0,0 +1,41 @@
+#include "validator.hpp"
+
+#include <sstream>
+
+#include "corpus.hpp"
+
+namespace names {
+    void ValidationReport::add(const IssueKind kind, const size_t row, const size_t column, const std::string &message) {
+        ++issueCount;
+        if (issues.size() >= options.maxIssues)
+            return;
+        ValidationIssue issue;
+        issue.kind = kind;
+        issue.row = row;
+        issue.column = column;
+        issue.message = message;
+        issues.push_back(issue);
+    }
+
+    std::string ValidationReport::str() const {
+        std::stringstream ss;
+        for (const ValidationIssue &issue: issues)
+            ss << issue.row << ":" << issue.column << ": " << issue.message << "\n";
+        if (issueCount > issues.size())
+            ss << "... and " << issueCount - issues.size() << " more\n";
+        return ss.str();
+    }
+
+    ValidationReport validateYearData(const char *data, const size_t len, const ValidationOptions &options) {
+        // the checks live in the loader's scanning pass, so validate by loading into a throwaway corpus
+        ValidationReport report(options);
+        Corpus scratch;
+        loadYearData(scratch, 0, data, len, &report);
+        return report;
+    }
+
+    ValidationReport validateYearFile(const std::string &path, const ValidationOptions &options) {
+        const std::string contents = readFile(path);
+        return validateYearData(contents.data(), contents.size(), options);
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * validator.hpp
+ *
+ * Validation of yob files. The checks run inside the loader's scanning pass (see loadYearData()), so validating while
+ * loading costs little more than loading alone.
+ */
+
+#ifndef VALIDATOR_HPP
+#define VALIDATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace names {
+    enum class IssueKind {
+        /// The line does not have exactly three fields.
+        FieldCount,
+        EmptyName,
+        NonAsciiName,
+        /// Sex is not exactly "F" or "M".
+        BadSex,
+        /// Count is missing, not a number, or too large.
+        BadCount,
+        /// Count is below the SSA publication threshold.
+        LowCount,
+        /// The (name, sex) pair already appeared earlier in the file.
+        Duplicate,
+        /// Count is larger than the previous row of the same sex.
+        OutOfOrder,
+    };
+
+    /// Whether an issue leaves the row unusable. Rows with structural issues are never loaded.
+    inline bool isStructural(const IssueKind kind) {
+        return kind == IssueKind::FieldCount || kind == IssueKind::EmptyName || kind == IssueKind::BadSex ||
+               kind == IssueKind::BadCount;
+    }
+
+    struct ValidationIssue {
+        IssueKind kind;
+        /// 1-based line number.
+        size_t row;
+        /// 1-based byte column within the line.
+        size_t column;
+        std::string message;
+    };
+
+    struct ValidationOptions {
+        uint32_t minCount;
+        /// Stop recording issues after this many; the rest are only counted.
+        size_t maxIssues;
+
+        ValidationOptions()
+            : minCount(5),
+              maxIssues(100) {
+        }
+    };
+
+    struct ValidationReport {
+        ValidationOptions options;
+        std::vector<ValidationIssue> issues;
+        /// Total number of issues found, including any beyond options.maxIssues.
+        size_t issueCount;
+        /// Number of data rows seen.
+        size_t rows;
+
+        explicit ValidationReport(const ValidationOptions &options = ValidationOptions())
+            : options(options),
+              issueCount(0),
+              rows(0) {
+        }
+
+        bool ok() const {
+            return issueCount == 0;
+        }
+
+        void add(IssueKind kind, size_t row, size_t column, const std::string &message);
+
+        /// One `line:column: message` per recorded issue.
+        std::string str() const;
+    };
+
+    /// Validates yob file contents without keeping the parsed data.
+    ValidationReport validateYearData(const char *data, size_t len,
+                                      const ValidationOptions &options = ValidationOptions());
+
+    /// Reads and validates a yob file. Throws std::runtime_error only if the file cannot be read.
+    ValidationReport validateYearFile(const std::string &path, const ValidationOptions &options = ValidationOptions());
+}
+
+#endif //VALIDATOR_HPP
@@ -0,0 +1,254 @@
+#include "wal.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "crc32c.hpp"
+#include "mapped_file.hpp"
+#include "snapshot.hpp"
+
+namespace names {
+    namespace {
+        const size_t RECORD_HEADER = 8;
+        /// lsn, delta, year, sex, reserved byte, name length
+        const size_t PAYLOAD_FIXED = 8 + 8 + 4 + 1 + 1 + 2;
+        const size_t MAX_NAME = UINT16_MAX;
+
+        void encode(std::string &out, const uint64_t lsn, const NameUpdate &update) {
+            char payload[PAYLOAD_FIXED];
+            const int32_t year = update.year;
+            const uint8_t sex = static_cast<uint8_t>(update.sex);
+            const uint8_t reserved = 0;
+            const uint16_t nameLen = static_cast<uint16_t>(update.name.size());
+            std::memcpy(payload, &lsn, 8);
+            std::memcpy(payload + 8, &update.delta, 8);
+            std::memcpy(payload + 16, &year, 4);
+            std::memcpy(payload + 20, &sex, 1);
+            std::memcpy(payload + 21, &reserved, 1);
+            std::memcpy(payload + 22, &nameLen, 2);
+
+            const uint32_t length = static_cast<uint32_t>(PAYLOAD_FIXED + nameLen);
+            const uint32_t crc = crc32c(update.name.data(), nameLen, crc32c(payload, PAYLOAD_FIXED));
+            out.append(reinterpret_cast<const char *>(&length), 4);
+            out.append(reinterpret_cast<const char *>(&crc), 4);
+            out.append(payload, PAYLOAD_FIXED);
+            out.append(update.name.data(), nameLen);
+        }
+    }
+
+    // ---- WriteAheadLog ---- //
+
+    WriteAheadLog::WriteAheadLog(const std::string &path, const uint64_t lastLsn, const WalOptions &options)
+        : file_(path),
+          options_(options),
+          lastLsn_(lastLsn),
+          durableLsn_(lastLsn),
+          syncs_(0),
+          stopping_(false) {
+        flusher_ = std::thread(&WriteAheadLog::flushLoop, this);
+    }
+
+    WriteAheadLog::~WriteAheadLog() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        pendingChanged_.notify_all();
+        flusher_.join();
+    }
+
+    uint64_t WriteAheadLog::append(const NameUpdate &update) {
+        if (update.name.empty() || update.name.size() > MAX_NAME)
+            throw std::invalid_argument("update name must be 1 to 65535 bytes");
+        if (update.sex != Sex::Female && update.sex != Sex::Male)
+            throw std::invalid_argument("update sex must be F or M");
+
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lsn = ++lastLsn_;
+            encode(pending_, lsn, update);
+        }
+        pendingChanged_.notify_one();
+        return lsn;
+    }
+
+    void WriteAheadLog::waitDurable(const uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        durableChanged_.wait(lock, [&]() { return durableLsn_ >= lsn || error_; });
+        if (durableLsn_ < lsn)
+            std::rethrow_exception(error_);
+    }
+
+    void WriteAheadLog::flushLoop() {
+        std::string batch;
+        while (true) {
+            uint64_t batchLsn;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                pendingChanged_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+                if (pending_.empty())
+                    return;
+                if (options_.groupCommitWindow.count() && !stopping_)
+                    pendingChanged_.wait_for(lock, options_.groupCommitWindow, [this]() { return stopping_; });
+                batch.clear();
+                batch.swap(pending_);
+                batchLsn = lastLsn_;
+            }
+
+            try {
+                file_.write(batch.data(), batch.size());
+                file_.sync();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_ = std::current_exception();
+                durableChanged_.notify_all();
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                durableLsn_ = batchLsn;
+                ++syncs_;
+            }
+            durableChanged_.notify_all();
+        }
+    }
+
+    void WriteAheadLog::reset() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        durableChanged_.wait(lock, [this]() { return durableLsn_ == lastLsn_ || error_; });
+        if (error_)
+            std::rethrow_exception(error_);
+        // nothing is pending and the flusher is idle, so it is safe to truncate underneath it
+        file_.truncate();
+    }
+
+    uint64_t WriteAheadLog::lastLsn() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lastLsn_;
+    }
+
+    uint64_t WriteAheadLog::syncCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return syncs_;
+    }
+
+    // ---- Recovery ---- //
+
+    LogReplay replayLog(const std::string &path, const uint64_t afterLsn,
+                        const std::function<void(const LogRecord &)> &fn) {
+        LogReplay replay = LogReplay();
+        replay.lastLsn = afterLsn;
+        if (!fileExists(path))
+            return replay;
+
+        const MappedFile log(path);
+        const char *p = log.data();
+        const char *const end = p + log.size();
+        while (static_cast<size_t>(end - p) >= RECORD_HEADER) {
+            uint32_t length;
+            uint32_t crc;
+            std::memcpy(&length, p, 4);
+            std::memcpy(&crc, p + 4, 4);
+            const char *payload = p + RECORD_HEADER;
+            if (length < PAYLOAD_FIXED || static_cast<size_t>(end - payload) < length)
+                break;
+            if (crc32c(payload, length) != crc)
+                break;
+
+            LogRecord record;
+            int32_t year;
+            uint8_t sex;
+            uint16_t nameLen;
+            std::memcpy(&record.lsn, payload, 8);
+            std::memcpy(&record.delta, payload + 8, 8);
+            std::memcpy(&year, payload + 16, 4);
+            std::memcpy(&sex, payload + 20, 1);
+            std::memcpy(&nameLen, payload + 22, 2);
+            if (PAYLOAD_FIXED + nameLen != length || sex > 1)
+                break;
+            record.year = year;
+            record.sex = static_cast<Sex>(sex);
+            record.name = payload + PAYLOAD_FIXED;
+            record.nameLen = nameLen;
+
+            if (record.lsn > afterLsn) {
+                fn(record);
+                ++replay.applied;
+            } else {
+                ++replay.skipped;
+            }
+            if (record.lsn > replay.lastLsn)
+                replay.lastLsn = record.lsn;
+            p = payload + length;
+        }
+        replay.validBytes = static_cast<uint64_t>(p - log.data());
+        return replay;
+    }
+
+    // ---- DurableCorpus ---- //
+
+    DurableCorpus::DurableCorpus(const std::string &dir, const DurableOptions &options)
+        : dir_(dir),
+          options_(options),
+          updater_(corpus_),
+          sinceCheckpoint_(0) {
+        uint64_t snapshotLsn = 0;
+        if (fileExists(snapshotPath(dir_)))
+            snapshotLsn = loadSnapshot(snapshotPath(dir_), corpus_);
+
+        recovery_ = replayLog(logPath(dir_), snapshotLsn, [this](const LogRecord &record) {
+            updater_.apply(record.year, record.sex, record.name, record.nameLen, record.delta);
+        });
+        sinceCheckpoint_ = recovery_.applied;
+
+        // drop any torn tail so new records are not appended after garbage
+        AppendFile(logPath(dir_)).truncate(recovery_.validBytes);
+        wal_.reset(new WriteAheadLog(logPath(dir_), recovery_.lastLsn, options_.wal));
+    }
+
+    uint64_t DurableCorpus::apply(const NameUpdate &update) {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lsn = wal_->append(update);
+            unapplied_.push_back(std::make_pair(lsn, update));
+        }
+        // memory never holds what the log may not; a failed sync stays failed, so the update is never applied
+        wal_->waitDurable(lsn);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        applyDurableLocked(lsn);
+        if (options_.checkpointEvery && sinceCheckpoint_ >= options_.checkpointEvery)
+            checkpointLocked();
+        return lsn;
+    }
+
+    void DurableCorpus::checkpoint() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkpointLocked();
+    }
+
+    void DurableCorpus::applyDurableLocked(const uint64_t lsn) {
+        // whichever caller gets here first applies every durable update before its own, keeping them in log order
+        while (!unapplied_.empty() && unapplied_.front().first <= lsn) {
+            const NameUpdate &update = unapplied_.front().second;
+            updater_.apply(update.year, update.sex, update.name.data(), update.name.size(), update.delta);
+            ++sinceCheckpoint_;
+            unapplied_.pop_front();
+        }
+    }
+
+    void DurableCorpus::checkpointLocked() {
+        const uint64_t lsn = wal_->lastLsn();
+        wal_->waitDurable(lsn);
+        // the log is about to be emptied, so the snapshot must hold every record in it
+        applyDurableLocked(lsn);
+        // If we crash after the snapshot is renamed into place but before the log is emptied, replay skips the
+        // records the snapshot already holds.
+        writeSnapshot(corpus_, snapshotPath(dir_), lsn);
+        wal_->reset();
+        sinceCheckpoint_ = 0;
+    }
+}
@@ -0,0 +1,183 @@
+/*
+ * wal.hpp
+ *
+ * Write-ahead log for live name-count updates, plus crash recovery on top of the last snapshot.
+ *
+ * Each record is `[u32 payload length][u32 CRC-32C of payload][payload]`, where the payload is the record's sequence
+ * number (LSN), year, sex, delta and name. Appends are buffered and a dedicated flusher thread writes and syncs whatever
+ * has accumulated in one go (group commit), so many concurrent writers share each fsync.
+ */
+
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "corpus.hpp"
+#include "file_io.hpp"
+
+namespace names {
+    /// A change to one (year, sex, name) count.
+    struct NameUpdate {
+        int year;
+        Sex sex;
+        std::string name;
+        int64_t delta;
+    };
+
+    /// A record decoded from a mapped log. The name points into the mapping.
+    struct LogRecord {
+        uint64_t lsn;
+        int year;
+        Sex sex;
+        const char *name;
+        size_t nameLen;
+        int64_t delta;
+    };
+
+    struct WalOptions {
+        /// How long the flusher waits after the first pending record before writing, to gather a larger group. Zero
+        /// still groups every record that arrives while the previous fsync is in progress.
+        std::chrono::microseconds groupCommitWindow;
+
+        WalOptions()
+            : groupCommitWindow(0) {
+        }
+    };
+
+    class WriteAheadLog {
+        AppendFile file_;
+        WalOptions options_;
+        mutable std::mutex mutex_;
+        std::condition_variable pendingChanged_;
+        std::condition_variable durableChanged_;
+        std::string pending_;
+        uint64_t lastLsn_;
+        uint64_t durableLsn_;
+        uint64_t syncs_;
+        bool stopping_;
+        std::exception_ptr error_;
+        std::thread flusher_;
+
+        void flushLoop();
+
+    public:
+        /// Opens the log for appending. New records are numbered after lastLsn, which should come from recovery.
+        WriteAheadLog(const std::string &path, uint64_t lastLsn, const WalOptions &options = WalOptions());
+
+        /// Flushes any pending records before closing.
+        ~WriteAheadLog();
+
+        WriteAheadLog(const WriteAheadLog &) = delete;
+
+        WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+        /// Buffers a record and returns its LSN. The record is not durable until waitDurable(lsn) returns.
+        uint64_t append(const NameUpdate &update);
+
+        /// Blocks until every record up to and including lsn has been synced. Rethrows flusher I/O errors.
+        void waitDurable(uint64_t lsn);
+
+        /// append() followed by waitDurable().
+        uint64_t commit(const NameUpdate &update) {
+            const uint64_t lsn = append(update);
+            waitDurable(lsn);
+            return lsn;
+        }
+
+        /// Waits for all pending records to become durable, then empties the log. Used after a checkpoint has captured
+        /// every record in a snapshot.
+        void reset();
+
+        uint64_t lastLsn() const;
+
+        /// Number of fsyncs issued so far; with group commit this is normally far below the number of records.
+        uint64_t syncCount() const;
+    };
+
+    struct LogReplay {
+        /// Number of records applied.
+        size_t applied;
+        /// Number of valid records skipped because the snapshot already covered them.
+        size_t skipped;
+        /// Highest LSN seen in the log, or the starting LSN if there were none.
+        uint64_t lastLsn;
+        /// Length of the valid prefix of the log. Anything after it is a torn or corrupt tail.
+        uint64_t validBytes;
+    };
+
+    /// Maps the log and calls fn for every valid record with an LSN greater than afterLsn. Replay stops at the first
+    /// truncated or corrupt record. A missing log replays nothing.
+    LogReplay replayLog(const std::string &path, uint64_t afterLsn, const std::function<void(const LogRecord &)> &fn);
+
+    struct DurableOptions {
+        WalOptions wal;
+        /// Write a snapshot and empty the log after this many updates, which bounds recovery time.
+        uint64_t checkpointEvery;
+
+        DurableOptions()
+            : checkpointEvery(100000) {
+        }
+    };
+
+    /// A corpus whose updates survive crashes. Lives in a directory holding `corpus.snap` and `corpus.wal`.
+    class DurableCorpus {
+        std::string dir_;
+        DurableOptions options_;
+        Corpus corpus_;
+        CorpusUpdater updater_;
+        std::unique_ptr<WriteAheadLog> wal_;
+        mutable std::mutex mutex_;
+        uint64_t sinceCheckpoint_;
+        /// Logged updates not yet in memory, in LSN order. Each is applied once it is durable.
+        std::deque<std::pair<uint64_t, NameUpdate> > unapplied_;
+        LogReplay recovery_;
+
+        /// Applies every logged update up to and including lsn, which must be durable.
+        void applyDurableLocked(uint64_t lsn);
+
+        void checkpointLocked();
+
+    public:
+        /// Recovers the corpus from the directory's snapshot and log, if present.
+        explicit DurableCorpus(const std::string &dir, const DurableOptions &options = DurableOptions());
+
+        static std::string snapshotPath(const std::string &dir) {
+            return dir + "/corpus.snap";
+        }
+
+        static std::string logPath(const std::string &dir) {
+            return dir + "/corpus.wal";
+        }
+
+        /// Logs the update and returns once it is durable and applied in memory. Concurrent callers share fsyncs. If
+        /// the log cannot be synced, throws the I/O error and leaves the update out of memory.
+        uint64_t apply(const NameUpdate &update);
+
+        /// Writes a snapshot of the current state and empties the log.
+        void checkpoint();
+
+        /// The in-memory corpus. Not safe to read while other threads are calling apply().
+        const Corpus &corpus() const {
+            return corpus_;
+        }
+
+        /// What recovery found when the corpus was opened.
+        const LogReplay &recovery() const {
+            return recovery_;
+        }
+    };
+}
+
+#endif //WAL_HPP